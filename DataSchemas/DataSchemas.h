@@ -23,4 +23,5 @@ Field_Schema_Array(type, name, hint) - define a field in the schema that is an a
 #include "Schemas/DataSchemas_World.h"
 #include "Schemas/DataSchemas_GfxSettings.h"
 #include "Schemas/DataSchemas_GameData.h"
-#include "Schemas/DataSchemas_XmdFile.h"
\ No newline at end of file
+#include "Schemas/DataSchemas_XmdFile.h"
+#include "Schemas/DataSchemas_Benchmark.h"
\ No newline at end of file
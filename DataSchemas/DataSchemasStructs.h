@@ -9,15 +9,10 @@ This expands the schemas defined in DataSchemas.h into structs
 
 #include <string>
 #include <vector>
+#include <string.h>
 
 namespace SData
 {
-	template <typename T> 
-	inline unsigned int GetEntryById(const std::vector<T>& data, const std::string &id, unsigned int defaultValue, decltype(T::m_id) *p = NULL)
-	{
-		return GetEntryById(data, id.c_str(), defaultValue);
-	}
-
 	template <typename T> 
 	inline unsigned int GetEntryById(const std::vector<T>& data, const char *id, unsigned int defaultValue, decltype(T::m_id) *p = NULL)
 	{
@@ -31,6 +26,14 @@ namespace SData
 		}
 		return defaultValue;
 	}
+
+	// after the const char * version, which it calls.  Compilers that look names up when the template is
+	// defined wouldn't see it otherwise, and this would call itself.
+	template <typename T> 
+	inline unsigned int GetEntryById(const std::vector<T>& data, const std::string &id, unsigned int defaultValue, decltype(T::m_id) *p = NULL)
+	{
+		return GetEntryById(data, id.c_str(), defaultValue);
+	}
 };
 
 // Define the structs
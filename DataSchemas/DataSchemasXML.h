@@ -8,7 +8,8 @@ This expands the schemas defined in DataSchemas.h into xml parsing code
 #pragma once
 
 #include "DataSchemasStructs.h"
-#include "External\tinyxml\tinyxml2.h"
+#include "External/tinyxml/tinyxml2.h"
+#include "Platform/OS.h"
 #include <stdarg.h>
 
 #define XMLLOGON 0
@@ -56,7 +57,7 @@ namespace DataSchemasXML {
 			if (data[index].m_id.c_str()[0] && SData::GetEntryById(data, data[index].m_id, -1) != index)
 			{
 				idsAreUnique = false;
-				XMLError(__FUNCTION__" failure: Schema '%s', field '%s', id '%s'", schemaName, fieldName, data[index].m_id.c_str());
+				XMLError("%s failure: Schema '%s', field '%s', id '%s'", __FUNCTION__, schemaName, fieldName, data[index].m_id.c_str());
 			}
 		}
 		return idsAreUnique;
@@ -66,7 +67,7 @@ namespace DataSchemasXML {
 	template <typename T>
 	inline bool LoadFromString (T &data, const char *stringData)
 	{
-		XMLError(__FUNCTION__" unhandled type");
+		XMLError("%s unhandled type", __FUNCTION__);
 		return false;
 	}
 
@@ -77,7 +78,7 @@ namespace DataSchemasXML {
 		if (sscanf(stringData, "%f", &data) == 1)
 			return true;
 
-		XMLError(__FUNCTION__" failure");
+		XMLError("%s failure", __FUNCTION__);
 		return false;
 	}
 
@@ -87,19 +88,19 @@ namespace DataSchemasXML {
 		if (sscanf(stringData, "%u", &data) == 1)
 			return true;
 
-		XMLError(__FUNCTION__" failure");
+		XMLError("%s failure", __FUNCTION__);
 		return false;
 	}
 
 	template <>
 	inline bool LoadFromString<bool> (bool &data, const char *stringData)
 	{
-		if (!stricmp(stringData,"true"))
+		if (!OS::StringCompareNoCase(stringData,"true"))
 		{
 			data = true;
 			return true;
 		}
-		else if (!stricmp(stringData,"false"))
+		else if (!OS::StringCompareNoCase(stringData,"false"))
 		{
 			data = false;
 			return true;
@@ -112,7 +113,7 @@ namespace DataSchemasXML {
 			return true;
 		}
 
-		XMLError(__FUNCTION__" failure");
+		XMLError("%s failure", __FUNCTION__);
 		return false;
 	}
 
@@ -129,7 +130,7 @@ namespace DataSchemasXML {
 		if (sscanf(stringData, "%f, %f", &data.m_x, &data.m_y) == 2)
 			return true;
 
-		XMLError(__FUNCTION__" failure");
+		XMLError("%s failure", __FUNCTION__);
 		return false;
 	}
 
@@ -139,7 +140,7 @@ namespace DataSchemasXML {
 		if (sscanf(stringData, "%f, %f, %f", &data.m_x, &data.m_y, &data.m_z) == 3)
 			return true;
 
-		XMLError(__FUNCTION__" failure");
+		XMLError("%s failure", __FUNCTION__);
 		return false;
 	}
 
@@ -149,7 +150,7 @@ namespace DataSchemasXML {
 		if (sscanf(stringData, "%f, %f, %f, %f", &data.m_x, &data.m_y, &data.m_z, &data.m_w) == 4)
 			return true;
 
-		XMLError(__FUNCTION__" failure");
+		XMLError("%s failure", __FUNCTION__);
 		return false;
 	}
 
@@ -172,7 +173,7 @@ namespace DataSchemasXML {
 			}
 			else
 			{
-				XMLError(__FUNCTION__" failed to read value from string '%s'", token);
+				XMLError("%s failed to read value from string '%s'", __FUNCTION__, token);
 				token = NULL;
 				ret = false;
 			}
@@ -186,24 +187,24 @@ namespace DataSchemasXML {
 	template <typename T>
 	inline bool Load (T &data, tinyxml2::XMLElement *node)
 	{
-		XMLLog(__FUNCTION__" starting");
+		XMLLog("%s starting", __FUNCTION__);
 		if (!node)
 		{
-			XMLError(__FUNCTION__" no node given");
+			XMLError("%s no node given", __FUNCTION__);
 			return false;
 		}
 		const tinyxml2::XMLAttribute *attr = node->FindAttribute("Value");
 		if (attr)
 		{
 			if(LoadFromString(data, attr->Value())) {
-				XMLLog(__FUNCTION__" loaded from 'Value' attribute.");
+				XMLLog("%s loaded from 'Value' attribute.", __FUNCTION__);
 				return true;
 			}
-			XMLError(__FUNCTION__" failed to load from 'Value' attribute.");
+			XMLError("%s failed to load from 'Value' attribute.", __FUNCTION__);
 			return false;
 		} 
 
-		XMLError(__FUNCTION__" failure");
+		XMLError("%s failure", __FUNCTION__);
 		return false;
 	}
 
@@ -213,10 +214,10 @@ namespace DataSchemasXML {
 	inline bool Load <SData_##name> ( SData_##name &data, tinyxml2::XMLElement *node) \
 	{ \
 		unsigned int arrayIndex = 0; \
-		XMLLog(__FUNCTION__" starting"); \
+		XMLLog("%s starting", __FUNCTION__); \
 		if (!node) \
 		{ \
-			XMLError(__FUNCTION__" no node given"); \
+			XMLError("%s no node given", __FUNCTION__); \
 			return false; \
 		} \
 		tinyxml2::XMLElement *childNode =  NULL; \
@@ -224,22 +225,22 @@ namespace DataSchemasXML {
 		if (attr) \
 		{ \
 			if(LoadFromString(data, attr->Value())) {\
-				XMLLog(__FUNCTION__" loaded from 'Value' attribute."); \
+				XMLLog("%s loaded from 'Value' attribute.", __FUNCTION__); \
 				return true; \
 			} \
-			XMLError(__FUNCTION__" failed to load from 'Value' attribute."); \
+			XMLError("%s failed to load from 'Value' attribute.", __FUNCTION__); \
 			return false; \
 		} 
 #define SchemaEnd \
-	XMLLog(__FUNCTION__" succeeded"); \
+	XMLLog("%s succeeded", __FUNCTION__); \
 	return true; }
 #define Field(type, name, default, hint) \
-		XMLLog(__FUNCTION__" attempting to load field '%s'", #name); \
+		XMLLog("%s attempting to load field '%s'", __FUNCTION__, #name); \
 		attr = node->FindAttribute(#name); \
 		if (attr) \
 		{ \
 			if(!LoadFromString(data.m_##name, attr->Value())) { \
-				XMLError(__FUNCTION__" failed to load field '%s' from 'Value' attribute.", #name); \
+				XMLError("%s failed to load field '%s' from 'Value' attribute.", __FUNCTION__, #name); \
 				return false; \
 			} \
 		} \
@@ -247,21 +248,21 @@ namespace DataSchemasXML {
 		{ \
 			childNode = node->FirstChildElement(#name); \
 			if (childNode && !Load(data.m_##name, childNode)) {\
-				XMLError(__FUNCTION__" failed to load field '%s' from childnode", #name); \
+				XMLError("%s failed to load field '%s' from childnode", __FUNCTION__, #name); \
 				return false; \
 			} \
 		}
 #define Field_Schema(type, name, default, hint) \
-		XMLLog(__FUNCTION__" attempting to load schema field '%s'", #name); \
+		XMLLog("%s attempting to load schema field '%s'", __FUNCTION__, #name); \
 		if (default != NULL && !LoadFromString(data.m_##name, default)) { \
-			XMLError(__FUNCTION__" failed to load schema field '%s' default value from string", #name); \
+			XMLError("%s failed to load schema field '%s' default value from string", __FUNCTION__, #name); \
 			return false; \
 		} \
 		attr = node->FindAttribute(#name); \
 		if (attr) \
 		{ \
 			if(!LoadFromString(data.m_##name, attr->Value())) { \
-				XMLError(__FUNCTION__" failed to load schema field '%s' from 'Value' attribute.", #name); \
+				XMLError("%s failed to load schema field '%s' from 'Value' attribute.", __FUNCTION__, #name); \
 				return false; \
 			} \
 		} \
@@ -269,19 +270,19 @@ namespace DataSchemasXML {
 		{ \
 			childNode = node->FirstChildElement(#name); \
 			if (childNode && !Load(data.m_##name, childNode)) {\
-				XMLError(__FUNCTION__" failed to load schema field '%s' from childnode", #name); \
+				XMLError("%s failed to load schema field '%s' from childnode", __FUNCTION__, #name); \
 				return false; \
 			} \
 		}
 #define Field_Schema_Array(type, name, hint) \
-	XMLLog(__FUNCTION__" attempting to load schema field array '%s'", #name); \
+	XMLLog("%s attempting to load schema field array '%s'", __FUNCTION__, #name); \
 	childNode = node->FirstChildElement(#name); \
 	arrayIndex = 0; \
 	while(childNode) \
 	{ \
 		SData_##type dataItem; \
 		if (!Load(dataItem, childNode)) {\
-			XMLError(__FUNCTION__" failed to load a schema field array item for '%s'[%u]", #name, arrayIndex); \
+			XMLError("%s failed to load a schema field array item for '%s'[%u]", __FUNCTION__, #name, arrayIndex); \
 			return false; \
 		} \
 		data.m_##name.push_back(dataItem); \
@@ -292,14 +293,14 @@ namespace DataSchemasXML {
 		return false;
 #define Field_Value_Array(type, hint) \
 	{ \
-		XMLLog(__FUNCTION__" attempting to load field value array"); \
+		XMLLog("%s attempting to load field value array", __FUNCTION__); \
 		tinyxml2::XMLNode *childNode = node->FirstChild(); \
 		if (!childNode) { \
-			XMLError(__FUNCTION__" failed to load a schema value array, no child node found"); \
+			XMLError("%s failed to load a schema value array, no child node found", __FUNCTION__); \
 			return false; \
 		} \
 		if (!LoadArrayFromString(data.m_ValueArray, childNode->Value())) { \
-			XMLError(__FUNCTION__" failed to load a schema value array"); \
+			XMLError("%s failed to load a schema value array", __FUNCTION__); \
 			return false; \
 		} \
 	}
@@ -315,15 +316,15 @@ namespace DataSchemasXML {
 	template <typename T>
 	inline bool Load (T &data, const char *fileName, const char *nodeName)
 	{
-		XMLLog(__FUNCTION__" %s", fileName);
+		XMLLog("%s %s", __FUNCTION__, fileName);
 		tinyxml2::XMLDocument doc;
 		if (doc.LoadFile(fileName) != tinyxml2::XML_NO_ERROR) {
-			XMLError(__FUNCTION__" could not load xml file '%s'", fileName);
+			XMLError("%s could not load xml file '%s'", __FUNCTION__, fileName);
 			return false;
 		}
 		tinyxml2::XMLElement *node = doc.FirstChildElement(nodeName);
 		if (!node) {
-			XMLError(__FUNCTION__" could not find node \"%s\"", nodeName);
+			XMLError("%s could not find node \"%s\"", __FUNCTION__, nodeName);
 			return false;
 		}
 		return Load(data, node);
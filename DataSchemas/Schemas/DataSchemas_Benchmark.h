@@ -0,0 +1,23 @@
+/*==================================================================================================
+
+	DataSchemas_Benchmark.h
+
+	This defines the schemas used by the benchmark camera path files.
+
+==================================================================================================*/
+
+SchemaBegin(CameraPathKey, "A camera position along a benchmark camera path")
+	Field(std::string, Sector, "", "The id of the sector the camera is in.  If the next key is in a different sector, the camera holds still at this key and then cuts to the next one.")
+	Field_Schema(Vec3, Position, "0,0,0", "The location within the sector")
+	Field(float, Pitch, 0.0f, "The pitch of the camera, in degrees.")
+	Field(float, Yaw, 0.0f, "The yaw of the camera, in degrees.")
+SchemaEnd
+
+SchemaBegin(CameraPath, "A fixed camera path that the benchmark renders frames along")
+	Field(std::string, Map, "./data/maps/level.xml", "The map to benchmark")
+	Field_Schema(Vec2, Resolution, "640, 360", "The width and height of the frames rendered")
+	Field(unsigned int, FramesPerKey, 30, "How many frames are rendered moving from each key to the next.  Position, pitch and yaw are interpolated linearly.")
+	Field(unsigned int, WarmupFrames, 2, "How many frames to render at the first key before timing starts")
+	Field(unsigned int, Threads, 0, "How many threads to render with.  0 means use all hardware threads.")
+	Field_Schema_Array(CameraPathKey, Key, "The keys of the camera path, in order")
+SchemaEnd
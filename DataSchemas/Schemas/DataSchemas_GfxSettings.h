@@ -10,21 +10,38 @@ SchemaBegin(GfxSettings, "Graphics Settings")
 	Field_Schema(Vec2, Resolution, "1000, 1000", "The width and height of the game window")
 	Field(bool, FullScreen, false, "Whether or not the game should run in full screen mode")
 	Field(std::string, DefaultMap, "./data/default.xml", "The map to load on startup")
-	Field(unsigned int, TextureSize, 512, "The width and height resolution of the textures stored in memory.  Make it smaller for less detail but less texture memory used.")
+	Field(unsigned int, TextureSize, 512, "The largest width and height a texture is stored at.  Bigger textures are halved until they fit.  Make it smaller for less detail but less texture memory used.")
 	Field(bool, TextureFilter, true, "If true, will interpolate pixel values to smooth out texture sampling")
 	Field(bool, InterlaceMode, false, "If true, will alternate between rendering the top half and the bottom half of the screen every frame.  Boosts performance!")
 	Field(bool, NormalMapping, true, "If false, normal mapping will be disabled")
 	Field(bool, Shadows, true, "If false, shadows will be disabled.  Big performance boost")
+	Field(bool, BakedShadows, true, "If true, the shadows on sector walls come from the visibility of each light baked when the world is loaded, instead of a shadow ray per light.  Only the first 32 lights of a sector are baked, and the walls of a sector go back to shadow rays once any of it's model instances move.")
 	Field(bool, HighQualityLights, true, "If false, lower quality lighting will be used")
 	Field(bool, RedBlue3D, false, "If true, the game will render in red/blue 3d glasses mode.")
 	Field(float, RedBlueWidth, -0.4f, "The distance between the left and right eye when rendering in red/blue 3d glasses mode.")
-	Field(unsigned int, RayBounces, 10, "The maximum times a ray may bounce in a scene while rendering")
+	Field(unsigned int, RayBounces, 10, "The maximum times a ray may bounce in a scene while rendering.  Going through a portal doesn't count as a bounce.")
 	Field(bool, FastestMath, true, "If true, the fastest (and least precise) math will be used")
 	Field(float, Brightness, 1.0f, "Used to adjust brightness")
+	Field(bool, AutoExposure, false, "If true, the brightness adjusts to the scene so the brightest pixels aren't blown out.  Never goes brighter than Brightness.")
 	Field(bool, ColorAbsorption, true, "If false, color absorption will be off for transparent objects")
+	Field(bool, PacketTracing, true, "If true, the cpu renderer traces camera rays for neighboring pixels together as packets.  Gives the same image faster.")
+	Field(bool, PipelineGameUpdate, true, "If true, the game logic for the next frame runs on another thread while the gpu renders the current frame")
+	Field(bool, WavefrontPath, false, "If true, renders with separate kernels for each stage of tracing a ray, with the rays queued in between, instead of the one big kernel.  Keeps more of the gpu busy when rays take different paths.")
+	Field(bool, DynamicQuality, false, "If true, lowers the resolution, then the ray bounces, when the gpu takes longer than TargetFrameTime to render a frame, and raises them again when there is time to spare.  The image is scaled up to the window.")
+	Field(float, TargetFrameTime, 16.6f, "The gpu time per frame, in milliseconds, that DynamicQuality aims for")
+	Field(float, MinResolutionScale, 0.5f, "The smallest fraction of Resolution that DynamicQuality will render at")
+	Field(unsigned int, MinRayBounces, 2, "The fewest ray bounces DynamicQuality will cut down to")
+	Field(bool, TemporalReprojection, false, "If true, pixels whose camera ray hits the same diffuse surface as last frame reuse last frame's color instead of being traced again.  Not used with WavefrontPath or RedBlue3D.")
+	Field(bool, VariableRate, false, "If true, traces a ray through the corners of each VariableRateTileSize square tile first, then only traces every pixel of the tiles whose corners hit different objects or surfaces, or are lit differently.  The rest are filled in from the corners.  Not used with WavefrontPath or RedBlue3D.")
+	Field(unsigned int, VariableRateTileSize, 4, "The width and height in pixels of the tiles VariableRate works in")
+	Field(float, VariableRateThreshold, 0.1f, "How different, relative to their brightness, the colors of a tile's corners can be for VariableRate to fill the tile in rather than trace it")
+	Field(bool, LightSampling, false, "If true, hits in sectors with more than LightSamples lights only cast shadow rays to LightSamples of them, picked at random with the brighter lights picked more often, and weighted so the lighting averages out the same.  Lighting costs the same however many lights there are, but is noisy.")
+	Field(unsigned int, LightSamples, 4, "How many of a sector's lights LightSampling picks for each hit")
+	Field(unsigned int, TemporalRefreshFrames, 4, "With TemporalReprojection, each pixel is traced again at least once in this many frames, so lighting changes show up.  With InterlaceMode, the half interlacing renders is traced instead.")
 
 	Field(bool, DebugRayBounceCount, false, "If true, will make pixels lighter the more ray bounces were required.  When hitting RayBounces (max) it will add white to the pixel.")
-	Field(bool, DebugModelBoundingSphere, false, "If true, will visualize where the bounding spheres of models are - showing which rays tested against which meshes.  It will show rays that only tested upper half resident polygons in green, rays that only tested lower half resident polygons in red, and rays that tested all polygons in white")
+	Field(bool, DebugModelBoundingSphere, false, "If true, will visualize where the bounding spheres of models are - rays that hit a model's bounding sphere and walked it's triangle BVH are tinted green")
 	Field(bool, DebugTextureUV, false, "If true, shows the U,V texture coordinates as Red,Green diffuse color instead of doing a texture lookup")
 	Field(bool, DebugTriangles, false, "If true, shows triangle geometry")
+	Field(bool, DebugVariableRate, false, "If true, tints the pixels VariableRate traced red, leaving the ones it filled in from the tile corners as they are")
 SchemaEnd
\ No newline at end of file
@@ -139,6 +139,7 @@ SchemaEnd
 SchemaBegin(Model, "A model to load")
 	Field(std::string, id, "", "The id (unique name) of the model")
 	Field(std::string, FileName, "", "the filename of the .xmd model file to load")
+	Field(bool, QuantizeShading, false, "If true, the texture coordinates, tangents and bitangents of the model's triangles are stored as 16 bit values, which halves their size but loses some precision")
 SchemaEnd
 
 SchemaBegin(World, "The definition of the world")
@@ -0,0 +1,228 @@
+/*==================================================================================================
+
+CBVHBuilder.cpp
+
+Builds flattened bounding volume hierarchies (SBVHNode) over axis aligned bounding boxes, using a
+binned surface area heuristic to decide where to split
+
+==================================================================================================*/
+
+#include "CBVHBuilder.h"
+
+#include <algorithm>
+#include <float.h>
+
+// how many bins the centroids are sorted into along each axis when looking for a split
+static const unsigned int c_numBins = 16;
+
+// relative costs of visiting a node versus testing a primitive, used by the surface area heuristic
+static const float c_traversalCost = 1.0f;
+static const float c_intersectionCost = 1.0f;
+
+// leaves with this many primitives or less are never split.  Leaves with up to c_maxLeafPrimitives
+// are made if the surface area heuristic says splitting them is not worth it.
+static const unsigned int c_minLeafPrimitives = 2;
+static const unsigned int c_maxLeafPrimitives = 8;
+
+//-----------------------------------------------------------------------------
+struct SBounds
+{
+	SBounds ()
+	{
+		m_min[0] = m_min[1] = m_min[2] = FLT_MAX;
+		m_max[0] = m_max[1] = m_max[2] = -FLT_MAX;
+	}
+
+	void Add (const float3 &boundsMin, const float3 &boundsMax)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (boundsMin[axis] < m_min[axis])
+				m_min[axis] = boundsMin[axis];
+			if (boundsMax[axis] > m_max[axis])
+				m_max[axis] = boundsMax[axis];
+		}
+	}
+
+	void Add (const SBounds &other)
+	{
+		Add(other.m_min, other.m_max);
+	}
+
+	float SurfaceArea () const
+	{
+		if (m_min[0] > m_max[0])
+			return 0.0f;
+		float3 extents = m_max - m_min;
+		return 2.0f * (extents[0] * extents[1] + extents[1] * extents[2] + extents[2] * extents[0]);
+	}
+
+	float3 m_min;
+	float3 m_max;
+};
+
+//-----------------------------------------------------------------------------
+static unsigned int GetBin (float value, float axisMin, float binScale)
+{
+	unsigned int bin = (unsigned int)((value - axisMin) * binScale);
+	return bin < c_numBins ? bin : c_numBins - 1;
+}
+
+//-----------------------------------------------------------------------------
+void CBVHBuilder::AddPrimitive (const float3 &min, const float3 &max)
+{
+	SPrimitive primitive;
+	primitive.m_min = min;
+	primitive.m_max = max;
+	primitive.m_centroid = (min + max) * 0.5f;
+	m_primitives.push_back(primitive);
+}
+
+//-----------------------------------------------------------------------------
+cl_uint CBVHBuilder::Build (CSharedArray<SBVHNode> &nodes, cl_uint primitiveIndexOffset)
+{
+	m_primitiveOrder.resize(m_primitives.size());
+	for (unsigned int index = 0, count = m_primitiveOrder.size(); index < count; ++index)
+		m_primitiveOrder[index] = index;
+
+	if (m_primitives.size() == 0)
+		return -1;
+
+	// a binary tree with one primitive per leaf has 2n-1 nodes, so make room for that up front
+	// to keep from reallocating on every node added.
+	nodes.Presize(nodes.Count() + 2 * m_primitives.size());
+	return BuildNode(nodes, 0, m_primitives.size(), 0, primitiveIndexOffset);
+}
+
+//-----------------------------------------------------------------------------
+cl_uint CBVHBuilder::BuildNode (
+	CSharedArray<SBVHNode> &nodes,
+	unsigned int start,
+	unsigned int stop,
+	unsigned int depth,
+	cl_uint primitiveIndexOffset
+)
+{
+	// calculate the bounds of the primitives, and the bounds of their centroids
+	SBounds bounds;
+	SBounds centroidBounds;
+	for (unsigned int index = start; index < stop; ++index)
+	{
+		const SPrimitive &primitive = m_primitives[m_primitiveOrder[index]];
+		bounds.Add(primitive.m_min, primitive.m_max);
+		centroidBounds.Add(primitive.m_centroid, primitive.m_centroid);
+	}
+
+	// add the node.  Since we add nodes depth first, the left child will be the next node added.
+	const cl_uint nodeIndex = nodes.Count();
+	{
+		SBVHNode &node = nodes.AddOne();
+		node.m_min = bounds.m_min;
+		node.m_max = bounds.m_max;
+		node.m_rightChildOrFirstPrimitive = start + primitiveIndexOffset;
+		node.m_primitiveCount = stop - start;
+		node.m_splitAxis = 0;
+		node.m_pad1 = 0;
+	}
+
+	// make a leaf if there are few enough primitives, or if we've reached the max depth the kernel can handle
+	const unsigned int count = stop - start;
+	if (count <= c_minLeafPrimitives || depth + 1 >= BVH_MAXDEPTH)
+		return nodeIndex;
+
+	// find the lowest cost split by binning the centroids along each axis
+	const float leafCost = c_intersectionCost * (float)count;
+	const float parentArea = bounds.SurfaceArea();
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	unsigned int bestBin = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float axisMin = centroidBounds.m_min[axis];
+		const float axisExtent = centroidBounds.m_max[axis] - axisMin;
+		if (axisExtent <= 0.0f)
+			continue;
+
+		SBounds binBounds[c_numBins];
+		unsigned int binCounts[c_numBins] = { 0 };
+		const float binScale = (float)c_numBins / axisExtent;
+		for (unsigned int index = start; index < stop; ++index)
+		{
+			const SPrimitive &primitive = m_primitives[m_primitiveOrder[index]];
+			unsigned int bin = GetBin(primitive.m_centroid[axis], axisMin, binScale);
+			binBounds[bin].Add(primitive.m_min, primitive.m_max);
+			binCounts[bin]++;
+		}
+
+		// sweep from the right to get the area and count of everything to the right of each split plane
+		float rightAreas[c_numBins];
+		unsigned int rightCounts[c_numBins];
+		SBounds rightBounds;
+		unsigned int rightCount = 0;
+		for (unsigned int bin = c_numBins - 1; bin > 0; --bin)
+		{
+			rightBounds.Add(binBounds[bin]);
+			rightCount += binCounts[bin];
+			rightAreas[bin] = rightBounds.SurfaceArea();
+			rightCounts[bin] = rightCount;
+		}
+
+		// sweep from the left, evaluating the cost of splitting between bin-1 and bin
+		SBounds leftBounds;
+		unsigned int leftCount = 0;
+		for (unsigned int bin = 1; bin < c_numBins; ++bin)
+		{
+			leftBounds.Add(binBounds[bin - 1]);
+			leftCount += binCounts[bin - 1];
+			if (leftCount == 0 || rightCounts[bin] == 0)
+				continue;
+
+			float cost = c_traversalCost + c_intersectionCost *
+				(leftBounds.SurfaceArea() * (float)leftCount + rightAreas[bin] * (float)rightCounts[bin]) / parentArea;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = bin;
+			}
+		}
+	}
+
+	// if splitting isn't any cheaper than testing everything, make a leaf as long as it isn't too large
+	if (bestCost >= leafCost && count <= c_maxLeafPrimitives)
+		return nodeIndex;
+
+	// partition the primitives on the best split found
+	unsigned int mid = start;
+	if (bestAxis >= 0)
+	{
+		const float axisMin = centroidBounds.m_min[bestAxis];
+		const float binScale = (float)c_numBins / (centroidBounds.m_max[bestAxis] - axisMin);
+		const std::vector<SPrimitive> &primitives = m_primitives;
+		mid = (unsigned int)(std::partition(
+			m_primitiveOrder.begin() + start,
+			m_primitiveOrder.begin() + stop,
+			[&] (unsigned int primitiveIndex) {
+				return GetBin(primitives[primitiveIndex].m_centroid[bestAxis], axisMin, binScale) < bestBin;
+			}
+		) - m_primitiveOrder.begin());
+	}
+
+	// if all the centroids are in the same place (or rounding put everything on one side), just split down the middle
+	if (mid == start || mid == stop)
+	{
+		mid = (start + stop) / 2;
+		if (bestAxis < 0)
+			bestAxis = 0;
+	}
+
+	// build the children.  The left child is implicitly nodeIndex + 1.
+	BuildNode(nodes, start, mid, depth + 1, primitiveIndexOffset);
+	cl_uint rightChildIndex = BuildNode(nodes, mid, stop, depth + 1, primitiveIndexOffset);
+
+	SBVHNode &node = nodes[nodeIndex];
+	node.m_rightChildOrFirstPrimitive = rightChildIndex;
+	node.m_primitiveCount = 0;
+	node.m_splitAxis = bestAxis;
+	return nodeIndex;
+}
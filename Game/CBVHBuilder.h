@@ -0,0 +1,97 @@
+/*==================================================================================================
+
+CBVHBuilder.h
+
+Builds flattened bounding volume hierarchies (SBVHNode) over axis aligned bounding boxes, using a
+binned surface area heuristic to decide where to split
+
+==================================================================================================*/
+
+#pragma once
+
+#include "Platform/SharedArray.h"
+#include "KernelCode/Shared/SharedGeometry.h"
+#include <vector>
+
+class CBVHBuilder
+{
+public:
+	// adds a primitive to build the hierarchy over, described by it's axis aligned bounding box
+	void AddPrimitive (const float3 &min, const float3 &max);
+
+	// builds the hierarchy, appending the nodes to the end of "nodes".  Leaf nodes reference primitives
+	// by their slot in GetPrimitiveOrder(), offset by primitiveIndexOffset.  Returns the index of the
+	// root node, or -1 if there are no primitives.
+	cl_uint Build (CSharedArray<SBVHNode> &nodes, cl_uint primitiveIndexOffset);
+
+	// after Build(), entry i holds the index (in AddPrimitive order) of the primitive that needs to be
+	// stored in slot i for the leaf node ranges to be correct.
+	const std::vector<unsigned int>& GetPrimitiveOrder () const { return m_primitiveOrder; }
+
+	unsigned int Count () const { return m_primitives.size(); }
+
+	// recalculates the bounds of an already built hierarchy, after it's primitives have moved, without changing
+	// it's structure.  getPrimitiveBounds(primitiveIndex, min, max) is called for every primitive in the leaves.
+	// The tree gets looser the further things move from where they were at build time, but it stays correct.
+	// The refit nodes are marked stale, so only they get uploaded to the kernel.
+	template <typename TGetPrimitiveBounds>
+	static void Refit (CSharedArray<SBVHNode> &nodes, cl_uint nodeIndex, const TGetPrimitiveBounds &getPrimitiveBounds)
+	{
+		SBVHNode &node = nodes[nodeIndex];
+		nodes.MarkStale(nodeIndex);
+
+		// leaf nodes take the bounds of their primitives
+		if (node.m_primitiveCount > 0)
+		{
+			for (cl_uint index = 0; index < node.m_primitiveCount; ++index)
+			{
+				float3 primitiveMin, primitiveMax;
+				getPrimitiveBounds(node.m_rightChildOrFirstPrimitive + index, primitiveMin, primitiveMax);
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					if (index == 0 || primitiveMin[axis] < node.m_min[axis])
+						node.m_min[axis] = primitiveMin[axis];
+					if (index == 0 || primitiveMax[axis] > node.m_max[axis])
+						node.m_max[axis] = primitiveMax[axis];
+				}
+			}
+			return;
+		}
+
+		// interior nodes take the bounds of their children, which are refit first
+		Refit(nodes, nodeIndex + 1, getPrimitiveBounds);
+		Refit(nodes, node.m_rightChildOrFirstPrimitive, getPrimitiveBounds);
+		const SBVHNode &left = nodes[nodeIndex + 1];
+		const SBVHNode &right = nodes[node.m_rightChildOrFirstPrimitive];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			node.m_min[axis] = left.m_min[axis] < right.m_min[axis] ? left.m_min[axis] : right.m_min[axis];
+			node.m_max[axis] = left.m_max[axis] > right.m_max[axis] ? left.m_max[axis] : right.m_max[axis];
+		}
+	}
+
+	void Clear ()
+	{
+		m_primitives.clear();
+		m_primitiveOrder.clear();
+	}
+
+private:
+	struct SPrimitive
+	{
+		float3 m_min;
+		float3 m_max;
+		float3 m_centroid;
+	};
+
+	cl_uint BuildNode (
+		CSharedArray<SBVHNode> &nodes,
+		unsigned int start,
+		unsigned int stop,
+		unsigned int depth,
+		cl_uint primitiveIndexOffset
+	);
+
+	std::vector<SPrimitive>		m_primitives;
+	std::vector<unsigned int>	m_primitiveOrder;
+};
@@ -48,6 +48,12 @@ public:
 		cameraShared.m_viewWidthHeightDistance[2] = 6.0f;
 
 		cameraShared.m_brightnessMultiplier = 1.0f;
+
+		// set by the quality governor each frame
+		cameraShared.m_renderWidth = 0;
+		cameraShared.m_renderHeight = 0;
+		cameraShared.m_maxRayBounces = 0;
+		cameraShared.m_pad = 0;
 	}
 
 	// singleton access
@@ -0,0 +1,344 @@
+/*==================================================================================================
+
+CModelCache.cpp
+
+A binary version of a .xmd model: the vertices are shared between triangles, the triangles of each
+object are already sorted into the order of the object's BVH, and the BVH and bounds are stored
+with them, so loading a model doesn't involve any xml parsing or BVH building.
+
+The file is a SModelCacheHeader followed by the objects, vertices, indices, BVH nodes and strings,
+each at a 16 byte aligned offset.  Bump c_modelCacheVersion when any of them change layout or
+meaning, and the caches will be rebuilt.
+
+==================================================================================================*/
+
+#include "CModelCache.h"
+#include "CWorld.h"
+#include "CBVHBuilder.h"
+#include "DataSchemas/DataSchemasXML.h"
+
+#include <stdio.h>
+#include <map>
+
+const char *CModelCache::c_cacheExtension = ".xmdcache";
+
+static const char c_modelCacheMagic[8] = { 'C', 'L', 'R', 'T', 'X', 'M', 'D', 'C' };
+static const cl_uint c_modelCacheVersion = 1;
+
+struct SModelCacheHeader
+{
+	char				m_magic[8];
+	cl_uint				m_version;
+	cl_uint				m_pad1;
+
+	unsigned long long	m_sourceSize;
+	unsigned long long	m_sourceTime;
+
+	cl_float			m_farthestPoint[3];
+	cl_uint				m_stringsSize;
+
+	cl_uint				m_objectCount;
+	cl_uint				m_vertexCount;
+	cl_uint				m_indexCount;
+	cl_uint				m_bvhNodeCount;
+};
+
+// orders vertices by their bytes, to find the ones that are exactly the same
+struct SVertexLess
+{
+	bool operator() (const CModelCache::SVertex &lhs, const CModelCache::SVertex &rhs) const
+	{
+		return memcmp(&lhs, &rhs, sizeof(lhs)) < 0;
+	}
+};
+
+//-----------------------------------------------------------------------------
+static size_t Align16 (size_t offset)
+{
+	return (offset + 15) & ~(size_t)15;
+}
+
+//-----------------------------------------------------------------------------
+static void Copy (cl_float *lhs, const SData_Vec3 &rhs)
+{
+	lhs[0] = rhs.m_x;
+	lhs[1] = rhs.m_y;
+	lhs[2] = rhs.m_z;
+}
+
+//-----------------------------------------------------------------------------
+static cl_uint AddString (std::vector<char> &strings, const std::string &string)
+{
+	const cl_uint offset = strings.size();
+	strings.insert(strings.end(), string.c_str(), string.c_str() + string.length() + 1);
+	return offset;
+}
+
+//-----------------------------------------------------------------------------
+bool CModelCache::Load (const char *modelFileName)
+{
+	const std::string cacheFileName = std::string(modelFileName) + c_cacheExtension;
+
+	// without the .xmd the cache is all there is, so it's used as is
+	unsigned long long sourceSize = 0;
+	unsigned long long sourceTime = 0;
+	if (!OS::GetFileSizeAndTime(modelFileName, sourceSize, sourceTime))
+		return LoadCache(cacheFileName.c_str(), 0, 0);
+
+	if (LoadCache(cacheFileName.c_str(), sourceSize, sourceTime))
+		return true;
+
+	if (!Build(modelFileName))
+		return false;
+
+	// not being able to write the cache (like from a read only folder) just means building it again next time
+	Save(cacheFileName.c_str(), sourceSize, sourceTime);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CModelCache::LoadCache (const char *cacheFileName, unsigned long long sourceSize, unsigned long long sourceTime)
+{
+	if (!m_file.Open(cacheFileName) || m_file.Size() < sizeof(SModelCacheHeader))
+		return false;
+
+	const SModelCacheHeader &header = *(const SModelCacheHeader *)m_file.Data();
+	bool valid = !memcmp(header.m_magic, c_modelCacheMagic, sizeof(header.m_magic)) && header.m_version == c_modelCacheVersion;
+	if (valid && sourceSize != 0)
+		valid = header.m_sourceSize == sourceSize && header.m_sourceTime == sourceTime;
+
+	// find where everything is, and make sure it's all in the file
+	size_t offset = Align16(sizeof(SModelCacheHeader));
+	const size_t objectsOffset = offset;
+	offset = Align16(offset + sizeof(SObject) * (size_t)header.m_objectCount);
+	const size_t verticesOffset = offset;
+	offset = Align16(offset + sizeof(SVertex) * (size_t)header.m_vertexCount);
+	const size_t indicesOffset = offset;
+	offset = Align16(offset + sizeof(cl_uint) * (size_t)header.m_indexCount);
+	const size_t bvhNodesOffset = offset;
+	offset = Align16(offset + sizeof(SBVHNode) * (size_t)header.m_bvhNodeCount);
+	const size_t stringsOffset = offset;
+	offset += header.m_stringsSize;
+	valid = valid && offset <= m_file.Size() && header.m_stringsSize > 0 && m_file.Data()[stringsOffset + header.m_stringsSize - 1] == 0;
+
+	if (!valid)
+	{
+		m_file.Close();
+		return false;
+	}
+
+	m_farthestPoint[0] = header.m_farthestPoint[0];
+	m_farthestPoint[1] = header.m_farthestPoint[1];
+	m_farthestPoint[2] = header.m_farthestPoint[2];
+	m_objectCount = header.m_objectCount;
+	m_vertexCount = header.m_vertexCount;
+	m_indexCount = header.m_indexCount;
+	m_bvhNodeCount = header.m_bvhNodeCount;
+	m_stringsSize = header.m_stringsSize;
+	m_objects = (const SObject *)(m_file.Data() + objectsOffset);
+	m_vertices = (const SVertex *)(m_file.Data() + verticesOffset);
+	m_indices = (const cl_uint *)(m_file.Data() + indicesOffset);
+	m_bvhNodes = (const SBVHNode *)(m_file.Data() + bvhNodesOffset);
+	m_strings = (const char *)(m_file.Data() + stringsOffset);
+
+	// make sure nothing indexes outside of the file, so a bad cache can't crash the loading
+	for (unsigned int index = 0; valid && index < m_indexCount; ++index)
+		valid = m_indices[index] < m_vertexCount;
+
+	for (unsigned int index = 0; valid && index < m_objectCount; ++index)
+	{
+		const SObject &object = m_objects[index];
+		valid = (unsigned long long)object.m_startIndex + object.m_triangleCount * 3ull <= m_indexCount
+			&& (unsigned long long)object.m_startBVHNode + object.m_bvhNodeCount <= m_bvhNodeCount
+			&& object.m_textures[0] < m_stringsSize
+			&& object.m_textures[1] < m_stringsSize
+			&& object.m_textures[2] < m_stringsSize;
+	}
+
+	if (!valid)
+	{
+		printf("Model cache %s is corrupt, rebuilding it.\n", cacheFileName);
+		m_file.Close();
+	}
+
+	return valid;
+}
+
+//-----------------------------------------------------------------------------
+bool CModelCache::Build (const char *modelFileName)
+{
+	SData_XMDFILE modelData;
+	if (!DataSchemasXML::Load(modelData, modelFileName, "model"))
+		return false;
+
+	m_builtObjects.clear();
+	m_builtVertices.clear();
+	m_builtIndices.clear();
+	m_builtBVHNodes.clear();
+	m_builtStrings.clear();
+
+	// string offset 0 is the empty string, for no texture
+	AddString(m_builtStrings, std::string());
+
+	m_farthestPoint[0] = 0.0f;
+	m_farthestPoint[1] = 0.0f;
+	m_farthestPoint[2] = 0.0f;
+	float farthestRadiusSq = 0.0f;
+
+	std::map<SVertex, cl_uint, SVertexLess> vertexIndices;
+	for (unsigned int objectIndex = 0, objectCount = modelData.m_object.size(); objectIndex < objectCount; ++objectIndex)
+	{
+		const SData_object &objectSource = modelData.m_object[objectIndex];
+
+		// TODO: log error instead? what if there are zero and we try to index slot 0?
+		AssertI_(objectSource.m_material.size() == 1, objectSource.m_material.size());
+		SData_Material defaultMaterial;
+		const SData_Material &materialSource = objectSource.m_material.size() > 0 ? objectSource.m_material[0] : defaultMaterial;
+
+		SObject object;
+		memset(&object, 0, sizeof(object));
+		CWorld::ConvertMaterial(materialSource, object.m_material);
+		object.m_castsShadows = objectSource.m_CastShadows;
+		object.m_textures[0] = materialSource.m_DiffuseTexture.length() > 0 ? AddString(m_builtStrings, materialSource.m_DiffuseTexture) : 0;
+		object.m_textures[1] = materialSource.m_NormalTexture.length() > 0 ? AddString(m_builtStrings, materialSource.m_NormalTexture) : 0;
+		object.m_textures[2] = materialSource.m_EmissiveTexture.length() > 0 ? AddString(m_builtStrings, materialSource.m_EmissiveTexture) : 0;
+
+		// add the vertices of each face, sharing the ones that are the same, and give each triangle's bounds
+		// to the BVH builder
+		std::vector<cl_uint> triangles;
+		CBVHBuilder builder;
+		for (unsigned int faceIndex = 0, faceCount = objectSource.m_face.size(); faceIndex < faceCount; ++faceIndex)
+		{
+			const SData_face &face = objectSource.m_face[faceIndex];
+			AssertI_(face.m_vert.size() == 3, face.m_vert.size()); // TODO: log error instead?
+			if (face.m_vert.size() != 3)
+				continue;
+
+			float3 boundsMin, boundsMax;
+			for (unsigned int vertIndex = 0; vertIndex < 3; ++vertIndex)
+			{
+				const SData_vert &vertSource = face.m_vert[vertIndex];
+				SVertex vertex;
+				Copy(vertex.m_pos, vertSource.m_pos);
+				Copy(vertex.m_normal, vertSource.m_normal);
+				Copy(vertex.m_tangent, vertSource.m_tangent);
+				Copy(vertex.m_bitangent, vertSource.m_bitangent);
+				vertex.m_uv[0] = vertSource.m_uv.m_x;
+				vertex.m_uv[1] = vertSource.m_uv.m_y;
+
+				std::map<SVertex, cl_uint, SVertexLess>::iterator it = vertexIndices.find(vertex);
+				if (it == vertexIndices.end())
+				{
+					it = vertexIndices.insert(std::make_pair(vertex, (cl_uint)m_builtVertices.size())).first;
+					m_builtVertices.push_back(vertex);
+				}
+				triangles.push_back(it->second);
+
+				// remember which vertex is farthest from the origin
+				const float radiusSq = vertex.m_pos[0] * vertex.m_pos[0] + vertex.m_pos[1] * vertex.m_pos[1] + vertex.m_pos[2] * vertex.m_pos[2];
+				if (radiusSq > farthestRadiusSq)
+				{
+					m_farthestPoint[0] = vertex.m_pos[0];
+					m_farthestPoint[1] = vertex.m_pos[1];
+					m_farthestPoint[2] = vertex.m_pos[2];
+					farthestRadiusSq = radiusSq;
+				}
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					if (vertIndex == 0 || vertex.m_pos[axis] < boundsMin[axis])
+						boundsMin[axis] = vertex.m_pos[axis];
+					if (vertIndex == 0 || vertex.m_pos[axis] > boundsMax[axis])
+						boundsMax[axis] = vertex.m_pos[axis];
+				}
+			}
+			builder.AddPrimitive(boundsMin, boundsMax);
+		}
+
+		// build the BVH with the indices relative to the object, and store the triangles in the order of it's leaves
+		CSharedArray<SBVHNode> nodes;
+		builder.Build(nodes, 0);
+		object.m_startBVHNode = m_builtBVHNodes.size();
+		object.m_bvhNodeCount = nodes.Count();
+		for (unsigned int index = 0, count = nodes.Count(); index < count; ++index)
+			m_builtBVHNodes.push_back(nodes[index]);
+
+		const std::vector<unsigned int> &order = builder.GetPrimitiveOrder();
+		object.m_startIndex = m_builtIndices.size();
+		object.m_triangleCount = order.size();
+		for (unsigned int index = 0, count = order.size(); index < count; ++index)
+		{
+			m_builtIndices.push_back(triangles[order[index] * 3]);
+			m_builtIndices.push_back(triangles[order[index] * 3 + 1]);
+			m_builtIndices.push_back(triangles[order[index] * 3 + 2]);
+		}
+
+		m_builtObjects.push_back(object);
+	}
+
+	PointAtBuiltData();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void CModelCache::PointAtBuiltData ()
+{
+	m_objectCount = m_builtObjects.size();
+	m_vertexCount = m_builtVertices.size();
+	m_indexCount = m_builtIndices.size();
+	m_bvhNodeCount = m_builtBVHNodes.size();
+	m_stringsSize = m_builtStrings.size();
+	m_objects = m_builtObjects.empty() ? NULL : &m_builtObjects[0];
+	m_vertices = m_builtVertices.empty() ? NULL : &m_builtVertices[0];
+	m_indices = m_builtIndices.empty() ? NULL : &m_builtIndices[0];
+	m_bvhNodes = m_builtBVHNodes.empty() ? NULL : &m_builtBVHNodes[0];
+	m_strings = &m_builtStrings[0];
+}
+
+//-----------------------------------------------------------------------------
+static bool WriteAligned (FILE *file, const void *data, size_t size)
+{
+	static const char c_padding[16] = { 0 };
+	const long position = ftell(file);
+	const size_t padding = Align16(position) - position;
+	if (padding > 0 && fwrite(c_padding, padding, 1, file) != 1)
+		return false;
+	return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+//-----------------------------------------------------------------------------
+bool CModelCache::Save (const char *cacheFileName, unsigned long long sourceSize, unsigned long long sourceTime) const
+{
+	FILE *file = fopen(cacheFileName, "wb");
+	if (!file)
+		return false;
+
+	SModelCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, c_modelCacheMagic, sizeof(header.m_magic));
+	header.m_version = c_modelCacheVersion;
+	header.m_sourceSize = sourceSize;
+	header.m_sourceTime = sourceTime;
+	header.m_farthestPoint[0] = m_farthestPoint[0];
+	header.m_farthestPoint[1] = m_farthestPoint[1];
+	header.m_farthestPoint[2] = m_farthestPoint[2];
+	header.m_stringsSize = m_stringsSize;
+	header.m_objectCount = m_objectCount;
+	header.m_vertexCount = m_vertexCount;
+	header.m_indexCount = m_indexCount;
+	header.m_bvhNodeCount = m_bvhNodeCount;
+
+	bool success = WriteAligned(file, &header, sizeof(header));
+	success = success && WriteAligned(file, m_objects, sizeof(SObject) * m_objectCount);
+	success = success && WriteAligned(file, m_vertices, sizeof(SVertex) * m_vertexCount);
+	success = success && WriteAligned(file, m_indices, sizeof(cl_uint) * m_indexCount);
+	success = success && WriteAligned(file, m_bvhNodes, sizeof(SBVHNode) * m_bvhNodeCount);
+	success = success && WriteAligned(file, m_strings, m_stringsSize);
+	success = fclose(file) == 0 && success;
+
+	// don't leave a partial cache behind
+	if (!success)
+		remove(cacheFileName);
+
+	return success;
+}
@@ -0,0 +1,102 @@
+/*==================================================================================================
+
+CModelCache.h
+
+A binary version of a .xmd model: the vertices are shared between triangles, the triangles of each
+object are already sorted into the order of the object's BVH, and the BVH and bounds are stored
+with them, so loading a model doesn't involve any xml parsing or BVH building.
+
+The cache is written next to the model as <model file>.xmdcache the first time the model is loaded,
+and rebuilt from the .xmd whenever the .xmd's size or last write time no longer match.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "KernelCode/Shared/SharedGeometry.h"
+#include "Platform/OS.h"
+#include <vector>
+#include <string>
+
+class CModelCache
+{
+public:
+	struct SVertex
+	{
+		cl_float	m_pos[3];
+		cl_float	m_normal[3];
+		cl_float	m_tangent[3];
+		cl_float	m_bitangent[3];
+		cl_float	m_uv[2];
+	};
+
+	struct SObject
+	{
+		SMaterial	m_material;			// converted by CWorld::ConvertMaterial(), so without texture indices
+		cl_uint		m_castsShadows;
+		cl_uint		m_startIndex;		// the object's triangles are 3 indices each, starting here in Indices()
+		cl_uint		m_triangleCount;
+		cl_uint		m_startBVHNode;		// where the object's BVH nodes start in BVHNodes(), root first
+		cl_uint		m_bvhNodeCount;		// the nodes index each other, and the triangles, relative to the object
+		cl_uint		m_textures[3];		// the diffuse, normal and emissive texture names, as offsets for String()
+	};
+
+	CModelCache ()
+		: m_objectCount(0)
+		, m_vertexCount(0)
+		, m_indexCount(0)
+		, m_bvhNodeCount(0)
+		, m_stringsSize(0)
+		, m_objects(NULL)
+		, m_vertices(NULL)
+		, m_indices(NULL)
+		, m_bvhNodes(NULL)
+		, m_strings(NULL)
+	{
+		m_farthestPoint[0] = m_farthestPoint[1] = m_farthestPoint[2] = 0.0f;
+	}
+
+	// loads the cache for a .xmd model file, building it from the model file if it's missing or out of date
+	bool Load (const char *modelFileName);
+
+	// the vertex that is farthest from the model's origin
+	const cl_float *FarthestPoint () const { return m_farthestPoint; }
+
+	unsigned int ObjectCount () const { return m_objectCount; }
+	const SObject &Object (unsigned int index) const { return m_objects[index]; }
+	const SVertex &Vertex (unsigned int index) const { return m_vertices[index]; }
+	const cl_uint *Indices () const { return m_indices; }
+	const SBVHNode *BVHNodes () const { return m_bvhNodes; }
+	const char *String (cl_uint offset) const { return &m_strings[offset]; }
+
+	static const char *c_cacheExtension;
+
+private:
+	bool LoadCache (const char *cacheFileName, unsigned long long sourceSize, unsigned long long sourceTime);
+	bool Build (const char *modelFileName);
+	bool Save (const char *cacheFileName, unsigned long long sourceSize, unsigned long long sourceTime) const;
+	void PointAtBuiltData ();
+
+	// the model data, pointing either into m_file or into the m_built* vectors
+	cl_float				m_farthestPoint[3];
+	unsigned int			m_objectCount;
+	unsigned int			m_vertexCount;
+	unsigned int			m_indexCount;
+	unsigned int			m_bvhNodeCount;
+	unsigned int			m_stringsSize;
+	const SObject			*m_objects;
+	const SVertex			*m_vertices;
+	const cl_uint			*m_indices;
+	const SBVHNode			*m_bvhNodes;
+	const char				*m_strings;
+
+	// a loaded cache file is used where it's mapped
+	OS::CMappedFile			m_file;
+
+	// a model built from a .xmd
+	std::vector<SObject>	m_builtObjects;
+	std::vector<SVertex>	m_builtVertices;
+	std::vector<cl_uint>	m_builtIndices;
+	std::vector<SBVHNode>	m_builtBVHNodes;
+	std::vector<char>		m_builtStrings;
+};
@@ -6,20 +6,15 @@ This class holds all information about the world
 
 ==================================================================================================*/
 
-#include "Platform\CDirectx.h"
-
 #include "CWorld.h"
 
 #include "DataSchemas/DataSchemasXML.h"
 
-#include "CGame.h"
 #include "MatrixMath.h"
-#include "CCamera.h"
 #include "Platform/OS.h"
+#include "Platform/CTextureManager.h"
 
-#include "ECS/ECS.h"
-
-#include "Game\CGame.h"
+#include "Game/CBVHBuilder.h"
 
 #include <algorithm>
 
@@ -28,6 +23,12 @@ static const unsigned int c_defaultPortal = -1;
 static const unsigned int c_defaultModel = -1;
 static const unsigned int c_defaultSector = -1;
 
+// attenuated light dimmer than this rounds away to nothing in an 8 bit color channel
+static const float c_lightInfluenceCutoff = 1.0f / 512.0f;
+
+// the influence radius of lights that don't attenuate with distance.  Still small enough to square.
+static const float c_unboundedLightRadius = 1.0e18f;
+
 //-----------------------------------------------------------------------------
 void Copy(cl_float2 &lhs, const SData_Vec2 &rhs)
 {
@@ -43,6 +44,21 @@ void Copy(float3 &lhs, const SData_Vec3 &rhs)
 	lhs[2] = rhs.m_z;
 }
 
+//-----------------------------------------------------------------------------
+void Copy(float3 &lhs, const cl_float *rhs)
+{
+	lhs[0] = rhs[0];
+	lhs[1] = rhs[1];
+	lhs[2] = rhs[2];
+}
+
+//-----------------------------------------------------------------------------
+void Copy(cl_float2 &lhs, const cl_float *rhs)
+{
+	lhs.s[0] = rhs[0];
+	lhs.s[1] = rhs[1];
+}
+
 //-----------------------------------------------------------------------------
 void ConvertFromLinearTosRGB(float3 &color)
 {
@@ -130,28 +146,25 @@ void Normalize4D(cl_float4 &vec)
 }
 
 //-----------------------------------------------------------------------------
-void CWorld::AddTriangle (
-	const SData_Vec3 &sa,
-	const SData_Vec3 &sb,
-	const SData_Vec3 &sc,
-	const SData_Vec2 &ta,
-	const SData_Vec2 &tb,
-	const SData_Vec2 &tc,
-	const struct SData_Vec3 &normal,
-	const struct SData_Vec3 &tangent,
-	const struct SData_Vec3 &bitangent
+void CWorld::BuildTriangle (
+	SModelTriangle &triangle,
+	SModelTriangleShading &shading,
+	const CModelCache::SVertex &va,
+	const CModelCache::SVertex &vb,
+	const CModelCache::SVertex &vc
 ) {
-	SModelTriangle &triangle = m_modelTriangles.AddOne();
-	triangle.m_objectId = m_nextObjectId++;
+	// clear the padding too, so built triangles can be compared with memcmp
+	memset(&triangle, 0, sizeof(triangle));
+	memset(&shading, 0, sizeof(shading));
 
 	// calculate pre-calculated info for triangle
 	float3 a,b,c;
-	Copy(a, sa);
-	Copy(b, sb);
-	Copy(c, sc);
+	Copy(a, va.m_pos);
+	Copy(b, vb.m_pos);
+	Copy(c, vc.m_pos);
 
 	float3 norm;
-	Copy(norm, normal);
+	Copy(norm, va.m_normal);
 	norm = normalize(norm);
 	triangle.m_plane   = plane(normalize(norm), a);
 	triangle.m_planeBC = plane(normalize(cross(norm, c-b)), b);
@@ -170,24 +183,69 @@ void CWorld::AddTriangle (
 	triangle.m_planeCA.s[2] *= ca;
 	triangle.m_planeCA.s[3] *= ca;
 
-	Copy(triangle.m_textureA, ta);
-	Copy(triangle.m_textureB, tb);
-	Copy(triangle.m_textureC, tc);
+	Copy(shading.m_textureA, va.m_uv);
+	Copy(shading.m_textureB, vb.m_uv);
+	Copy(shading.m_textureC, vc.m_uv);
 
-	Copy(triangle.m_tangent, tangent);
-	Copy(triangle.m_bitangent, bitangent);
+	Copy(shading.m_tangent, va.m_tangent);
+	Copy(shading.m_bitangent, va.m_bitangent);
 
-	// calculate the quadrant flags by noting which half spaces this triangle exists in
-	triangle.m_halfSpaceFlags = 0;
-	triangle.m_halfSpaceFlags |= sa.m_y > 0.0f ? e_halfSpacePosY : e_halfSpaceNegY;
-	triangle.m_halfSpaceFlags |= sb.m_y > 0.0f ? e_halfSpacePosY : e_halfSpaceNegY;
-	triangle.m_halfSpaceFlags |= sc.m_y > 0.0f ? e_halfSpacePosY : e_halfSpaceNegY;
+	// how many texture coordinate units there are per unit of model space, from how much bigger the triangle
+	// is in one than the other.  The kernel picks the mip level from it.
+	const float textureArea = fabsf(
+		(vb.m_uv[0] - va.m_uv[0]) * (vc.m_uv[1] - va.m_uv[1]) -
+		(vc.m_uv[0] - va.m_uv[0]) * (vb.m_uv[1] - va.m_uv[1])
+	);
+	const float area = length(cross(b - a, c - a));
+	shading.m_textureDensity = area > 0.0f ? sqrtf(textureArea / area) : 0.0f;
 }
 
 //-----------------------------------------------------------------------------
-unsigned int CWorld::AddMaterial (const struct SData_Material &materialSource, const char *path)
+static cl_ushort QuantizeUnsigned (float value, float minValue, float range)
 {
-	SMaterial &material = m_materials.AddOne();
+	// value is in [minValue, minValue + range]
+	const float fraction = range > 0.0f ? (value - minValue) / range : 0.0f;
+	return (cl_ushort)(fraction <= 0.0f ? 0.0f : (fraction >= 1.0f ? 65535.0f : fraction * 65535.0f + 0.5f));
+}
+
+//-----------------------------------------------------------------------------
+static cl_short QuantizeSigned (float value)
+{
+	// value is in [-1, 1]
+	const float scaled = value * 32767.0f;
+	return (cl_short)(scaled <= -32767.0f ? -32767.0f : (scaled >= 32767.0f ? 32767.0f : (scaled < 0.0f ? scaled - 0.5f : scaled + 0.5f)));
+}
+
+//-----------------------------------------------------------------------------
+void CWorld::QuantizeTriangleShading (
+	const SModelTriangleShading &shading,
+	const cl_float textureBounds[4],
+	SModelTriangleShadingQuantized &quantized
+) {
+	memset(&quantized, 0, sizeof(quantized));
+	for (int index = 0; index < 2; ++index)
+	{
+		quantized.m_textureA[index] = QuantizeUnsigned(shading.m_textureA.s[index], textureBounds[index], textureBounds[index + 2]);
+		quantized.m_textureB[index] = QuantizeUnsigned(shading.m_textureB.s[index], textureBounds[index], textureBounds[index + 2]);
+		quantized.m_textureC[index] = QuantizeUnsigned(shading.m_textureC.s[index], textureBounds[index], textureBounds[index + 2]);
+	}
+	for (int index = 0; index < 3; ++index)
+	{
+		quantized.m_tangent[index] = QuantizeSigned(shading.m_tangent[index]);
+		quantized.m_bitangent[index] = QuantizeSigned(shading.m_bitangent[index]);
+	}
+
+	// stored as a log, since only the mip level it picks matters
+	const float maxDensity = (65535.0f / c_textureDensityQuantizeScale) - c_textureDensityQuantizeBias;
+	float logDensity = shading.m_textureDensity > 0.0f ? logf(shading.m_textureDensity) / logf(2.0f) : -c_textureDensityQuantizeBias;
+	logDensity = logDensity < -c_textureDensityQuantizeBias ? -c_textureDensityQuantizeBias : (logDensity > maxDensity ? maxDensity : logDensity);
+	quantized.m_textureDensity = (cl_ushort)((logDensity + c_textureDensityQuantizeBias) * c_textureDensityQuantizeScale + 0.5f);
+}
+
+//-----------------------------------------------------------------------------
+void CWorld::ConvertMaterial (const struct SData_Material &materialSource, SMaterial &material)
+{
+	memset(&material, 0, sizeof(material));
 	Copy(material.m_diffuseColor, materialSource.m_DiffuseColor);
 	Copy(material.m_specularColorAndPower, materialSource.m_SpecularColor, materialSource.m_SpecularPower);
 	Copy(material.m_emissiveColor, materialSource.m_EmissiveColor);
@@ -215,33 +273,66 @@ unsigned int CWorld::AddMaterial (const struct SData_Material &materialSource, c
 	material.m_absorbance[1] *= 100.0f;
 	material.m_absorbance[2] *= 100.0f;
 
-	material.m_diffuseTextureIndex = 0.0f;
-	if (materialSource.m_DiffuseTexture.length() > 0)
-	{
-		std::string texturePath = path;
-		texturePath += materialSource.m_DiffuseTexture.c_str();
-		material.m_diffuseTextureIndex = (float)CDirectX::TextureManager().GetOrLoad(texturePath.c_str());
-	}
+	material.m_diffuseTextureIsDistanceField = materialSource.m_DiffuseTextureIsDistanceField;
+}
 
-	material.m_normalTextureIndex = 0.0f;
-	if (materialSource.m_NormalTexture.length() > 0)
-	{
-		std::string texturePath = path;
-		texturePath += materialSource.m_NormalTexture.c_str();
-		material.m_normalTextureIndex = (float)CDirectX::TextureManager().GetOrLoad(texturePath.c_str());
-	}
+//-----------------------------------------------------------------------------
+unsigned int CWorld::AddMaterial (const struct SData_Material &materialSource, const char *path)
+{
+	SMaterial material;
+	ConvertMaterial(materialSource, material);
+	return AddMaterial(material, path, materialSource.m_DiffuseTexture, materialSource.m_NormalTexture, materialSource.m_EmissiveTexture);
+}
+
+//-----------------------------------------------------------------------------
+unsigned int CWorld::AddMaterial (
+	const SMaterial &material,
+	const char *path,
+	const std::string &diffuseTexture,
+	const std::string &normalTexture,
+	const std::string &emissiveTexture
+) {
+	m_materials.AddOne() = material;
+
+	// remember the texture file names.  The textures are loaded once all the materials are in, by
+	// ResolveMaterialTextures().
+	SMaterialTextures textures;
+	if (diffuseTexture.length() > 0)
+		textures.m_diffuse = path + diffuseTexture;
+	if (normalTexture.length() > 0)
+		textures.m_normal = path + normalTexture;
+	if (emissiveTexture.length() > 0)
+		textures.m_emissive = path + emissiveTexture;
+	m_materialTextures.push_back(textures);
+
+	return m_materials.Count() - 1;
+}
+
+//-----------------------------------------------------------------------------
+unsigned int CWorld::FindOrAddMaterial (
+	const SMaterial &material,
+	const char *path,
+	const std::string &diffuseTexture,
+	const std::string &normalTexture,
+	const std::string &emissiveTexture
+) {
+	// the texture file names are compared the way AddMaterial stores them
+	const std::string diffuse = diffuseTexture.length() > 0 ? path + diffuseTexture : std::string();
+	const std::string normal = normalTexture.length() > 0 ? path + normalTexture : std::string();
+	const std::string emissive = emissiveTexture.length() > 0 ? path + emissiveTexture : std::string();
 
-	material.m_emissiveTextureIndex = 0.0f;
-	if (materialSource.m_EmissiveTexture.length() > 0)
+	// ConvertMaterial clears the materials before filling them in, so they can be compared with memcmp
+	for (unsigned int index = 0, count = m_materials.Count(); index < count; ++index)
 	{
-		std::string texturePath = path;
-		texturePath += materialSource.m_EmissiveTexture.c_str();
-		material.m_emissiveTextureIndex = (float)CDirectX::TextureManager().GetOrLoad(texturePath.c_str());
+		const SMaterialTextures &textures = m_materialTextures[index];
+		if (!memcmp(&m_materials[index], &material, sizeof(material)) &&
+			textures.m_diffuse == diffuse &&
+			textures.m_normal == normal &&
+			textures.m_emissive == emissive)
+			return index;
 	}
 
-	material.m_diffuseTextureIsDistanceField = materialSource.m_DiffuseTextureIsDistanceField;
-
-	return m_materials.Count() - 1;
+	return AddMaterial(material, path, diffuseTexture, normalTexture, emissiveTexture);
 }
 
 //-----------------------------------------------------------------------------
@@ -257,121 +348,257 @@ void CWorld::AddDebugMaterial ()
 }
 
 //-----------------------------------------------------------------------------
-void CWorld::AddModel (const struct SData_Model &modelSource)
+static unsigned long long HashBytes (unsigned long long hash, const void *data, unsigned int size)
 {
-	SNamedModel namedModel;
+	// 64 bit FNV-1a
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (unsigned int index = 0; index < size; ++index)
+		hash = (hash ^ bytes[index]) * 1099511628211ull;
+	return hash;
+}
 
-	// set the starting object index and copy the id
-	namedModel.m_startObjectIndex = m_modelObjects.Count();
-	namedModel.m_id = modelSource.m_id;
-		
-	// init bounding sphere data
-	namedModel.m_farthestPointFromOrigin[0] = 0.0f;
-	namedModel.m_farthestPointFromOrigin[1] = 0.0f;
-	namedModel.m_farthestPointFromOrigin[2] = 0.0f;
+//-----------------------------------------------------------------------------
+static bool BVHNodesMatch (const SBVHNode &lhs, const SBVHNode &rhs, cl_uint rightChildOffset, cl_uint firstPrimitiveOffset)
+{
+	// only the used parts are compared, the padding comes from whoever built the node
+	const cl_uint offset = rhs.m_primitiveCount > 0 ? firstPrimitiveOffset : rightChildOffset;
+	return
+		lhs.m_min[0] == rhs.m_min[0] && lhs.m_min[1] == rhs.m_min[1] && lhs.m_min[2] == rhs.m_min[2] &&
+		lhs.m_max[0] == rhs.m_max[0] && lhs.m_max[1] == rhs.m_max[1] && lhs.m_max[2] == rhs.m_max[2] &&
+		lhs.m_rightChildOrFirstPrimitive == rhs.m_rightChildOrFirstPrimitive + offset &&
+		lhs.m_primitiveCount == rhs.m_primitiveCount &&
+		lhs.m_splitAxis == rhs.m_splitAxis;
+}
+
+//-----------------------------------------------------------------------------
+void CWorld::AddModelGeometry (const CModelCache &model, const CModelCache::SObject &object, bool quantizedShading, SModelObject &modelObject)
+{
+	const cl_uint *indices = model.Indices() + object.m_startIndex;
+	const SBVHNode *nodes = model.BVHNodes() + object.m_startBVHNode;
 
-	SData_XMDFILE modelData;
-	if (DataSchemasXML::Load(modelData, modelSource.m_FileName.c_str(), "model"))
+	// quantized texture coordinates are fractions of the range the object's texture coordinates cover
+	cl_float textureBounds[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	if (quantizedShading && object.m_triangleCount > 0)
 	{
-		// get the path that all textures etc are based on
-		std::string basePath;
-		bool result = OS::GetAbsolutePath(modelSource.m_FileName.c_str(), basePath);
-		Assert_(result == true);
+		cl_float textureMax[2];
+		for (int axis = 0; axis < 2; ++axis)
+			textureBounds[axis] = textureMax[axis] = model.Vertex(indices[0]).m_uv[axis];
+		for (unsigned int index = 1, count = object.m_triangleCount * 3; index < count; ++index)
+		{
+			for (int axis = 0; axis < 2; ++axis)
+			{
+				const cl_float value = model.Vertex(indices[index]).m_uv[axis];
+				if (value < textureBounds[axis])
+					textureBounds[axis] = value;
+				if (value > textureMax[axis])
+					textureMax[axis] = value;
+			}
+		}
+		textureBounds[2] = textureMax[0] - textureBounds[0];
+		textureBounds[3] = textureMax[1] - textureBounds[1];
+	}
 
-		// remember which vertex is farthest from the origin
-		CalculateModelFarthestPoint(modelData, namedModel.m_farthestPointFromOrigin);
-
-		// create the objects and triangles and such
-		for (unsigned int objectIndex = 0, objectCount = modelData.m_object.size(); objectIndex < objectCount; ++objectIndex) {
-
-			// TODO: log error instead? what if there are zero and we try to index slot 0?
-			AssertI_(modelData.m_object[objectIndex].m_material.size() == 1, modelData.m_object[objectIndex].m_material.size());
-
-			// add an object
-			SModelObject &modelobject = m_modelObjects.AddOne();
-			modelobject.m_castsShadows = modelData.m_object[objectIndex].m_CastShadows;
-			modelobject.m_materialIndex = AddMaterial(modelData.m_object[objectIndex].m_material[0], basePath.c_str());
-			modelobject.m_startTriangleIndex = m_modelTriangles.Count();
-
-			SData_object &object = modelData.m_object[objectIndex];
-			for (unsigned int faceIndex = 0, faceCount = object.m_face.size(); faceIndex < faceCount; ++faceIndex) {
-				SData_face &face = object.m_face[faceIndex];
-				AssertI_(face.m_vert.size() == 3, face.m_vert.size()); // TODO: log error instead?
-				AddTriangle(
-					face.m_vert[0].m_pos,
-					face.m_vert[1].m_pos,
-					face.m_vert[2].m_pos,
-					face.m_vert[0].m_uv,
-					face.m_vert[1].m_uv,
-					face.m_vert[2].m_uv,
-					face.m_vert[0].m_normal,
-					face.m_vert[0].m_tangent,
-					face.m_vert[0].m_bitangent
-				);
+	// hash the vertices of each triangle, and the parts of the BVH nodes that get used
+	unsigned long long hash = 14695981039346656037ull;
+	hash = HashBytes(hash, &object.m_triangleCount, sizeof(object.m_triangleCount));
+	hash = HashBytes(hash, &object.m_bvhNodeCount, sizeof(object.m_bvhNodeCount));
+	hash = HashBytes(hash, &quantizedShading, sizeof(quantizedShading));
+	for (unsigned int index = 0, count = object.m_triangleCount * 3; index < count; ++index)
+		hash = HashBytes(hash, &model.Vertex(indices[index]), sizeof(CModelCache::SVertex));
+	for (unsigned int nodeIndex = 0; nodeIndex < object.m_bvhNodeCount; ++nodeIndex)
+	{
+		const SBVHNode &node = nodes[nodeIndex];
+		hash = HashBytes(hash, &node.m_min, sizeof(cl_float) * 3);
+		hash = HashBytes(hash, &node.m_max, sizeof(cl_float) * 3);
+		hash = HashBytes(hash, &node.m_rightChildOrFirstPrimitive, sizeof(cl_uint) * 3);
+	}
+
+	// use the geometry that's already loaded if it really is the same, not just the same hash
+	const SModelGeometry *found = NULL;
+	typedef std::multimap<unsigned long long, SModelGeometry>::const_iterator TGeometryIterator;
+	std::pair<TGeometryIterator, TGeometryIterator> candidates = m_modelGeometry.equal_range(hash);
+	for (TGeometryIterator it = candidates.first; !found && it != candidates.second; ++it)
+	{
+		const SModelGeometry &geometry = it->second;
+		if (geometry.m_stopTriangleIndex - geometry.m_startTriangleIndex != object.m_triangleCount ||
+			geometry.m_bvhNodeCount != object.m_bvhNodeCount ||
+			geometry.m_quantizedShading != (cl_uint)quantizedShading ||
+			memcmp(geometry.m_textureBounds, textureBounds, sizeof(textureBounds)))
+			continue;
+
+		bool match = true;
+		for (unsigned int triangleIndex = 0; match && triangleIndex < object.m_triangleCount; ++triangleIndex)
+		{
+			SModelTriangle triangle;
+			SModelTriangleShading shading;
+			BuildTriangle(triangle, shading, model.Vertex(indices[triangleIndex * 3]), model.Vertex(indices[triangleIndex * 3 + 1]), model.Vertex(indices[triangleIndex * 3 + 2]));
+			match = !memcmp(&triangle, &m_modelTriangles[geometry.m_startTriangleIndex + triangleIndex], sizeof(triangle));
+
+			if (match && quantizedShading)
+			{
+				SModelTriangleShadingQuantized quantized;
+				QuantizeTriangleShading(shading, textureBounds, quantized);
+				match = !memcmp(&quantized, (const SModelTriangleShadingQuantized *)&m_modelTriangleShading[geometry.m_shadingStartIndex] + triangleIndex, sizeof(quantized));
 			}
+			else if (match)
+				match = !memcmp(&shading, &m_modelTriangleShading[geometry.m_shadingStartIndex + triangleIndex], sizeof(shading));
+		}
 
-			modelobject.m_stopTriangleIndex = m_modelTriangles.Count();
+		for (unsigned int nodeIndex = 0; match && nodeIndex < object.m_bvhNodeCount; ++nodeIndex)
+			match = BVHNodesMatch(m_modelBVHNodes[geometry.m_bvhRootIndex + nodeIndex], nodes[nodeIndex], geometry.m_bvhRootIndex, geometry.m_startTriangleIndex);
 
-			// sort the triangles from m_startTriangleIndex to m_stopTriangleIndex, based on their 
-			// y axis (negative only, mixed, positive only) so that we can set the mix start and mix end
-			// indices.  This way, when rendering, if the line segment is only in pos, or only in neg,
-			// we can limit the triangles we test.
-			SortTrianglesByHalfSpace(modelobject);
+		if (match)
+			found = &geometry;
+	}
+
+	if (!found)
+	{
+		SModelGeometry geometry;
+		geometry.m_startTriangleIndex = m_modelTriangles.Count();
+		geometry.m_stopTriangleIndex = geometry.m_startTriangleIndex + object.m_triangleCount;
+		geometry.m_bvhRootIndex = object.m_bvhNodeCount > 0 ? m_modelBVHNodes.Count() : -1;
+		geometry.m_bvhNodeCount = object.m_bvhNodeCount;
+		geometry.m_shadingStartIndex = m_modelTriangleShading.Count();
+		geometry.m_quantizedShading = quantizedShading;
+		memcpy(geometry.m_textureBounds, textureBounds, sizeof(textureBounds));
+
+		// quantized shading packs two triangles into each entry.  The entries are cleared so an odd
+		// triangle out leaves the other half zero.
+		const unsigned int shadingCount = quantizedShading ? (object.m_triangleCount + 1) / 2 : object.m_triangleCount;
+		m_modelTriangles.Resize(geometry.m_stopTriangleIndex);
+		m_modelTriangleShading.Resize(geometry.m_shadingStartIndex + shadingCount);
+		if (shadingCount > 0)
+			memset(&m_modelTriangleShading[geometry.m_shadingStartIndex], 0, sizeof(SModelTriangleShading) * shadingCount);
+
+		// the triangles are already in the order of the BVH leaves
+		for (unsigned int triangleIndex = 0; triangleIndex < object.m_triangleCount; ++triangleIndex, indices += 3)
+		{
+			SModelTriangleShading shading;
+			BuildTriangle(m_modelTriangles[geometry.m_startTriangleIndex + triangleIndex], shading, model.Vertex(indices[0]), model.Vertex(indices[1]), model.Vertex(indices[2]));
+			if (quantizedShading)
+				QuantizeTriangleShading(shading, textureBounds, ((SModelTriangleShadingQuantized *)&m_modelTriangleShading[geometry.m_shadingStartIndex])[triangleIndex]);
+			else
+				m_modelTriangleShading[geometry.m_shadingStartIndex + triangleIndex] = shading;
 		}
 
-		namedModel.m_stopObjectIndex = m_modelObjects.Count();
-		m_namedModels.push_back(namedModel);
+		// add the bounding volume hierarchy over the triangles, moving it's node and triangle indices from
+		// being relative to the object to being relative to the whole arrays
+		m_modelBVHNodes.Presize(m_modelBVHNodes.Count() + object.m_bvhNodeCount);
+		for (unsigned int nodeIndex = 0; nodeIndex < object.m_bvhNodeCount; ++nodeIndex)
+		{
+			SBVHNode &node = m_modelBVHNodes.AddOne();
+			node = nodes[nodeIndex];
+			node.m_rightChildOrFirstPrimitive += node.m_primitiveCount > 0 ? geometry.m_startTriangleIndex : geometry.m_bvhRootIndex;
+		}
+
+		found = &m_modelGeometry.insert(std::make_pair(hash, geometry))->second;
 	}
+
+	modelObject.m_startTriangleIndex = found->m_startTriangleIndex;
+	modelObject.m_stopTriangleIndex = found->m_stopTriangleIndex;
+	modelObject.m_bvhRootIndex = found->m_bvhRootIndex;
+	modelObject.m_shadingStartIndex = found->m_shadingStartIndex;
+	modelObject.m_quantizedShading = found->m_quantizedShading;
+	for (int index = 0; index < 4; ++index)
+		modelObject.m_textureBounds.s[index] = found->m_textureBounds[index];
 }
 
 //-----------------------------------------------------------------------------
-static bool TriangleHalfSpaceSortFunc (const SModelTriangle &a, const SModelTriangle &b)
-{
-	// sort order is e_halfSpaceNegY, then mixed, then e_halfSpacePosY
-	int orderA = 0;
-	switch (a.m_halfSpaceFlags)
+bool CWorld::ShareModelObjects (
+	const std::vector<SModelObject> &objects,
+	cl_uint &startObjectIndex,
+	cl_uint &stopObjectIndex,
+	cl_uint &materialOverride
+) const {
+	if (objects.empty())
+		return false;
+
+	// a material override replaces the material of every object, so it can only stand in for models
+	// that use one material throughout
+	bool singleMaterial = true;
+	for (unsigned int index = 1, count = objects.size(); index < count; ++index)
+		singleMaterial = singleMaterial && objects[index].m_materialIndex == objects[0].m_materialIndex;
+
+	for (unsigned int modelIndex = 0, modelCount = m_namedModels.size(); modelIndex < modelCount; ++modelIndex)
 	{
-		case e_halfSpaceNegY: orderA = 0; break;
-		case e_halfSpaceNegY | e_halfSpacePosY: orderA = 1; break;
-		case e_halfSpacePosY: orderA = 2; break;
-		default: Assert_(false);
-	}
+		const SNamedModel &namedModel = m_namedModels[modelIndex];
+		if (namedModel.m_stopObjectIndex - namedModel.m_startObjectIndex != objects.size())
+			continue;
 
-	int orderB = 0;
-	switch (b.m_halfSpaceFlags)
-	{
-		case e_halfSpaceNegY: orderB = 0; break;
-		case e_halfSpaceNegY | e_halfSpacePosY: orderB = 1; break;
-		case e_halfSpacePosY: orderB = 2; break;
-		default: Assert_(false);
+		bool sameGeometry = true;
+		bool sameMaterials = true;
+		for (unsigned int index = 0, count = objects.size(); sameGeometry && index < count; ++index)
+		{
+			const SModelObject &existing = m_modelObjects[namedModel.m_startObjectIndex + index];
+			sameGeometry =
+				existing.m_startTriangleIndex == objects[index].m_startTriangleIndex &&
+				existing.m_stopTriangleIndex == objects[index].m_stopTriangleIndex &&
+				existing.m_castsShadows == objects[index].m_castsShadows;
+			sameMaterials = sameMaterials && existing.m_materialIndex == objects[index].m_materialIndex;
+		}
+
+		if (sameGeometry && (sameMaterials || singleMaterial))
+		{
+			startObjectIndex = namedModel.m_startObjectIndex;
+			stopObjectIndex = namedModel.m_stopObjectIndex;
+			materialOverride = sameMaterials ? -1 : objects[0].m_materialIndex;
+			return true;
+		}
 	}
 
-	// sort by the order described above
-	return orderA < orderB;
+	return false;
 }
 
 //-----------------------------------------------------------------------------
-void CWorld::SortTrianglesByHalfSpace (SModelObject &object)
+void CWorld::AddModel (const struct SData_Model &modelSource)
 {
-	// sort the triangles by the y axis half space flags
-	std::sort(
-		&m_modelTriangles[object.m_startTriangleIndex],
-		&m_modelTriangles[object.m_startTriangleIndex] + (object.m_stopTriangleIndex - object.m_startTriangleIndex),
-		TriangleHalfSpaceSortFunc
-	);
+	SNamedModel namedModel;
 
-	// find where any e_halfSpacePosY starts, and store it in m_mixStartTriangleIndex
-	for (object.m_mixStartTriangleIndex = object.m_startTriangleIndex;  object.m_mixStartTriangleIndex < object.m_stopTriangleIndex; ++object.m_mixStartTriangleIndex)
-	{
-		if ((m_modelTriangles[object.m_mixStartTriangleIndex].m_halfSpaceFlags & e_halfSpacePosY) != 0)
-			break;
-	}
+	// copy the id
+	namedModel.m_id = modelSource.m_id;
+	namedModel.m_materialOverride = -1;
 
-	// find where all e_halfSpaceNegY ends and store it in m_mixStopTriangleIndex
-	for (object.m_mixStopTriangleIndex = object.m_startTriangleIndex;  object.m_mixStopTriangleIndex < object.m_stopTriangleIndex; ++object.m_mixStopTriangleIndex)
+	// load the model from it's binary cache, which has the vertices, bounds and BVHs all ready to go
+	CModelCache model;
+	if (model.Load(modelSource.m_FileName.c_str()))
 	{
-		if ((m_modelTriangles[object.m_mixStopTriangleIndex].m_halfSpaceFlags & e_halfSpaceNegY) == 0)
-			break;
+		// get the path that all textures etc are based on
+		std::string basePath;
+		bool result = OS::GetAbsolutePath(modelSource.m_FileName.c_str(), basePath);
+		Assert_(result == true);
+
+		// remember which vertex is farthest from the origin
+		Copy(namedModel.m_farthestPointFromOrigin, model.FarthestPoint());
+
+		// make the objects, sharing the triangles and materials of any earlier objects that are the same
+		std::vector<SModelObject> objects(model.ObjectCount());
+		for (unsigned int objectIndex = 0, objectCount = model.ObjectCount(); objectIndex < objectCount; ++objectIndex) {
+			const CModelCache::SObject &object = model.Object(objectIndex);
+
+			SModelObject &modelobject = objects[objectIndex];
+			memset(&modelobject, 0, sizeof(modelobject));
+			modelobject.m_castsShadows = object.m_castsShadows;
+			modelobject.m_materialIndex = FindOrAddMaterial(
+				object.m_material,
+				basePath.c_str(),
+				model.String(object.m_textures[0]),
+				model.String(object.m_textures[1]),
+				model.String(object.m_textures[2])
+			);
+			AddModelGeometry(model, object, modelSource.m_QuantizeShading, modelobject);
+		}
+
+		// a model that's the same as an earlier one, or only differs in it's material, uses the earlier one's objects
+		if (!ShareModelObjects(objects, namedModel.m_startObjectIndex, namedModel.m_stopObjectIndex, namedModel.m_materialOverride))
+		{
+			namedModel.m_startObjectIndex = m_modelObjects.Count();
+			m_modelObjects.Presize(m_modelObjects.Count() + objects.size());
+			for (unsigned int objectIndex = 0, objectCount = objects.size(); objectIndex < objectCount; ++objectIndex)
+				m_modelObjects.AddOne() = objects[objectIndex];
+			namedModel.m_stopObjectIndex = m_modelObjects.Count();
+		}
+
+		m_namedModels.push_back(namedModel);
 	}
 }
 
@@ -404,6 +631,91 @@ void CWorld::LoadSectorSpheres (
 	sector.m_staticSphereStopIndex = m_spheres.Count();
 }
 
+//-----------------------------------------------------------------------------
+static void CalculateLightInfluenceSphere (SPointLight &light)
+{
+	// find how far away the attenuation takes the brightest color channel below the cutoff, by solving
+	// brightest / (constant + distance * range + distanceSq * range^2) = cutoff for range
+	float brightest = light.m_color[0] > light.m_color[1] ? light.m_color[0] : light.m_color[1];
+	brightest = brightest > light.m_color[2] ? brightest : light.m_color[2];
+	const float constant = light.m_attenuationConstDistDistsq[0];
+	const float distance = light.m_attenuationConstDistDistsq[1];
+	const float distanceSq = light.m_attenuationConstDistDistsq[2];
+	const float cutoffDenominator = brightest / c_lightInfluenceCutoff;
+
+	float range;
+	if (constant == 1.0f && distance == 0.0f && distanceSq == 0.0f)
+		range = c_unboundedLightRadius; // the kernel doesn't attenuate these at all
+	else if (constant >= cutoffDenominator)
+		range = 0.0f;
+	else if (distanceSq > 0.0f)
+		range = (-distance + sqrtf(distance * distance - 4.0f * distanceSq * (constant - cutoffDenominator))) / (2.0f * distanceSq);
+	else if (distance > 0.0f)
+		range = (cutoffDenominator - constant) / distance;
+	else
+		range = c_unboundedLightRadius;
+
+	// a spot light only lights the part of that range inside it's cone, so bound the cone instead when that's smaller
+	const float cosHalfAngle = light.m_spotLightcosPhiOver2;
+	float centerDistance = 0.0f;
+	float radius = range;
+	if (range < c_unboundedLightRadius && cosHalfAngle > 0.0f)
+	{
+		if (cosHalfAngle <= sqrtf(0.5f))
+		{
+			// wide cones: the sphere through the rim of the cone's cap
+			centerDistance = range * cosHalfAngle;
+			radius = range * sqrtf(1.0f - cosHalfAngle * cosHalfAngle);
+		}
+		else
+		{
+			// narrow cones: the sphere through the apex and the rim of the cone's cap
+			centerDistance = range / (2.0f * cosHalfAngle);
+			radius = centerDistance;
+		}
+	}
+
+	// the spot light direction is stored reversed
+	light.m_influenceSphere.s[0] = light.m_position[0] - light.m_spotLightReverseDir[0] * centerDistance;
+	light.m_influenceSphere.s[1] = light.m_position[1] - light.m_spotLightReverseDir[1] * centerDistance;
+	light.m_influenceSphere.s[2] = light.m_position[2] - light.m_spotLightReverseDir[2] * centerDistance;
+	light.m_influenceSphere.s[3] = radius;
+}
+
+//-----------------------------------------------------------------------------
+static void BuildLightSamplingTable (const SSector &sector, SPointLight *lights, unsigned int count)
+{
+	// weight each light by how much light it gives off, times how attenuated it is across a typical distance in the
+	// sector, times the fraction of all directions its cone lights.  Any weights would average out to the right
+	// lighting, but the closer they are to what each light really adds, the less noise there is.
+	const float typicalDistance = sqrtf(sector.m_halfDims[0] * sector.m_halfDims[0] + sector.m_halfDims[1] * sector.m_halfDims[1] + sector.m_halfDims[2] * sector.m_halfDims[2]);
+	float totalWeight = 0.0f;
+	for (unsigned int index = 0; index < count; ++index)
+	{
+		SPointLight &light = lights[index];
+		const float3 &constDistDistsq = light.m_attenuationConstDistDistsq;
+
+		float weight = light.m_color[0] + light.m_color[1] + light.m_color[2];
+		if (constDistDistsq[0] != 1.0f || constDistDistsq[1] != 0.0f || constDistDistsq[2] != 0.0f)
+		{
+			const float denominator = constDistDistsq[0] + typicalDistance * constDistDistsq[1] + typicalDistance * typicalDistance * constDistDistsq[2];
+			weight = denominator > 0.0f ? weight / denominator : weight;
+		}
+		if (light.m_spotLightcosPhiOver2 > -1.0f)
+			weight *= (1.0f - light.m_spotLightcosPhiOver2) * 0.5f;
+
+		totalWeight += weight > 0.0f ? weight : 0.0f;
+		light.m_samplingCdf = totalWeight;
+	}
+
+	// normalize it into a cumulative distribution, making sure the last light ends at exactly 1 so every pick lands
+	// on a light.  If no light is worth anything, they are all picked evenly.
+	for (unsigned int index = 0; index < count; ++index)
+		lights[index].m_samplingCdf = totalWeight > 0.0f ? lights[index].m_samplingCdf / totalWeight : (float)(index + 1) / (float)count;
+	if (count > 0)
+		lights[count - 1].m_samplingCdf = 1.0f;
+}
+
 //-----------------------------------------------------------------------------
 void CWorld::LoadSectorPointLights (
 	SSector &sector,
@@ -439,8 +751,13 @@ void CWorld::LoadSectorPointLights (
 		light.m_spotLightFalloffFactor = lightSource.m_ConeFalloffFactor;
 		light.m_spotLightcosThetaOver2 = cos(((lightSource.m_ConeAngle - + lightSource.m_ConeAttenuationAngle) * 3.14f / 180.0f) / 2.0f);
 		light.m_spotLightcosPhiOver2 = cos((lightSource.m_ConeAngle * 3.14f / 180.0f) / 2.0f);
+
+		CalculateLightInfluenceSphere(light);
 	}
 	sector.m_staticLightStopIndex = m_pointLights.Count();
+
+	if (sector.m_staticLightStopIndex > sector.m_staticLightStartIndex)
+		BuildLightSamplingTable(sector, &m_pointLights[sector.m_staticLightStartIndex], sector.m_staticLightStopIndex - sector.m_staticLightStartIndex);
 }
 
 //-----------------------------------------------------------------------------
@@ -460,6 +777,7 @@ void CWorld::LoadSectorModelInstances (
 		{
 			const SNamedModel &namedModel = m_namedModels[modelIndex];
 			SModelInstance &modelInstance = m_modelInstances.AddOne();
+			modelInstance.m_authoredIndex = index;
 
 			// copy the start and stop object index
 			modelInstance.m_startObjectIndex = namedModel.m_startObjectIndex;
@@ -469,208 +787,249 @@ void CWorld::LoadSectorModelInstances (
 			modelInstance.m_boundingSphere.s[0] = model.m_Position.m_x;
 			modelInstance.m_boundingSphere.s[1] = model.m_Position.m_y;
 			modelInstance.m_boundingSphere.s[2] = model.m_Position.m_z;
-			modelInstance.m_boundingSphere.s[3] = sqrtf(lengthsq(namedModel.m_farthestPointFromOrigin)) * model.m_Scale;
+			modelInstance.m_unscaledRadius = sqrtf(lengthsq(namedModel.m_farthestPointFromOrigin));
+			modelInstance.m_boundingSphere.s[3] = modelInstance.m_unscaledRadius * model.m_Scale;
 			modelInstance.m_scale = model.m_Scale;
 
 			// set material override if there is one
 			if (model.m_MaterialOverride.length() > 0)
 				modelInstance.m_materialOverride = SData::GetEntryById(materials, model.m_MaterialOverride, c_defaultMaterial) + 1;
 			else
-				modelInstance.m_materialOverride = -1;
+				modelInstance.m_materialOverride = namedModel.m_materialOverride;
 			
 			// set the portal if there is one
 			modelInstance.m_portalIndex = SData::GetEntryById(portals, model.m_Portal, c_defaultPortal);
 
-			// calculate model to world - translate, scale, rotate
-			{
-				MatrixIdentity(modelInstance.m_modelToWorldX, modelInstance.m_modelToWorldY, modelInstance.m_modelToWorldZ, modelInstance.m_modelToWorldW);
-
-				// make the translation matrix
-				cl_float4 transX;
-				cl_float4 transY;
-				cl_float4 transZ;
-				cl_float4 transW;
-				float3 translation;
-				Copy(translation, model.m_Position);
-				MatrixTranslation(transX, transY, transZ, transW, translation);
-
-				// make the scale matrix
-				cl_float4 scaleX;
-				cl_float4 scaleY;
-				cl_float4 scaleZ;
-				cl_float4 scaleW;
-				MatrixScale(scaleX, scaleY, scaleZ, scaleW, model.m_Scale);
-
-				// make the rotation matrix
-				cl_float4 rotX;
-				cl_float4 rotY;
-				cl_float4 rotZ;
-				cl_float4 rotW;
-				MatrixRotation(rotX, rotY, rotZ, rotW,
-					DegreesToRadians(model.m_Rotation.m_x),
-					DegreesToRadians(model.m_Rotation.m_y),
-					DegreesToRadians(model.m_Rotation.m_z));
-
-				TransformMatrixByMatrix(
-					modelInstance.m_modelToWorldX,
-					modelInstance.m_modelToWorldY,
-					modelInstance.m_modelToWorldZ,
-					modelInstance.m_modelToWorldW,
-					rotX,
-					rotY,
-					rotZ,
-					rotW
-				);
-
-				TransformMatrixByMatrix(
-					modelInstance.m_modelToWorldX,
-					modelInstance.m_modelToWorldY,
-					modelInstance.m_modelToWorldZ,
-					modelInstance.m_modelToWorldW,
-					scaleX,
-					scaleY,
-					scaleZ,
-					scaleW
-				);
-
-				TransformMatrixByMatrix(
-					modelInstance.m_modelToWorldX,
-					modelInstance.m_modelToWorldY,
-					modelInstance.m_modelToWorldZ,
-					modelInstance.m_modelToWorldW,
-					transX,
-					transY,
-					transZ,
-					transW
-				);
-			}
-
-			// calculate world to model - rotate, scale, translate
-			{
-				MatrixIdentity(modelInstance.m_worldToModelX, modelInstance.m_worldToModelY, modelInstance.m_worldToModelZ, modelInstance.m_worldToModelW);
-
-				// make the translation matrix
-				cl_float4 transX;
-				cl_float4 transY;
-				cl_float4 transZ;
-				cl_float4 transW;
-				float3 translation;
-				Copy(translation, model.m_Position);
-				translation *= -1.0f;
-				MatrixTranslation(transX, transY, transZ, transW, translation);
-
-				// make the scale matrix
-				cl_float4 scaleX;
-				cl_float4 scaleY;
-				cl_float4 scaleZ;
-				cl_float4 scaleW;
-				MatrixScale(scaleX, scaleY, scaleZ, scaleW, 1.0f / model.m_Scale);
-
-				// make the rotation matrix
-				cl_float4 rotX;
-				cl_float4 rotY;
-				cl_float4 rotZ;
-				cl_float4 rotW;
-				MatrixUnrotation(rotX, rotY, rotZ, rotW,
-					DegreesToRadians(model.m_Rotation.m_x),
-					DegreesToRadians(model.m_Rotation.m_y),
-					DegreesToRadians(model.m_Rotation.m_z));
-
-				TransformMatrixByMatrix(
-					modelInstance.m_worldToModelX,
-					modelInstance.m_worldToModelY,
-					modelInstance.m_worldToModelZ,
-					modelInstance.m_worldToModelW,
-					transX,
-					transY,
-					transZ,
-					transW
-				);
-
-				TransformMatrixByMatrix(
-					modelInstance.m_worldToModelX,
-					modelInstance.m_worldToModelY,
-					modelInstance.m_worldToModelZ,
-					modelInstance.m_worldToModelW,
-					scaleX,
-					scaleY,
-					scaleZ,
-					scaleW
-				);
-
-				TransformMatrixByMatrix(
-					modelInstance.m_worldToModelX,
-					modelInstance.m_worldToModelY,
-					modelInstance.m_worldToModelZ,
-					modelInstance.m_worldToModelW,
-					rotX,
-					rotY,
-					rotZ,
-					rotW
-				);
-			}
-
-			// todo: remove, this is just for testing
-			cl_float4 testX;
-			cl_float4 testY;
-			cl_float4 testZ;
-			cl_float4 testW;
-
-			TransformMatrixByMatrix(
-				testX,
-				testY,
-				testZ,
-				testW,
-				modelInstance.m_modelToWorldX,
-				modelInstance.m_modelToWorldY,
-				modelInstance.m_modelToWorldZ,
-				modelInstance.m_modelToWorldW,
-				modelInstance.m_worldToModelX,
-				modelInstance.m_worldToModelY,
-				modelInstance.m_worldToModelZ,
-				modelInstance.m_worldToModelW
-			);
-
-			int ijkl = 0;
+			// calculate the model to world and world to model matrices
+			float3 position;
+			float3 rotation;
+			Copy(position, model.m_Position);
+			Copy(rotation, model.m_Rotation);
+			CalculateModelInstanceTransforms(modelInstance, position, rotation, model.m_Scale);
 		}
 	}
 
 	sector.m_staticModelStopIndex = m_modelInstances.Count();
+
+	// build a BVH over the instances so rays only test the instances near them
+	BuildSectorModelBVH(sector);
 }
 
 //-----------------------------------------------------------------------------
-void CWorld::CalculateModelFarthestPoint (
-	const struct SData_XMDFILE &modelData,
-	float3 &point
+void CWorld::CalculateModelInstanceTransforms (
+	SModelInstance &modelInstance,
+	const float3 &position,
+	const float3 &rotationDegrees,
+	float scale
 )
 {
-	point[0] = 0.0f;
-	point[1] = 0.0f;
-	point[2] = 0.0f;
-	float radiusSq = 0.0f;
+	// calculate model to world - translate, scale, rotate
+	{
+		MatrixIdentity(modelInstance.m_modelToWorldX, modelInstance.m_modelToWorldY, modelInstance.m_modelToWorldZ, modelInstance.m_modelToWorldW);
+
+		// make the translation matrix
+		cl_float4 transX;
+		cl_float4 transY;
+		cl_float4 transZ;
+		cl_float4 transW;
+		MatrixTranslation(transX, transY, transZ, transW, position);
+
+		// make the scale matrix
+		cl_float4 scaleX;
+		cl_float4 scaleY;
+		cl_float4 scaleZ;
+		cl_float4 scaleW;
+		MatrixScale(scaleX, scaleY, scaleZ, scaleW, scale);
+
+		// make the rotation matrix
+		cl_float4 rotX;
+		cl_float4 rotY;
+		cl_float4 rotZ;
+		cl_float4 rotW;
+		MatrixRotation(rotX, rotY, rotZ, rotW,
+			DegreesToRadians(rotationDegrees[0]),
+			DegreesToRadians(rotationDegrees[1]),
+			DegreesToRadians(rotationDegrees[2]));
+
+		TransformMatrixByMatrix(
+			modelInstance.m_modelToWorldX,
+			modelInstance.m_modelToWorldY,
+			modelInstance.m_modelToWorldZ,
+			modelInstance.m_modelToWorldW,
+			rotX,
+			rotY,
+			rotZ,
+			rotW
+		);
+
+		TransformMatrixByMatrix(
+			modelInstance.m_modelToWorldX,
+			modelInstance.m_modelToWorldY,
+			modelInstance.m_modelToWorldZ,
+			modelInstance.m_modelToWorldW,
+			scaleX,
+			scaleY,
+			scaleZ,
+			scaleW
+		);
+
+		TransformMatrixByMatrix(
+			modelInstance.m_modelToWorldX,
+			modelInstance.m_modelToWorldY,
+			modelInstance.m_modelToWorldZ,
+			modelInstance.m_modelToWorldW,
+			transX,
+			transY,
+			transZ,
+			transW
+		);
+	}
 
-	// find the point that is farthest from the origin (0,0,0)
-	for (unsigned int objectIndex = 0, objectCount = modelData.m_object.size(); objectIndex < objectCount; ++objectIndex)
+	// calculate world to model - rotate, scale, translate
 	{
-		const SData_object &object = modelData.m_object[objectIndex];
-		for (unsigned int faceIndex = 0, faceCount = object.m_face.size(); faceIndex < faceCount; ++faceIndex)
-		{
-			const SData_face &face = object.m_face[faceIndex];
-			for (unsigned int vertIndex = 0, vertCount = face.m_vert.size(); vertIndex < vertCount; ++vertIndex)
-			{
-				float3 pos;
-				Copy(pos, face.m_vert[vertIndex].m_pos);
-				float posRadius = lengthsq(pos);
-				if (posRadius > radiusSq)
-				{
-					point = pos;
-					radiusSq = posRadius;
-				}
-			}
-		}
+		MatrixIdentity(modelInstance.m_worldToModelX, modelInstance.m_worldToModelY, modelInstance.m_worldToModelZ, modelInstance.m_worldToModelW);
+
+		// make the translation matrix
+		cl_float4 transX;
+		cl_float4 transY;
+		cl_float4 transZ;
+		cl_float4 transW;
+		MatrixTranslation(transX, transY, transZ, transW, position * -1.0f);
+
+		// make the scale matrix
+		cl_float4 scaleX;
+		cl_float4 scaleY;
+		cl_float4 scaleZ;
+		cl_float4 scaleW;
+		MatrixScale(scaleX, scaleY, scaleZ, scaleW, 1.0f / scale);
+
+		// make the rotation matrix
+		cl_float4 rotX;
+		cl_float4 rotY;
+		cl_float4 rotZ;
+		cl_float4 rotW;
+		MatrixUnrotation(rotX, rotY, rotZ, rotW,
+			DegreesToRadians(rotationDegrees[0]),
+			DegreesToRadians(rotationDegrees[1]),
+			DegreesToRadians(rotationDegrees[2]));
+
+		TransformMatrixByMatrix(
+			modelInstance.m_worldToModelX,
+			modelInstance.m_worldToModelY,
+			modelInstance.m_worldToModelZ,
+			modelInstance.m_worldToModelW,
+			transX,
+			transY,
+			transZ,
+			transW
+		);
+
+		TransformMatrixByMatrix(
+			modelInstance.m_worldToModelX,
+			modelInstance.m_worldToModelY,
+			modelInstance.m_worldToModelZ,
+			modelInstance.m_worldToModelW,
+			scaleX,
+			scaleY,
+			scaleZ,
+			scaleW
+		);
+
+		TransformMatrixByMatrix(
+			modelInstance.m_worldToModelX,
+			modelInstance.m_worldToModelY,
+			modelInstance.m_worldToModelZ,
+			modelInstance.m_worldToModelW,
+			rotX,
+			rotY,
+			rotZ,
+			rotW
+		);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void CWorld::GetModelInstanceBounds (const SModelInstance &modelInstance, float3 &boundsMin, float3 &boundsMax)
+{
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		boundsMin[axis] = modelInstance.m_boundingSphere.s[axis] - modelInstance.m_boundingSphere.s[3];
+		boundsMax[axis] = modelInstance.m_boundingSphere.s[axis] + modelInstance.m_boundingSphere.s[3];
 	}
 }
 
+//-----------------------------------------------------------------------------
+void CWorld::BuildSectorModelBVH (SSector &sector)
+{
+	const unsigned int modelCount = sector.m_staticModelStopIndex - sector.m_staticModelStartIndex;
+	sector.m_staticModelBVHRootIndex = -1;
+	if (modelCount == 0)
+		return;
+
+	// the instances are bounded by their bounding spheres
+	CBVHBuilder builder;
+	for (unsigned int index = sector.m_staticModelStartIndex; index < sector.m_staticModelStopIndex; ++index)
+	{
+		float3 boundsMin, boundsMax;
+		GetModelInstanceBounds(m_modelInstances[index], boundsMin, boundsMax);
+		builder.AddPrimitive(boundsMin, boundsMax);
+	}
+
+	sector.m_staticModelBVHRootIndex = builder.Build(m_modelInstanceBVHNodes, sector.m_staticModelStartIndex);
+
+	// re-order the instances so that each leaf's instances are contiguous
+	const std::vector<unsigned int> &order = builder.GetPrimitiveOrder();
+	std::vector<SModelInstance> modelInstances(&m_modelInstances[sector.m_staticModelStartIndex], &m_modelInstances[sector.m_staticModelStartIndex] + modelCount);
+	for (unsigned int index = 0; index < modelCount; ++index)
+		m_modelInstances[sector.m_staticModelStartIndex + index] = modelInstances[order[index]];
+}
+
+//-----------------------------------------------------------------------------
+void CWorld::MoveModelInstance (
+	unsigned int sectorIndex,
+	unsigned int modelInstanceIndex,
+	const float3 &position,
+	const float3 &rotationDegrees,
+	float scale
+)
+{
+	// find where the BVH put the instance
+	AssertI_(sectorIndex < m_modelInstanceSlots.size(), sectorIndex);
+	const std::vector<unsigned int> &slots = m_modelInstanceSlots[sectorIndex];
+	AssertI_(modelInstanceIndex < slots.size() && slots[modelInstanceIndex] != (unsigned int)-1, modelInstanceIndex);
+	const unsigned int instanceIndex = slots[modelInstanceIndex];
+
+	SSector &sector = m_sectors[sectorIndex];
+
+	SModelInstance &modelInstance = m_modelInstances[instanceIndex];
+
+	// move the bounding sphere.  The radius comes from the unscaled one, so a scale of 0 doesn't lose it.
+	modelInstance.m_boundingSphere.s[0] = position[0];
+	modelInstance.m_boundingSphere.s[1] = position[1];
+	modelInstance.m_boundingSphere.s[2] = position[2];
+	modelInstance.m_boundingSphere.s[3] = modelInstance.m_unscaledRadius * scale;
+	modelInstance.m_scale = scale;
+
+	CalculateModelInstanceTransforms(modelInstance, position, rotationDegrees, scale);
+
+	// refit the sector's BVH.  The structure stays the same, so the instance indices don't change.
+	CBVHBuilder::Refit(
+		m_modelInstanceBVHNodes,
+		sector.m_staticModelBVHRootIndex,
+		[this] (cl_uint index, float3 &boundsMin, float3 &boundsMax) {
+			GetModelInstanceBounds(m_modelInstances[index], boundsMin, boundsMax);
+		}
+	);
+
+	// the baked shadows of the sector's walls were of the instance where it was, so the sector goes back
+	// to tracing shadow rays
+	for (unsigned int planeIndex = 0; planeIndex < SSECTOR_NUMPLANES; ++planeIndex)
+		sector.m_planes[planeIndex].m_shadowTexelStart = -1;
+
+	m_modelInstances.MarkStale(instanceIndex);
+	m_sectors.MarkStale(sectorIndex);
+}
+
 //-----------------------------------------------------------------------------
 void CWorld::HandleSectorConnectTos (
 	unsigned int sectorIndex,
@@ -1040,7 +1399,13 @@ void CWorld::GetSectorPlaneDimenions (
 //-----------------------------------------------------------------------------
 unsigned int CWorld::GetSectorIDByName (const char *sector) const
 {
-	return SData::GetEntryById(m_worldData.m_Sector, sector, c_defaultSector);
+	if (sector && sector[0])
+	{
+		std::unordered_map<std::string, unsigned int>::const_iterator it = m_sectorIndices.find(sector);
+		if (it != m_sectorIndices.end())
+			return it->second;
+	}
+	return c_defaultSector;
 }
 
 //-----------------------------------------------------------------------------
@@ -1101,11 +1466,62 @@ void CWorld::LoadSector (
 }
 
 //-----------------------------------------------------------------------------
-bool CWorld::Load (const char *worldFileName)
+bool CWorld::Load (const char *worldFileName, CTextureManager &textureManager)
 {
-	// tell the ECS system about our world data (temp, until map access is more formalized)
-	ECS::SetWorldData(m_sectors);
+	const size_t nameLength = strlen(worldFileName);
+	const size_t extensionLength = strlen(c_bakedWorldExtension);
+	const bool baked = nameLength >= extensionLength && !OS::StringCompareNoCase(worldFileName + nameLength - extensionLength, c_bakedWorldExtension);
+	if (baked ? !LoadBaked(worldFileName) : !LoadXML(worldFileName))
+		return false;
+
+	// the portal graph isn't baked, since it's quick to build from the portals
+	BuildPortalGraph();
+
+	// index the sector names.  If two sectors have the same id, the first one wins.
+	m_sectorIndices.clear();
+	for (unsigned int index = 0, count = m_sectorNames.size(); index < count; ++index)
+		m_sectorIndices.insert(std::make_pair(m_sectorNames[index], index));
+
+	// map the authored index of each model instance to where the BVH put it.  Instances of models that
+	// didn't load leave a -1.
+	m_modelInstanceSlots.assign(m_sectors.Count(), std::vector<unsigned int>());
+	for (unsigned int sectorIndex = 0, sectorCount = m_sectors.Count(); sectorIndex < sectorCount; ++sectorIndex)
+	{
+		const SSector &sector = m_sectors[sectorIndex];
+		std::vector<unsigned int> &slots = m_modelInstanceSlots[sectorIndex];
+		for (cl_uint index = sector.m_staticModelStartIndex; index < sector.m_staticModelStopIndex; ++index)
+		{
+			const cl_uint authoredIndex = m_modelInstances[index].m_authoredIndex;
+			if (authoredIndex >= slots.size())
+				slots.resize(authoredIndex + 1, (unsigned int)-1);
+			slots[authoredIndex] = index;
+		}
+	}
+
+	ResolveMaterialTextures(textureManager);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void CWorld::ResolveMaterialTextures (CTextureManager &textureManager)
+{
+	// load the textures
+	for (unsigned int index = 0, count = m_materials.Count(); index < count; ++index)
+	{
+		const SMaterialTextures &textures = m_materialTextures[index];
+		SMaterial &material = m_materials[index];
+		material.m_diffuseTextureIndex = textures.m_diffuse.empty() ? -1 : textureManager.GetOrLoad(textures.m_diffuse.c_str());
+		material.m_normalTextureIndex = textures.m_normal.empty() ? -1 : textureManager.GetOrLoad(textures.m_normal.c_str());
+		material.m_emissiveTextureIndex = textures.m_emissive.empty() ? -1 : textureManager.GetOrLoad(textures.m_emissive.c_str());
+	}
+
+	// combine all the textures now that they are all loaded
+	textureManager.FinalizeTextures();
+}
 
+//-----------------------------------------------------------------------------
+bool CWorld::LoadXML (const char *worldFileName)
+{
 	if (!DataSchemasXML::Load(m_worldData, worldFileName, "World"))
 		m_worldData.SetDefault();
 
@@ -1136,31 +1552,20 @@ bool CWorld::Load (const char *worldFileName)
 
 	// sectors
 	m_sectors.Resize(m_worldData.m_Sector.size());
+	m_sectorNames.resize(m_worldData.m_Sector.size());
 	for (unsigned int sectorIndex = 0, sectorCount = m_worldData.m_Sector.size(); sectorIndex < sectorCount; ++sectorIndex)
-		LoadSector(m_sectors[sectorIndex], m_worldData.m_Sector[sectorIndex], m_worldData.m_Material, m_worldData.m_Portal);
-
-	// calculate the texture indices of our textures
-	for (unsigned int index = 0, count = m_materials.Count(); index < count; ++index)
 	{
-		const float add = -0.5f / ((float)CDirectX::TextureManager().NumTextures());
-
-		m_materials[index].m_diffuseTextureIndex = (m_materials[index].m_diffuseTextureIndex) / (float)CDirectX::TextureManager().NumTextures();
-		m_materials[index].m_diffuseTextureIndex += add;
-
-		m_materials[index].m_normalTextureIndex = (m_materials[index].m_normalTextureIndex) / (float)CDirectX::TextureManager().NumTextures();
-		m_materials[index].m_normalTextureIndex += add;
-
-		m_materials[index].m_emissiveTextureIndex = (m_materials[index].m_emissiveTextureIndex) / (float)CDirectX::TextureManager().NumTextures();
-		m_materials[index].m_emissiveTextureIndex += add;
+		m_sectorNames[sectorIndex] = m_worldData.m_Sector[sectorIndex].m_id;
+		LoadSector(m_sectors[sectorIndex], m_worldData.m_Sector[sectorIndex], m_worldData.m_Material, m_worldData.m_Portal);
 	}
 
-	// combine all the textures now that they are all loaded
-	CDirectX::TextureManager().FinalizeTextures();
-
 	// handle the sector ConnectToSector fields for automatic portal generation
 	for (unsigned int sectorIndex = 0, sectorCount = m_worldData.m_Sector.size(); sectorIndex < sectorCount; ++sectorIndex)
 		HandleSectorConnectTos(sectorIndex, m_worldData.m_Sector);
 
+	// the shadows go last, once every model instance is where it goes
+	BakeShadows();
+
 	/*
 	// handle the connect tags that connect sectors together
 	for (unsigned int connectIndex = 0, connectCount = m_worldData.m_Connect.size(); connectIndex < connectCount; ++connectIndex)
@@ -12,7 +12,13 @@ This class holds all information about the world
 #include "KernelCode/Shared/SharedGeometry.h"
 #include "KernelCode/Shared/SSharedDataRoot.h"
 #include "DataSchemas/DataSchemasStructs.h"
+#include "CModelCache.h"
+#include "Platform/CPUTrace.h"
 #include <vector>
+#include <map>
+#include <unordered_map>
+
+class CTextureManager;
 
 class CWorld
 {
@@ -25,14 +31,38 @@ public:
 		m_pointLights.Release();
 		m_spheres.Release();
 		m_modelTriangles.Release();
+		m_modelTriangleShading.Release();
 		m_modelObjects.Release();
+		m_modelBVHNodes.Release();
 		m_modelInstances.Release();
+		m_modelInstanceBVHNodes.Release();
 		m_sectors.Release();
 		m_materials.Release();
 		m_portals.Release();
+		m_shadowTexels.Release();
+		m_materialTextures.clear();
+		m_sectorNames.clear();
+		m_sectorIndices.clear();
+		m_modelInstanceSlots.clear();
+		m_modelGeometry.clear();
+		m_potentiallyVisibleSectors.clear();
 	}
 
-	bool Load(const char *worldFileName);
+	// loads a world from it's xml file, or from a baked world file if the file name ends in c_bakedWorldExtension.
+	// The materials' textures are loaded through textureManager, which has to be initialized already.
+	bool Load(const char *worldFileName, CTextureManager &textureManager);
+
+	// writes the loaded world out as a baked world file, which loads without parsing any xml, building
+	// any BVHs or baking any shadows.  Use "-bake <world file> [baked file]" on the command line to bake a world.
+	bool Bake(const char *bakedFileName) const;
+
+	// the name of the baked world file for a world xml file: the same name with c_bakedWorldExtension on the end
+	static std::string BakedFileName(const char *worldFileName);
+
+	static const char *c_bakedWorldExtension;
+
+	// converts a material to the form the kernel takes, except for the texture indices
+	static void ConvertMaterial (const struct SData_Material &materialSource, SMaterial &material);
 
 	const SSector* GetSectors(unsigned int& numSectors) const
 	{
@@ -48,8 +78,44 @@ public:
 
 	unsigned int GetSectorIDByName (const char *sector) const;
 
+	// cpu side queries against the world, for gameplay code, which don't touch the gpu.  Positions and
+	// directions are in the space of the sector they're given with.  In CWorldQuery.cpp.
+
+	// see CPUTrace::RayCast()
+	bool RayCast (unsigned int sector, const float3 &rayPos, const float3 &rayDir, float maxDistance, CPUTrace::SRayHit &hit) const;
+
+	// see CPUTrace::LocatePoint()
+	bool LocatePoint (unsigned int startSector, const float3 &startPos, const float3 &targetPos, unsigned int &sector, float3 &position) const;
+
+	// whether the point is within the sector's walls
+	bool PointInSector (unsigned int sector, const float3 &point) const;
+
+	// whether sector is reachable from cameraSector through at most SPORTAL_MAXCROSSINGS portals.  This
+	// is portal graph reachability, not visibility: it doesn't check that the portals can be seen through
+	// each other, so it's true for more sectors than the camera can really see, but never fewer.  True for
+	// any sector if cameraSector is -1.
+	bool SectorPotentiallyVisible (unsigned int cameraSector, unsigned int sector) const;
+
+	// moves a model instance within it's sector and refits the sector's model instance BVH to match.
+	// modelInstanceIndex is the index of the instance in the sector in the world file, which stays the
+	// same however the sector's BVH orders the instances.
+	void MoveModelInstance (
+		unsigned int sectorIndex,
+		unsigned int modelInstanceIndex,
+		const float3 &position,
+		const float3 &rotationDegrees,
+		float scale
+	);
+
 private:
 	friend class CDirectX;
+	friend class CCPURenderer;
+
+	bool LoadXML (const char *worldFileName);
+	bool LoadBaked (const char *bakedFileName);
+
+	// loads the textures named in m_materialTextures and points the materials at them
+	void ResolveMaterialTextures (CTextureManager &textureManager);
 
 	void LoadSector (
 		SSector &sector,
@@ -58,25 +124,55 @@ private:
 		std::vector<struct SData_Portal> &portals
 	);
 
-	// temp - until models are working more fully and the other (useless) primitives go away
-	void AddTriangle (
-		const struct SData_Vec3 &sa,
-		const struct SData_Vec3 &sb,
-		const struct SData_Vec3 &sc,
-		const struct SData_Vec2 &ta,
-		const struct SData_Vec2 &tb,
-		const struct SData_Vec2 &tc,
-		const struct SData_Vec3 &normal,
-		const struct SData_Vec3 &tangent,
-		const struct SData_Vec3 &bitangent
+	// builds a model triangle and it's shading.  The normal, tangent and bitangent come from the first vertex.
+	static void BuildTriangle (
+		SModelTriangle &triangle,
+		SModelTriangleShading &shading,
+		const CModelCache::SVertex &a,
+		const CModelCache::SVertex &b,
+		const CModelCache::SVertex &c
+	);
+
+	// textureBounds is the smallest texture coordinates followed by their range, as in SModelObject::m_textureBounds
+	static void QuantizeTriangleShading (
+		const SModelTriangleShading &shading,
+		const cl_float textureBounds[4],
+		SModelTriangleShadingQuantized &quantized
 	);
 
 	unsigned int AddMaterial (const struct SData_Material &materialSource, const char *path ="./");
+	unsigned int AddMaterial (
+		const SMaterial &material,
+		const char *path,
+		const std::string &diffuseTexture,
+		const std::string &normalTexture,
+		const std::string &emissiveTexture
+	);
 	void AddDebugMaterial ();
 
+	// like AddMaterial, but returns an existing material instead if there's one that's identical
+	unsigned int FindOrAddMaterial (
+		const SMaterial &material,
+		const char *path,
+		const std::string &diffuseTexture,
+		const std::string &normalTexture,
+		const std::string &emissiveTexture
+	);
+
 	void AddModel (const struct SData_Model &modelSource);
 
-	void SortTrianglesByHalfSpace (SModelObject &object);
+	// points the model object at the triangles and BVH of an object of the model, adding them only if
+	// no other object has loaded the same geometry already
+	void AddModelGeometry (const CModelCache &model, const CModelCache::SObject &object, bool quantizedShading, SModelObject &modelObject);
+
+	// finds the objects of an earlier model with the same geometry as these objects, and with either the
+	// same materials or materials that can be made the same with a material override
+	bool ShareModelObjects (
+		const std::vector<SModelObject> &objects,
+		cl_uint &startObjectIndex,
+		cl_uint &stopObjectIndex,
+		cl_uint &materialOverride
+	) const;
 
 	void LoadSectorSpheres (
 		SSector &sector,
@@ -99,11 +195,28 @@ private:
 		std::vector<struct SData_Portal> &portals
 	);
 
-	void CalculateModelFarthestPoint (
-		const struct SData_XMDFILE &modelData,
-		float3 &point
+	void CalculateModelInstanceTransforms (
+		SModelInstance &modelInstance,
+		const float3 &position,
+		const float3 &rotationDegrees,
+		float scale
 	);
 
+	void BuildSectorModelBVH (SSector &sector);
+
+	// the axis aligned box around a model instance's bounding sphere, which is what the instance BVHs are built over
+	static void GetModelInstanceBounds (const SModelInstance &modelInstance, float3 &boundsMin, float3 &boundsMax);
+
+	// points the scene at the world's arrays, for tracing rays on the cpu.  The settings are left NULL.
+	void GetTraceScene (CPUTrace::SScene &scene) const;
+
+	// bakes which lights each texel of each sector wall can see into m_shadowTexels.  In CWorldShadows.cpp.
+	void BakeShadows ();
+
+	// finds which sectors each sector's portals lead to, and from that, which sectors can be reached from
+	// each sector.  In CWorldPortals.cpp.
+	void BuildPortalGraph ();
+
 	void HandleSectorConnectTos (
 		unsigned int sectorIndex,
 		const std::vector<struct SData_Sector> &sectorsSource
@@ -153,21 +266,66 @@ private:
 		std::string	m_id;
 		cl_uint		m_startObjectIndex;
 		cl_uint		m_stopObjectIndex;
+		cl_uint		m_materialOverride;	// for instances without an override of their own, or -1
 		float3		m_farthestPointFromOrigin;
 	};
 
+	// a range of model triangles, their shading and the BVH over them, which any number of model objects can use
+	struct SModelGeometry
+	{
+		cl_uint		m_startTriangleIndex;
+		cl_uint		m_stopTriangleIndex;
+		cl_uint		m_bvhRootIndex;
+		cl_uint		m_bvhNodeCount;
+		cl_uint		m_shadingStartIndex;
+		cl_uint		m_quantizedShading;
+		cl_float	m_textureBounds[4];
+	};
+
 	CSharedArray<SPointLight>		m_pointLights;
 	CSharedArray<SSphere>			m_spheres;
-	CSharedArray<SModelTriangle>	m_modelTriangles;	// a face
+	CSharedArray<SModelTriangle>	m_modelTriangles;	// a face, as much of it as the intersection test needs
+	CSharedArray<SModelTriangleShading>	m_modelTriangleShading;	// the texture coordinates and tangents of the faces, for the closest hit
 	CSharedArray<SModelObject>		m_modelObjects;		// objects are a collection of triangles
+	CSharedArray<SBVHNode>			m_modelBVHNodes;	// a bounding volume hierarchy over the triangles of each object
 	CSharedArray<SModelInstance>	m_modelInstances;	// a list of objects, along with a bounding sphere and a transform object
+	CSharedArray<SBVHNode>			m_modelInstanceBVHNodes; // a bounding volume hierarchy over the model instances of each sector
 	CSharedArray<SSector>			m_sectors;
 	CSharedArray<SMaterial>			m_materials;
 	CSharedArray<SPortal>			m_portals;
+	CSharedArray<cl_uint4>			m_shadowTexels;		// a bit per light for each texel of each sector wall, four texels to an element
+
+	// the textures each material uses, by file name.  The materials only get texture indices once the
+	// textures are loaded, so this is what gets baked.
+	struct SMaterialTextures
+	{
+		std::string	m_diffuse;
+		std::string	m_normal;
+		std::string	m_emissive;
+	};
+
+	std::vector<SMaterialTextures>	m_materialTextures;	// one per entry in m_materials
+
+	// the id of each sector, for looking sectors up by name
+	std::vector<std::string>		m_sectorNames;
+
+	// the index of each sector by it's id, for GetSectorIDByName().  Built from m_sectorNames by Load().
+	std::unordered_map<std::string, unsigned int>	m_sectorIndices;
+
+	// for each sector, the index in m_modelInstances of each of it's instances by their authored index
+	// (SModelInstance::m_authoredIndex).  Built by Load().
+	std::vector<std::vector<unsigned int> >	m_modelInstanceSlots;
 
 	// the models specified in the level file
 	std::vector<SNamedModel>		m_namedModels;
 
+	// the model geometry loaded so far, by a hash of it's vertices and BVH, so that models that are
+	// exported more than once only have their triangles in memory once
+	std::multimap<unsigned long long, SModelGeometry>	m_modelGeometry;
+
+	// m_potentiallyVisibleSectors[a * sectorCount + b] is true if sector b is reachable from sector a
+	std::vector<bool>				m_potentiallyVisibleSectors;
+
 	// the currently loaded world data
 	SData_World m_worldData;
 
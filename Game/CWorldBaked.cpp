@@ -0,0 +1,249 @@
+/*==================================================================================================
+
+CWorldBaked.cpp
+
+Saving and loading of baked world files.  A baked world file is the contents of the world's shared
+arrays after loading from xml, written out as is, so loading one is a handful of copies out of a
+memory mapped file instead of parsing xml and building BVHs.  The xml stays the authoring format.
+
+The layout is a SBakedWorldHeader, then each array at a 16 byte aligned offset, then the strings.
+Changing any of the shared structs changes their sizes or meaning, so bump c_bakedWorldVersion when
+that happens and re-bake.
+
+==================================================================================================*/
+
+#include "CWorld.h"
+#include "Platform/OS.h"
+
+#include <stdio.h>
+
+const char *CWorld::c_bakedWorldExtension = ".bakedworld";
+
+static const char c_bakedWorldMagic[8] = { 'C', 'L', 'R', 'T', 'W', 'R', 'L', 'D' };
+static const cl_uint c_bakedWorldVersion = 6;
+
+enum EBakedArray
+{
+	e_bakedArrayPointLights,
+	e_bakedArraySpheres,
+	e_bakedArrayModelTriangles,
+	e_bakedArrayModelTriangleShading,
+	e_bakedArrayModelObjects,
+	e_bakedArrayModelBVHNodes,
+	e_bakedArrayModelInstances,
+	e_bakedArrayModelInstanceBVHNodes,
+	e_bakedArraySectors,
+	e_bakedArrayMaterials,
+	e_bakedArrayPortals,
+	e_bakedArrayShadowTexels,
+
+	e_bakedArrayCount
+};
+
+struct SBakedArray
+{
+	cl_uint	m_offset;		// from the start of the file
+	cl_uint	m_count;
+	cl_uint	m_elementSize;
+	cl_uint	m_pad;
+};
+
+struct SBakedWorldHeader
+{
+	char		m_magic[8];
+	cl_uint		m_version;
+	cl_uint		m_nextObjectId;
+
+	SBakedArray	m_arrays[e_bakedArrayCount];
+
+	// null terminated strings: the sector names, then the diffuse, normal and emissive texture of each material
+	SBakedArray	m_strings;
+};
+
+//-----------------------------------------------------------------------------
+template <typename T>
+static bool WriteBakedArray (FILE *file, SBakedArray &bakedArray, const T *data, unsigned int count)
+{
+	// pad to 16 bytes so the array is aligned in memory when the file is mapped
+	static const char c_padding[16] = { 0 };
+	const long position = ftell(file);
+	const long padding = (16 - position % 16) % 16;
+	if (padding > 0 && fwrite(c_padding, padding, 1, file) != 1)
+		return false;
+
+	bakedArray.m_offset = (cl_uint)(position + padding);
+	bakedArray.m_count = count;
+	bakedArray.m_elementSize = sizeof(T);
+	bakedArray.m_pad = 0;
+	return count == 0 || fwrite(data, sizeof(T) * count, 1, file) == 1;
+}
+
+//-----------------------------------------------------------------------------
+template <typename T>
+static bool WriteBakedArray (FILE *file, SBakedArray &bakedArray, const CSharedArray<T> &sharedArray)
+{
+	return WriteBakedArray(file, bakedArray, sharedArray.DataConst(), sharedArray.Count());
+}
+
+//-----------------------------------------------------------------------------
+template <typename T>
+static bool ReadBakedArray (const OS::CMappedFile &file, const SBakedArray &bakedArray, CSharedArray<T> &sharedArray)
+{
+	if (bakedArray.m_elementSize != sizeof(T) || bakedArray.m_offset % 16 != 0)
+		return false;
+
+	if ((unsigned long long)bakedArray.m_offset + (unsigned long long)bakedArray.m_count * sizeof(T) > file.Size())
+		return false;
+
+	sharedArray.Assign((const T *)(file.Data() + bakedArray.m_offset), bakedArray.m_count);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+static void AddBakedString (std::vector<char> &strings, const std::string &string)
+{
+	strings.insert(strings.end(), string.c_str(), string.c_str() + string.length() + 1);
+}
+
+//-----------------------------------------------------------------------------
+static void AddBakedTexture (std::vector<char> &strings, const std::string &texture)
+{
+	// model textures have absolute paths, which wouldn't work on another machine
+	std::string relativePath;
+	if (!texture.empty())
+		OS::GetRelativePath(texture.c_str(), relativePath);
+	AddBakedString(strings, relativePath);
+}
+
+//-----------------------------------------------------------------------------
+std::string CWorld::BakedFileName (const char *worldFileName)
+{
+	return std::string(worldFileName) + c_bakedWorldExtension;
+}
+
+//-----------------------------------------------------------------------------
+bool CWorld::Bake (const char *bakedFileName) const
+{
+	FILE *file = fopen(bakedFileName, "wb");
+	if (!file)
+	{
+		printf("Could not open %s for writing\n", bakedFileName);
+		return false;
+	}
+
+	// the header goes in last, once the offsets are known
+	SBakedWorldHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, c_bakedWorldMagic, sizeof(header.m_magic));
+	header.m_version = c_bakedWorldVersion;
+	header.m_nextObjectId = m_nextObjectId;
+
+	std::vector<char> strings;
+	for (unsigned int index = 0, count = m_sectorNames.size(); index < count; ++index)
+		AddBakedString(strings, m_sectorNames[index]);
+	for (unsigned int index = 0, count = m_materialTextures.size(); index < count; ++index)
+	{
+		AddBakedTexture(strings, m_materialTextures[index].m_diffuse);
+		AddBakedTexture(strings, m_materialTextures[index].m_normal);
+		AddBakedTexture(strings, m_materialTextures[index].m_emissive);
+	}
+
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayPointLights], m_pointLights);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArraySpheres], m_spheres);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayModelTriangles], m_modelTriangles);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayModelTriangleShading], m_modelTriangleShading);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayModelObjects], m_modelObjects);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayModelBVHNodes], m_modelBVHNodes);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayModelInstances], m_modelInstances);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayModelInstanceBVHNodes], m_modelInstanceBVHNodes);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArraySectors], m_sectors);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayMaterials], m_materials);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayPortals], m_portals);
+	success = success && WriteBakedArray(file, header.m_arrays[e_bakedArrayShadowTexels], m_shadowTexels);
+	success = success && WriteBakedArray(file, header.m_strings, strings.empty() ? NULL : &strings[0], strings.size());
+	success = success && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	success = fclose(file) == 0 && success;
+
+	if (!success)
+		printf("Could not write %s\n", bakedFileName);
+	else
+		printf("Baked world to %s\n", bakedFileName);
+
+	return success;
+}
+
+//-----------------------------------------------------------------------------
+bool CWorld::LoadBaked (const char *bakedFileName)
+{
+	OS::CMappedFile file;
+	if (!file.Open(bakedFileName) || file.Size() < sizeof(SBakedWorldHeader))
+	{
+		printf("Could not load baked world %s\n", bakedFileName);
+		return false;
+	}
+
+	const SBakedWorldHeader &header = *(const SBakedWorldHeader *)file.Data();
+	if (memcmp(header.m_magic, c_bakedWorldMagic, sizeof(header.m_magic)) || header.m_version != c_bakedWorldVersion)
+	{
+		printf("%s is not a baked world, or was baked by a different version.  Re-bake it.\n", bakedFileName);
+		return false;
+	}
+
+	m_nextObjectId = header.m_nextObjectId;
+
+	bool success = ReadBakedArray(file, header.m_arrays[e_bakedArrayPointLights], m_pointLights);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArraySpheres], m_spheres);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArrayModelTriangles], m_modelTriangles);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArrayModelTriangleShading], m_modelTriangleShading);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArrayModelObjects], m_modelObjects);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArrayModelBVHNodes], m_modelBVHNodes);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArrayModelInstances], m_modelInstances);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArrayModelInstanceBVHNodes], m_modelInstanceBVHNodes);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArraySectors], m_sectors);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArrayMaterials], m_materials);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArrayPortals], m_portals);
+	success = success && ReadBakedArray(file, header.m_arrays[e_bakedArrayShadowTexels], m_shadowTexels);
+
+	// read the strings, making sure they don't run off the end
+	const SBakedArray &strings = header.m_strings;
+	success = success && strings.m_elementSize == 1 && strings.m_count > 0 && (unsigned long long)strings.m_offset + strings.m_count <= file.Size();
+	success = success && file.Data()[strings.m_offset + strings.m_count - 1] == 0;
+
+	const char *string = success ? (const char *)(file.Data() + strings.m_offset) : NULL;
+	const char *stringsEnd = success ? string + strings.m_count : NULL;
+
+	m_sectorNames.resize(m_sectors.Count());
+	for (unsigned int index = 0, count = m_sectorNames.size(); success && index < count; ++index)
+	{
+		success = string < stringsEnd;
+		if (success)
+		{
+			m_sectorNames[index] = string;
+			string += m_sectorNames[index].length() + 1;
+		}
+	}
+
+	m_materialTextures.resize(m_materials.Count());
+	for (unsigned int index = 0, count = m_materialTextures.size(); success && index < count; ++index)
+	{
+		std::string *textures[3] = { &m_materialTextures[index].m_diffuse, &m_materialTextures[index].m_normal, &m_materialTextures[index].m_emissive };
+		for (unsigned int textureIndex = 0; success && textureIndex < 3; ++textureIndex)
+		{
+			success = string < stringsEnd;
+			if (success)
+			{
+				*textures[textureIndex] = string;
+				string += textures[textureIndex]->length() + 1;
+			}
+		}
+	}
+
+	if (!success)
+	{
+		printf("Baked world %s is corrupt.  Re-bake it.\n", bakedFileName);
+		Release();
+	}
+
+	return success;
+}
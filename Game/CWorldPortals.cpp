@@ -0,0 +1,85 @@
+/*==================================================================================================
+
+CWorldPortals.cpp
+
+The portal graph: which sectors the portals of each sector lead to.  Rays only leave a sector
+through it's portals, and go through at most SPORTAL_MAXCROSSINGS of them, so the sectors a camera
+can see are among the ones within that many portals of it's sector.  That reachability set is all
+this is: it doesn't check whether portals can be seen through each other, so it holds every sector
+the camera can see, and usually more.
+
+==================================================================================================*/
+
+#include "CWorld.h"
+
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+void CWorld::BuildPortalGraph ()
+{
+	const unsigned int sectorCount = m_sectors.Count();
+
+	// the sectors each sector's portals lead to.  Portals can be on the sector walls, spheres and model instances.
+	std::vector<std::vector<unsigned int> > links(sectorCount);
+	for (unsigned int sectorIndex = 0; sectorIndex < sectorCount; ++sectorIndex)
+	{
+		const SSector &sector = m_sectors[sectorIndex];
+
+		std::vector<cl_uint> portalIndices;
+		for (unsigned int planeIndex = 0; planeIndex < SSECTOR_NUMPLANES; ++planeIndex)
+			portalIndices.push_back(sector.m_planes[planeIndex].m_portalIndex);
+		for (cl_uint index = sector.m_staticSphereStartIndex; index < sector.m_staticSphereStopIndex; ++index)
+			portalIndices.push_back(m_spheres[index].m_portalIndex);
+		for (cl_uint index = sector.m_staticModelStartIndex; index < sector.m_staticModelStopIndex; ++index)
+			portalIndices.push_back(m_modelInstances[index].m_portalIndex);
+
+		for (unsigned int index = 0, count = portalIndices.size(); index < count; ++index)
+		{
+			if (portalIndices[index] >= m_portals.Count())
+				continue;
+
+			const cl_uint destSector = m_portals[portalIndices[index]].m_sector;
+			if (destSector < sectorCount && std::find(links[sectorIndex].begin(), links[sectorIndex].end(), destSector) == links[sectorIndex].end())
+				links[sectorIndex].push_back(destSector);
+		}
+	}
+
+	// walk the graph out from each sector, as many portals deep as a ray can go
+	m_potentiallyVisibleSectors.assign(sectorCount * sectorCount, false);
+	std::vector<unsigned int> frontier;
+	std::vector<unsigned int> nextFrontier;
+	for (unsigned int sectorIndex = 0; sectorIndex < sectorCount; ++sectorIndex)
+	{
+		const unsigned int rowStart = sectorIndex * sectorCount;
+		m_potentiallyVisibleSectors[rowStart + sectorIndex] = true;
+
+		frontier.assign(1, sectorIndex);
+		for (unsigned int depth = 0; depth < SPORTAL_MAXCROSSINGS && !frontier.empty(); ++depth)
+		{
+			nextFrontier.clear();
+			for (unsigned int index = 0, count = frontier.size(); index < count; ++index)
+			{
+				const std::vector<unsigned int> &sectorLinks = links[frontier[index]];
+				for (unsigned int linkIndex = 0, linkCount = sectorLinks.size(); linkIndex < linkCount; ++linkIndex)
+				{
+					if (m_potentiallyVisibleSectors[rowStart + sectorLinks[linkIndex]])
+						continue;
+
+					m_potentiallyVisibleSectors[rowStart + sectorLinks[linkIndex]] = true;
+					nextFrontier.push_back(sectorLinks[linkIndex]);
+				}
+			}
+			frontier.swap(nextFrontier);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool CWorld::SectorPotentiallyVisible (unsigned int cameraSector, unsigned int sector) const
+{
+	const unsigned int sectorCount = m_sectors.Count();
+	if (cameraSector >= sectorCount || m_potentiallyVisibleSectors.size() != sectorCount * sectorCount)
+		return true;
+
+	return m_potentiallyVisibleSectors[cameraSector * sectorCount + sector];
+}
@@ -0,0 +1,80 @@
+/*==================================================================================================
+
+CWorldQuery.cpp
+
+Queries against the world on the cpu, for physics, AI and gameplay code.  They use the same arrays
+and the same intersection routines (Platform/CPUTrace.h) the renderers do, BVHs and all, so what
+they find is what's drawn, and they never wait on the gpu.
+
+Sectors don't share a space.  Every position goes with the sector it's in, and queries that go
+through portals hand back the sector they end up in along with positions in it's space.
+
+==================================================================================================*/
+
+#include "CWorld.h"
+
+//-----------------------------------------------------------------------------
+void CWorld::GetTraceScene (CPUTrace::SScene &scene) const
+{
+	scene.m_lights = m_pointLights.DataConst();
+	scene.m_spheres = m_spheres.DataConst();
+	scene.m_triangles = m_modelTriangles.DataConst();
+	scene.m_triangleShading = m_modelTriangleShading.DataConst();
+	scene.m_objects = m_modelObjects.DataConst();
+	scene.m_bvhNodes = m_modelBVHNodes.DataConst();
+	scene.m_instanceBVHNodes = m_modelInstanceBVHNodes.DataConst();
+	scene.m_models = m_modelInstances.DataConst();
+	scene.m_sectors = m_sectors.DataConst();
+	scene.m_materials = m_materials.DataConst();
+	scene.m_portals = m_portals.DataConst();
+	scene.m_shadowTexels = (const cl_uint *)m_shadowTexels.DataConst();
+	scene.m_textureAtlas = NULL;
+	scene.m_textureAtlasWidth = 0;
+	scene.m_textureAtlasHeight = 0;
+	scene.m_atlasTextures = NULL;
+	scene.m_settings = NULL;
+	scene.m_frameCount = 0;
+	scene.m_pixelSpreadAngle = 0.0f;
+}
+
+//-----------------------------------------------------------------------------
+bool CWorld::RayCast (unsigned int sector, const float3 &rayPos, const float3 &rayDir, float maxDistance, CPUTrace::SRayHit &hit) const
+{
+	if (sector >= m_sectors.Count())
+		return false;
+
+	CPUTrace::SScene scene;
+	GetTraceScene(scene);
+	return CPUTrace::RayCast(scene, sector, rayPos, rayDir, maxDistance, hit);
+}
+
+//-----------------------------------------------------------------------------
+bool CWorld::LocatePoint (unsigned int startSector, const float3 &startPos, const float3 &targetPos, unsigned int &sector, float3 &position) const
+{
+	if (startSector >= m_sectors.Count())
+		return false;
+
+	CPUTrace::SScene scene;
+	GetTraceScene(scene);
+	cl_uint foundSector;
+	if (!CPUTrace::LocatePoint(scene, startSector, startPos, targetPos, foundSector, position))
+		return false;
+
+	sector = foundSector;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CWorld::PointInSector (unsigned int sector, const float3 &point) const
+{
+	if (sector >= m_sectors.Count())
+		return false;
+
+	const SSector &sectorData = m_sectors[sector];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (point[axis] < -sectorData.m_halfDims[axis] || point[axis] > sectorData.m_halfDims[axis])
+			return false;
+	}
+	return true;
+}
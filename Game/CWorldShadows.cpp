@@ -0,0 +1,124 @@
+/*==================================================================================================
+
+CWorldShadows.cpp
+
+Bakes which of a sector's lights can see each point on it's walls, so the kernel can look the
+shadows of the walls up instead of tracing a shadow ray for every light at every hit.  Each wall
+gets a grid of texels holding a bit per light, for the first SSECTOR_MAXBAKEDSHADOWLIGHTS lights of
+the sector.  The kernel filters between the four nearest texels, and lights past the first
+SSECTOR_MAXBAKEDSHADOWLIGHTS, and hits on anything other than a wall, still trace shadow rays.
+
+==================================================================================================*/
+
+#include "CWorld.h"
+
+#include "Platform/CJobSystem.h"
+
+#include <math.h>
+
+// the size of a baked shadow texel in world units
+static const float c_shadowTexelSize = 0.25f;
+
+// the most texels a wall gets along each axis, so huge sectors don't take forever to bake
+static const unsigned int c_maxShadowTexelsPerAxis = 256;
+
+// a row of texels of one wall, which is what each job bakes
+struct SShadowTexelRow
+{
+	unsigned int	m_sectorIndex;
+	unsigned int	m_planeIndex;
+	unsigned int	m_v;
+};
+
+//-----------------------------------------------------------------------------
+void CWorld::BakeShadows ()
+{
+	// lay the texels of every wall of every sector with lights out one after the other
+	std::vector<SShadowTexelRow> rows;
+	unsigned int texelCount = 0;
+	for (unsigned int sectorIndex = 0, sectorCount = m_sectors.Count(); sectorIndex < sectorCount; ++sectorIndex)
+	{
+		SSector &sector = m_sectors[sectorIndex];
+		const bool hasLights = sector.m_staticLightStopIndex > sector.m_staticLightStartIndex;
+
+		for (unsigned int axis = 0; axis < 3; ++axis)
+		{
+			unsigned int count = (unsigned int)ceilf(2.0f * sector.m_halfDims[axis] / c_shadowTexelSize);
+			count = count < 1 ? 1 : (count > c_maxShadowTexelsPerAxis ? c_maxShadowTexelsPerAxis : count);
+			sector.m_shadowTexelCounts[axis] = hasLights ? count : 0;
+		}
+
+		for (unsigned int planeIndex = 0; planeIndex < SSECTOR_NUMPLANES; ++planeIndex)
+		{
+			SSectorPlane &plane = sector.m_planes[planeIndex];
+			if (!hasLights)
+			{
+				plane.m_shadowTexelStart = -1;
+				continue;
+			}
+
+			const unsigned int axis = planeIndex / 2;
+			const unsigned int countU = sector.m_shadowTexelCounts[axis == 0 ? 1 : 0];
+			const unsigned int countV = sector.m_shadowTexelCounts[axis == 2 ? 1 : 2];
+
+			plane.m_shadowTexelStart = texelCount;
+			texelCount += countU * countV;
+
+			for (unsigned int v = 0; v < countV; ++v)
+			{
+				SShadowTexelRow row;
+				row.m_sectorIndex = sectorIndex;
+				row.m_planeIndex = planeIndex;
+				row.m_v = v;
+				rows.push_back(row);
+			}
+		}
+	}
+
+	// the texels are uints, but the shared array is of uint4s so it's elements are a multiple of 16 bytes
+	m_shadowTexels.Resize((texelCount + 3) / 4);
+	if (texelCount == 0)
+		return;
+	cl_uint *texels = (cl_uint *)&m_shadowTexels[0];
+
+	// the walls don't have anything baked yet, so the scene doesn't need the shadow texels
+	CPUTrace::SScene scene;
+	GetTraceScene(scene);
+	scene.m_shadowTexels = NULL;
+
+	CJobSystem jobSystem;
+	jobSystem.ParallelFor(rows.size(), [&] (unsigned int rowIndex) {
+		const SShadowTexelRow &row = rows[rowIndex];
+		const SSector &sector = m_sectors.DataConst()[row.m_sectorIndex];
+		const SSectorPlane &plane = sector.m_planes[row.m_planeIndex];
+
+		const unsigned int axis = row.m_planeIndex / 2;
+		const unsigned int axisU = axis == 0 ? 1 : 0;
+		const unsigned int axisV = axis == 2 ? 1 : 2;
+		const unsigned int countU = sector.m_shadowTexelCounts[axisU];
+		const unsigned int countV = sector.m_shadowTexelCounts[axisV];
+
+		const unsigned int lightCount = sector.m_staticLightStopIndex - sector.m_staticLightStartIndex;
+		const unsigned int bakedLightCount = lightCount < SSECTOR_MAXBAKEDSHADOWLIGHTS ? lightCount : SSECTOR_MAXBAKEDSHADOWLIGHTS;
+
+		// the positive side plane of axis N is plane N*2, same as when tracing the sector's walls
+		float3 point;
+		point[axis] = (row.m_planeIndex & 1) ? -sector.m_halfDims[axis] : sector.m_halfDims[axis];
+		point[axisV] = ((float)row.m_v + 0.5f) * 2.0f * sector.m_halfDims[axisV] / (float)countV - sector.m_halfDims[axisV];
+
+		cl_uint *rowTexels = &texels[plane.m_shadowTexelStart + row.m_v * countU];
+		for (unsigned int u = 0; u < countU; ++u)
+		{
+			point[axisU] = ((float)u + 0.5f) * 2.0f * sector.m_halfDims[axisU] / (float)countU - sector.m_halfDims[axisU];
+
+			cl_uint visibleLights = 0;
+			for (unsigned int lightIndex = 0; lightIndex < bakedLightCount; ++lightIndex)
+			{
+				const SPointLight &light = scene.m_lights[sector.m_staticLightStartIndex + lightIndex];
+				if (!CPUTrace::PointOccluded(scene, sector, point, light.m_position, plane.m_objectId))
+					visibleLights |= 1u << lightIndex;
+			}
+			rowTexels[u] = visibleLights;
+		}
+	});
+}
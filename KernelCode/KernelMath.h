@@ -182,4 +182,13 @@ inline float dotPointPlane (const float3 *point, __global const float4 *plane)
 		(point->y * plane->y) +
 		(point->z * plane->z) +
 		(1.0f * plane->w);
-}
\ No newline at end of file
+}
+inline float3 SafeReciprocal (const float3 v)
+{
+	// zero components become a very large number rather than infinity, so slab tests against boxes
+	// still give sensible answers when -cl-fast-relaxed-math is on
+	return (float3)(
+		v.x != 0.0f ? 1.0f / v.x : FLT_MAX,
+		v.y != 0.0f ? 1.0f / v.y : FLT_MAX,
+		v.z != 0.0f ? 1.0f / v.z : FLT_MAX);
+}
@@ -22,4 +22,11 @@ struct SCamera
 	cl_uint m_frameCount; // used for interlaced rendering
 	float   m_brightnessMultiplier;
 	unsigned int m_HDRBrightnessSamplingInterval;
+
+	// set every frame by the quality governor.  The pixels rendered are the top left m_renderWidth x
+	// m_renderHeight of the output texture, which the present pass scales up to the window.
+	cl_uint m_renderWidth;
+	cl_uint m_renderHeight;
+	cl_uint m_maxRayBounces;  // the most bounces a ray makes this frame, never more than SETTINGS_RAYBOUNCES
+	cl_uint m_pad;
 };
\ No newline at end of file
@@ -8,15 +8,15 @@ This holds all constant sized data that we send to the kernal program
 
 #include "SSharedDataRoot.h"
 
-static CSharedObject<SSharedDataRootHostToKernel> s_dataHostToKernel;
-static CSharedObject<SSharedDataRootKernelToHost> s_dataKernelToHost;
+static CPinnedSharedObject<SSharedDataRootHostToKernel> s_dataHostToKernel;
+static CPinnedSharedObject<SSharedDataRootKernelToHost> s_dataKernelToHost;
 
-CSharedObject<SSharedDataRootHostToKernel>& SSharedDataRootHostToKernel::Get()
+CPinnedSharedObject<SSharedDataRootHostToKernel>& SSharedDataRootHostToKernel::Get()
 {
 	return s_dataHostToKernel;
 }
 
-CSharedObject<SSharedDataRootKernelToHost>& SSharedDataRootKernelToHost::Get()
+CPinnedSharedObject<SSharedDataRootKernelToHost>& SSharedDataRootKernelToHost::Get()
 {
 	return s_dataKernelToHost;
 }
@@ -18,8 +18,16 @@ struct SSharedDataRootHostToKernel
 {
 	struct SCamera		m_camera;
 
+	// the camera last frame, for temporal reprojection.  m_temporalHistoryValid is 0 when last frame's
+	// history can't be used, like on the first frame or after the kernel changed.
+	struct SCamera		m_previousCamera;
+	cl_uint				m_temporalHistoryValid;
+	cl_uint				m_pad1;
+	cl_uint				m_pad2;
+	cl_uint				m_pad3;
+
 #ifndef OPENCL
-	static CSharedObject<SSharedDataRootHostToKernel>& Get();
+	static CPinnedSharedObject<SSharedDataRootHostToKernel>& Get();
 	static SCamera &Camera();
 	static const SCamera &CameraConst();
 #endif
@@ -39,6 +47,6 @@ struct SSharedDataRootKernelToHost
 		Get().GetObject().m_maxBrightness1000x = 0;
 	}
 
-	static CSharedObject<SSharedDataRootKernelToHost>& Get();
+	static CPinnedSharedObject<SSharedDataRootKernelToHost>& Get();
 #endif
 };
\ No newline at end of file
@@ -0,0 +1,31 @@
+/*==================================================================================================
+
+STextureAtlas.h
+
+Where each texture is in the texture atlas.  All the textures are packed into one 8 bit RGBA image,
+each at it's own size, with it's mip chain next to it:
+
+  +---------+----+
+  |         |mip1|
+  |  mip 0  +--+-+
+  |         |m2|
+  |         +-++
+  |         |.|
+  +---------+-+
+
+Mip n is max(width >> n, 1) by max(height >> n, 1), and the chain goes down to 1x1.  See
+Platform/CTextureManager.cpp for the packing and SampleTexture() in clrt.cl for the lookup.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "SharedTypes.h"
+
+struct SAtlasTexture
+{
+	cl_int m_x;			// the top left of mip 0 in the atlas, in texels
+	cl_int m_y;
+	cl_int m_width;		// the size of mip 0
+	cl_int m_height;
+};
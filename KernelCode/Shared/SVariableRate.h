@@ -0,0 +1,27 @@
+/*==================================================================================================
+
+SVariableRate.h
+
+What the clrt_coarse kernel in clrt.cl keeps for each tile corner when VariableRate is on, for the
+clrt kernel to decide which tiles it has to trace every pixel of.  The host only needs the size, to
+allocate the buffer (see CDirectX::RunKernels).
+
+==================================================================================================*/
+
+#pragma once
+
+#include "SharedTypes.h"
+#include "SharedGeometry.h"
+
+// the ray traced through a tile corner.  The corner is the pixel at the top left of the tile, or the
+// last pixel of the row or column for the corners past the edge of the screen.
+struct SVariableRateSample
+{
+	float3		m_color;				// before the brightness multiplier
+	float3		m_normal;				// of the first surface the ray hit, through any portals
+
+	TObjectId	m_objectHit;			// c_invalidObjectId if the ray didn't hit anything
+	cl_uint		m_pad1;
+	cl_uint		m_pad2;
+	cl_uint		m_pad3;
+};
@@ -0,0 +1,96 @@
+/*==================================================================================================
+
+SWavefront.h
+
+Structs the wavefront kernels in clrt.cl keep in global memory between kernel launches.  The host
+only needs their sizes, to allocate the buffers (see Platform/CWavefront.h), except for
+SWavefrontPassStats, which it reads back.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "SharedTypes.h"
+#include "SharedGeometry.h"
+
+// a ray being traced, between bounces.
+//
+// TraceRay() in clrt.cl keeps a color stack per ray and resolves it from the top down when the ray is
+// done.  Each level of the stack maps the color coming from the levels above it to
+// mix(color * filter + add, fog, fogAmount), so the levels can be folded in as they are made instead:
+// the pixel color is m_color + m_filterColor * (the color of everything the ray hasn't hit yet).
+// That keeps a path the same size no matter how many bounces it can make.
+struct SWavefrontPath
+{
+	float3		m_rayPos;
+	float3		m_rayDir;
+	float3		m_absorbance;
+	float3		m_filterColor;
+	float3		m_color;
+
+	cl_uint		m_sector;
+	TObjectId	m_lastHitPrimitiveId;
+	cl_uint		m_bounce;
+	cl_float	m_rayLength;			// how far the path has gone, for how wide it's footprint is
+
+	cl_uint		m_portalCrossings;		// portals don't count as bounces, they have a limit of their own
+	cl_uint		m_pad[3];
+};
+
+// the closest hit of a path's current ray.  The same as SCollisionInfo in clrt.cl, which can't be kept
+// in global memory as is because it has a bool in it.
+struct SWavefrontHit
+{
+	float3		m_intersectionPoint;
+	float3		m_surfaceNormal;
+	float3		m_surfaceU;
+	float3		m_surfaceV;
+	float3		m_debugAdditiveColor;
+
+	cl_float2	m_textureCoordinates;
+	cl_float	m_intersectionTime;
+	TObjectId	m_objectHit;
+
+	cl_uint		m_fromInside;
+	cl_uint		m_materialIndex;
+	cl_uint		m_portalIndex;
+	cl_float	m_textureDensity;
+};
+
+// a surface point waiting to have the sector's point lights applied to it, with shadow rays
+struct SWavefrontShadowRay
+{
+	float3		m_intersectionPoint;
+	float3		m_surfaceNormal;
+	float3		m_rayDir;
+	float3		m_diffuseColorBase;
+	float3		m_filterColor;			// what the path's filter color was at this surface
+
+	cl_uint		m_pathIndex;
+	cl_uint		m_sector;
+	TObjectId	m_objectHit;
+	cl_uint		m_materialIndex;
+};
+
+// the counts of the ray queues.  The two extend queues take turns being the queue read from and the
+// queue written to by each bounce.
+enum EWavefrontQueueCount
+{
+	e_wavefrontQueueCountExtend0,
+	e_wavefrontQueueCountExtend1,
+	e_wavefrontQueueCountShadow,
+	e_wavefrontQueueCountPad,
+
+	e_wavefrontQueueCountCount
+};
+
+// the pass wavefront_reset is given before the camera rays are made, to clear SWavefrontPassStats
+#define WAVEFRONT_RESET_FRAME 0xffffffff
+
+// how deep a frame's rays went, which the host reads back to decide how many passes to run
+struct SWavefrontPassStats
+{
+	cl_uint		m_passesWithRays;		// one more than the last pass that had any rays to trace
+	cl_uint		m_passesRun;			// if m_passesWithRays is more than this, rays were left when the passes ran out
+	cl_uint		m_pad[2];
+};
@@ -30,9 +30,9 @@ struct SMaterial
 	float3 m_absorbance;
 
 	cl_float m_refractionIndex;
-	cl_float m_diffuseTextureIndex;
-	cl_float m_normalTextureIndex;
-	cl_float m_emissiveTextureIndex;
+	cl_int m_diffuseTextureIndex;	// index into the texture atlas' textures, or -1 for none
+	cl_int m_normalTextureIndex;
+	cl_int m_emissiveTextureIndex;
 
 	cl_uint m_rayInteraction;
 	cl_float m_pad1;
@@ -40,6 +40,10 @@ struct SMaterial
 	cl_uint m_diffuseTextureIsDistanceField;
 };
 
+// the most portals a ray goes through before it's ended.  Portal crossings don't count against the
+// RayBounces setting, so this is what keeps a ray between two facing portals from going on forever.
+#define SPORTAL_MAXCROSSINGS 16
+
 struct SPortal
 {
 	cl_float4 m_xaxis;
@@ -67,40 +71,80 @@ struct SSphere
 	cl_uchar m_pack1d;
 };
 
-// flags for each 3d half space
-enum EHalfSpaceFlags
+// the deepest a bounding volume hierarchy can be.  The kernel uses this as the size of its traversal stack
+#define BVH_MAXDEPTH 32
+
+// a node of a flattened bounding volume hierarchy.  Nodes are stored depth first, so the left child of
+// an interior node is always the very next node in the array.
+struct SBVHNode
 {
-	e_halfSpacePosY = 0x01,
-	e_halfSpaceNegY = 0x02,
+	float3 m_min;
+	float3 m_max;
+
+	cl_uint m_rightChildOrFirstPrimitive; // interior nodes: index of the right child.  leaf nodes: index of the first primitive
+	cl_uint m_primitiveCount;             // zero for interior nodes
+	cl_uint m_splitAxis;                  // interior nodes: the axis the children were split on, so rays can visit the nearest child first
+	cl_uint m_pad1;
 };
 
+// the part of a model triangle that the intersection test reads: the triangle's plane, and the planes
+// through it's edges that give the barycentric coordinates of a point on it.  A triangle's object id
+// is c_firstModelTriangleObjectId plus it's index, so it doesn't need storing.
 struct SModelTriangle
 {
 	cl_float4 m_plane;
 	cl_float4 m_planeBC;
 	cl_float4 m_planeCA;
+};
+
+#define c_firstModelTriangleObjectId 0x80000000
+
+// the rest of a model triangle, which is only read for the closest hit.  Objects index into their
+// shading with SModelObject::m_shadingStartIndex.
+struct SModelTriangleShading
+{
 	cl_float2 m_textureA;
 	cl_float2 m_textureB;
 
 	cl_float2 m_textureC;
-	TObjectId m_objectId;
-	cl_uint m_halfSpaceFlags;  // could be an 8 bit number, just need 6 bits currently
+	cl_float m_textureDensity;	// texture coordinate units per model space unit, for picking the mip level
+	cl_float m_pack1;
+
 	float3 m_tangent;
 	float3 m_bitangent;
-	cl_float4 m_pack2;
 };
 
-struct SModelObject
+// the 16 bit version of SModelTriangleShading, used by objects with m_quantizedShading set.  Texture
+// coordinates are relative to the object's m_textureBounds and the tangent and bitangent are unit
+// vectors, so both are stored as fractions of their range.  Two of these fit in a SModelTriangleShading.
+struct SModelTriangleShadingQuantized
 {
-	cl_uint m_startTriangleIndex;    // this is where the triangles start - also the beginning of the e_halfSpaceNegY triangles
-	cl_uint m_mixStartTriangleIndex; // this is where the triangles start that are both e_halfSpaceNegY and e_halfSpacePosY
-	cl_uint m_mixStopTriangleIndex;  // this is where the triangles end that are both e_halfSpaceNegY and e_halfSpacePosY - also the start of the e_halfSpacePosY triangles
-	cl_uint m_stopTriangleIndex;     // this is where the triangles end - also the end of e_halfSpacePosY triangles
+	cl_ushort m_textureA[2];
+	cl_ushort m_textureB[2];
+	cl_ushort m_textureC[2];
+	cl_short m_tangent[3];
+	cl_short m_bitangent[3];
+	cl_ushort m_textureDensity;	// (log2(density) + c_textureDensityQuantizeBias) * c_textureDensityQuantizeScale
+	cl_ushort m_pack1[3];
+};
+
+// covers densities from 2^-16 to 2^16, to within a fraction of a mip level
+#define c_textureDensityQuantizeBias 16.0f
+#define c_textureDensityQuantizeScale 1024.0f
 
+struct SModelObject
+{
+	cl_uint m_startTriangleIndex;    // this is where the triangles start
+	cl_uint m_stopTriangleIndex;     // this is where the triangles end
+	cl_uint m_bvhRootIndex;          // the root node of this object's triangle BVH, or -1 if there are no triangles
 	cl_uint m_castsShadows;
+
 	cl_uint m_materialIndex;
+	cl_uint m_shadingStartIndex;     // where the shading of the first triangle is in the triangle shading array
+	cl_uint m_quantizedShading;      // whether the shading is SModelTriangleShadingQuantized, packed two to an entry
 	cl_uint m_pack1;
-	cl_uint m_pack2;
+
+	cl_float4 m_textureBounds;       // quantized shading: the smallest texture coordinates in xy, and their range in zw
 };
 
 struct SModelInstance
@@ -111,8 +155,8 @@ struct SModelInstance
 	cl_uint m_portalIndex;
 
 	cl_float m_scale;
-	cl_float m_pad1;
-	cl_float m_pad2;
+	cl_uint m_authoredIndex;         // the instance's index in it's sector in the world file, before the BVH re-ordered them
+	cl_float m_unscaledRadius;       // the bounding sphere radius at a scale of 1
 	cl_float m_pad3;
 
 	cl_float4 m_boundingSphere;
@@ -130,6 +174,9 @@ struct SModelInstance
 
 #define SSECTOR_NUMPLANES 6
 
+// the lights of a sector past this many don't get baked shadows, since each baked shadow texel holds a bit per light
+#define SSECTOR_MAXBAKEDSHADOWLIGHTS 32
+
 struct SSectorPlane
 {
 	float3 m_UAxis;
@@ -137,7 +184,7 @@ struct SSectorPlane
 	cl_float2 m_textureOffset;
 	cl_float4 m_portalWindow;
 	TObjectId m_objectId;
-	cl_uint m_pack1a;
+	cl_uint m_shadowTexelStart; // the first of this wall's baked shadow texels, or -1 if it doesn't have any
 	cl_uint m_materialIndex;
 	cl_uint m_portalIndex;
 };
@@ -169,6 +216,11 @@ struct SSector
 	cl_uint m_staticLightStopIndex;
 	cl_uint m_staticModelStartIndex;
 	cl_uint m_staticModelStopIndex;
+
+	cl_uint m_staticModelBVHRootIndex; // root node of the BVH over this sector's model instances, or -1 if there are none
+
+	// how many baked shadow texels the walls have along the x, y and z axes
+	cl_uint m_shadowTexelCounts[3];
 };
 
 struct SPointLight
@@ -181,8 +233,15 @@ struct SPointLight
 	// spot light params
 	float3 m_spotLightReverseDir;
 
+	// xyz is the center and w the radius of a sphere around everything the light is bright enough to
+	// change, once attenuated.  Made by CWorld::LoadSectorPointLights().
+	cl_float4 m_influenceSphere;
+
 	float m_spotLightcosThetaOver2;
 	float m_spotLightcosPhiOver2;
 	float m_spotLightFalloffFactor;
-	float m_pad;
+
+	// the chance of light sampling picking this light or one before it in the sector.  The last light in
+	// each sector has 1.  Made by CWorld::LoadSectorPointLights().
+	float m_samplingCdf;
 };
\ No newline at end of file
@@ -16,4 +16,6 @@ defines simple, common types for use in code shared between the cpu and gpu code
 	typedef float2 cl_float2;
 	typedef float4 cl_float4;
 	typedef unsigned char cl_uchar;
+	typedef unsigned short cl_ushort;
+	typedef short cl_short;
 #endif
\ No newline at end of file
@@ -4,20 +4,53 @@ clrt.cl
 
 The kernel code
 
+Platform/CPUTrace.cpp is a C++ port of the ray tracing in here, used by the cpu renderer.  Keep
+the two in sync.
+
 ==================================================================================================*/
 
 #include "KernelCode/Shared/SSharedDataRoot.h"
 #include "KernelCode/Shared/SharedGeometry.h"
+#include "KernelCode/Shared/SWavefront.h"
+#include "KernelCode/Shared/SVariableRate.h"
+#include "KernelCode/Shared/STextureAtlas.h"
 #include "KernelCode/KernelMath.h"
 
 #define c_maxRayBounces SETTINGS_RAYBOUNCES
 #define c_maxRayLength 1000.0f
 
-#if SETTINGS_TEXTUREFILTER == 1
-const sampler_t g_textureSampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_REPEAT | CLK_FILTER_LINEAR;
-#else
-const sampler_t g_textureSampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_REPEAT | CLK_FILTER_NEAREST;
-#endif
+// temporal reprojection is only done by the clrt kernel, and not for the second eye of red/blue 3d
+#define TEMPORAL_REPROJECTION (SETTINGS_TEMPORAL == 1 && SETTINGS_REDBLUE3D == 0)
+
+// how far the point a pixel saw last frame can be from the one it sees now, as a fraction of the
+// distance to it, for last frame's color to be reused
+#define c_temporalDistanceTolerance 0.02f
+
+// variable rate tracing traces a grid of rays every SETTINGS_VARIABLERATETILE pixels first, with the
+// clrt_coarse kernel, then clrt only traces the pixels of tiles whose corners differ.  Not for red/blue 3d.
+#define VARIABLE_RATE (SETTINGS_VARIABLERATE == 1 && SETTINGS_REDBLUE3D == 0)
+
+// tile corners with normals closer than this (the cosine of the angle between them) count as the same surface
+#define c_variableRateNormalTolerance 0.95f
+
+// keeps the color threshold from going to nothing in the dark, where noise in the lighting isn't visible
+#define c_variableRateMinBrightness 0.05f
+
+// TraceRay() only needs to know what the camera ray hit first for these
+#define TRACK_PRIMARY_RAY (TEMPORAL_REPROJECTION || VARIABLE_RATE)
+
+// light sampling only kicks in for sectors with more lights than it would sample
+#define c_lightSamples SETTINGS_LIGHTSAMPLES
+
+// baked shadows replace shadow rays, so they are only used when there are shadows
+#define BAKED_SHADOWS (SETTINGS_SHADOWS == 1 && SETTINGS_BAKEDSHADOWS == 1)
+
+// the textures are sub rectangles of the atlas, so SampleTexture() does the wrapping and filtering itself
+const sampler_t g_atlasSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+// the most a surface seen at a glancing angle can blur it's texture, as a cosine.  Ray cones blur
+// isotropically, so going all the way would smear floors in the distance.
+#define c_textureLodMinCosine 0.25f
 
 struct SCollisionInfo
 {
@@ -32,13 +65,16 @@ struct SCollisionInfo
 	float3				m_debugAdditiveColor; // for debugging!
 	unsigned int		m_materialIndex;
 	unsigned int		m_portalIndex;
+	float				m_textureDensity;	// texture coordinate units per world unit at the hit, to pick the mip level
 };
 
+// a level of TraceRay()'s color stack, which maps the color coming from the levels after it to
+// color * m_filterColor + m_addColor.  The fog of the level, and of any portals crossed on the way to
+// it, is already folded in.
 struct SColorStackItem
 {
 	float3		m_filterColor;
 	float3		m_addColor;
-	cl_float4	m_fogColorAndAmount;
 };
 
 inline float3 LinearColorTosRGB (float3 f)
@@ -61,7 +97,13 @@ inline bool IsRefractive (__global const struct SMaterial *material)
 	return material->m_rayInteraction ==  e_rayInteractionRefract;
 }
 
-inline bool RayHitsSphere(const float4 sphere, const float3 rayPos, const float3 rayDir, float3 *sphereStartPoint, float3 *sphereEndPoint)
+inline bool IsSpecular (__global const struct SMaterial *material)
+{
+	return any(material->m_specularColorAndPower.xyz != (float3)(0.0f));
+}
+
+// returns whether the ray is inside the sphere anywhere before maxTime
+inline bool RayHitsSphere(const float4 sphere, const float3 rayPos, const float3 rayDir, const float maxTime)
 {
 	// get the vector from the center of this circle to where the ray begins.
 	float3 m = rayPos - sphere.xyz;
@@ -82,17 +124,8 @@ inline bool RayHitsSphere(const float4 sphere, const float3 rayPos, const float3
 	if(discr < 0.0)
 		return false;
 
-	//ray now found to intersect sphere, compute smallest t value of intersection
-	float collisionTime = -b - sqrt(discr);
-
-	//if t is negative, ray started inside sphere so use that as the sphere start point, else use the place we hit the sphere
-	*sphereStartPoint = (collisionTime < 0.0) ? rayPos : rayPos + rayDir * collisionTime;
-
-	// the sphere end point is the other side of the sphere hit
-	collisionTime = -b + sqrt(discr);
-	*sphereEndPoint = rayPos + rayDir * collisionTime;
-
-	return true;
+	//ray now found to intersect sphere, so it's a hit unless it enters the sphere after maxTime
+	return -b - sqrt(discr) <= maxTime;
 }
 
 bool RayIntersectSphere (__global const struct SSphere *sphere, struct SCollisionInfo *info, const float3 rayPos, const float3 rayDir, const TObjectId ignorePrimitiveId)
@@ -159,15 +192,44 @@ bool RayIntersectSphere (__global const struct SSphere *sphere, struct SCollisio
 	info->m_textureCoordinates.y = acos(info->m_surfaceNormal.z );
 	info->m_textureCoordinates *= sphere->m_textureScale;
 	info->m_textureCoordinates += sphere->m_textureOffset;
+	info->m_textureDensity = max(fabs(sphere->m_textureScale.x), fabs(sphere->m_textureScale.y)) / sphere->m_positionAndRadius.w;
 
 	// we found a hit!
 	info->m_objectHit = sphere->m_objectId;
 	return true;
 }
 
-inline bool RayIntersectTriangle (__global const struct SModelTriangle *triangle, struct SCollisionInfo *info, const float3 rayPos, const float3 rayDir, const TObjectId ignorePrimitiveId, bool backFaceCulling, cl_uint materialIndex, cl_uint portalIndex)
+// shadow rays only need to know whether something is in the way, so the RayOccludedBy*() tests below return
+// at the first hit closer than maxTime, and don't work out anything else about it
+inline bool RayOccludedBySphere (__global const struct SSphere *sphere, const float3 rayPos, const float3 rayDir, const float maxTime, const TObjectId ignorePrimitiveId)
+{
+	if (ignorePrimitiveId == sphere->m_objectId)
+		return false;
+
+	float3 m = rayPos - sphere->m_positionAndRadius.xyz;
+	float b = dot(m, rayDir);
+	float c = dot(m, m) - sphere->m_positionAndRadius.w * sphere->m_positionAndRadius.w;
+	if(c > 0.0 && b > 0.0)
+		return false;
+
+	float discr = b * b - c;
+	if(discr < 0.0)
+		return false;
+
+	// from inside the sphere, it's the far side that gets hit
+	float collisionTime = -b - sqrt(discr);
+	if(collisionTime < 0.0)
+		collisionTime = -b + sqrt(discr);
+
+	return collisionTime <= maxTime;
+}
+
+// the texture coordinates and tangents of a hit model triangle are left for ResolveModelTriangleShading() to fill in
+// once the closest hit is known.  Until then, the texture coordinates hold the barycentric coordinates of the hit.
+inline bool RayIntersectTriangle (__global const struct SModelTriangle *triangle, unsigned int triangleIndex, struct SCollisionInfo *info, const float3 rayPos, const float3 rayDir, const TObjectId ignorePrimitiveId, bool backFaceCulling, cl_uint materialIndex, cl_uint portalIndex)
 {
-	if (ignorePrimitiveId == triangle->m_objectId)
+	const TObjectId objectId = c_firstModelTriangleObjectId + triangleIndex;
+	if (ignorePrimitiveId == objectId)
 		return false;
 
 	// do back face culling if we are allowed.  It seems to make no impact on performance from what i can tell though unfortunately ):
@@ -217,12 +279,8 @@ inline bool RayIntersectTriangle (__global const struct SModelTriangle *triangle
 	info->m_surfaceNormal = triangle->m_plane.xyz;
 	info->m_fromInside = dot(rayDir, info->m_surfaceNormal) > 0;
 
-	// set the tangent and bitangent
-	info->m_surfaceU = triangle->m_tangent;
-	info->m_surfaceV = triangle->m_bitangent;
-
-	// texture coordinates - get from texture coordinates on triangle
-	info->m_textureCoordinates = triangle->m_textureA * u + triangle->m_textureB * v + triangle->m_textureC * w;
+	// remember where on the triangle we hit, for ResolveModelTriangleShading()
+	info->m_textureCoordinates = (float2)(u, v);
 
 	#if DEBUG_TRIANGLES
 	if (u < 0.025f)
@@ -238,10 +296,202 @@ inline bool RayIntersectTriangle (__global const struct SModelTriangle *triangle
 	//info->m_debugAdditiveColor += (float3)(u*factor,v*factor,w*factor);
 
 	// we found a hit!
-	info->m_objectHit = triangle->m_objectId;
+	info->m_objectHit = objectId;
 	return true;
 }
 
+inline bool RayOccludedByTriangle (__global const struct SModelTriangle *triangle, unsigned int triangleIndex, const float3 rayPos, const float3 rayDir, const float maxTime, const TObjectId ignorePrimitiveId, bool backFaceCulling)
+{
+	if (ignorePrimitiveId == c_firstModelTriangleObjectId + triangleIndex)
+		return false;
+
+	if (backFaceCulling && dot(rayDir, triangle->m_plane.xyz) > 0.0f)
+		return false;
+
+	float distp = dot(rayPos, triangle->m_plane.xyz) - triangle->m_plane.w;
+	float distq = dot((rayPos + rayDir), triangle->m_plane.xyz) - triangle->m_plane.w;
+	float t = distp / (distp - distq);
+	if(t < 0 || t > maxTime)
+		return false;
+
+	float3 s = rayPos + t * rayDir;
+	float u = dot(s, triangle->m_planeBC.xyz) - triangle->m_planeBC.w;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	float v = dot(s, triangle->m_planeCA.xyz) - triangle->m_planeCA.w;
+	return v >= 0.0f && 1.0f - u - v >= 0.0f;
+}
+
+// see SModelTriangleShadingQuantized::m_textureDensity
+inline float DequantizeTextureDensity (const ushort density)
+{
+	return exp2((float)density / c_textureDensityQuantizeScale - c_textureDensityQuantizeBias);
+}
+
+// fills in the texture coordinates, tangent and bitangent of a hit on a triangle of the object, from the
+// barycentric coordinates RayIntersectTriangle() left in the texture coordinates
+void ResolveModelTriangleShading (__global const struct SModelObject *object, __global const struct SModelTriangleShading *triangleShading, struct SCollisionInfo *info)
+{
+	const unsigned int shadingIndex = info->m_objectHit - c_firstModelTriangleObjectId - object->m_startTriangleIndex;
+	const float u = info->m_textureCoordinates.x;
+	const float v = info->m_textureCoordinates.y;
+	const float w = 1.0f - u - v;
+
+	if (object->m_quantizedShading)
+	{
+		__global const struct SModelTriangleShadingQuantized *shading = (__global const struct SModelTriangleShadingQuantized *)&triangleShading[object->m_shadingStartIndex] + shadingIndex;
+		const float2 textureA = convert_float2(vload2(0, shading->m_textureA));
+		const float2 textureB = convert_float2(vload2(0, shading->m_textureB));
+		const float2 textureC = convert_float2(vload2(0, shading->m_textureC));
+		info->m_textureCoordinates = object->m_textureBounds.xy + (textureA * u + textureB * v + textureC * w) * object->m_textureBounds.zw / 65535.0f;
+		info->m_surfaceU = convert_float3(vload3(0, shading->m_tangent)) / 32767.0f;
+		info->m_surfaceV = convert_float3(vload3(0, shading->m_bitangent)) / 32767.0f;
+		info->m_textureDensity = DequantizeTextureDensity(shading->m_textureDensity);
+	}
+	else
+	{
+		__global const struct SModelTriangleShading *shading = &triangleShading[object->m_shadingStartIndex + shadingIndex];
+		info->m_textureCoordinates = shading->m_textureA * u + shading->m_textureB * v + shading->m_textureC * w;
+		info->m_surfaceU = shading->m_tangent;
+		info->m_surfaceV = shading->m_bitangent;
+		info->m_textureDensity = shading->m_textureDensity;
+	}
+}
+
+inline bool RayHitsBVHNode (__global const struct SBVHNode *node, const float3 rayPos, const float3 rayDirInverse, const float maxTime)
+{
+	// slab test against the node's bounding box
+	float3 time1 = (node->m_min - rayPos) * rayDirInverse;
+	float3 time2 = (node->m_max - rayPos) * rayDirInverse;
+	float3 timeMin = fmin(time1, time2);
+	float3 timeMax = fmax(time1, time2);
+
+	float enterTime = max(max(timeMin.x, timeMin.y), max(timeMin.z, 0.0f));
+	float exitTime = min(min(timeMax.x, timeMax.y), min(timeMax.z, maxTime));
+	return enterTime <= exitTime;
+}
+
+// walks the BVH of an object, testing the ray against the triangles of the leaves it reaches, to find the closest hit
+bool RayIntersectModelObject (
+	__global const struct SModelObject *object,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SModelTriangle *triangles,
+	struct SCollisionInfo *info,
+	const float3 rayPos,
+	const float3 rayDir,
+	const float3 rayDirInverse,
+	const TObjectId ignorePrimitiveId,
+	bool backFaceCulling,
+	cl_uint materialIndex,
+	cl_uint portalIndex
+)
+{
+	if (object->m_bvhRootIndex == -1)
+		return false;
+
+	unsigned int nodeStack[BVH_MAXDEPTH];
+	unsigned int nodeStackDepth = 0;
+	unsigned int nodeIndex = object->m_bvhRootIndex;
+	bool hit = false;
+
+	while (true)
+	{
+		__global const struct SBVHNode *node = &bvhNodes[nodeIndex];
+
+		// the max time shrinks as we find closer hits, so nodes behind the closest hit so far get skipped
+		if (RayHitsBVHNode(node, rayPos, rayDirInverse, info->m_intersectionTime))
+		{
+			// if this is an interior node, visit the child nearest to the ray start first, and come back for the other one later.
+			// the left child is always the next node, and holds the children on the negative side of the split axis.
+			if (node->m_primitiveCount == 0)
+			{
+				float rayDirSplitAxis = node->m_splitAxis == 0 ? rayDir.x : (node->m_splitAxis == 1 ? rayDir.y : rayDir.z);
+				if (rayDirSplitAxis < 0.0f)
+				{
+					nodeStack[nodeStackDepth++] = nodeIndex + 1;
+					nodeIndex = node->m_rightChildOrFirstPrimitive;
+				}
+				else
+				{
+					nodeStack[nodeStackDepth++] = node->m_rightChildOrFirstPrimitive;
+					nodeIndex = nodeIndex + 1;
+				}
+				continue;
+			}
+
+			// else it's a leaf, so test it's triangles
+			for (unsigned int triangleIndex = node->m_rightChildOrFirstPrimitive, triangleStopIndex = triangleIndex + node->m_primitiveCount; triangleIndex < triangleStopIndex; ++triangleIndex)
+			{
+				if (RayIntersectTriangle(&triangles[triangleIndex], triangleIndex, info, rayPos, rayDir, ignorePrimitiveId, backFaceCulling, materialIndex, portalIndex))
+					hit = true;
+			}
+		}
+
+		// go back to the most recent node we skipped, or bail out if there are none left
+		if (nodeStackDepth == 0)
+			break;
+		nodeIndex = nodeStack[--nodeStackDepth];
+	}
+
+	return hit;
+}
+
+// like RayIntersectModelObject(), but returns at the first triangle hit before maxTime.  With no closest hit to shrink
+// towards, the nodes are visited in the same near to far order, since near occluders are the likeliest.
+bool RayOccludedByModelObject (
+	__global const struct SModelObject *object,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SModelTriangle *triangles,
+	const float3 rayPos,
+	const float3 rayDir,
+	const float3 rayDirInverse,
+	const float maxTime,
+	const TObjectId ignorePrimitiveId,
+	bool backFaceCulling
+)
+{
+	if (object->m_bvhRootIndex == -1)
+		return false;
+
+	unsigned int nodeStack[BVH_MAXDEPTH];
+	unsigned int nodeStackDepth = 0;
+	unsigned int nodeIndex = object->m_bvhRootIndex;
+
+	while (true)
+	{
+		__global const struct SBVHNode *node = &bvhNodes[nodeIndex];
+		if (RayHitsBVHNode(node, rayPos, rayDirInverse, maxTime))
+		{
+			if (node->m_primitiveCount == 0)
+			{
+				float rayDirSplitAxis = node->m_splitAxis == 0 ? rayDir.x : (node->m_splitAxis == 1 ? rayDir.y : rayDir.z);
+				if (rayDirSplitAxis < 0.0f)
+				{
+					nodeStack[nodeStackDepth++] = nodeIndex + 1;
+					nodeIndex = node->m_rightChildOrFirstPrimitive;
+				}
+				else
+				{
+					nodeStack[nodeStackDepth++] = node->m_rightChildOrFirstPrimitive;
+					nodeIndex = nodeIndex + 1;
+				}
+				continue;
+			}
+
+			for (unsigned int triangleIndex = node->m_rightChildOrFirstPrimitive, triangleStopIndex = triangleIndex + node->m_primitiveCount; triangleIndex < triangleStopIndex; ++triangleIndex)
+			{
+				if (RayOccludedByTriangle(&triangles[triangleIndex], triangleIndex, rayPos, rayDir, maxTime, ignorePrimitiveId, backFaceCulling))
+					return true;
+			}
+		}
+
+		if (nodeStackDepth == 0)
+			return false;
+		nodeIndex = nodeStack[--nodeStackDepth];
+	}
+}
+
 bool RayIntersectSector (__global const struct SSector *sector, struct SCollisionInfo *info, const float3 rayPos, const float3 rayDir, const TObjectId ignorePrimitiveId)
 {
 	float closestHitTime = info->m_intersectionTime;
@@ -387,6 +637,7 @@ bool RayIntersectSector (__global const struct SSector *sector, struct SCollisio
 	// scale the texture coordinates
 	info->m_textureCoordinates *= sector->m_planes[closestHitPlaneIndex].m_textureScale;
 	info->m_textureCoordinates += sector->m_planes[closestHitPlaneIndex].m_textureOffset;
+	info->m_textureDensity = max(fabs(sector->m_planes[closestHitPlaneIndex].m_textureScale.x), fabs(sector->m_planes[closestHitPlaneIndex].m_textureScale.y));
 
 	info->m_fromInside = false;
 	info->m_materialIndex = sector->m_planes[closestHitPlaneIndex].m_materialIndex;
@@ -396,21 +647,24 @@ bool RayIntersectSector (__global const struct SSector *sector, struct SCollisio
 	return true;
 }
 
-inline bool PointCanSeePoint(
-	const float3 startPos,
-	const float3 targetPos,
-	const TObjectId ignorePrimitiveId,
-	__global const struct SSector *sector,
-	__global const struct SSphere *spheres,
-	__global const struct SModelTriangle *triangles,
+// tests a ray against the objects of a model instance in model space.  A hit closer than the one already in info gets converted back to world space.
+bool RayIntersectModelInstance (
+	__global const struct SModelInstance *model,
 	__global const struct SModelObject *objects,
-	__global const struct SModelInstance *models,
-	__global const struct SMaterial *materials
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelTriangleShading *triangleShading,
+	__global const struct SMaterial *materials,
+	struct SCollisionInfo *info,
+	const float3 rayPos,
+	const float3 rayDir,
+	const TObjectId ignorePrimitiveId
 )
 {
-	#if SETTINGS_SHADOWS == 1
-	// see if we can hit the target point from the starting point
-	struct SCollisionInfo collisionInfo = 
+	if (!RayHitsSphere(model->m_boundingSphere, rayPos, rayDir, info->m_intersectionTime))
+		return false;
+
+	struct SCollisionInfo collisionInfoLocal = 
 	{
 		c_invalidObjectId,
 		false,
@@ -420,194 +674,526 @@ inline bool PointCanSeePoint(
 		{ 0.0f, 0.0f, 0.0f },
 		{ 0.0f, 0.0f, 0.0f },
 		{ 0.0f, 0.0f },
-		{ 0.0f, 0.0f, 0.0f },
+		info->m_debugAdditiveColor,
 		0,
 		0,
+		0.0f,
 	};
-	
-	float3 rayDir = targetPos - startPos;
-	collisionInfo.m_intersectionTime = length(rayDir);
-	rayDir = normalize(rayDir);
 
-	for (int index = sector->m_staticSphereStartIndex; index < sector->m_staticSphereStopIndex; ++index)
-	{
-		if (spheres[index].m_castsShadows
-		 && RayIntersectSphere(&spheres[index], &collisionInfo, startPos, rayDir, ignorePrimitiveId))
-			return false;
-	}
+	// convert max intersection time from world to local space, so the BVH can skip anything behind what we've already hit
+	collisionInfoLocal.m_intersectionTime = info->m_intersectionTime / model->m_scale;
+
+	// convert the ray from world space to model space, making sure the ray direction is normalized to account for scaling or rounding errors
+	float3 rayPosLocal;
+	float3 rayDirLocal;
+	TransformPointByMatrix(&rayPosLocal, &rayPos, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ, &model->m_worldToModelW);
+	TransformVectorByMatrix(&rayDirLocal, &rayDir, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ);
+	rayDirLocal = normalize(rayDirLocal);
+	const float3 rayDirLocalInverse = SafeReciprocal(rayDirLocal);
 
-	for (int modelIndex = sector->m_staticModelStartIndex; modelIndex < sector->m_staticModelStopIndex; ++modelIndex)
+	bool hit = false;
+	__global const struct SModelObject *hitObject = 0;
+	for (int objectIndex = model->m_startObjectIndex; objectIndex < model->m_stopObjectIndex; ++objectIndex)
 	{
-		__global const struct SModelInstance *model = &models[modelIndex];
-		float3 hitStart, hitEnd;
-		if (RayHitsSphere(model->m_boundingSphere, startPos, rayDir, &hitStart, &hitEnd))
+		__global const struct SModelObject *object = &objects[objectIndex];
+
+		// allow back face culling if the triangle isn't refractive (transparent)
+		unsigned int materialIndex = model->m_materialOverride == -1 ? object->m_materialIndex : model->m_materialOverride;
+		bool backFaceCulling = !IsRefractive(&materials[materialIndex]);
+
+		if (RayIntersectModelObject(object, bvhNodes, triangles, &collisionInfoLocal, rayPosLocal, rayDirLocal, rayDirLocalInverse, ignorePrimitiveId, backFaceCulling, materialIndex, model->m_portalIndex))
 		{
-			struct SCollisionInfo collisionInfoLocal = 
-			{
-				c_invalidObjectId,
-				false,
-				{ 0.0f, 0.0f, 0.0f },
-				c_maxRayLength,
-				{ 0.0f, 0.0f, 0.0f },
-				{ 0.0f, 0.0f, 0.0f },
-				{ 0.0f, 0.0f, 0.0f },
-				{ 0.0f, 0.0f },
-				collisionInfo.m_debugAdditiveColor,
-				0,
-				0,
-			};
-
-			// convert max intersection time from world to local space
-			if (collisionInfo.m_objectHit != c_invalidObjectId)
-				collisionInfoLocal.m_intersectionTime = collisionInfo.m_intersectionTime / model->m_scale;
-
-			// convert the ray from world space to model space, making sure the ray direction is normalized to account for scaling or rounding errors
-			float3 startPosLocal;
-			float3 rayDirLocal;
-			TransformPointByMatrix(&startPosLocal, &startPos, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ, &model->m_worldToModelW);
-			TransformVectorByMatrix(&rayDirLocal, &rayDir, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ);
-			rayDirLocal = normalize(rayDirLocal);
-
-			// convert the bounding sphere hit locations from world space to model space
-			float3 hitStartLocal;
-			float3 hitEndLocal;
-			TransformPointByMatrix(&hitStartLocal, &hitStart, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ, &model->m_worldToModelW);
-			TransformPointByMatrix(&hitEndLocal, &hitEnd, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ, &model->m_worldToModelW);
-
-			// calculate which y half spaces this segment goes through
-			cl_uint halfSpaceFlags = 0;
-			halfSpaceFlags |= hitStartLocal.y > 0.0f ? e_halfSpacePosY : e_halfSpaceNegY;
-			halfSpaceFlags |= hitEndLocal.y > 0.0f ? e_halfSpacePosY : e_halfSpaceNegY;
-
-			for (int objectIndex = model->m_startObjectIndex; objectIndex < model->m_stopObjectIndex; ++objectIndex)
-			{
-				__global const struct SModelObject *object = &objects[objectIndex];
-				unsigned int materialIndex = model->m_materialOverride == -1 ? object->m_materialIndex : model->m_materialOverride;
-				bool backFaceCulling = !IsRefractive(&materials[materialIndex]);
-				if (object->m_castsShadows)
-				{
-					// figure out the triangle start and stop index to test against.
-					// if the segment we are testing is in only the positive y half space or only the negative y half space, we can cut out triangles
-					// that are completely in the other y half space.  If it has both, we need to test all unfortunately.
-					unsigned int triangleIndex = (halfSpaceFlags & e_halfSpaceNegY) ? object->m_startTriangleIndex : object->m_mixStartTriangleIndex;
-					unsigned int triangleStopIndex = (halfSpaceFlags & e_halfSpacePosY) ? object->m_stopTriangleIndex : object->m_mixStopTriangleIndex;
-
-					for (; triangleIndex < triangleStopIndex; ++triangleIndex)
-					{
-						if (RayIntersectTriangle(&triangles[triangleIndex], &collisionInfoLocal, startPosLocal, rayDirLocal, ignorePrimitiveId, backFaceCulling, object->m_materialIndex, model->m_portalIndex))
-							return false;
-					}
-				}
-			}
+			hit = true;
+			hitObject = object;
 		}
 	}
 
+	// if we hit something in local space, we need to convert the local space hit information back into world space
+	if (hit)
+	{
+		// only the closest hit needs it's texture coordinates and tangents
+		ResolveModelTriangleShading(hitObject, triangleShading, &collisionInfoLocal);
+
+		// copy everything over
+		*info = collisionInfoLocal;
+
+		// convert collision info from model space to world space
+		TransformPointByMatrixNoTemporary(&info->m_intersectionPoint, &model->m_modelToWorldX, &model->m_modelToWorldY, &model->m_modelToWorldZ, &model->m_modelToWorldW);
+		TransformVectorByMatrixNoTemporary(&info->m_surfaceNormal, &model->m_modelToWorldX, &model->m_modelToWorldY, &model->m_modelToWorldZ);
+		TransformVectorByMatrixNoTemporary(&info->m_surfaceU, &model->m_modelToWorldX, &model->m_modelToWorldY, &model->m_modelToWorldZ);
+		TransformVectorByMatrixNoTemporary(&info->m_surfaceV, &model->m_modelToWorldX, &model->m_modelToWorldY, &model->m_modelToWorldZ);
+		info->m_intersectionTime *= model->m_scale;
+		info->m_textureDensity /= model->m_scale;
+
+		// make sure things are normalized as is appropriate (to account for scaling and rounding errors)
+		info->m_surfaceNormal = normalize(info->m_surfaceNormal);
+		info->m_surfaceU = normalize(info->m_surfaceU);
+		info->m_surfaceV = normalize(info->m_surfaceV);
+	}
+
+	#if DEBUG_MODEL_BOUNDING_SPHERE
+	info->m_debugAdditiveColor += (float3)(0.0f,0.2f,0.0f);
 	#endif
 
-	// if no hit, bail out
-	return true;
+	return hit;
 }
 
-void ApplyPointLight (
-	float3 *pixelColor,
-	const struct SCollisionInfo *collisionInfo,
-	__global const struct SSector *sector,
-	__global const struct SMaterial *material,
-	__global const struct SPointLight *light,
-	const float3 rayDir,
-	__global const struct SSphere *spheres,
-	__global const struct SModelTriangle *triangles,
+// tests the shadow casting objects of a model instance in model space, returning at the first hit before maxTime.
+// Nothing about the hit is needed, so nothing gets converted back to world space.
+bool RayOccludedByModelInstance (
+	__global const struct SModelInstance *model,
 	__global const struct SModelObject *objects,
-	__global const struct SModelInstance *models,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SModelTriangle *triangles,
 	__global const struct SMaterial *materials,
-	float3 diffuseColor
+	const float3 rayPos,
+	const float3 rayDir,
+	const float maxTime,
+	const TObjectId ignorePrimitiveId
 )
 {
-	float3 hitToLight = normalize(light->m_position - collisionInfo->m_intersectionPoint);
+	if (!RayHitsSphere(model->m_boundingSphere, rayPos, rayDir, maxTime))
+		return false;
 
-	float coneAngle = dot(light->m_spotLightReverseDir, hitToLight);
-	if (coneAngle <= light->m_spotLightcosPhiOver2)
-		return;
+	float3 rayPosLocal;
+	float3 rayDirLocal;
+	TransformPointByMatrix(&rayPosLocal, &rayPos, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ, &model->m_worldToModelW);
+	TransformVectorByMatrix(&rayDirLocal, &rayDir, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ);
+	rayDirLocal = normalize(rayDirLocal);
+	const float3 rayDirLocalInverse = SafeReciprocal(rayDirLocal);
+	const float maxTimeLocal = maxTime / model->m_scale;
 
-	if (!PointCanSeePoint(
-		collisionInfo->m_intersectionPoint,
-		light->m_position,
-		collisionInfo->m_objectHit,
-		sector,
-		spheres,
-		triangles,
-		objects,
-		models,
-		materials
-		)
-	)
-		return;
+	for (int objectIndex = model->m_startObjectIndex; objectIndex < model->m_stopObjectIndex; ++objectIndex)
+	{
+		__global const struct SModelObject *object = &objects[objectIndex];
+		if (!object->m_castsShadows)
+			continue;
 
-	// light attenuation for high quality lights
-	float attenuation = 1.0f;
-	#if SETTINGS_HIQLIGHTS == 1
-		// spot light attenuation
-		if (light->m_spotLightFalloffFactor != 0 && coneAngle < light->m_spotLightcosThetaOver2)
-			attenuation *= pow((coneAngle - light->m_spotLightcosPhiOver2) / (light->m_spotLightcosThetaOver2 - light->m_spotLightcosPhiOver2), light->m_spotLightFalloffFactor);
+		unsigned int materialIndex = model->m_materialOverride == -1 ? object->m_materialIndex : model->m_materialOverride;
+		bool backFaceCulling = !IsRefractive(&materials[materialIndex]);
 
-		// distance attenuation
-		if (light->m_attenuationConstDistDistsq.x != 1.0f ||
-			light->m_attenuationConstDistDistsq.y != 0.0f ||
-			light->m_attenuationConstDistDistsq.z != 0.0f)
-		{
-			float distanceToLight = length(light->m_position - collisionInfo->m_intersectionPoint);
-			attenuation /= (
-				light->m_attenuationConstDistDistsq.x +
-				distanceToLight * light->m_attenuationConstDistDistsq.y + 
-				distanceToLight * distanceToLight * light->m_attenuationConstDistDistsq.z);
-		}
-	#endif
+		if (RayOccludedByModelObject(object, bvhNodes, triangles, rayPosLocal, rayDirLocal, rayDirLocalInverse, maxTimeLocal, ignorePrimitiveId, backFaceCulling))
+			return true;
+	}
 
-	// diffuse
-	float dp = dot(collisionInfo->m_surfaceNormal, hitToLight);
-	if(dp > 0.0)
-		*pixelColor += diffuseColor * dp * light->m_color * attenuation;
-				
-	// specular
-	float3 reflection = reflect(hitToLight, collisionInfo->m_surfaceNormal);
-	dp = dot(rayDir, reflection);
-	if (dp > 0.0)
-		*pixelColor += material->m_specularColorAndPower.xyz * pow(dp, material->m_specularColorAndPower.w) * light->m_color * attenuation;
+	return false;
 }
 
-inline void AddColorStackItem (struct SColorStackItem *colorStack, unsigned int *colorStackDepth, const float3 *filterColor, const float3 *addColor, const cl_float4 *fogColorAndAmount)
+// walks the sector's BVH over it's model instances, and only tests the instances whose nodes the ray actually hits.
+bool RayIntersectSectorModels (
+	__global const struct SSector *sector,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelTriangleShading *triangleShading,
+	__global const struct SMaterial *materials,
+	struct SCollisionInfo *info,
+	const float3 rayPos,
+	const float3 rayDir,
+	const TObjectId ignorePrimitiveId
+)
 {
-	// get the color stack item
-	struct SColorStackItem *item = &colorStack[*colorStackDepth];
-
-	// mark that we've taken that item
-	++colorStackDepth[0];
-
-	// set the item of the data
-	item->m_filterColor = *filterColor;
-	item->m_addColor = *addColor;
-	item->m_fogColorAndAmount = *fogColorAndAmount;
-}
+	if (sector->m_staticModelBVHRootIndex == -1)
+		return false;
 
-// taken from https://www.terathon.com/lengyel/Lengyel-UnifiedFog.pdf
-inline float LineSegmentFogAmount (const float3 *c, const float3 *p, __global const float4 *plane, const float fogDensityFactor, const float fogFactorMax, const cl_uint fogMode)
-{
-	if (fogMode == e_fogNone)
-		return 0.0f;
+	const float3 rayDirInverse = SafeReciprocal(rayDir);
 
-	const float k = dotPointPlane(c, plane) <= 0.0f ? 1.0f : 0.0f;
-	const float3 v = *p - *c;
-	const float f_dot_v = dotVectorPlane(&v, plane);
-	const float f_dot_p = dotPointPlane(p, plane);
+	unsigned int nodeStack[BVH_MAXDEPTH];
+	unsigned int nodeStackDepth = 0;
+	unsigned int nodeIndex = sector->m_staticModelBVHRootIndex;
+	bool hit = false;
 
-	// constant density
-	if (fogMode == e_fogConstantDensity)
+	while (true)
 	{
-		float d = Saturate(k - (f_dot_p / abs(f_dot_v))); 
-		d *= length(v); 
+		__global const struct SBVHNode *node = &instanceBVHNodes[nodeIndex];
+		if (RayHitsBVHNode(node, rayPos, rayDirInverse, info->m_intersectionTime))
+		{
+			// interior node: visit the nearest child first
+			if (node->m_primitiveCount == 0)
+			{
+				float rayDirSplitAxis = node->m_splitAxis == 0 ? rayDir.x : (node->m_splitAxis == 1 ? rayDir.y : rayDir.z);
+				if (rayDirSplitAxis < 0.0f)
+				{
+					nodeStack[nodeStackDepth++] = nodeIndex + 1;
+					nodeIndex = node->m_rightChildOrFirstPrimitive;
+				}
+				else
+				{
+					nodeStack[nodeStackDepth++] = node->m_rightChildOrFirstPrimitive;
+					nodeIndex = nodeIndex + 1;
+				}
+				continue;
+			}
 
-		return Saturate(min(d * fogDensityFactor, fogFactorMax));
-	}
+			// leaf node: test the model instances
+			for (unsigned int modelIndex = node->m_rightChildOrFirstPrimitive, modelStopIndex = modelIndex + node->m_primitiveCount; modelIndex < modelStopIndex; ++modelIndex)
+			{
+				if (RayIntersectModelInstance(&models[modelIndex], objects, bvhNodes, triangles, triangleShading, materials, info, rayPos, rayDir, ignorePrimitiveId))
+					hit = true;
+			}
+		}
+
+		if (nodeStackDepth == 0)
+			break;
+		nodeIndex = nodeStack[--nodeStackDepth];
+	}
+
+	return hit;
+}
+
+// walks the sector's BVH over it's model instances like RayIntersectSectorModels(), returning at the first hit before maxTime
+bool RayOccludedBySectorModels (
+	__global const struct SSector *sector,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SMaterial *materials,
+	const float3 rayPos,
+	const float3 rayDir,
+	const float maxTime,
+	const TObjectId ignorePrimitiveId
+)
+{
+	if (sector->m_staticModelBVHRootIndex == -1)
+		return false;
+
+	const float3 rayDirInverse = SafeReciprocal(rayDir);
+
+	unsigned int nodeStack[BVH_MAXDEPTH];
+	unsigned int nodeStackDepth = 0;
+	unsigned int nodeIndex = sector->m_staticModelBVHRootIndex;
+
+	while (true)
+	{
+		__global const struct SBVHNode *node = &instanceBVHNodes[nodeIndex];
+		if (RayHitsBVHNode(node, rayPos, rayDirInverse, maxTime))
+		{
+			if (node->m_primitiveCount == 0)
+			{
+				float rayDirSplitAxis = node->m_splitAxis == 0 ? rayDir.x : (node->m_splitAxis == 1 ? rayDir.y : rayDir.z);
+				if (rayDirSplitAxis < 0.0f)
+				{
+					nodeStack[nodeStackDepth++] = nodeIndex + 1;
+					nodeIndex = node->m_rightChildOrFirstPrimitive;
+				}
+				else
+				{
+					nodeStack[nodeStackDepth++] = node->m_rightChildOrFirstPrimitive;
+					nodeIndex = nodeIndex + 1;
+				}
+				continue;
+			}
+
+			for (unsigned int modelIndex = node->m_rightChildOrFirstPrimitive, modelStopIndex = modelIndex + node->m_primitiveCount; modelIndex < modelStopIndex; ++modelIndex)
+			{
+				if (RayOccludedByModelInstance(&models[modelIndex], objects, bvhNodes, triangles, materials, rayPos, rayDir, maxTime, ignorePrimitiveId))
+					return true;
+			}
+		}
+
+		if (nodeStackDepth == 0)
+			return false;
+		nodeIndex = nodeStack[--nodeStackDepth];
+	}
+}
+
+inline bool PointCanSeePoint(
+	const float3 startPos,
+	const float3 targetPos,
+	const TObjectId ignorePrimitiveId,
+	__global const struct SSector *sector,
+	__global const struct SSphere *spheres,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SMaterial *materials
+)
+{
+	#if SETTINGS_SHADOWS == 1
+	// see if we can hit the target point from the starting point
+	float3 rayDir = targetPos - startPos;
+	const float maxTime = length(rayDir);
+	rayDir = normalize(rayDir);
+
+	for (int index = sector->m_staticSphereStartIndex; index < sector->m_staticSphereStopIndex; ++index)
+	{
+		if (spheres[index].m_castsShadows
+		 && RayOccludedBySphere(&spheres[index], startPos, rayDir, maxTime, ignorePrimitiveId))
+			return false;
+	}
+
+	if (RayOccludedBySectorModels(sector, instanceBVHNodes, models, objects, bvhNodes, triangles, materials, startPos, rayDir, maxTime, ignorePrimitiveId))
+		return false;
+
+	#endif
+
+	// if no hit, bail out
+	return true;
+}
+
+#if BAKED_SHADOWS
+inline float AxisComponent (const float3 v, const unsigned int axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// how much of the light gets to a hit on one of the sector's walls, bilinearly filtered from the visibility
+// CWorld::BakeShadows() baked at the wall's texels.  Returns -1 if there is nothing baked for the hit.
+float BakedLightVisibility (
+	__global const struct SSector *sector,
+	__global const uint *shadowTexels,
+	const struct SCollisionInfo *collisionInfo,
+	const unsigned int sectorLightIndex
+)
+{
+	const unsigned int planeIndex = collisionInfo->m_objectHit - sector->m_planes[0].m_objectId;
+	if (planeIndex >= SSECTOR_NUMPLANES || sectorLightIndex >= SSECTOR_MAXBAKEDSHADOWLIGHTS)
+		return -1.0f;
+
+	__global const struct SSectorPlane *plane = &sector->m_planes[planeIndex];
+	if (plane->m_shadowTexelStart == -1)
+		return -1.0f;
+
+	// the walls of axis N are planes N*2 and N*2+1, and their texels run along the other two axes, lowest axis first
+	const unsigned int axis = planeIndex / 2;
+	const unsigned int axisU = axis == 0 ? 1 : 0;
+	const unsigned int axisV = axis == 2 ? 1 : 2;
+	const int countU = sector->m_shadowTexelCounts[axisU];
+	const int countV = sector->m_shadowTexelCounts[axisV];
+	const float halfDimU = AxisComponent(sector->m_halfDims, axisU);
+	const float halfDimV = AxisComponent(sector->m_halfDims, axisV);
+
+	// texel coordinates with the texel centers on whole numbers
+	const float texelU = clamp((AxisComponent(collisionInfo->m_intersectionPoint, axisU) + halfDimU) / (2.0f * halfDimU) * (float)countU - 0.5f, 0.0f, (float)(countU - 1));
+	const float texelV = clamp((AxisComponent(collisionInfo->m_intersectionPoint, axisV) + halfDimV) / (2.0f * halfDimV) * (float)countV - 0.5f, 0.0f, (float)(countV - 1));
+	const int u0 = (int)texelU;
+	const int v0 = (int)texelV;
+	const int u1 = min(u0 + 1, countU - 1);
+	const int v1 = min(v0 + 1, countV - 1);
+
+	__global const uint *texels = &shadowTexels[plane->m_shadowTexelStart];
+	const uint lightBit = 1u << sectorLightIndex;
+	const float visible00 = (texels[v0 * countU + u0] & lightBit) ? 1.0f : 0.0f;
+	const float visible10 = (texels[v0 * countU + u1] & lightBit) ? 1.0f : 0.0f;
+	const float visible01 = (texels[v1 * countU + u0] & lightBit) ? 1.0f : 0.0f;
+	const float visible11 = (texels[v1 * countU + u1] & lightBit) ? 1.0f : 0.0f;
+	const float fractionU = texelU - (float)u0;
+	return mix(mix(visible00, visible10, fractionU), mix(visible01, visible11, fractionU), texelV - (float)v0);
+}
+#endif
+
+void ApplyPointLight (
+	float3 *pixelColor,
+	const struct SCollisionInfo *collisionInfo,
+	__global const struct SSector *sector,
+	__global const struct SMaterial *material,
+	__global const struct SPointLight *light,
+	const unsigned int sectorLightIndex,
+	__global const uint *shadowTexels,
+	const float3 rayDir,
+	__global const struct SSphere *spheres,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SMaterial *materials,
+	float3 diffuseColor
+)
+{
+	// high quality lights attenuate to nothing outside their influence sphere, so they can be skipped before the shadow ray
+	#if SETTINGS_HIQLIGHTS == 1
+	const float3 influenceToHit = collisionInfo->m_intersectionPoint - light->m_influenceSphere.xyz;
+	if (dot(influenceToHit, influenceToHit) > light->m_influenceSphere.w * light->m_influenceSphere.w)
+		return;
+	#endif
+
+	float3 hitToLight = normalize(light->m_position - collisionInfo->m_intersectionPoint);
+
+	float coneAngle = dot(light->m_spotLightReverseDir, hitToLight);
+	if (coneAngle <= light->m_spotLightcosPhiOver2)
+		return;
+
+	// the walls have their shadows baked, everything else casts a shadow ray
+	float visibility = -1.0f;
+	#if BAKED_SHADOWS
+	visibility = BakedLightVisibility(sector, shadowTexels, collisionInfo, sectorLightIndex);
+	#endif
+	if (visibility < 0.0f)
+	{
+		visibility = PointCanSeePoint(
+			collisionInfo->m_intersectionPoint,
+			light->m_position,
+			collisionInfo->m_objectHit,
+			sector,
+			spheres,
+			triangles,
+			objects,
+			bvhNodes,
+			instanceBVHNodes,
+			models,
+			materials
+		) ? 1.0f : 0.0f;
+	}
+	if (visibility <= 0.0f)
+		return;
+
+	// light attenuation for high quality lights, on top of how much of the light the shadows let through
+	float attenuation = visibility;
+	#if SETTINGS_HIQLIGHTS == 1
+		// spot light attenuation
+		if (light->m_spotLightFalloffFactor != 0 && coneAngle < light->m_spotLightcosThetaOver2)
+			attenuation *= pow((coneAngle - light->m_spotLightcosPhiOver2) / (light->m_spotLightcosThetaOver2 - light->m_spotLightcosPhiOver2), light->m_spotLightFalloffFactor);
+
+		// distance attenuation
+		if (light->m_attenuationConstDistDistsq.x != 1.0f ||
+			light->m_attenuationConstDistDistsq.y != 0.0f ||
+			light->m_attenuationConstDistDistsq.z != 0.0f)
+		{
+			float distanceToLight = length(light->m_position - collisionInfo->m_intersectionPoint);
+			attenuation /= (
+				light->m_attenuationConstDistDistsq.x +
+				distanceToLight * light->m_attenuationConstDistDistsq.y + 
+				distanceToLight * distanceToLight * light->m_attenuationConstDistDistsq.z);
+		}
+	#endif
+
+	// diffuse
+	float dp = dot(collisionInfo->m_surfaceNormal, hitToLight);
+	if(dp > 0.0)
+		*pixelColor += diffuseColor * dp * light->m_color * attenuation;
+				
+	// specular
+	float3 reflection = reflect(hitToLight, collisionInfo->m_surfaceNormal);
+	dp = dot(rayDir, reflection);
+	if (dp > 0.0)
+		*pixelColor += material->m_specularColorAndPower.xyz * pow(dp, material->m_specularColorAndPower.w) * light->m_color * attenuation;
+}
+
+#if SETTINGS_LIGHTSAMPLING == 1
+// a well mixed hash of the hit point and the frame, so each pixel, bounce and frame picks it's own lights
+inline uint HashLightSample (const float3 point, const uint frameCount)
+{
+	uint hash = (as_uint(point.x) * 0x8da6b343u) ^ (as_uint(point.y) * 0xd8163841u) ^ (as_uint(point.z) * 0xcb1ab31fu) ^ (frameCount * 0x9e3779b9u);
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+#endif
+
+// applies the sector's point lights to a hit.  With light sampling on, sectors with more than c_lightSamples lights only get
+// c_lightSamples of them, picked with the probabilities in SPointLight::m_samplingCdf.  The picks are stratified so they
+// spread over the whole table, and each is divided by the chance of picking it, so on average the result is the same as
+// applying every light.
+void ApplySectorPointLights (
+	float3 *pixelColor,
+	const struct SCollisionInfo *collisionInfo,
+	__global const struct SSector *sector,
+	__global const struct SMaterial *material,
+	__global const struct SPointLight *lights,
+	const float3 rayDir,
+	__global const struct SSphere *spheres,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SMaterial *materials,
+	__global const uint *shadowTexels,
+	float3 diffuseColor,
+	const uint frameCount
+)
+{
+	#if SETTINGS_LIGHTSAMPLING == 1
+	if (sector->m_staticLightStopIndex - sector->m_staticLightStartIndex > c_lightSamples)
+	{
+		const float offset = (float)(HashLightSample(collisionInfo->m_intersectionPoint, frameCount) >> 8) / 16777216.0f;
+		for (int sample = 0; sample < c_lightSamples; ++sample)
+		{
+			// find the first light whose cumulative probability is above the pick
+			const float pick = ((float)sample + offset) / (float)c_lightSamples;
+			int low = sector->m_staticLightStartIndex;
+			int high = sector->m_staticLightStopIndex - 1;
+			while (low < high)
+			{
+				const int middle = (low + high) / 2;
+				if (lights[middle].m_samplingCdf <= pick)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+
+			const float probability = lights[low].m_samplingCdf - (low > sector->m_staticLightStartIndex ? lights[low - 1].m_samplingCdf : 0.0f);
+			if (probability <= 0.0f)
+				continue;
+
+			float3 lightColor = (float3)(0.0f);
+			ApplyPointLight(&lightColor, collisionInfo, sector, material, &lights[low], low - sector->m_staticLightStartIndex, shadowTexels, rayDir, spheres, triangles, objects, bvhNodes, instanceBVHNodes, models, materials, diffuseColor);
+			*pixelColor += lightColor / (probability * (float)c_lightSamples);
+		}
+		return;
+	}
+	#endif
+
+	for (int index = sector->m_staticLightStartIndex; index < sector->m_staticLightStopIndex; ++index)
+		ApplyPointLight(pixelColor, collisionInfo, sector, material, &lights[index], index - sector->m_staticLightStartIndex, shadowTexels, rayDir, spheres, triangles, objects, bvhNodes, instanceBVHNodes, models, materials, diffuseColor);
+}
+
+// a portal crossing maps the color coming from past the portal to mix(color + addColor, fog, fogAmount).
+// Crossings don't get a level of the color stack of their own.  Instead the ones since the last level
+// are kept as color * portalFilter + portalAdd, and folded into the next level made.
+inline void AddPortalCrossing (float *portalFilter, float3 *portalAdd, const float3 *addColor, const cl_float4 *fogColorAndAmount)
+{
+	const float fogAmount = fogColorAndAmount->w;
+	*portalAdd += *portalFilter * (*addColor * (1.0f - fogAmount) + fogColorAndAmount->xyz * fogAmount);
+	*portalFilter *= 1.0f - fogAmount;
+}
+
+inline void AddColorStackItem (struct SColorStackItem *colorStack, unsigned int *colorStackDepth, float *portalFilter, float3 *portalAdd, const float3 *filterColor, const float3 *addColor, const cl_float4 *fogColorAndAmount)
+{
+	// get the color stack item
+	struct SColorStackItem *item = &colorStack[*colorStackDepth];
+
+	// mark that we've taken that item
+	++colorStackDepth[0];
+
+	// set the item of the data, with it's fog and the portals crossed since the last item folded in
+	const float fogAmount = fogColorAndAmount->w;
+	item->m_filterColor = *filterColor * ((1.0f - fogAmount) * *portalFilter);
+	item->m_addColor = (*addColor * (1.0f - fogAmount) + fogColorAndAmount->xyz * fogAmount) * *portalFilter + *portalAdd;
+
+	*portalFilter = 1.0f;
+	*portalAdd = (float3)(0.0f);
+}
+
+// taken from https://www.terathon.com/lengyel/Lengyel-UnifiedFog.pdf
+inline float LineSegmentFogAmount (const float3 *c, const float3 *p, __global const float4 *plane, const float fogDensityFactor, const float fogFactorMax, const cl_uint fogMode)
+{
+	if (fogMode == e_fogNone)
+		return 0.0f;
+
+	const float k = dotPointPlane(c, plane) <= 0.0f ? 1.0f : 0.0f;
+	const float3 v = *p - *c;
+	const float f_dot_v = dotVectorPlane(&v, plane);
+	const float f_dot_p = dotPointPlane(p, plane);
+
+	// constant density
+	if (fogMode == e_fogConstantDensity)
+	{
+		float d = Saturate(k - (f_dot_p / abs(f_dot_v))); 
+		d *= length(v); 
+
+		return Saturate(min(d * fogDensityFactor, fogFactorMax));
+	}
 	// linear density
 	else
 	{
@@ -624,32 +1210,354 @@ inline float LineSegmentFogAmount (const float3 *c, const float3 *p, __global co
 	}
 }
 
+// tests the ray against everything in the sector: the spheres, the model instances and the sector walls
+inline void RayIntersectSectorContents (
+	__global const struct SSector *sector,
+	__global const struct SSphere *spheres,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelTriangleShading *triangleShading,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SMaterial *materials,
+	struct SCollisionInfo *info,
+	const float3 rayPos,
+	const float3 rayDir,
+	const TObjectId ignorePrimitiveId
+)
+{
+	for (int index = sector->m_staticSphereStartIndex; index < sector->m_staticSphereStopIndex; ++index)
+		RayIntersectSphere(&spheres[index], info, rayPos, rayDir, ignorePrimitiveId);
+
+	RayIntersectSectorModels(sector, instanceBVHNodes, models, objects, bvhNodes, triangles, triangleShading, materials, info, rayPos, rayDir, ignorePrimitiveId);
+
+	RayIntersectSector(sector, info, rayPos, rayDir, ignorePrimitiveId);
+}
+
+// moves a ray that hit a portal at intersectionPoint into the space of the sector on the other side
+inline void TransformRayThroughPortal (__global const struct SPortal *portal, const float3 *intersectionPoint, float3 *rayPos, float3 *rayDir)
+{
+	// set our point if we are supposed to
+	float3 transformedPoint;
+	if (portal->m_setPosition)
+	{
+		transformedPoint = portal->m_position;
+	}
+	// else transform the collision point into sector space
+	else
+	{
+		TransformPointByMatrix(
+			&transformedPoint,
+			intersectionPoint,
+			&portal->m_xaxis,
+			&portal->m_yaxis,
+			&portal->m_zaxis,
+			&portal->m_waxis);
+	}
+
+	// transform the ray direction into sector space
+	float3 transformedDir;
+	TransformVectorByMatrix(
+		&transformedDir,
+		rayDir,
+		&portal->m_xaxis,
+		&portal->m_yaxis,
+		&portal->m_zaxis);
+
+	*rayPos = transformedPoint;
+	*rayDir = normalize(transformedDir);
+}
+
+// how much of the light coming back along a ray of the given length is left after the absorbance of
+// the transparent objects it's inside of
+inline float3 AbsorbanceFilter (const float3 absorbance, const float intersectionTime)
+{
+	#if SETTINGS_COLORABSORB == 1
+	float3 currentAbsorbance = absorbance * -intersectionTime;
+
+	currentAbsorbance.x = pow(10, currentAbsorbance.x);
+	currentAbsorbance.y = pow(10, currentAbsorbance.y);
+	currentAbsorbance.z = pow(10, currentAbsorbance.z);
+	return currentAbsorbance;
+	#else
+	return (float3)(1.0f);
+	#endif
+}
+
+// the angle between the camera rays of neighboring pixels, which is how fast the footprint of a ray
+// grows with the distance it travels
+inline float PixelSpreadAngle (__global const struct SCamera *camera)
+{
+	return camera->m_viewWidthHeightDistance.x / (camera->m_viewWidthHeightDistance.z * (float)camera->m_renderWidth);
+}
+
+// how much of the texture coordinate space the ray's footprint on the surface covers, following ray
+// cones: coneWidth is how wide the cone around the ray is where it hit
+inline float TextureFootprint (const struct SCollisionInfo *collisionInfo, const float3 rayDir, const float coneWidth)
+{
+	const float cosine = max(fabs(dot(rayDir, collisionInfo->m_surfaceNormal)), c_textureLodMinCosine);
+	return coneWidth * collisionInfo->m_textureDensity / cosine;
+}
+
+// the mip level of a texture whose texels are about the size of the footprint
+inline float TextureLod (__global const struct SAtlasTexture *texture, const float footprint)
+{
+	const float texels = footprint * sqrt((float)(texture->m_width * texture->m_height));
+	return log2(max(texels, 1.0f));
+}
+
+// reads a texture from the atlas at texture coordinates uv, which repeat, from the mip level nearest lod
+inline float4 SampleTexture (__read_only image2d_t textureAtlas, __global const struct SAtlasTexture *texture, const float2 uv, const float lod)
+{
+	// find the mip level in the atlas.  See STextureAtlas.h for the layout.
+	const int2 size0 = (int2)(texture->m_width, texture->m_height);
+	const int level = clamp((int)(lod + 0.5f), 0, 31 - (int)clz(max(size0.x, size0.y)));
+	const int2 size = max(size0 >> level, (int2)(1));
+	int2 origin = (int2)(texture->m_x, texture->m_y);
+	if (level > 0)
+	{
+		origin.x += size0.x;
+		for (int index = 1; index < level; ++index)
+			origin.y += max(size0.y >> index, 1);
+	}
+
+	const float2 texel = (uv - floor(uv)) * convert_float2(size);
+
+	#if SETTINGS_TEXTUREFILTER == 1
+	// bilinear, wrapping around the edges of the texture like CLK_ADDRESS_REPEAT would
+	const float2 texelCenter = texel - 0.5f;
+	const float2 texelFloor = floor(texelCenter);
+	const float2 fraction = texelCenter - texelFloor;
+	const int2 texel0 = (convert_int2(texelFloor) + size) % size;
+	const int2 texel1 = (texel0 + 1) % size;
+	const float4 top = mix(
+		read_imagef(textureAtlas, g_atlasSampler, origin + (int2)(texel0.x, texel0.y)),
+		read_imagef(textureAtlas, g_atlasSampler, origin + (int2)(texel1.x, texel0.y)),
+		fraction.x);
+	const float4 bottom = mix(
+		read_imagef(textureAtlas, g_atlasSampler, origin + (int2)(texel0.x, texel1.y)),
+		read_imagef(textureAtlas, g_atlasSampler, origin + (int2)(texel1.x, texel1.y)),
+		fraction.x);
+	return mix(top, bottom, fraction.y);
+	#else
+	return read_imagef(textureAtlas, g_atlasSampler, origin + min(convert_int2(texel), size - 1));
+	#endif
+}
+
+// applies the normal map to the surface normal, and returns the color of the surface lit by the ambient
+// light and it's emissive color.  diffuseColorBase gets the unlit diffuse color, for the point lights.
+// rayDir and coneWidth are for picking the mip level of the textures.
+inline float3 ShadeSurface (
+	__read_only image2d_t textureAtlas,
+	__global const struct SAtlasTexture *atlasTextures,
+	__global const struct SMaterial *material,
+	struct SCollisionInfo *collisionInfo,
+	const float3 ambientLight,
+	float3 *diffuseColorBase,
+	const float3 rayDir,
+	const float coneWidth
+)
+{
+	// before the normal map changes the normal
+	const float2 textureCoords = collisionInfo->m_textureCoordinates;
+	const float footprint = TextureFootprint(collisionInfo, rayDir, coneWidth);
+
+	// handle normal mapping if there is any
+	#if SETTINGS_NORMALMAP == 1
+	if (material->m_normalTextureIndex >= 0)
+	{
+		__global const struct SAtlasTexture *texture = &atlasTextures[material->m_normalTextureIndex];
+		// do not convert to sRGB since this is a normal map!
+		float3 textureNormal = SampleTexture(textureAtlas, texture, textureCoords, TextureLod(texture, footprint)).xyz;
+
+		textureNormal = normalize(textureNormal * 2.0 - 1.0);
+
+		float3 adjustedNormal;
+		adjustedNormal.x = textureNormal.x * collisionInfo->m_surfaceU.x + textureNormal.y * collisionInfo->m_surfaceV.x + textureNormal.z * collisionInfo->m_surfaceNormal.x;
+		adjustedNormal.y = textureNormal.x * collisionInfo->m_surfaceU.y + textureNormal.y * collisionInfo->m_surfaceV.y + textureNormal.z * collisionInfo->m_surfaceNormal.y;
+		adjustedNormal.z = textureNormal.x * collisionInfo->m_surfaceU.z + textureNormal.y * collisionInfo->m_surfaceV.z + textureNormal.z * collisionInfo->m_surfaceNormal.z;
+
+		collisionInfo->m_surfaceNormal = normalize(adjustedNormal);
+	}
+	#endif
+
+	// get the diffuse color of the object we hit
+	*diffuseColorBase = material->m_diffuseColor;
+	if (material->m_diffuseTextureIndex >= 0)
+	{
+		__global const struct SAtlasTexture *texture = &atlasTextures[material->m_diffuseTextureIndex];
+		const float4 texel = SampleTexture(textureAtlas, texture, textureCoords, TextureLod(texture, footprint));
+
+		// if this is a distance field texture
+		if (material->m_diffuseTextureIsDistanceField)
+		{
+			#if 1
+				const float smoothing = 1.0/64.0;
+				// do not convert to sRGB since this is a distance texture
+				float distance = texel.w;
+				float alpha = Saturate(smoothstep(0.5 - smoothing, 0.5 + smoothing, distance));
+				*diffuseColorBase *= (float3)(1.0f - alpha);
+			#else
+				// do not convert to sRGB since this is a distance texture
+				float alpha = texel.w;
+				if (alpha > 0.5f)
+					*diffuseColorBase *= (float3)(0.0f);
+			#endif
+		}
+		// else it's a regular texture map
+		else
+		{
+			// convert to sRGB since this is a color
+			*diffuseColorBase *= LinearColorTosRGB(texel.xyz);
+		}
+	}
+
+	// get the emissive color of the object we hit
+	float3 emissiveColor = material->m_emissiveColor;
+	if (material->m_emissiveTextureIndex >= 0)
+	{
+		__global const struct SAtlasTexture *texture = &atlasTextures[material->m_emissiveTextureIndex];
+		// convert to sRGB since this is a color
+		emissiveColor *= LinearColorTosRGB(SampleTexture(textureAtlas, texture, textureCoords, TextureLod(texture, footprint)).xyz);
+	}
+
+	#if DEBUG_TEXTURE_UV
+	*diffuseColorBase = (float3)(collisionInfo->m_textureCoordinates.xy, 0.0f);
+	#endif
+
+	// apply ambient lighting, emissive color and the debug additive color
+	return *diffuseColorBase * ambientLight + emissiveColor + collisionInfo->m_debugAdditiveColor;
+}
+
+// the direction of the camera ray for the pixel at coord
+inline float3 CameraRayDir (__global const struct SCamera *camera, const int2 coord, const int2 dims)
+{
+	const float2 percent = (float2)(((float)coord.x / (float)dims.x) - 0.5f, ((float)coord.y / (float)dims.y) - 0.5f);
+	return normalize((camera->m_fwd * camera->m_viewWidthHeightDistance.z)
+		- (camera->m_left * percent.x * camera->m_viewWidthHeightDistance.x)
+		- (camera->m_up * percent.y * camera->m_viewWidthHeightDistance.y));
+}
+
+// what TraceRay() finds out about the first surface a camera ray hits, through any portals, and what it
+// needs to reuse last frame's color instead of shading it again
+struct SPrimaryRay
+{
+	TObjectId				m_firstHitObject;		// c_invalidObjectId if the ray didn't hit anything
+	float3					m_firstHitNormal;
+	float					m_firstHitDistance;		// the distance along the camera ray, or -1
+	bool					m_firstHitReusable;		// false for reflective, refractive and specular surfaces, which change with the view
+
+	__global const float4	*m_historyIn;			// last frame's color and first hit distance for each pixel
+	int						m_historyStride;
+	bool					m_canReuse;				// false for the pixels traced fresh this frame
+	bool					m_reused;				// set if last frame's color was used
+};
+
+inline void InitPrimaryRay (struct SPrimaryRay *primaryRay)
+{
+	primaryRay->m_firstHitObject = c_invalidObjectId;
+	primaryRay->m_firstHitNormal = (float3)(0.0f);
+	primaryRay->m_firstHitDistance = -1.0f;
+	primaryRay->m_firstHitReusable = false;
+	primaryRay->m_historyIn = 0;
+	primaryRay->m_historyStride = 0;
+	primaryRay->m_canReuse = false;
+	primaryRay->m_reused = false;
+}
+
+// finds the pixel that saw hitPoint last frame, and gives the color it had if it saw the same point.
+// The history holds the distance along each pixel's camera ray to what it hit, -1 for nothing reusable.
+inline bool ReprojectHistory (
+	__global const struct SSharedDataRootHostToKernel *dataRoot,
+	const struct SPrimaryRay *primaryRay,
+	const float3 hitPoint,
+	float3 *color
+)
+{
+	// invert CameraRayDir() for the previous camera
+	__global const struct SCamera *camera = &dataRoot->m_previousCamera;
+	const float3 offset = hitPoint - camera->m_pos;
+	const float forward = dot(offset, camera->m_fwd);
+	if (forward <= 0.0f)
+		return false;
+
+	const float scale = camera->m_viewWidthHeightDistance.z / forward;
+	const float2 percent = (float2)(
+		-dot(offset, camera->m_left) * scale / camera->m_viewWidthHeightDistance.x,
+		-dot(offset, camera->m_up) * scale / camera->m_viewWidthHeightDistance.y
+	);
+
+	const int2 dims = (int2)(camera->m_renderWidth, camera->m_renderHeight);
+	const int2 coord = convert_int2_rtn((percent + 0.5f) * convert_float2(dims) + 0.5f);
+	if (coord.x < 0 || coord.y < 0 || coord.x >= dims.x || coord.y >= dims.y)
+		return false;
+
+	const float4 history = primaryRay->m_historyIn[coord.y * primaryRay->m_historyStride + coord.x];
+	if (history.w < 0.0f)
+		return false;
+
+	// if that pixel saw something else, the point has just been uncovered or something moved
+	const float3 historyPoint = camera->m_pos + CameraRayDir(camera, coord, dims) * history.w;
+	if (distance(historyPoint, hitPoint) > history.w * c_temporalDistanceTolerance)
+		return false;
+
+	*color = history.xyz;
+	return true;
+}
+
 void TraceRay (
 	__global const struct SSharedDataRootHostToKernel *dataRoot,
-	__read_only image3d_t tex3dIn,
+	__read_only image2d_t textureAtlas,
+	__global const struct SAtlasTexture *atlasTextures,
 	float3 rayPos,
 	float3 rayDir,
 	float3 *pixelColor,
+	struct SPrimaryRay *primaryRay,
 	__global const struct SPointLight *lights,
 	__global const struct SSphere *spheres,
 	__global const struct SModelTriangle *triangles,
+	__global const struct SModelTriangleShading *triangleShading,
 	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
 	__global const struct SModelInstance *models,
 	__global const struct SSector *sectors,
 	__global const struct SMaterial *materials,
-	__global const struct SPortal *portals
+	__global const struct SPortal *portals,
+	__global const uint *shadowTexels
 )
 {
 	struct SColorStackItem colorStack[c_maxRayBounces];
 	unsigned int colorStackDepth = 0;
 
+	// the portals crossed since the last color stack item, see AddPortalCrossing()
+	float portalFilter = 1.0f;
+	float3 portalAdd = (float3)(0.0f);
+
 	TObjectId lastHitPrimitiveId = c_invalidObjectId;
 
 	float3 absorbance = {0.0f, 0.0f, 0.0f};
 
 	unsigned int currentSector = dataRoot->m_camera.m_sector;
 
-	for(int index = 0; index < c_maxRayBounces && currentSector != -1; ++index)
+	// the quality governor can cut the bounces short of the most the kernel was built for
+	const int maxRayBounces = min(c_maxRayBounces, (int)dataRoot->m_camera.m_maxRayBounces);
+
+	// how far the ray has gone, through portals and bounces, for how wide it's footprint is
+	const float pixelSpreadAngle = PixelSpreadAngle(&dataRoot->m_camera);
+	float rayLength = 0.0f;
+
+	#if TRACK_PRIMARY_RAY
+	const float3 cameraRayPos = rayPos;
+	const float3 cameraRayDir = rayDir;
+	bool firstSurface = primaryRay != 0;
+	#endif
+
+	// portal crossings don't count as bounces, they have a limit of their own
+	int bounce = 0;
+	int portalCrossings = 0;
+	while (bounce < maxRayBounces && portalCrossings < SPORTAL_MAXCROSSINGS && currentSector != -1)
 	{
 		struct SCollisionInfo collisionInfo = 
 		{
@@ -668,104 +1576,14 @@ void TraceRay (
 			#endif
 			0,
 			0,
+			0.0f,
 		};
 
 		__global const struct SSector *sector = &sectors[currentSector];
 
 		const float3 ambientLight = sector->m_ambientLight;
 
-		for (int index = sector->m_staticSphereStartIndex; index < sector->m_staticSphereStopIndex; ++index)
-			RayIntersectSphere(&spheres[index], &collisionInfo, rayPos, rayDir, lastHitPrimitiveId);
-
-		for (int modelIndex = sector->m_staticModelStartIndex; modelIndex < sector->m_staticModelStopIndex; ++modelIndex)
-		{
-			__global const struct SModelInstance *model = &models[modelIndex];
-			float3 hitStart, hitEnd;
-			if (RayHitsSphere(model->m_boundingSphere, rayPos, rayDir, &hitStart, &hitEnd))
-			{
-				struct SCollisionInfo collisionInfoLocal = 
-				{
-					c_invalidObjectId,
-					false,
-					{ 0.0f, 0.0f, 0.0f },
-					c_maxRayLength,
-					{ 0.0f, 0.0f, 0.0f },
-					{ 0.0f, 0.0f, 0.0f },
-					{ 0.0f, 0.0f, 0.0f },
-					{ 0.0f, 0.0f },
-					collisionInfo.m_debugAdditiveColor,
-					0,
-					0,
-				};
-
-				// convert max intersection time from world to local space
-				if (collisionInfo.m_objectHit != c_invalidObjectId)
-					collisionInfoLocal.m_intersectionTime = collisionInfo.m_intersectionTime / model->m_scale;
-
-				// convert the ray from world space to model space, making sure the ray direction is normalized to account for scaling or rounding errors
-				float3 rayPosLocal;
-				float3 rayDirLocal;
-				TransformPointByMatrix(&rayPosLocal, &rayPos, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ, &model->m_worldToModelW);
-				TransformVectorByMatrix(&rayDirLocal, &rayDir, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ);
-				rayDirLocal = normalize(rayDirLocal);
-
-				// convert the bounding sphere hit locations from world space to model space
-				float3 hitStartLocal;
-				float3 hitEndLocal;
-				TransformPointByMatrix(&hitStartLocal, &hitStart, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ, &model->m_worldToModelW);
-				TransformPointByMatrix(&hitEndLocal, &hitEnd, &model->m_worldToModelX, &model->m_worldToModelY, &model->m_worldToModelZ, &model->m_worldToModelW);
-
-				// calculate which y half spaces this segment goes through
-				cl_uint halfSpaceFlags = 0;
-				halfSpaceFlags |= hitStartLocal.y > 0.0f ? e_halfSpacePosY : e_halfSpaceNegY;
-				halfSpaceFlags |= hitEndLocal.y > 0.0f ? e_halfSpacePosY : e_halfSpaceNegY;
-
-				for (int objectIndex = model->m_startObjectIndex; objectIndex < model->m_stopObjectIndex; ++objectIndex)
-				{
-					__global const struct SModelObject *object = &objects[objectIndex];
-
-					// allow back face culling if the triangle isn't refractive (transparent)
-					unsigned int materialIndex = model->m_materialOverride == -1 ? object->m_materialIndex : model->m_materialOverride;
-					bool backFaceCulling = !IsRefractive(&materials[materialIndex]);
-
-					// figure out the triangle start and stop index to test against.
-					// if the segment we are testing is in only the positive y half space or only the negative y half space, we can cut out triangles
-					// that are completely in the other y half space.  If it has both, we need to test all unfortunately.
-					unsigned int triangleIndex = (halfSpaceFlags & e_halfSpaceNegY) ? object->m_startTriangleIndex : object->m_mixStartTriangleIndex;
-					unsigned int triangleStopIndex = (halfSpaceFlags & e_halfSpacePosY) ? object->m_stopTriangleIndex : object->m_mixStopTriangleIndex;
-
-					for (; triangleIndex < triangleStopIndex; ++triangleIndex)
-						RayIntersectTriangle(&triangles[triangleIndex], &collisionInfoLocal, rayPosLocal, rayDirLocal, lastHitPrimitiveId, backFaceCulling, materialIndex, model->m_portalIndex);
-				}
-
-				// if we hit something in local space, we need to convert the local space hit information back into world space
-				if (collisionInfoLocal.m_objectHit != c_invalidObjectId)
-				{
-					// copy everything over
-					collisionInfo = collisionInfoLocal;
-
-					// convert collision info from model space to world space
-					TransformPointByMatrixNoTemporary(&collisionInfo.m_intersectionPoint, &model->m_modelToWorldX, &model->m_modelToWorldY, &model->m_modelToWorldZ, &model->m_modelToWorldW);
-					TransformVectorByMatrixNoTemporary(&collisionInfo.m_surfaceNormal, &model->m_modelToWorldX, &model->m_modelToWorldY, &model->m_modelToWorldZ);
-					TransformVectorByMatrixNoTemporary(&collisionInfo.m_surfaceU, &model->m_modelToWorldX, &model->m_modelToWorldY, &model->m_modelToWorldZ);
-					TransformVectorByMatrixNoTemporary(&collisionInfo.m_surfaceV, &model->m_modelToWorldX, &model->m_modelToWorldY, &model->m_modelToWorldZ);
-					collisionInfo.m_intersectionTime *= model->m_scale;
-
-					// make sure things are normalized as is appropriate (to account for scaling and rounding errors)
-					collisionInfo.m_surfaceNormal = normalize(collisionInfo.m_surfaceNormal);
-					collisionInfo.m_surfaceU = normalize(collisionInfo.m_surfaceU);
-					collisionInfo.m_surfaceV = normalize(collisionInfo.m_surfaceV);
-				}
-
-				#if DEBUG_MODEL_BOUNDING_SPHERE
-				collisionInfo.m_debugAdditiveColor += (halfSpaceFlags == e_halfSpacePosY) ? (float3)(0.0f,0.2f,0.0f) : (float3)(0.0f,0.0f,0.0f);
-				collisionInfo.m_debugAdditiveColor += (halfSpaceFlags == e_halfSpaceNegY) ? (float3)(0.2f,0.0f,0.0f) : (float3)(0.0f,0.0f,0.0f);
-				collisionInfo.m_debugAdditiveColor += (halfSpaceFlags == (e_halfSpaceNegY | e_halfSpacePosY)) ? (float3)(0.2f,0.2f,0.2f) : (float3)(0.0f,0.0f,0.0f);
-				#endif
-			}
-		}
-
-		RayIntersectSector(sector, &collisionInfo, rayPos, rayDir, lastHitPrimitiveId);
+		RayIntersectSectorContents(sector, spheres, triangles, triangleShading, objects, bvhNodes, instanceBVHNodes, models, materials, &collisionInfo, rayPos, rayDir, lastHitPrimitiveId);
 
 		// if no hit, set pixel to ambient light and bail out
 		if (collisionInfo.m_objectHit == c_invalidObjectId)
@@ -773,7 +1591,7 @@ void TraceRay (
 			const float3 white = (float3)(1.0f);
 			const float3 missColor = ambientLight + collisionInfo.m_debugAdditiveColor;
 			const float4 noFog = (float4)(0.0f);
-			AddColorStackItem(colorStack, &colorStackDepth, &white, &missColor, &noFog);
+			AddColorStackItem(colorStack, &colorStackDepth, &portalFilter, &portalAdd, &white, &missColor, &noFog);
 			break;
 		}
 
@@ -785,144 +1603,74 @@ void TraceRay (
 		// if we hit a portal, change our sector, transform the ray and bail out of this loop.
 		if (collisionInfo.m_portalIndex != -1)
 		{
-			// set our point if we are supposed to
-			float3 transformedPoint;
-			if (portals[collisionInfo.m_portalIndex].m_setPosition)
-			{
-				transformedPoint = portals[collisionInfo.m_portalIndex].m_position;
-			}
-			// else transform the collision point into sector space
-			else
-			{
-				TransformPointByMatrix(
-					&transformedPoint,
-					&collisionInfo.m_intersectionPoint,
-					&portals[collisionInfo.m_portalIndex].m_xaxis,
-					&portals[collisionInfo.m_portalIndex].m_yaxis,
-					&portals[collisionInfo.m_portalIndex].m_zaxis,
-					&portals[collisionInfo.m_portalIndex].m_waxis);
-			}
+			rayLength += collisionInfo.m_intersectionTime;
 
-			// transform the ray direction into sector space
-			float3 transformedDir;
-			TransformVectorByMatrix(
-				&transformedDir,
-				&rayDir,
-				&portals[collisionInfo.m_portalIndex].m_xaxis,
-				&portals[collisionInfo.m_portalIndex].m_yaxis,
-				&portals[collisionInfo.m_portalIndex].m_zaxis);
-
-			rayPos = transformedPoint;
-			rayDir = normalize(transformedDir);
+			TransformRayThroughPortal(&portals[collisionInfo.m_portalIndex], &collisionInfo.m_intersectionPoint, &rayPos, &rayDir);
 			currentSector = portals[collisionInfo.m_portalIndex].m_sector;
 			lastHitPrimitiveId = collisionInfo.m_objectHit;
 
-			// add a color stack item for portal traversal, just for the sake of handling fog
-			const float3 white = (float3)(1.0f);
-			float3 black = collisionInfo.m_debugAdditiveColor;
-			AddColorStackItem(colorStack, &colorStackDepth, &white, &black, &fogColorAndAmount);
+			// the fog on the way to the portal goes in with the next color stack item
+			AddPortalCrossing(&portalFilter, &portalAdd, &collisionInfo.m_debugAdditiveColor, &fogColorAndAmount);
+			++portalCrossings;
 			continue;
 		}
 
 		__global const struct SMaterial *material = &materials[collisionInfo.m_materialIndex];
 
-		// if we hit an object from the inside, flip it's normal, and also make sure no fog is used
-		if (collisionInfo.m_fromInside)
-		{
-			collisionInfo.m_surfaceNormal *= -1.0f;
-			fogColorAndAmount = (cl_float4)(0.0f);
-		}
-
-		// handle normal mapping if there is any
-		#if SETTINGS_NORMALMAP == 1
-		if (material->m_normalTextureIndex >= 0)
+		#if TRACK_PRIMARY_RAY
+		if (firstSurface)
 		{
-			float4 textureCoords = {collisionInfo.m_textureCoordinates.x, collisionInfo.m_textureCoordinates.y, material->m_normalTextureIndex, 0};
-			// do not convert to sRGB since this is a normal map!
-			float3 textureNormal = read_imagef(tex3dIn, g_textureSampler, textureCoords).xyz;
-
-			textureNormal = normalize(textureNormal * 2.0 - 1.0);
-
-			float3 adjustedNormal;
-			adjustedNormal.x = textureNormal.x * collisionInfo.m_surfaceU.x + textureNormal.y * collisionInfo.m_surfaceV.x + textureNormal.z * collisionInfo.m_surfaceNormal.x;
-			adjustedNormal.y = textureNormal.x * collisionInfo.m_surfaceU.y + textureNormal.y * collisionInfo.m_surfaceV.y + textureNormal.z * collisionInfo.m_surfaceNormal.y;
-			adjustedNormal.z = textureNormal.x * collisionInfo.m_surfaceU.z + textureNormal.y * collisionInfo.m_surfaceV.z + textureNormal.z * collisionInfo.m_surfaceNormal.z;
-
-			collisionInfo.m_surfaceNormal = normalize(adjustedNormal);
-		}
-		#endif
-
-		#if SETTINGS_COLORABSORB == 1
-		float3 currentAbsorbance = absorbance * -collisionInfo.m_intersectionTime;
-
-		currentAbsorbance.x = pow(10, currentAbsorbance.x);
-		currentAbsorbance.y = pow(10, currentAbsorbance.y);
-		currentAbsorbance.z = pow(10, currentAbsorbance.z);
-		#endif
-
-		// get the diffuse color of the object we hit
-		float3 diffuseColorBase = material->m_diffuseColor;
-		if (material->m_diffuseTextureIndex >= 0)
-		{
-			// make texture coordinates
-			float4 textureCoords = {collisionInfo.m_textureCoordinates.x, collisionInfo.m_textureCoordinates.y, material->m_diffuseTextureIndex, 0};
-
-			// if this is a distance field texture
-			if (material->m_diffuseTextureIsDistanceField)
+			firstSurface = false;
+			primaryRay->m_firstHitObject = collisionInfo.m_objectHit;
+			primaryRay->m_firstHitNormal = collisionInfo.m_fromInside ? -collisionInfo.m_surfaceNormal : collisionInfo.m_surfaceNormal;
+			primaryRay->m_firstHitDistance = rayLength + collisionInfo.m_intersectionTime;
+			primaryRay->m_firstHitReusable = !IsReflective(material) && !IsRefractive(material) && !IsSpecular(material);
+
+			// the first surface the camera ray hits decides if last frame's color can be used instead of shading
+			#if TEMPORAL_REPROJECTION
+			if (primaryRay->m_canReuse && primaryRay->m_firstHitReusable &&
+				ReprojectHistory(dataRoot, primaryRay, cameraRayPos + cameraRayDir * primaryRay->m_firstHitDistance, pixelColor))
 			{
-				#if 1
-					const float smoothing = 1.0/64.0;
-					// do not convert to sRGB since this is a distance texture
-					float distance = read_imagef(tex3dIn, g_textureSampler, textureCoords).w;
-					float alpha = Saturate(smoothstep(0.5 - smoothing, 0.5 + smoothing, distance));
-					diffuseColorBase *= (float3)(1.0f - alpha);
-				#else
-					// do not convert to sRGB since this is a distance texture
-					float alpha = read_imagef(tex3dIn, g_textureSampler, textureCoords).w;
-					if (alpha > 0.5f)
-						diffuseColorBase *= (float3)(0.0f);
-				#endif
-			}
-			// else it's a regular texture map
-			else
-			{
-				// convert to sRGB since this is a color
-				diffuseColorBase *= LinearColorTosRGB(read_imagef(tex3dIn, g_textureSampler, textureCoords).xyz);
+				primaryRay->m_reused = true;
+				return;
 			}
+			#endif
 		}
+		#endif
 
-		// get the emissive color of the object we hit
-		float3 emissiveColor = material->m_emissiveColor;
-		if (material->m_emissiveTextureIndex >= 0)
+		// if we hit an object from the inside, flip it's normal, and also make sure no fog is used
+		if (collisionInfo.m_fromInside)
 		{
-			float4 textureCoords = {collisionInfo.m_textureCoordinates.x, collisionInfo.m_textureCoordinates.y, material->m_emissiveTextureIndex, 0};
-			// convert to sRGB since this is a color
-			emissiveColor *= LinearColorTosRGB(read_imagef(tex3dIn, g_textureSampler, textureCoords).xyz);
+			collisionInfo.m_surfaceNormal *= -1.0f;
+			fogColorAndAmount = (cl_float4)(0.0f);
 		}
 
-		#if DEBUG_TEXTURE_UV
-		diffuseColorBase = (float3)(collisionInfo.m_textureCoordinates.xy, 0.0f);
-		#endif
-
-		// apply ambient lighting, emissive color and the debug additive color
-		float3 diffuseColor = diffuseColorBase * ambientLight + emissiveColor + collisionInfo.m_debugAdditiveColor;
-
-		// apply diffuse / specular from a point light
-		for (int index = sector->m_staticLightStartIndex; index < sector->m_staticLightStopIndex; ++index)
-			ApplyPointLight(
-				&diffuseColor,
-				&collisionInfo,
-				sector,
-				material,
-				&lights[index],
-				rayDir,
-				spheres,
-				triangles,
-				objects,
-				models,
-				materials,
-				diffuseColorBase
-			);
+		const float3 currentAbsorbance = AbsorbanceFilter(absorbance, collisionInfo.m_intersectionTime);
+
+		// get the colors of the surface we hit, with ambient lighting, emissive color and the debug additive color applied
+		float3 diffuseColorBase;
+		rayLength += collisionInfo.m_intersectionTime;
+		float3 diffuseColor = ShadeSurface(textureAtlas, atlasTextures, material, &collisionInfo, ambientLight, &diffuseColorBase, rayDir, rayLength * pixelSpreadAngle);
+
+		// apply diffuse / specular from the point lights
+		ApplySectorPointLights(
+			&diffuseColor,
+			&collisionInfo,
+			sector,
+			material,
+			lights,
+			rayDir,
+			spheres,
+			triangles,
+			objects,
+			bvhNodes,
+			instanceBVHNodes,
+			models,
+			materials,
+			shadowTexels,
+			diffuseColorBase,
+			dataRoot->m_camera.m_frameCount
+		);
 
 		// if reflective, set up the reflected ray
 		if (IsReflective(material))
@@ -936,7 +1684,7 @@ void TraceRay (
 
 			// add this calculated color to the stack, tinting all future colors by the reflection color
 			const float3 filterColor = material->m_reflectionColor * currentAbsorbance;
-			AddColorStackItem(colorStack, &colorStackDepth, &filterColor, &diffuseColor, &fogColorAndAmount);
+			AddColorStackItem(colorStack, &colorStackDepth, &portalFilter, &portalAdd, &filterColor, &diffuseColor, &fogColorAndAmount);
 		}
 		// if refractive, set up the refracted ray
 		else if (IsRefractive(material))
@@ -957,46 +1705,181 @@ void TraceRay (
 
 			// add this calculated color to the stack, tinting all future colors by the refraction color
 			const float3 filterColor = material->m_refractionColor * currentAbsorbance;
-			AddColorStackItem(colorStack, &colorStackDepth, &filterColor, &diffuseColor, &fogColorAndAmount);
+			AddColorStackItem(colorStack, &colorStackDepth, &portalFilter, &portalAdd, &filterColor, &diffuseColor, &fogColorAndAmount);
 		}
 		// else we are done
 		else
 		{
 			// add this calculated color to the stack and bail out since it doesn't reflect or refract
 			const float3 white = (float3)(1.0f) * currentAbsorbance;
-			AddColorStackItem(colorStack, &colorStackDepth, &white, &diffuseColor, &fogColorAndAmount);
+			AddColorStackItem(colorStack, &colorStackDepth, &portalFilter, &portalAdd, &white, &diffuseColor, &fogColorAndAmount);
 			break;
 		}
+
+		++bounce;
 	}
 
-	*pixelColor = (float3)(0);
+	// a ray that ran out of portal crossings still gets the fog of the portals it went through
+	*pixelColor = portalAdd;
 	for (int index = colorStackDepth - 1; index >= 0; --index)
+		*pixelColor = *pixelColor * colorStack[index].m_filterColor + colorStack[index].m_addColor;
+}
+
+//==================================================================================================
+// Variable rate tracing
+//
+// clrt_coarse traces a ray through the corners of each SETTINGS_VARIABLERATETILE square tile of the
+// screen.  clrt then fills in the pixels of a tile from its corners when they all hit the same object,
+// facing the same way, lit about the same, and only traces the pixels of the tiles where they don't.
+// Flat walls end up costing a ray per tile, while silhouettes and shadow edges get every pixel traced.
+//==================================================================================================
+
+#if VARIABLE_RATE
+
+// the number of tile corners across and down, which is one more than the tiles across and down
+inline int2 CoarseSampleDims (const int2 dims)
+{
+	return (dims + SETTINGS_VARIABLERATETILE - 1) / SETTINGS_VARIABLERATETILE + 1;
+}
+
+// the pixel the ray for a tile corner goes through
+inline int2 CoarseSamplePixel (const int2 corner, const int2 dims)
+{
+	return min(corner * SETTINGS_VARIABLERATETILE, dims - 1);
+}
+
+// whether the tile corners saw the same surface, lit about the same, so the pixels between them can be
+// interpolated
+inline bool CoarseSamplesMatch (__global const struct SVariableRateSample *samples[4])
+{
+	const TObjectId objectHit = samples[0]->m_objectHit;
+	float3 minColor = samples[0]->m_color;
+	float3 maxColor = samples[0]->m_color;
+	for (int index = 1; index < 4; ++index)
+	{
+		if (samples[index]->m_objectHit != objectHit)
+			return false;
+
+		if (objectHit != c_invalidObjectId && dot(samples[index]->m_normal, samples[0]->m_normal) < c_variableRateNormalTolerance)
+			return false;
+
+		minColor = min(minColor, samples[index]->m_color);
+		maxColor = max(maxColor, samples[index]->m_color);
+	}
+
+	// the threshold is relative to the brightness, since that's how the eye sees differences
+	const float3 difference = maxColor - minColor;
+	const float threshold = SETTINGS_VARIABLERATETHRESHOLD * (ColorToGray(&maxColor) + c_variableRateMinBrightness);
+	return difference.x <= threshold && difference.y <= threshold && difference.z <= threshold;
+}
+
+// fills in the color of the pixel at coord from the corners of its tile.  Returns false if the corners
+// differ and the pixel needs to be traced.
+inline bool InterpolateCoarseSamples (__global const struct SVariableRateSample *coarseSamples, const int2 coord, const int2 dims, float3 *color)
+{
+	const int2 sampleDims = CoarseSampleDims(dims);
+	const int2 corner = coord / SETTINGS_VARIABLERATETILE;
+	const int2 pixel0 = CoarseSamplePixel(corner, dims);
+	const int2 pixel1 = CoarseSamplePixel(corner + 1, dims);
+
+	__global const struct SVariableRateSample *samples[4] =
+	{
+		&coarseSamples[corner.y * sampleDims.x + corner.x],
+		&coarseSamples[corner.y * sampleDims.x + corner.x + 1],
+		&coarseSamples[(corner.y + 1) * sampleDims.x + corner.x],
+		&coarseSamples[(corner.y + 1) * sampleDims.x + corner.x + 1],
+	};
+
+	// the corner pixel itself was traced already
+	if (coord.x == pixel0.x && coord.y == pixel0.y)
 	{
-		*pixelColor *= colorStack[index].m_filterColor;
-		*pixelColor += colorStack[index].m_addColor;
-		*pixelColor = mix(*pixelColor, colorStack[index].m_fogColorAndAmount.xyz, colorStack[index].m_fogColorAndAmount.w);
+		*color = samples[0]->m_color;
+		return true;
 	}
+
+	if (!CoarseSamplesMatch(samples))
+		return false;
+
+	// the tiles at the right and bottom edges can be thinner than the others
+	const int2 size = max(pixel1 - pixel0, (int2)(1));
+	const float2 fraction = convert_float2(coord - pixel0) / convert_float2(size);
+	const float3 top = mix(samples[0]->m_color, samples[1]->m_color, fraction.x);
+	const float3 bottom = mix(samples[2]->m_color, samples[3]->m_color, fraction.x);
+	*color = mix(top, bottom, fraction.y);
+	return true;
+}
+
+__kernel void clrt_coarse (
+	__read_only image2d_t textureAtlas,
+	__global const struct SAtlasTexture *atlasTextures,
+	__global const struct SSharedDataRootHostToKernel *dataRoot,
+	__global const struct SPointLight *lights,
+	__global const struct SSphere *spheres,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelTriangleShading *triangleShading,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SSector *sectors,
+	__global const struct SMaterial *materials,
+	__global const struct SPortal *portals,
+	__global const uint *shadowTexels,
+	__global struct SVariableRateSample *coarseSamples
+)
+{
+	const int2 dims = (int2)(dataRoot->m_camera.m_renderWidth, dataRoot->m_camera.m_renderHeight);
+	const int2 sampleDims = CoarseSampleDims(dims);
+	const int2 corner = (int2)(get_global_id(0), get_global_id(1));
+	if (corner.x >= sampleDims.x || corner.y >= sampleDims.y)
+		return;
+
+	// the same ray clrt would trace for the pixel
+	const float3 rayDir = CameraRayDir(&dataRoot->m_camera, CoarseSamplePixel(corner, dims), dims);
+
+	struct SPrimaryRay primaryRay;
+	InitPrimaryRay(&primaryRay);
+
+	float3 color = (float3)(0);
+	TraceRay(dataRoot, textureAtlas, atlasTextures, dataRoot->m_camera.m_pos, rayDir, &color, &primaryRay, lights, spheres, triangles, triangleShading, objects, bvhNodes, instanceBVHNodes, models, sectors, materials, portals, shadowTexels);
+
+	__global struct SVariableRateSample *sample = &coarseSamples[corner.y * sampleDims.x + corner.x];
+	sample->m_color = color;
+	sample->m_normal = primaryRay.m_firstHitNormal;
+	sample->m_objectHit = primaryRay.m_firstHitObject;
 }
 
+#endif // VARIABLE_RATE
+
 __kernel void clrt (
 	__write_only image2d_t texOut, 
-	__read_only image3d_t tex3dIn,
+	__read_only image2d_t textureAtlas,
+	__global const struct SAtlasTexture *atlasTextures,
 	__global const struct SSharedDataRootHostToKernel *dataRoot,
 	__global const struct SPointLight *lights,
 	__global const struct SSphere *spheres,
 	__global const struct SModelTriangle *triangles,
+	__global const struct SModelTriangleShading *triangleShading,
 	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
 	__global const struct SModelInstance *models,
 	__global const struct SSector *sectors,
 	__global const struct SMaterial *materials,
-	__global const struct SPortal *portals
-	//__global struct SSharedDataRootKernelToHost *outDataRoot
+	__global const struct SPortal *portals,
+	__global const uint *shadowTexels,
+	__global struct SSharedDataRootKernelToHost *outDataRoot,
+	__global const float4 *historyIn,
+	__global float4 *historyOut,
+	__global const struct SVariableRateSample *coarseSamples
 )
 {
-    const int2 dims = (int2)(get_image_width(texOut), get_image_height(texOut));
+	// only the top left of texOut is rendered when the resolution is scaled down
+	const int2 dims = (int2)(dataRoot->m_camera.m_renderWidth, dataRoot->m_camera.m_renderHeight);
 	const int2 coord = (int2)(get_global_id(0), get_global_id(1));
 
-	#if SETTINGS_INTERLACED == 1
+	// with temporal reprojection the other half is reprojected from last frame instead of left as it was
+	#if SETTINGS_INTERLACED == 1 && !TEMPORAL_REPROJECTION
 	if ((coord.y > dims.y / 2) == (dataRoot->m_camera.m_frameCount % 2))
 		return;
 	//if ((coord.y / 16) % 2 == dataRoot->m_camera.m_frameCount % 2)
@@ -1010,18 +1893,52 @@ __kernel void clrt (
 		return;
 
 	// calculate the ray direction
-	const float2 percent = (float2)(((float)coord.x / (float)dims.x) - 0.5f, ((float)coord.y / (float)dims.y) - 0.5f);
-	float3 rayDir = normalize((dataRoot->m_camera.m_fwd * dataRoot->m_camera.m_viewWidthHeightDistance.z)
-		- (dataRoot->m_camera.m_left * percent.x * dataRoot->m_camera.m_viewWidthHeightDistance.x)
-		- (dataRoot->m_camera.m_up * percent.y * dataRoot->m_camera.m_viewWidthHeightDistance.y));
+	float3 rayDir = CameraRayDir(&dataRoot->m_camera, coord, dims);
+
+	struct SPrimaryRay primaryRay;
+	InitPrimaryRay(&primaryRay);
+
+	#if TEMPORAL_REPROJECTION
+	// some of the pixels are traced fresh every frame, so the lighting of the pixels reusing last frame's
+	// color is never more than a few frames old.  With interlacing it's the half interlacing renders.
+	#if SETTINGS_INTERLACED == 1
+	const bool refresh = (coord.y > dims.y / 2) != (dataRoot->m_camera.m_frameCount % 2);
+	#else
+	const bool refresh = (coord.x + coord.y * 3 + dataRoot->m_camera.m_frameCount) % SETTINGS_TEMPORALREFRESH == 0;
+	#endif
+
+	primaryRay.m_historyIn = historyIn;
+	primaryRay.m_historyStride = get_image_width(texOut);
+	primaryRay.m_canReuse = !refresh && dataRoot->m_temporalHistoryValid;
+	#endif
 
-	// trace the ray
 	float3 color = (float3)(0);
-	TraceRay(dataRoot, tex3dIn, dataRoot->m_camera.m_pos, rayDir, &color, lights, spheres, triangles, objects, models, sectors, materials, portals);
+
+	// the pixels of tiles that clrt_coarse found to be all one surface are filled in from the corners
+	#if VARIABLE_RATE
+	const bool traced = !InterpolateCoarseSamples(coarseSamples, coord, dims, &color);
+	if (traced)
+	#endif
+	{
+		// trace the ray
+		TraceRay(dataRoot, textureAtlas, atlasTextures, dataRoot->m_camera.m_pos, rayDir, &color, &primaryRay, lights, spheres, triangles, triangleShading, objects, bvhNodes, instanceBVHNodes, models, sectors, materials, portals, shadowTexels);
+	}
+
+	// keep the color and what the pixel saw for next frame.  Interpolated pixels don't know what they saw.
+	#if TEMPORAL_REPROJECTION
+	historyOut[coord.y * primaryRay.m_historyStride + coord.x] = (float4)(color, primaryRay.m_firstHitReusable ? primaryRay.m_firstHitDistance : -1.0f);
+	#endif
+
+	#if VARIABLE_RATE && DEBUG_VARIABLE_RATE
+	if (traced)
+		color = mix(color, (float3)(1.0f, 0.0f, 0.0f), 0.25f);
+	#endif
 
 	// record the max brightness if we should
-	//if (dataRoot->m_camera.m_frameCount % dataRoot->m_camera.m_HDRBrightnessSamplingInterval == 0)
-	//  atomic_max(&outDataRoot->m_maxBrightness1000x, (unsigned int)(ColorToGray(&color) * 1000.0f));
+	#if SETTINGS_AUTOEXPOSURE == 1
+	if (dataRoot->m_camera.m_HDRBrightnessSamplingInterval > 0 && dataRoot->m_camera.m_frameCount % dataRoot->m_camera.m_HDRBrightnessSamplingInterval == 0)
+		atomic_max(&outDataRoot->m_maxBrightness1000x, (unsigned int)(ColorToGray(&color) * 1000.0f));
+	#endif
 
 	// adjust for brightness
 	color *= dataRoot->m_camera.m_brightnessMultiplier;
@@ -1032,7 +1949,7 @@ __kernel void clrt (
 
 		// trace the ray for the other eye
 		float3 rightEyePos = dataRoot->m_camera.m_pos + dataRoot->m_camera.m_left * SETTINGS_REDBLUEWIDTH;
-		TraceRay(dataRoot, tex3dIn, rightEyePos, rayDir, &color, lights, spheres, triangles, objects, models, sectors, materials, portals);
+		TraceRay(dataRoot, textureAtlas, atlasTextures, rightEyePos, rayDir, &color, 0, lights, spheres, triangles, triangleShading, objects, bvhNodes, instanceBVHNodes, models, sectors, materials, portals, shadowTexels);
 		color *= dataRoot->m_camera.m_brightnessMultiplier;
 		float grayRight = ColorToGray(&color);
 
@@ -1043,4 +1960,446 @@ __kernel void clrt (
 
 	// convert color from sRGB back to linear space
 	write_imagef(texOut, coord, (float4)(sRGBToLinearColor(color), 1.0)); 
-}
\ No newline at end of file
+}
+
+//==================================================================================================
+// Wavefront path
+//
+// The same rendering as the clrt kernel, with TraceRay() split into a kernel per stage so that each
+// launch runs one small, uniform piece of code instead of the whole megakernel:
+//
+//   wavefront_generate  - makes a path for each pixel (and eye) and queues it
+//   wavefront_extend    - finds the closest hit of each queued path's ray
+//   wavefront_shade     - handles the hit: misses, portals and surface colors, reflection and
+//                         refraction.  Paths that continue are compacted into the next queue, and
+//                         lit surface points are queued for wavefront_connect
+//   wavefront_connect   - applies the point lights to the queued surface points, with shadow rays
+//   wavefront_resolve   - writes out the final pixel colors
+//
+// extend, shade and connect run once per bounce, only over the rays still alive.  The queues and the
+// path state live in global memory, see SWavefront.h.  Platform/CWavefront.cpp runs the kernels.
+//==================================================================================================
+
+#if SETTINGS_WAVEFRONT == 1
+
+#if SETTINGS_REDBLUE3D == 1
+	#define c_wavefrontEyes 2
+#else
+	#define c_wavefrontEyes 1
+#endif
+
+inline void StoreWavefrontHit (__global struct SWavefrontHit *hit, const struct SCollisionInfo *info)
+{
+	hit->m_intersectionPoint = info->m_intersectionPoint;
+	hit->m_surfaceNormal = info->m_surfaceNormal;
+	hit->m_surfaceU = info->m_surfaceU;
+	hit->m_surfaceV = info->m_surfaceV;
+	hit->m_debugAdditiveColor = info->m_debugAdditiveColor;
+	hit->m_textureCoordinates = info->m_textureCoordinates;
+	hit->m_intersectionTime = info->m_intersectionTime;
+	hit->m_objectHit = info->m_objectHit;
+	hit->m_fromInside = info->m_fromInside ? 1 : 0;
+	hit->m_materialIndex = info->m_materialIndex;
+	hit->m_portalIndex = info->m_portalIndex;
+	hit->m_textureDensity = info->m_textureDensity;
+}
+
+inline void LoadWavefrontHit (struct SCollisionInfo *info, __global const struct SWavefrontHit *hit)
+{
+	info->m_intersectionPoint = hit->m_intersectionPoint;
+	info->m_surfaceNormal = hit->m_surfaceNormal;
+	info->m_surfaceU = hit->m_surfaceU;
+	info->m_surfaceV = hit->m_surfaceV;
+	info->m_debugAdditiveColor = hit->m_debugAdditiveColor;
+	info->m_textureCoordinates = hit->m_textureCoordinates;
+	info->m_intersectionTime = hit->m_intersectionTime;
+	info->m_objectHit = hit->m_objectHit;
+	info->m_fromInside = hit->m_fromInside != 0;
+	info->m_materialIndex = hit->m_materialIndex;
+	info->m_portalIndex = hit->m_portalIndex;
+	info->m_textureDensity = hit->m_textureDensity;
+}
+
+// folds a color stack item into the path.  Returns the filter color the item's add color gets multiplied by.
+inline float3 AddWavefrontColorStackItem (struct SWavefrontPath *path, const float3 filterColor, const float3 addColor, const cl_float4 fogColorAndAmount)
+{
+	const float3 addFilter = path->m_filterColor * (1.0f - fogColorAndAmount.w);
+	path->m_color += addFilter * addColor + path->m_filterColor * fogColorAndAmount.xyz * fogColorAndAmount.w;
+	path->m_filterColor = addFilter * filterColor;
+	return addFilter;
+}
+
+// clears the count of the queue a pass writes it's rays to, and of the shadow rays, and notes in
+// passStats whether the pass has any rays, which are in the other queue.  Run as a single work item
+// before each pass, so the counts never have to go through the host.  It's run once more after the last
+// pass, with pass being how many were run, to note whether any rays were left over, and once before the
+// camera rays are made with pass WAVEFRONT_RESET_FRAME, to clear passStats.
+__kernel void wavefront_reset (
+	__global cl_uint *queueCounts,
+	__global struct SWavefrontPassStats *passStats,
+	const cl_uint queueCountIndex,
+	const cl_uint pass
+)
+{
+	queueCounts[queueCountIndex] = 0;
+	queueCounts[e_wavefrontQueueCountShadow] = 0;
+
+	if (pass == WAVEFRONT_RESET_FRAME)
+	{
+		passStats->m_passesWithRays = 0;
+		passStats->m_passesRun = 0;
+		return;
+	}
+
+	passStats->m_passesRun = pass;
+	if (queueCounts[1 - queueCountIndex] > 0)
+		passStats->m_passesWithRays = pass + 1;
+}
+
+__kernel void wavefront_generate (
+	__global const struct SSharedDataRootHostToKernel *dataRoot,
+	__global struct SWavefrontPath *paths,
+	__global cl_uint *queue,
+	__global cl_uint *queueCounts,
+	const int width,
+	const int height
+)
+{
+	const int2 dims = (int2)(width, height);
+	const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+
+	#if SETTINGS_INTERLACED == 1
+	if ((coord.y > dims.y / 2) == (dataRoot->m_camera.m_frameCount % 2))
+		return;
+	#endif
+
+	if (coord.x >= dims.x || coord.y >= dims.y)
+		return;
+
+	const float3 rayDir = CameraRayDir(&dataRoot->m_camera, coord, dims);
+
+	for (unsigned int eye = 0; eye < c_wavefrontEyes; ++eye)
+	{
+		const unsigned int pathIndex = (coord.y * width + coord.x) * c_wavefrontEyes + eye;
+		__global struct SWavefrontPath *path = &paths[pathIndex];
+
+		// the right eye is off to the side of the camera
+		path->m_rayPos = dataRoot->m_camera.m_pos;
+		#if SETTINGS_REDBLUE3D == 1
+		if (eye == 1)
+			path->m_rayPos += dataRoot->m_camera.m_left * SETTINGS_REDBLUEWIDTH;
+		#endif
+
+		path->m_rayDir = rayDir;
+		path->m_absorbance = (float3)(0.0f);
+		path->m_filterColor = (float3)(1.0f);
+		path->m_color = (float3)(0.0f);
+		path->m_sector = dataRoot->m_camera.m_sector;
+		path->m_lastHitPrimitiveId = c_invalidObjectId;
+		path->m_bounce = 0;
+		path->m_rayLength = 0.0f;
+		path->m_portalCrossings = 0;
+
+		if (path->m_sector != -1)
+			queue[atomic_inc(&queueCounts[e_wavefrontQueueCountExtend0])] = pathIndex;
+	}
+}
+
+__kernel void wavefront_extend (
+	__global const struct SWavefrontPath *paths,
+	__global struct SWavefrontHit *hits,
+	__global const cl_uint *queue,
+	__global const cl_uint *queueCounts,
+	const cl_uint queueCountIndex,
+	__global const struct SPointLight *lights,
+	__global const struct SSphere *spheres,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelTriangleShading *triangleShading,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SSector *sectors,
+	__global const struct SMaterial *materials,
+	__global const struct SPortal *portals,
+	__global const uint *shadowTexels
+)
+{
+	const unsigned int queueIndex = get_global_id(0);
+	if (queueIndex >= queueCounts[queueCountIndex])
+		return;
+
+	const unsigned int pathIndex = queue[queueIndex];
+	__global const struct SWavefrontPath *path = &paths[pathIndex];
+
+	struct SCollisionInfo collisionInfo = 
+	{
+		c_invalidObjectId,
+		false,
+		{ 0.0f, 0.0f, 0.0f },
+		c_maxRayLength,
+		{ 0.0f, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, 0.0f },
+		{ 0.0f, 0.0f, 0.0f },
+		{ 0.0f, 0.0f },
+		#if DEBUG_RAY_BOUNCECOUNT
+		{ 1.0f / ((float)c_maxRayBounces), 1.0f / ((float)c_maxRayBounces), 1.0f / ((float)c_maxRayBounces) },
+		#else
+		{ 0.0f, 0.0f, 0.0f },
+		#endif
+		0,
+		0,
+		0.0f,
+	};
+
+	RayIntersectSectorContents(&sectors[path->m_sector], spheres, triangles, triangleShading, objects, bvhNodes, instanceBVHNodes, models, materials, &collisionInfo, path->m_rayPos, path->m_rayDir, path->m_lastHitPrimitiveId);
+
+	StoreWavefrontHit(&hits[pathIndex], &collisionInfo);
+}
+
+__kernel void wavefront_shade (
+	__read_only image2d_t textureAtlas,
+	__global const struct SAtlasTexture *atlasTextures,
+	__global const struct SSharedDataRootHostToKernel *dataRoot,
+	__global struct SWavefrontPath *paths,
+	__global const struct SWavefrontHit *hits,
+	__global const cl_uint *queue,
+	__global cl_uint *nextQueue,
+	__global struct SWavefrontShadowRay *shadowRays,
+	__global cl_uint *queueCounts,
+	const cl_uint queueCountIndex,
+	__global const struct SPointLight *lights,
+	__global const struct SSphere *spheres,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelTriangleShading *triangleShading,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SSector *sectors,
+	__global const struct SMaterial *materials,
+	__global const struct SPortal *portals,
+	__global const uint *shadowTexels
+)
+{
+	const unsigned int queueIndex = get_global_id(0);
+	if (queueIndex >= queueCounts[queueCountIndex])
+		return;
+
+	const unsigned int pathIndex = queue[queueIndex];
+	struct SWavefrontPath path = paths[pathIndex];
+
+	struct SCollisionInfo collisionInfo;
+	LoadWavefrontHit(&collisionInfo, &hits[pathIndex]);
+
+	__global const struct SSector *sector = &sectors[path.m_sector];
+	bool continuePath = false;
+
+	// if no hit, set pixel to ambient light and bail out
+	if (collisionInfo.m_objectHit == c_invalidObjectId)
+	{
+		const float3 white = (float3)(1.0f);
+		const float4 noFog = (float4)(0.0f);
+		AddWavefrontColorStackItem(&path, white, sector->m_ambientLight + collisionInfo.m_debugAdditiveColor, noFog);
+	}
+	else
+	{
+		// set the fog color and calculate how long the ray spent in the fog half space
+		cl_float4 fogColorAndAmount;
+		fogColorAndAmount.xyz = sector->m_fogColorAndFactor.xyz;
+		fogColorAndAmount.w = LineSegmentFogAmount(&path.m_rayPos, &collisionInfo.m_intersectionPoint, &sector->m_fogPlane, sector->m_fogColorAndFactor.w, sector->m_fogFactorMax, sector->m_fogMode);
+
+		path.m_rayLength += collisionInfo.m_intersectionTime;
+
+		// if we hit a portal, change our sector and transform the ray
+		if (collisionInfo.m_portalIndex != -1)
+		{
+			TransformRayThroughPortal(&portals[collisionInfo.m_portalIndex], &collisionInfo.m_intersectionPoint, &path.m_rayPos, &path.m_rayDir);
+			path.m_sector = portals[collisionInfo.m_portalIndex].m_sector;
+			path.m_lastHitPrimitiveId = collisionInfo.m_objectHit;
+			++path.m_portalCrossings;
+
+			// add a color stack item for portal traversal, just for the sake of handling fog.  It's folded
+			// into the path, so unlike a bounce it doesn't take anything but a launch.
+			const float3 white = (float3)(1.0f);
+			AddWavefrontColorStackItem(&path, white, collisionInfo.m_debugAdditiveColor, fogColorAndAmount);
+			continuePath = path.m_portalCrossings < SPORTAL_MAXCROSSINGS;
+		}
+		else
+		{
+			__global const struct SMaterial *material = &materials[collisionInfo.m_materialIndex];
+
+			// if we hit an object from the inside, flip it's normal, and also make sure no fog is used
+			if (collisionInfo.m_fromInside)
+			{
+				collisionInfo.m_surfaceNormal *= -1.0f;
+				fogColorAndAmount = (cl_float4)(0.0f);
+			}
+
+			const float3 currentAbsorbance = AbsorbanceFilter(path.m_absorbance, collisionInfo.m_intersectionTime);
+
+			float3 diffuseColorBase;
+			const float3 rayDir = path.m_rayDir;
+			const float3 diffuseColor = ShadeSurface(textureAtlas, atlasTextures, material, &collisionInfo, sector->m_ambientLight, &diffuseColorBase, rayDir, path.m_rayLength * PixelSpreadAngle(&dataRoot->m_camera));
+
+			float3 filterColor;
+			if (IsReflective(material))
+			{
+				path.m_rayPos = collisionInfo.m_intersectionPoint;
+				path.m_rayDir = reflect(rayDir, collisionInfo.m_surfaceNormal);
+				path.m_lastHitPrimitiveId = collisionInfo.m_objectHit;
+				filterColor = material->m_reflectionColor * currentAbsorbance;
+				continuePath = true;
+			}
+			else if (IsRefractive(material))
+			{
+				// push a little bit past the point of intersection so we don't intersect it again.  See TraceRay().
+				path.m_rayPos = collisionInfo.m_intersectionPoint + rayDir * 0.001f;
+				path.m_rayDir = refract(rayDir, collisionInfo.m_surfaceNormal, material->m_refractionIndex);
+				path.m_lastHitPrimitiveId = 0;
+
+				if (collisionInfo.m_fromInside)
+					path.m_absorbance -= material->m_absorbance;
+				else
+					path.m_absorbance += material->m_absorbance;
+
+				filterColor = material->m_refractionColor * currentAbsorbance;
+				continuePath = true;
+			}
+			else
+			{
+				filterColor = (float3)(1.0f) * currentAbsorbance;
+			}
+
+			const float3 addFilter = AddWavefrontColorStackItem(&path, filterColor, diffuseColor, fogColorAndAmount);
+
+			// queue the point lights to be applied
+			if (sector->m_staticLightStartIndex < sector->m_staticLightStopIndex)
+			{
+				__global struct SWavefrontShadowRay *shadowRay = &shadowRays[atomic_inc(&queueCounts[e_wavefrontQueueCountShadow])];
+				shadowRay->m_intersectionPoint = collisionInfo.m_intersectionPoint;
+				shadowRay->m_surfaceNormal = collisionInfo.m_surfaceNormal;
+				shadowRay->m_rayDir = rayDir;
+				shadowRay->m_diffuseColorBase = diffuseColorBase;
+				shadowRay->m_filterColor = addFilter;
+				shadowRay->m_pathIndex = pathIndex;
+				shadowRay->m_sector = path.m_sector;
+				shadowRay->m_objectHit = collisionInfo.m_objectHit;
+				shadowRay->m_materialIndex = collisionInfo.m_materialIndex;
+			}
+		}
+	}
+
+	// compact the paths that are still going into the next queue.  Only hits on surfaces count as bounces.
+	if (collisionInfo.m_objectHit == c_invalidObjectId || collisionInfo.m_portalIndex == -1)
+		++path.m_bounce;
+	const unsigned int maxRayBounces = min(c_maxRayBounces, (int)dataRoot->m_camera.m_maxRayBounces);
+	if (continuePath && path.m_bounce < maxRayBounces && path.m_sector != -1)
+		nextQueue[atomic_inc(&queueCounts[1 - queueCountIndex])] = pathIndex;
+
+	paths[pathIndex] = path;
+}
+
+__kernel void wavefront_connect (
+	__global const struct SSharedDataRootHostToKernel *dataRoot,
+	__global struct SWavefrontPath *paths,
+	__global const struct SWavefrontShadowRay *shadowRays,
+	__global const cl_uint *queueCounts,
+	__global const struct SPointLight *lights,
+	__global const struct SSphere *spheres,
+	__global const struct SModelTriangle *triangles,
+	__global const struct SModelTriangleShading *triangleShading,
+	__global const struct SModelObject *objects,
+	__global const struct SBVHNode *bvhNodes,
+	__global const struct SBVHNode *instanceBVHNodes,
+	__global const struct SModelInstance *models,
+	__global const struct SSector *sectors,
+	__global const struct SMaterial *materials,
+	__global const struct SPortal *portals,
+	__global const uint *shadowTexels
+)
+{
+	const unsigned int shadowRayIndex = get_global_id(0);
+	if (shadowRayIndex >= queueCounts[e_wavefrontQueueCountShadow])
+		return;
+
+	__global const struct SWavefrontShadowRay *shadowRay = &shadowRays[shadowRayIndex];
+	__global const struct SSector *sector = &sectors[shadowRay->m_sector];
+
+	// ApplyPointLight() only needs the point, normal and object hit of the collision
+	struct SCollisionInfo collisionInfo;
+	collisionInfo.m_objectHit = shadowRay->m_objectHit;
+	collisionInfo.m_intersectionPoint = shadowRay->m_intersectionPoint;
+	collisionInfo.m_surfaceNormal = shadowRay->m_surfaceNormal;
+
+	float3 lightColor = (float3)(0.0f);
+	ApplySectorPointLights(
+		&lightColor,
+		&collisionInfo,
+		sector,
+		&materials[shadowRay->m_materialIndex],
+		lights,
+		shadowRay->m_rayDir,
+		spheres,
+		triangles,
+		objects,
+		bvhNodes,
+		instanceBVHNodes,
+		models,
+		materials,
+		shadowTexels,
+		shadowRay->m_diffuseColorBase,
+		dataRoot->m_camera.m_frameCount
+	);
+
+	// each path has at most one shadow ray per bounce, so there is nobody else writing to the path
+	paths[shadowRay->m_pathIndex].m_color += shadowRay->m_filterColor * lightColor;
+}
+
+__kernel void wavefront_resolve (
+	__write_only image2d_t texOut,
+	__global const struct SSharedDataRootHostToKernel *dataRoot,
+	__global struct SSharedDataRootKernelToHost *outDataRoot,
+	__global const struct SWavefrontPath *paths,
+	const int width,
+	const int height
+)
+{
+	const int2 dims = (int2)(width, height);
+	const int2 coord = (int2)(get_global_id(0), get_global_id(1));
+
+	#if SETTINGS_INTERLACED == 1
+	if ((coord.y > dims.y / 2) == (dataRoot->m_camera.m_frameCount % 2))
+		return;
+	#endif
+
+	if (coord.x >= dims.x || coord.y >= dims.y)
+		return;
+
+	const unsigned int pathIndex = (coord.y * dims.x + coord.x) * c_wavefrontEyes;
+	float3 color = paths[pathIndex].m_color;
+
+	// record the max brightness if we should
+	#if SETTINGS_AUTOEXPOSURE == 1
+	if (dataRoot->m_camera.m_HDRBrightnessSamplingInterval > 0 && dataRoot->m_camera.m_frameCount % dataRoot->m_camera.m_HDRBrightnessSamplingInterval == 0)
+		atomic_max(&outDataRoot->m_maxBrightness1000x, (unsigned int)(ColorToGray(&color) * 1000.0f));
+	#endif
+
+	// adjust for brightness
+	color *= dataRoot->m_camera.m_brightnessMultiplier;
+
+	#if SETTINGS_REDBLUE3D == 1	
+		float grayLeft = ColorToGray(&color);
+		color = paths[pathIndex + 1].m_color * dataRoot->m_camera.m_brightnessMultiplier;
+		float grayRight = ColorToGray(&color);
+
+		color.x = grayLeft;
+		color.y = 0.0f;
+		color.z = grayRight;
+	#endif
+
+	// convert color from sRGB back to linear space
+	write_imagef(texOut, coord, (float4)(sRGBToLinearColor(color), 1.0));
+}
+
+#endif // SETTINGS_WAVEFRONT == 1
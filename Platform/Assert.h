@@ -6,11 +6,13 @@ Assert.h
 
 #pragma once
 
-#include <Windows.h>
-
 #define TOSTRING2(x) #x
 #define TOSTRING(x) TOSTRING2(x)
 
+#ifdef _WIN32
+
+#include <Windows.h>
+
 #define Assert_(x) { \
 	if (!(x)) { \
 		OutputDebugStringA("Failed: " TOSTRING(x) " at " __FUNCTION__ " " __FILE__ " line " TOSTRING(__LINE__) "\r\n"); \
@@ -25,4 +27,25 @@ Assert.h
 		OutputDebugStringA(buffer); \
 		((int*)0)[0] = 0; \
 	} \
-}
\ No newline at end of file
+}
+
+#else
+
+// non windows builds (the headless cpu renderer) report to stderr.  __FUNCTION__ isn't a string literal there.
+#include <stdio.h>
+
+#define Assert_(x) { \
+	if (!(x)) { \
+		fprintf(stderr, "Failed: " TOSTRING(x) " at %s " __FILE__ " line " TOSTRING(__LINE__) "\n", __FUNCTION__); \
+		((int*)0)[0] = 0; \
+	} \
+}
+
+#define AssertI_(x,i) { \
+	if (!(x)) { \
+		fprintf(stderr, "Failed: " TOSTRING(x) " (%i) at %s " __FILE__ " line " TOSTRING(__LINE__) "\n", i, __FUNCTION__); \
+		((int*)0)[0] = 0; \
+	} \
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*==================================================================================================
+
+BakeMain.cpp
+
+Entry point of the Bake executable.  Loads a world from xml and writes it out as a baked world (see
+CWorldBaked.cpp), the same as -bake does in the game, without needing windows or directx.
+
+==================================================================================================*/
+
+#include "CTextureManager.h"
+#include "Game/CWorld.h"
+#include "DataSchemas/DataSchemasXML.h"
+
+#include <stdio.h>
+#include <string>
+
+static const char *c_graphicsSettings = "./Data/GfxSettings.xml";
+
+//-----------------------------------------------------------------------------
+// Program main
+//-----------------------------------------------------------------------------
+int main (int argc, char** argv)
+{
+	// Bake <world file> [baked file]
+	if (argc < 2)
+	{
+		printf("usage: Bake <world file> [baked file]\n");
+		return 1;
+	}
+
+	SData_GfxSettings settings;
+	if (!DataSchemasXML::Load(settings, c_graphicsSettings, "GfxSettings"))
+		settings.SetDefault();
+
+	// only the texture names go in the baked world, but loading it decodes the textures all the same
+	CTextureManager textureManager;
+	textureManager.SetHeadless(true);
+	textureManager.Init(settings, NULL, NULL);
+
+	CWorld world;
+	if (!world.Load(argv[1], textureManager))
+	{
+		printf("Bake: could not load world %s\n", argv[1]);
+		return 1;
+	}
+
+	const std::string bakedFileName = argc > 2 ? argv[2] : CWorld::BakedFileName(argv[1]);
+	return world.Bake(bakedFileName.c_str()) ? 0 : 1;
+}
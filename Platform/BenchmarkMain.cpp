@@ -0,0 +1,18 @@
+/*==================================================================================================
+
+BenchmarkMain.cpp
+
+Entry point of the Benchmark executable.  See CBenchmark.h.
+
+==================================================================================================*/
+
+#include "CBenchmark.h"
+
+//-----------------------------------------------------------------------------
+// Program main
+//-----------------------------------------------------------------------------
+int main (int argc, char** argv)
+{
+	// Benchmark [camera path file] [output file]
+	return CBenchmark::Run(argc > 1 ? argv[1] : CBenchmark::c_defaultCameraPath, argc > 2 ? argv[2] : CBenchmark::c_defaultOutput);
+}
@@ -0,0 +1,308 @@
+/*==================================================================================================
+
+CBenchmark.cpp
+
+Headless benchmark.  Loads a map, flies the camera along a fixed camera path (see
+DataSchemas_Benchmark.h) rendering each frame with the cpu renderer, and writes out frame time
+statistics, rays per second and how many rays were traced at each bounce depth.
+
+==================================================================================================*/
+
+#include "CBenchmark.h"
+#include "CCPURenderer.h"
+#include "CTextureManager.h"
+#include "OS.h"
+#include "Game/CWorld.h"
+#include "Game/MatrixMath.h"
+#include "DataSchemas/DataSchemasXML.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+const char *CBenchmark::c_defaultCameraPath = "./Data/Benchmarks/level.xml";
+const char *CBenchmark::c_defaultOutput = "benchmark.json";
+const char *CBenchmark::c_graphicsSettings = "./Data/GfxSettings.xml";
+
+struct SBenchmarkFrame
+{
+	double				m_milliseconds;
+	CPUTrace::SRayStats	m_rayStats;
+};
+
+struct SBenchmarkSummary
+{
+	double				m_minMilliseconds;
+	double				m_medianMilliseconds;
+	double				m_p99Milliseconds;
+	double				m_meanMilliseconds;
+	double				m_raysPerSecond;
+	unsigned int		m_numBounces;		// how many entries of m_rayStats.m_raysPerBounce are used
+	CPUTrace::SRayStats	m_rayStats;			// totals over all frames
+};
+
+//-----------------------------------------------------------------------------
+static double TimeMilliseconds ()
+{
+	const std::chrono::steady_clock::duration now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration<double, std::milli>(now).count();
+}
+
+//-----------------------------------------------------------------------------
+static void InitCamera (SCamera &camera, unsigned int width, unsigned int height, float brightness)
+{
+	// the same view CCamera starts the game with
+	memset(&camera, 0, sizeof(camera));
+	camera.m_viewWidthHeightDistance[0] = 6.0f;
+	camera.m_viewWidthHeightDistance[1] = camera.m_viewWidthHeightDistance[0] * (float)height / (float)width;
+	camera.m_viewWidthHeightDistance[2] = 6.0f;
+	camera.m_brightnessMultiplier = brightness;
+}
+
+//-----------------------------------------------------------------------------
+static void LerpKeys (
+	const SData_CameraPathKey &a,
+	const SData_CameraPathKey &b,
+	float t,
+	float3 &pos,
+	float &pitch,
+	float &yaw
+)
+{
+	pos[0] = a.m_Position.m_x + (b.m_Position.m_x - a.m_Position.m_x) * t;
+	pos[1] = a.m_Position.m_y + (b.m_Position.m_y - a.m_Position.m_y) * t;
+	pos[2] = a.m_Position.m_z + (b.m_Position.m_z - a.m_Position.m_z) * t;
+	pitch = DegreesToRadians(a.m_Pitch + (b.m_Pitch - a.m_Pitch) * t);
+	yaw = DegreesToRadians(a.m_Yaw + (b.m_Yaw - a.m_Yaw) * t);
+}
+
+//-----------------------------------------------------------------------------
+static void SetCameraForFrame (const SData_CameraPath &path, const CWorld &world, unsigned int frame, SCamera &camera)
+{
+	// find the keys we are between.  The last frame sits on the last key.
+	const unsigned int numKeys = path.m_Key.size();
+	unsigned int keyIndex = frame / path.m_FramesPerKey;
+	float t = (float)(frame % path.m_FramesPerKey) / (float)path.m_FramesPerKey;
+	if (keyIndex >= numKeys - 1)
+	{
+		keyIndex = numKeys - 1;
+		t = 0.0f;
+	}
+	const SData_CameraPathKey &key = path.m_Key[keyIndex];
+	const SData_CameraPathKey &nextKey = path.m_Key[keyIndex + 1 < numKeys ? keyIndex + 1 : keyIndex];
+
+	// positions are relative to the sector, so there's no moving between keys in different sectors.  The
+	// camera holds still at the first key and cuts to the next.
+	if (key.m_Sector != nextKey.m_Sector)
+		t = 0.0f;
+
+	float3 pos;
+	float pitch, yaw;
+	LerpKeys(key, nextKey, t, pos, pitch, yaw);
+
+	// the same basis vectors Camera_GetBasisVectors() makes
+	float3 fwd;
+	fwd[0] = cos(yaw) * cos(pitch);
+	fwd[1] = sin(pitch);
+	fwd[2] = sin(yaw) * cos(pitch);
+
+	const float3 trueUp = {0.0f,1.0f,0.0f};
+	float3 left = normalize(cross(trueUp, fwd));
+	float3 up = normalize(cross(fwd, left));
+
+	camera.m_pos = pos;
+	camera.m_fwd = fwd;
+	camera.m_left = left;
+	camera.m_up = up;
+	camera.m_sector = world.GetSectorIDByName(key.m_Sector.c_str());
+	camera.m_frameCount = frame;
+}
+
+//-----------------------------------------------------------------------------
+static void Summarize (const std::vector<SBenchmarkFrame> &frames, SBenchmarkSummary &summary)
+{
+	std::vector<double> times;
+	double totalMilliseconds = 0.0;
+	summary.m_rayStats.Clear();
+	for (unsigned int index = 0, count = frames.size(); index < count; ++index)
+	{
+		times.push_back(frames[index].m_milliseconds);
+		totalMilliseconds += frames[index].m_milliseconds;
+		summary.m_rayStats.Add(frames[index].m_rayStats);
+	}
+
+	// nearest rank percentiles
+	std::sort(times.begin(), times.end());
+	const unsigned int count = times.size();
+	summary.m_minMilliseconds = times[0];
+	summary.m_medianMilliseconds = times[(count - 1) / 2];
+	summary.m_p99Milliseconds = times[(count * 99 + 99) / 100 - 1];
+	summary.m_meanMilliseconds = totalMilliseconds / (double)count;
+	summary.m_raysPerSecond = totalMilliseconds > 0.0 ? (double)summary.m_rayStats.TotalRays() * 1000.0 / totalMilliseconds : 0.0;
+
+	summary.m_numBounces = 0;
+	for (unsigned int index = 0; index < CPUTrace::c_maxRayBounces; ++index)
+	{
+		if (summary.m_rayStats.m_raysPerBounce[index] > 0)
+			summary.m_numBounces = index + 1;
+	}
+}
+
+//-----------------------------------------------------------------------------
+static void WriteJSONString (FILE *file, const char *string)
+{
+	fputc('"', file);
+	for (; *string; ++string)
+	{
+		if (*string == '"' || *string == '\\')
+			fputc('\\', file);
+		fputc(*string, file);
+	}
+	fputc('"', file);
+}
+
+//-----------------------------------------------------------------------------
+static void WriteJSON (
+	FILE *file,
+	const char *cameraPathFileName,
+	const SData_CameraPath &path,
+	unsigned int numThreads,
+	const std::vector<SBenchmarkFrame> &frames,
+	const SBenchmarkSummary &summary
+)
+{
+	fprintf(file, "{\n\t\"cameraPath\": ");
+	WriteJSONString(file, cameraPathFileName);
+	fprintf(file, ",\n\t\"map\": ");
+	WriteJSONString(file, path.m_Map.c_str());
+	fprintf(file, ",\n\t\"renderer\": \"cpu\",\n");
+	fprintf(file, "\t\"threads\": %u,\n", numThreads);
+	fprintf(file, "\t\"width\": %u,\n", (unsigned int)path.m_Resolution.m_x);
+	fprintf(file, "\t\"height\": %u,\n", (unsigned int)path.m_Resolution.m_y);
+	fprintf(file, "\t\"frames\": %u,\n", (unsigned int)frames.size());
+	fprintf(file, "\t\"frameTimeMs\": { \"min\": %.3f, \"median\": %.3f, \"p99\": %.3f, \"mean\": %.3f },\n",
+		summary.m_minMilliseconds, summary.m_medianMilliseconds, summary.m_p99Milliseconds, summary.m_meanMilliseconds);
+	fprintf(file, "\t\"raysPerSecond\": %.0f,\n", summary.m_raysPerSecond);
+	fprintf(file, "\t\"totalRays\": %llu,\n", summary.m_rayStats.TotalRays());
+	fprintf(file, "\t\"shadowRays\": %llu,\n", summary.m_rayStats.m_shadowRays);
+
+	fprintf(file, "\t\"raysPerBounce\": [");
+	for (unsigned int index = 0; index < summary.m_numBounces; ++index)
+		fprintf(file, "%s%llu", index > 0 ? ", " : "", summary.m_rayStats.m_raysPerBounce[index]);
+	fprintf(file, "],\n");
+
+	fprintf(file, "\t\"frameTimesMs\": [");
+	for (unsigned int index = 0, count = frames.size(); index < count; ++index)
+		fprintf(file, "%s%.3f", index > 0 ? ", " : "", frames[index].m_milliseconds);
+	fprintf(file, "]\n}\n");
+}
+
+//-----------------------------------------------------------------------------
+static void WriteCSV (FILE *file, const std::vector<SBenchmarkFrame> &frames, const SBenchmarkSummary &summary)
+{
+	// one row per frame
+	fprintf(file, "frame,ms,rays,shadowRays");
+	for (unsigned int index = 0; index < summary.m_numBounces; ++index)
+		fprintf(file, ",bounce%u", index);
+	fprintf(file, "\n");
+
+	for (unsigned int frameIndex = 0, count = frames.size(); frameIndex < count; ++frameIndex)
+	{
+		const SBenchmarkFrame &frame = frames[frameIndex];
+		fprintf(file, "%u,%.3f,%llu,%llu", frameIndex, frame.m_milliseconds, frame.m_rayStats.TotalRays(), frame.m_rayStats.m_shadowRays);
+		for (unsigned int index = 0; index < summary.m_numBounces; ++index)
+			fprintf(file, ",%llu", frame.m_rayStats.m_raysPerBounce[index]);
+		fprintf(file, "\n");
+	}
+}
+
+//-----------------------------------------------------------------------------
+int CBenchmark::Run (const char *cameraPathFileName, const char *outputFileName)
+{
+	SData_CameraPath path;
+	if (!DataSchemasXML::Load(path, cameraPathFileName, "CameraPath"))
+	{
+		printf("Benchmark: could not load camera path %s\n", cameraPathFileName);
+		return 1;
+	}
+
+	const unsigned int width = (unsigned int)path.m_Resolution.m_x;
+	const unsigned int height = (unsigned int)path.m_Resolution.m_y;
+	if (path.m_Key.empty() || path.m_FramesPerKey == 0 || width == 0 || height == 0)
+	{
+		printf("Benchmark: camera path %s needs at least one key, FramesPerKey and a resolution\n", cameraPathFileName);
+		return 1;
+	}
+
+	// the graphics settings decide what the renderer does, same as in the game
+	SData_GfxSettings settings;
+	if (!DataSchemasXML::Load(settings, c_graphicsSettings, "GfxSettings"))
+	{
+		printf("Benchmark: could not load %s, using the default graphics settings\n", c_graphicsSettings);
+		settings.SetDefault();
+	}
+
+	// load the world.  Headless, the textures are put together in memory for the cpu renderer to sample.
+	CTextureManager textureManager;
+	textureManager.SetHeadless(true);
+	textureManager.Init(settings, NULL, NULL);
+
+	CWorld world;
+	if (!world.Load(path.m_Map.c_str(), textureManager))
+	{
+		printf("Benchmark: could not load map %s\n", path.m_Map.c_str());
+		return 1;
+	}
+
+	SCamera camera;
+	InitCamera(camera, width, height, settings.m_Brightness);
+
+	CCPURenderer renderer(path.m_Threads);
+
+	// warm up the caches and the worker threads at the first key
+	for (unsigned int index = 0; index < path.m_WarmupFrames; ++index)
+	{
+		SetCameraForFrame(path, world, 0, camera);
+		renderer.Render(world, textureManager, camera, settings, width, height);
+	}
+
+	// render the path
+	const unsigned int numFrames = (path.m_Key.size() - 1) * path.m_FramesPerKey + 1;
+	std::vector<SBenchmarkFrame> frames(numFrames);
+	for (unsigned int index = 0; index < numFrames; ++index)
+	{
+		SetCameraForFrame(path, world, index, camera);
+
+		const double startTime = TimeMilliseconds();
+		renderer.Render(world, textureManager, camera, settings, width, height);
+		frames[index].m_milliseconds = TimeMilliseconds() - startTime;
+		frames[index].m_rayStats = renderer.GetRayStats();
+	}
+
+	SBenchmarkSummary summary;
+	Summarize(frames, summary);
+
+	printf("Benchmark: %s, %u frames at %ux%u on %u threads\n", cameraPathFileName, numFrames, width, height, renderer.NumThreads());
+	printf("  frame ms: min %.3f, median %.3f, p99 %.3f, mean %.3f\n",
+		summary.m_minMilliseconds, summary.m_medianMilliseconds, summary.m_p99Milliseconds, summary.m_meanMilliseconds);
+	printf("  rays/sec: %.0f\n", summary.m_raysPerSecond);
+
+	// write the results
+	FILE *file = fopen(outputFileName, "wt");
+	if (!file)
+	{
+		printf("Benchmark: could not write %s\n", outputFileName);
+		return 1;
+	}
+
+	const size_t outputFileNameLength = strlen(outputFileName);
+	if (outputFileNameLength >= 4 && !OS::StringCompareNoCase(&outputFileName[outputFileNameLength - 4], ".csv"))
+		WriteCSV(file, frames, summary);
+	else
+		WriteJSON(file, cameraPathFileName, path, renderer.NumThreads(), frames, summary);
+
+	fclose(file);
+	return 0;
+}
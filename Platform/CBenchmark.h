@@ -0,0 +1,27 @@
+/*==================================================================================================
+
+CBenchmark.h
+
+Headless benchmark.  Loads a map, flies the camera along a fixed camera path (see
+DataSchemas_Benchmark.h) rendering each frame with the cpu renderer, and writes out frame time
+statistics, rays per second and how many rays were traced at each bounce depth.
+
+The benchmark is a separate executable, Benchmark, which CMakeLists.txt builds on any platform.  It
+doesn't need windows, directx or an opencl device.  Run it from the repository root with:
+Benchmark [camera path file] [output file]
+The output is written as .csv if the output file name ends in .csv, otherwise as .json.
+
+==================================================================================================*/
+
+#pragma once
+
+class CBenchmark
+{
+public:
+	// runs the benchmark and returns the exit code for the process
+	static int Run (const char *cameraPathFileName, const char *outputFileName);
+
+	static const char *c_defaultCameraPath;
+	static const char *c_defaultOutput;
+	static const char *c_graphicsSettings;
+};
@@ -0,0 +1,176 @@
+/*==================================================================================================
+
+CCPURenderer.cpp
+
+Renders a CWorld on the cpu, using the C++ port of the kernel code in CPUTrace.h.  The frame is
+split into tiles which are spread across all cores.  The output is a float RGBA frame buffer
+holding the same values clrt writes to it's output texture.
+
+==================================================================================================*/
+
+#include "CCPURenderer.h"
+#include "Game/CWorld.h"
+#include "CTextureManager.h"
+
+#include <stdio.h>
+
+//-----------------------------------------------------------------------------
+CCPURenderer::CCPURenderer (unsigned int numThreads)
+	: m_jobSystem(numThreads)
+	, m_width(0)
+	, m_height(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+static inline void WritePixel (float *frameBuffer, unsigned int width, unsigned int x, unsigned int y, const cl_float4 &color)
+{
+	float *pixel = &frameBuffer[(y * width + x) * 4];
+	pixel[0] = color.s[0];
+	pixel[1] = color.s[1];
+	pixel[2] = color.s[2];
+	pixel[3] = color.s[3];
+}
+
+//-----------------------------------------------------------------------------
+void CCPURenderer::Render (
+	const CWorld &world,
+	const CTextureManager &textureManager,
+	const SCamera &camera,
+	const SData_GfxSettings &settings,
+	unsigned int width,
+	unsigned int height
+)
+{
+	m_width = width;
+	m_height = height;
+	m_frameBuffer.resize(width * height * 4);
+
+	CPUTrace::SScene scene;
+	scene.m_lights = world.m_pointLights.DataConst();
+	scene.m_spheres = world.m_spheres.DataConst();
+	scene.m_triangles = world.m_modelTriangles.DataConst();
+	scene.m_triangleShading = world.m_modelTriangleShading.DataConst();
+	scene.m_objects = world.m_modelObjects.DataConst();
+	scene.m_bvhNodes = world.m_modelBVHNodes.DataConst();
+	scene.m_instanceBVHNodes = world.m_modelInstanceBVHNodes.DataConst();
+	scene.m_models = world.m_modelInstances.DataConst();
+	scene.m_sectors = world.m_sectors.DataConst();
+	scene.m_materials = world.m_materials.DataConst();
+	scene.m_portals = world.m_portals.DataConst();
+	scene.m_shadowTexels = (const cl_uint *)world.m_shadowTexels.DataConst();
+	scene.m_textureAtlas = textureManager.GetHostAtlas();
+	scene.m_textureAtlasWidth = textureManager.AtlasWidth();
+	scene.m_textureAtlasHeight = textureManager.AtlasHeight();
+	scene.m_atlasTextures = textureManager.GetHostAtlasTextures();
+	scene.m_settings = &settings;
+	scene.m_frameCount = camera.m_frameCount;
+	scene.m_pixelSpreadAngle = CPUTrace::PixelSpreadAngle(camera, width);
+
+	// each job renders one tile
+	const unsigned int tilesX = (width + c_tileSize - 1) / c_tileSize;
+	const unsigned int tilesY = (height + c_tileSize - 1) / c_tileSize;
+	float *frameBuffer = m_frameBuffer.empty() ? NULL : &m_frameBuffer[0];
+
+	// each tile counts it's own rays so the jobs don't have to share counters
+	m_tileRayStats.resize(tilesX * tilesY);
+	CPUTrace::SRayStats *tileRayStats = m_tileRayStats.empty() ? NULL : &m_tileRayStats[0];
+
+	m_jobSystem.ParallelFor(tilesX * tilesY,
+		[&] (unsigned int tileIndex)
+		{
+			const unsigned int startX = (tileIndex % tilesX) * c_tileSize;
+			const unsigned int startY = (tileIndex / tilesX) * c_tileSize;
+			const unsigned int stopX = startX + c_tileSize < width ? startX + c_tileSize : width;
+			const unsigned int stopY = startY + c_tileSize < height ? startY + c_tileSize : height;
+			CPUTrace::SRayStats &rayStats = tileRayStats[tileIndex];
+			rayStats.Clear();
+			if (settings.m_PacketTracing)
+			{
+				// the tile size is a multiple of the packet size, so packets never cross tiles
+				for (unsigned int y = startY; y < stopY; y += CPUTrace::c_packetHeight)
+				{
+					for (unsigned int x = startX; x < stopX; x += CPUTrace::c_packetWidth)
+					{
+						cl_float4 colors[CPUTrace::c_packetSize];
+						CPUTrace::TracePixelPacket(scene, camera, x, y, width, height, colors, &rayStats);
+						for (unsigned int lane = 0; lane < CPUTrace::c_packetSize; ++lane)
+						{
+							const unsigned int pixelX = x + lane % CPUTrace::c_packetWidth;
+							const unsigned int pixelY = y + lane / CPUTrace::c_packetWidth;
+							if (pixelX < stopX && pixelY < stopY)
+								WritePixel(frameBuffer, width, pixelX, pixelY, colors[lane]);
+						}
+					}
+				}
+			}
+			else
+			{
+				for (unsigned int y = startY; y < stopY; ++y)
+				{
+					for (unsigned int x = startX; x < stopX; ++x)
+						WritePixel(frameBuffer, width, x, y, CPUTrace::TracePixel(scene, camera, x, y, width, height, &rayStats));
+				}
+			}
+		}
+	);
+
+	m_rayStats.Clear();
+	for (unsigned int index = 0, count = m_tileRayStats.size(); index < count; ++index)
+		m_rayStats.Add(m_tileRayStats[index]);
+}
+
+//-----------------------------------------------------------------------------
+static void WriteLittleEndian (unsigned char *dest, unsigned int value, unsigned int numBytes)
+{
+	for (unsigned int index = 0; index < numBytes; ++index)
+		dest[index] = (unsigned char)((value >> (index * 8)) & 0xFF);
+}
+
+//-----------------------------------------------------------------------------
+bool CCPURenderer::SaveBMP (const char *fileName) const
+{
+	if (m_frameBuffer.empty())
+		return false;
+
+	FILE *file = fopen(fileName, "wb");
+	if (!file)
+		return false;
+
+	// bmp rows are padded to 4 bytes
+	const unsigned int rowSize = (m_width * 3 + 3) & ~3;
+	const unsigned int headerSize = 14 + 40;
+
+	unsigned char header[headerSize] = { 0 };
+	header[0] = 'B';
+	header[1] = 'M';
+	WriteLittleEndian(&header[2], headerSize + rowSize * m_height, 4);
+	WriteLittleEndian(&header[10], headerSize, 4);
+	WriteLittleEndian(&header[14], 40, 4);
+	WriteLittleEndian(&header[18], m_width, 4);
+	WriteLittleEndian(&header[22], m_height, 4);
+	WriteLittleEndian(&header[26], 1, 2);
+	WriteLittleEndian(&header[28], 24, 2);
+	WriteLittleEndian(&header[34], rowSize * m_height, 4);
+	fwrite(header, headerSize, 1, file);
+
+	// bmp rows are stored bottom row first, as BGR
+	std::vector<unsigned char> row(rowSize, 0);
+	for (unsigned int y = m_height; y-- > 0;)
+	{
+		for (unsigned int x = 0; x < m_width; ++x)
+		{
+			const float *pixel = &m_frameBuffer[(y * m_width + x) * 4];
+			for (unsigned int channel = 0; channel < 3; ++channel)
+			{
+				float value = pixel[2 - channel];
+				value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+				row[x * 3 + channel] = (unsigned char)(value * 255.0f + 0.5f);
+			}
+		}
+		fwrite(&row[0], rowSize, 1, file);
+	}
+
+	fclose(file);
+	return true;
+}
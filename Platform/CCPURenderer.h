@@ -0,0 +1,62 @@
+/*==================================================================================================
+
+CCPURenderer.h
+
+Renders a CWorld on the cpu, using the C++ port of the kernel code in CPUTrace.h.  The frame is
+split into tiles which are spread across all cores.  The output is a float RGBA frame buffer
+holding the same values clrt writes to it's output texture.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "CJobSystem.h"
+#include "CPUTrace.h"
+#include "KernelCode/Shared/SCamera.h"
+#include <vector>
+
+class CWorld;
+class CTextureManager;
+struct SData_GfxSettings;
+
+class CCPURenderer
+{
+public:
+	// numThreads of 0 means use all hardware threads
+	CCPURenderer (unsigned int numThreads = 0);
+
+	// renders the world as seen from the camera into the frame buffer, resizing it if needed.  Textures are
+	// sampled from the texture manager's atlas in memory, if it has one.
+	void Render (
+		const CWorld &world,
+		const CTextureManager &textureManager,
+		const SCamera &camera,
+		const SData_GfxSettings &settings,
+		unsigned int width,
+		unsigned int height
+	);
+
+	// RGBA floats, width * height pixels, top row first
+	const float* GetFrameBuffer () const { return m_frameBuffer.empty() ? NULL : &m_frameBuffer[0]; }
+
+	unsigned int Width () const { return m_width; }
+	unsigned int Height () const { return m_height; }
+
+	unsigned int NumThreads () const { return m_jobSystem.NumThreads(); }
+
+	// the rays traced by the last Render()
+	const CPUTrace::SRayStats& GetRayStats () const { return m_rayStats; }
+
+	// writes the frame buffer out as a 24 bit .bmp, clamping colors to 0-1
+	bool SaveBMP (const char *fileName) const;
+
+	static const unsigned int c_tileSize = 16;
+
+private:
+	CJobSystem				m_jobSystem;
+	std::vector<float>		m_frameBuffer;
+	std::vector<CPUTrace::SRayStats>	m_tileRayStats;
+	CPUTrace::SRayStats		m_rayStats;
+	unsigned int			m_width;
+	unsigned int			m_height;
+};
@@ -10,6 +10,9 @@ DirectX and OpenCL code lives here
 #include "Game/CCamera.h"
 #include "Game/CGame.h"
 #include "Game/CInput.h"
+#include "CCPURenderer.h"
+#include "CWorkerThread.h"
+#include "ECS/ECS.h"
 #include <direct.h>
 
 #include <vector>
@@ -42,6 +45,7 @@ size_t shrRoundUp(int group_size, int global_size)
 
 static const char g_simpleEffectSrc[] =
     "Texture2D g_Texture2D; \n" \
+    "float4 g_UVScaleMax; \n" \
     "\n" \
     "SamplerState samLinear{ \n" \
     "    Filter = MIN_MAG_LINEAR_MIP_POINT; \n" \
@@ -61,7 +65,7 @@ static const char g_simpleEffectSrc[] =
     "\n" \
     "float4 PS( Fragment f ) : SV_Target\n" \
     "{\n" \
-    "    return g_Texture2D.Sample( samLinear, f.Tex.xy ); \n" \
+    "    return g_Texture2D.Sample( samLinear, min(f.Tex.xy * g_UVScaleMax.xy, g_UVScaleMax.zw) ); \n" \
     "}\n" \
     "\n" \
     "technique10 Render\n" \
@@ -87,13 +91,17 @@ CDirectX::CDirectX ()
 	, m_pSimpleEffect(NULL)
 	, m_pSimpleTechnique(NULL)
 	, m_pTexture2D(NULL)
+	, m_pUVScaleMax(NULL)
 	, m_clGetDeviceIDsFromD3D10KHR(NULL)
 	, m_clCreateFromD3D10Texture2DKHR(NULL)
 	, m_clEnqueueAcquireD3D10ObjectsKHR(NULL)
 	, m_clEnqueueReleaseD3D10ObjectsKHR(NULL)
+	, m_renderWidth(0)
+	, m_renderHeight(0)
 	, m_recording(false)
 	, m_recordingFrameNumber(0)
 	, m_wantsScreenshot(false)
+	, m_wantsCPUScreenshot(false)
 {
 }
 
@@ -120,11 +128,17 @@ CDirectX::~CDirectX ()
 
 	m_world.Release();
 
-	if(m_ckKernel_tex2d)
-		clReleaseKernel(m_ckKernel_tex2d); 
+	m_wavefront.Release();
 
-    if(m_cpProgram_tex2d)
-		clReleaseProgram(m_cpProgram_tex2d);
+	m_qualityGovernor.Release();
+	m_temporalHistory.Release();
+	m_variableRate.Release();
+
+	SSharedDataRootHostToKernel::Get().Release();
+	SSharedDataRootKernelToHost::Get().Release();
+
+	m_kernelVariants.Release();
+	m_ckKernel_tex2d = NULL;
 
     if(m_cqCommandQueue)
 		clReleaseCommandQueue(m_cqCommandQueue);
@@ -141,8 +155,6 @@ CDirectX::~CDirectX ()
 {
 	const SData_GfxSettings& settings = Settings();
 
-	m_textureManager.Init();
-
 	m_width = (unsigned int)settings.m_Resolution.m_x;
 	m_height = (unsigned int)settings.m_Resolution.m_y;
 
@@ -188,6 +200,15 @@ CDirectX::~CDirectX ()
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+void CDirectX::InitHeadless ()
+{
+	m_textureManager.SetHeadless(true);
+	m_textureManager.Init(m_graphicsSettings, NULL, NULL);
+
+	m_world.Load(m_worldFileName.c_str(), m_textureManager);
+}
+
  //-----------------------------------------------------------------------------
 HRESULT CDirectX::InitCL()
 {
@@ -243,14 +264,43 @@ HRESULT CDirectX::InitCL()
     printf("\n");
 
     // create a command-queue
-    m_cqCommandQueue = clCreateCommandQueue(m_cxGPUContext, cdDevice, 0, &ciErrNum);
+    // with profiling, so the quality governor can time the kernels
+    m_cqCommandQueue = clCreateCommandQueue(m_cxGPUContext, cdDevice, CL_QUEUE_PROFILING_ENABLE, &ciErrNum);
 	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-	CreateKernelProgram("./KernelCode/clrt.cl", "clrt.ptx", "clrt", m_cpProgram_tex2d, m_ckKernel_tex2d);
+	// build the kernel for the starting settings now, later settings get built in the background
+	m_kernelVariants.Init(m_cxGPUContext, cdDevice, "./KernelCode/clrt.cl", "clrt.ptx", "clrt");
+	if (!m_kernelVariants.BuildNow(m_graphicsSettings) || !UseKernelVariant())
+		return E_FAIL;
 
 	return S_OK;
 }
 
+//-----------------------------------------------------------------------------
+bool CDirectX::UseKernelVariant ()
+{
+	const SKernelVariant &variant = m_kernelVariants.Current();
+	m_ckKernel_tex2d = variant.m_kernel;
+
+	// a different kernel may shade the pixels differently
+	m_temporalHistory.Invalidate();
+
+	// the wavefront and variable rate kernels are built into the same program
+	bool success = true;
+	if (variant.m_settings.m_VariableRate && !variant.m_settings.m_RedBlue3D && !variant.m_settings.m_WavefrontPath)
+		success = m_variableRate.Init(variant.m_program);
+	else
+		m_variableRate.Release();
+
+	if (!variant.m_settings.m_WavefrontPath)
+	{
+		m_wavefront.Release();
+		return success;
+	}
+
+	return m_wavefront.Init(variant.m_program) && success;
+}
+
 //-----------------------------------------------------------------------------
 void CDirectX::LoadGraphicsSettings ()
 {
@@ -260,6 +310,29 @@ void CDirectX::LoadGraphicsSettings ()
 	DataSchemasXML::Load(m_graphicsSettings, "./data/gfxsettings.xml", "GfxSettings");
 }
 
+//-----------------------------------------------------------------------------
+void CDirectX::SetGraphicsSettings (const SData_GfxSettings &settings)
+{
+	// the window, textures and map are set up once at startup, so those settings stay as they were
+	SData_GfxSettings newSettings = settings;
+	newSettings.m_Resolution = m_graphicsSettings.m_Resolution;
+	newSettings.m_FullScreen = m_graphicsSettings.m_FullScreen;
+	newSettings.m_DefaultMap = m_graphicsSettings.m_DefaultMap;
+	newSettings.m_TextureSize = m_graphicsSettings.m_TextureSize;
+	m_graphicsSettings = newSettings;
+
+	if (m_kernelVariants.HasCurrent())
+		m_kernelVariants.Request(m_graphicsSettings);
+}
+
+//-----------------------------------------------------------------------------
+void CDirectX::ReloadGraphicsSettings ()
+{
+	SData_GfxSettings settings;
+	if (DataSchemasXML::Load(settings, "./data/gfxsettings.xml", "GfxSettings"))
+		SetGraphicsSettings(settings);
+}
+
 PBITMAPINFO CreateBitmapInfoStruct(HWND hwnd, HBITMAP hBmp)
 { 
     BITMAP bmp; 
@@ -423,7 +496,8 @@ void CreateBMPFile(HWND hwnd, const char *pszFile, PBITMAPINFO pbi,
 }
 
 //-----------------------------------------------------------------------------
-void CDirectX::TakeScreenshot ()
+// finds the first file name of the form "format" with a number in it that doesn't exist yet
+static void GetNextScreenshotFileName (const char *format, char *fileName)
 {
 	// make sure the screenshots directory exists
 	_mkdir("Screenshots");
@@ -431,11 +505,10 @@ void CDirectX::TakeScreenshot ()
 	// find the next screen shot number to take
 	FILE *File = NULL;
 	bool done = false;
-	char fileName[256];
 	int nextFileIndex = 1;
 	do 
 	{
-		sprintf(fileName,"Screenshots/Screen%i.bmp",nextFileIndex);
+		sprintf(fileName,format,nextFileIndex);
 		File = fopen(fileName,"rb");
 
 		if(File)
@@ -449,10 +522,31 @@ void CDirectX::TakeScreenshot ()
 		}
 	} 
 	while(!done);
+}
 
+//-----------------------------------------------------------------------------
+void CDirectX::TakeScreenshot ()
+{
+	char fileName[256];
+	GetNextScreenshotFileName("Screenshots/Screen%i.bmp", fileName);
 	TakeScreenshot(fileName);
 }
 
+//-----------------------------------------------------------------------------
+void CDirectX::TakeCPUScreenshot ()
+{
+	// render the current view with the cpu reference renderer, to compare against the kernel's output
+	// it samples the textures from a copy of the atlas in memory
+	m_textureManager.ReadBackAtlas();
+
+	CCPURenderer renderer;
+	renderer.Render(m_world, m_textureManager, SSharedDataRootHostToKernel::CameraConst(), m_graphicsSettings, m_width, m_height);
+
+	char fileName[256];
+	GetNextScreenshotFileName("Screenshots/CPUScreen%i.bmp", fileName);
+	renderer.SaveBMP(fileName);
+}
+
 //-----------------------------------------------------------------------------
 void CDirectX::TakeScreenshot (const char *fileName)
 {
@@ -530,6 +624,12 @@ void CDirectX::RequestScreenshot ()
 	m_wantsScreenshot = true;
 }
 
+//-----------------------------------------------------------------------------
+void CDirectX::RequestCPUScreenshot ()
+{
+	m_wantsCPUScreenshot = true;
+}
+
 //-----------------------------------------------------------------------------
 void CDirectX::ToggleRecording ()
 {
@@ -581,11 +681,45 @@ void CDirectX::ToggleRecording ()
 //-----------------------------------------------------------------------------
 void CDirectX::DrawScene (float elapsed)
 {
+	BeginScene(elapsed);
+	EndScene();
+}
+
+//-----------------------------------------------------------------------------
+void CDirectX::BeginScene (float elapsed)
+{
+	// swap in the kernel for new graphics settings if it has finished building.  The frames already
+	// queued keep their references to the old kernel, so it's safe to change between them.
+	if (m_kernelVariants.Update() && !UseKernelVariant())
+		printf("Couldn't create the wavefront kernels for the new graphics settings\n");
+
+	// the cpu renderer reads the world and camera, so do it now while nothing else is changing them
+	if (m_wantsCPUScreenshot)
+	{
+		TakeCPUScreenshot();
+		m_wantsCPUScreenshot = false;
+	}
+
 	RunCL(elapsed);
 
+	// get the gpu started on the frame now, rather than whenever the driver gets around to it
+	cl_int ciErrNum = clFlush(m_cqCommandQueue);
+	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+}
+
+//-----------------------------------------------------------------------------
+void CDirectX::EndScene ()
+{
     //
-    // draw the 2d texture
+    // draw the 2d texture, scaling up the part that was rendered to fill the window.  The texture
+    // coordinates stop half a texel inside it, so the filtering doesn't pull in pixels from outside.
     //
+	float uvScaleMax[4];
+	uvScaleMax[0] = (float)m_renderWidth / (float)m_texture_2d.width;
+	uvScaleMax[1] = (float)m_renderHeight / (float)m_texture_2d.height;
+	uvScaleMax[2] = ((float)m_renderWidth - 0.5f) / (float)m_texture_2d.width;
+	uvScaleMax[3] = ((float)m_renderHeight - 0.5f) / (float)m_texture_2d.height;
+	m_pUVScaleMax->SetFloatVector(uvScaleMax);
     m_pSimpleTechnique->GetPassByIndex(0)->Apply(0);
     m_pd3dDevice->Draw( 3, 0 );
 
@@ -748,6 +882,7 @@ HRESULT CDirectX::InitD3D10 ()
         m_pSimpleTechnique = m_pSimpleEffect->GetTechniqueByName( "Render" );
 
 		m_pTexture2D = m_pSimpleEffect->GetVariableByName("g_Texture2D")->AsShaderResource();
+		m_pUVScaleMax = m_pSimpleEffect->GetVariableByName("g_UVScaleMax")->AsVector();
 
         // Setup  no Input Layout
         m_pd3dDevice->IASetInputLayout(0);
@@ -813,94 +948,13 @@ HRESULT CDirectX::InitTextures ()
 		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 	}
 
-	m_world.Load(m_worldFileName.c_str());
-
-	return S_OK;
-}
-
-//-----------------------------------------------------------------------------
-HRESULT CDirectX::CreateKernelProgram(
-	const char *clName,
-	const char *clPtx,
-	const char *kernelEntryPoint,
-	cl_program			&cpProgram,
-	cl_kernel			&ckKernel )
-{
-	cl_int ciErrNum;
+	m_textureManager.Init(m_graphicsSettings, m_cxGPUContext, m_cqCommandQueue);
 
-    // Program Setup
-    size_t program_length;
-    //const char* source_path = shrFindFilePath(clName, exepath);
-	const char* source_path = clName;
-    char *source = oclLoadProgSource(source_path, "", &program_length);
-	oclCheckErrorEX(source != NULL, true, NULL);
+	// tell the ECS system about our world data (temp, until map access is more formalized)
+	ECS::SetWorldData(m_world.m_sectors);
+	m_world.Load(m_worldFileName.c_str(), m_textureManager);
 
-    // create the program
-    cpProgram = clCreateProgramWithSource(m_cxGPUContext, 1,(const char **) &source, &program_length, &ciErrNum);
-	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
-    free(source);
-
-	// make our build options
-	std::string buildOptions;
-	char buffer[32];
-	buildOptions = "-I ./KernelCode/ -D OPENCL=1 -Werror";
-	buildOptions.append(" -D SETTINGS_TEXTUREFILTER=");
-	buildOptions.append(m_graphicsSettings.m_TextureFilter ? "1" : "0");
-	buildOptions.append(" -D SETTINGS_INTERLACED=");
-	buildOptions.append(m_graphicsSettings.m_InterlaceMode ? "1" : "0");
-	buildOptions.append(" -D SETTINGS_NORMALMAP=");
-	buildOptions.append(m_graphicsSettings.m_NormalMapping ? "1" : "0");
-	buildOptions.append(" -D SETTINGS_SHADOWS=");
-	buildOptions.append(m_graphicsSettings.m_Shadows ? "1" : "0");
-	buildOptions.append(" -D SETTINGS_HIQLIGHTS=");
-	buildOptions.append(m_graphicsSettings.m_HighQualityLights ? "1" : "0");
-	buildOptions.append(" -D SETTINGS_REDBLUE3D=");
-	buildOptions.append(m_graphicsSettings.m_RedBlue3D ? "1" : "0");
-	buildOptions.append(" -D SETTINGS_REDBLUEWIDTH=");
-	sprintf(buffer, "%f", m_graphicsSettings.m_RedBlueWidth);
-	buildOptions.append(buffer);
-	buildOptions.append(" -D SETTINGS_RAYBOUNCES=");
-	sprintf(buffer, "%i", m_graphicsSettings.m_RayBounces);
-	buildOptions.append(buffer);
-	buildOptions.append(" -D SETTINGS_COLORABSORB=");
-	buildOptions.append(m_graphicsSettings.m_ColorAbsorption ? "1" : "0");
-
-	// debug options
-	buildOptions.append(" -D DEBUG_MODEL_BOUNDING_SPHERE=");
-	buildOptions.append(m_graphicsSettings.m_DebugModelBoundingSphere ? "1" : "0");
-	buildOptions.append(" -D DEBUG_TEXTURE_UV=");
-	buildOptions.append(m_graphicsSettings.m_DebugTextureUV ? "1" : "0");
-	buildOptions.append(" -D DEBUG_RAY_BOUNCECOUNT=");
-	buildOptions.append(m_graphicsSettings.m_DebugRayBounceCount ? "1" : "0");
-	buildOptions.append(" -D DEBUG_TRIANGLES=");
-	buildOptions.append(m_graphicsSettings.m_DebugTriangles ? "1" : "0");
-
-	// if this setting is on, turn on the optimizations that prefer speed over accuracy and safety
-	if (m_graphicsSettings.m_FastestMath) {
-		buildOptions.append(" -cl-single-precision-constant");
-		buildOptions.append(" -cl-denorms-are-zero");
-		buildOptions.append(" -cl-strict-aliasing");
-		buildOptions.append(" -cl-fast-relaxed-math");
-	}
-
-    // build the program
-	ciErrNum = clBuildProgram(cpProgram, 0, NULL, buildOptions.c_str(), NULL, NULL);
-    if (ciErrNum != CL_SUCCESS)
-    {
-        // write out standard error, Build Log and PTX, then cleanup and exit
-		printf(" error in clBuildProgram: %i", ciErrNum);
-        oclLogBuildInfo(cpProgram, oclGetFirstDev(m_cxGPUContext));
-        oclLogPtx(cpProgram, oclGetFirstDev(m_cxGPUContext), clPtx);
-        return -1;
-    }
-
-    // create the kernel
-    ckKernel = clCreateKernel(cpProgram, kernelEntryPoint, &ciErrNum);
-    if (!ckKernel)
-        return -1;
-
-    // set the args values
-	return ciErrNum ? E_FAIL : S_OK;
+	return S_OK;
 }
 
 //-----------------------------------------------------------------------------
@@ -1005,68 +1059,226 @@ void CDirectX::RunKernels(float elapsed)
 		SCamera& camera = SSharedDataRootHostToKernel::Camera();
 		camera.m_frameCount++;
 
-		CSharedObject<SSharedDataRootKernelToHost> &sharedDataRootKernelToHost = SSharedDataRootKernelToHost::Get();
+		CPinnedSharedObject<SSharedDataRootHostToKernel> &sharedDataRootHostToKernel = SSharedDataRootHostToKernel::Get();
+
+		// the settings compiled into the kernel, which lag behind m_graphicsSettings while a new kernel builds
+		const SData_GfxSettings &kernelSettings = m_kernelVariants.Current().m_settings;
+
+		// pick the resolution and bounces for this frame from how long the last frames took
+		m_qualityGovernor.Update(m_graphicsSettings, kernelSettings.m_RayBounces);
+		m_renderWidth = (unsigned int)((float)m_texture_2d.width * m_qualityGovernor.ResolutionScale() + 0.5f);
+		m_renderHeight = (unsigned int)((float)m_texture_2d.height * m_qualityGovernor.ResolutionScale() + 0.5f);
+		if (m_renderWidth < 1 || m_renderWidth > m_texture_2d.width)
+			m_renderWidth = m_texture_2d.width;
+		if (m_renderHeight < 1 || m_renderHeight > m_texture_2d.height)
+			m_renderHeight = m_texture_2d.height;
+		camera.m_renderWidth = m_renderWidth;
+		camera.m_renderHeight = m_renderHeight;
+		camera.m_maxRayBounces = m_qualityGovernor.RayBounces();
+		cl_event firstEvent = NULL;
+		cl_event lastEvent = NULL;
+
+		// last frame's pixels can be reused unless the camera went through a portal, since the points they
+		// saw are stored relative to the camera's sector
+		const bool temporal = kernelSettings.m_TemporalReprojection && !kernelSettings.m_WavefrontPath && !kernelSettings.m_RedBlue3D;
+		SSharedDataRootHostToKernel &root = sharedDataRootHostToKernel.GetObject();
+		if (root.m_previousCamera.m_sector != camera.m_sector)
+			m_temporalHistory.Invalidate();
+		m_temporalHistory.BeginFrame(m_cxGPUContext, m_texture_2d.width, m_texture_2d.height, temporal);
+		root.m_temporalHistoryValid = m_temporalHistory.IsValid() ? 1 : 0;
+
+		// clear the max brightness on the frames the kernel samples it
+		CPinnedSharedObject<SSharedDataRootKernelToHost> &sharedDataRootKernelToHost = SSharedDataRootKernelToHost::Get();
+		const bool sampleBrightness = kernelSettings.m_AutoExposure && camera.m_HDRBrightnessSamplingInterval > 0 && camera.m_frameCount % camera.m_HDRBrightnessSamplingInterval == 0;
+		if (sampleBrightness)
+			sharedDataRootKernelToHost.GetObject().PreRender();
+
+		// the world buffers, in the order all the kernels take them
+		SWavefrontScene scene;
+		scene.m_pointLights = m_world.m_pointLights.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_spheres = m_world.m_spheres.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_modelTriangles = m_world.m_modelTriangles.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_modelTriangleShading = m_world.m_modelTriangleShading.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_modelObjects = m_world.m_modelObjects.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_modelBVHNodes = m_world.m_modelBVHNodes.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_modelInstanceBVHNodes = m_world.m_modelInstanceBVHNodes.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_modelInstances = m_world.m_modelInstances.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_sectors = m_world.m_sectors.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_materials = m_world.m_materials.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_portals = m_world.m_portals.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+		scene.m_shadowTexels = m_world.m_shadowTexels.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue);
+
+		// written once a frame, and after everything above has set its part of the data root
+		cl_mem dataRoot = sharedDataRootHostToKernel.GetAndWriteCLMem(m_cxGPUContext, m_cqCommandQueue);
+		cl_mem dataRootOut = sharedDataRootKernelToHost.GetAndWriteCLMem(m_cxGPUContext, m_cqCommandQueue);
+		cl_mem textureAtlas = m_textureManager.GetCLAtlas();
+		cl_mem atlasTextures = m_textureManager.GetCLAtlasTextures();
+
+		if (kernelSettings.m_WavefrontPath)
+		{
+			m_wavefront.Render(
+				m_cxGPUContext,
+				m_cqCommandQueue,
+				m_texture_2d.clTexture,
+				textureAtlas,
+				atlasTextures,
+				dataRoot,
+				dataRootOut,
+				scene,
+				m_renderWidth,
+				m_renderHeight,
+				kernelSettings.m_RedBlue3D ? 2 : 1,
+				m_qualityGovernor.RayBounces(),
+				&firstEvent,
+				&lastEvent
+			);
+		}
+		else
+		{
+			// trace the tile corners first, so clrt knows which tiles it can fill in.  NULL when it's off.
+			cl_mem coarseSamples = NULL;
+			if (m_variableRate.IsInitialized())
+			{
+				coarseSamples = m_variableRate.Render(
+					m_cxGPUContext,
+					m_cqCommandQueue,
+					textureAtlas,
+					atlasTextures,
+					dataRoot,
+					scene,
+					m_renderWidth,
+					m_renderHeight,
+					kernelSettings.m_VariableRateTileSize,
+					&firstEvent
+				);
+			}
 
-		// set global and local work item dimensions
-		m_szLocalWorkSize[0] = 16;
-		m_szLocalWorkSize[1] = 16;
-		m_szGlobalWorkSize[0] = shrRoundUp((int)m_szLocalWorkSize[0], m_texture_2d.pitch);
-		m_szGlobalWorkSize[1] = shrRoundUp((int)m_szLocalWorkSize[1], m_texture_2d.height);
+			// set global and local work item dimensions
+			m_szLocalWorkSize[0] = 16;
+			m_szLocalWorkSize[1] = 16;
+			m_szGlobalWorkSize[0] = shrRoundUp((int)m_szLocalWorkSize[0], m_renderWidth);
+			m_szGlobalWorkSize[1] = shrRoundUp((int)m_szLocalWorkSize[1], m_renderHeight);
 
-		// set the args values
-		cl_uint argNumber = 0;
-		cl_int ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(m_texture_2d.clTexture), (void *) &(m_texture_2d.clTexture));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			// set the args values
+			cl_uint argNumber = 0;
+			cl_int ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(m_texture_2d.clTexture), (void *) &(m_texture_2d.clTexture));
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		cl_mem texture3d = m_textureManager.GetCLTexture3d();
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(texture3d), &texture3d);
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &textureAtlas);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		CSharedObject<SSharedDataRootHostToKernel> &sharedDataRootHostToKernel = SSharedDataRootHostToKernel::Get();
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &sharedDataRootHostToKernel.GetAndWriteCLMem(m_cxGPUContext, m_cqCommandQueue));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &atlasTextures);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &m_world.m_pointLights.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &dataRoot);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &m_world.m_spheres.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_pointLights);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &m_world.m_modelTriangles.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_spheres);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &m_world.m_modelObjects.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_modelTriangles);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &m_world.m_modelInstances.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_modelTriangleShading);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &m_world.m_sectors.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_modelObjects);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &m_world.m_materials.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_modelBVHNodes);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &m_world.m_portals.GetAndUpdateMem(m_cxGPUContext, m_cqCommandQueue));
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_modelInstanceBVHNodes);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		//sharedDataRootKernelToHost.GetObject().PreRender();
-		//ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &sharedDataRootKernelToHost.GetAndWriteCLMem(m_cxGPUContext, m_cqCommandQueue));
-		//oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_modelInstances);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		// launch computation kernel
-		ciErrNum = clEnqueueNDRangeKernel(m_cqCommandQueue, m_ckKernel_tex2d, 2, NULL,
-										  m_szGlobalWorkSize, m_szLocalWorkSize, 
-										 0, NULL, NULL);
-		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_sectors);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_materials);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_portals);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &scene.m_shadowTexels);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &dataRootOut);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+			// NULL when temporal reprojection is off, and the kernel doesn't touch them
+			cl_mem historyIn = m_temporalHistory.HistoryIn();
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &historyIn);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+			cl_mem historyOut = m_temporalHistory.HistoryOut();
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &historyOut);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+			ciErrNum = clSetKernelArg(m_ckKernel_tex2d, argNumber++, sizeof(cl_mem), &coarseSamples);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 
-		// read the data the kernel wrote back
-		//sharedDataRootKernelToHost.ReadFromCLMem(m_cxGPUContext, m_cqCommandQueue);
+			// launch computation kernel
+			ciErrNum = clEnqueueNDRangeKernel(m_cqCommandQueue, m_ckKernel_tex2d, 2, NULL,
+											  m_szGlobalWorkSize, m_szLocalWorkSize, 
+											 0, NULL, &lastEvent);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+			if (!firstEvent)
+				firstEvent = lastEvent;
+		}
+
+		// the shared data root was copied to the gpu above, so the camera can go in for next frame
+		root.m_previousCamera = camera;
+		m_temporalHistory.EndFrame();
+
+		// the governor reads the kernel times once the gpu gets to them
+		if (lastEvent)
+			m_qualityGovernor.AddFrame(firstEvent, lastEvent);
+
+		// read the data the kernel wrote back.  It arrives a frame or two later, without stalling.
+		if (sampleBrightness)
+			sharedDataRootKernelToHost.ReadFromCLMemAsync(m_cxGPUContext, m_cqCommandQueue);
 
-		camera.m_brightnessMultiplier = CDirectX::Settings().m_Brightness;
+		UpdateExposure();
     }
 }
 
+//-----------------------------------------------------------------------------
+void CDirectX::UpdateExposure ()
+{
+	SCamera& camera = SSharedDataRootHostToKernel::Camera();
+	if (!m_kernelVariants.Current().m_settings.m_AutoExposure)
+	{
+		camera.m_brightnessMultiplier = m_graphicsSettings.m_Brightness;
+		return;
+	}
+
+	SSharedDataRootKernelToHost kernelToHost;
+	if (!SSharedDataRootKernelToHost::Get().GetLatestRead(kernelToHost) || kernelToHost.m_maxBrightness1000x == 0)
+		return;
+
+	// aim for the brightest pixel to be at full brightness, but never go brighter than the Brightness setting
+	const float maxBrightness = (float)kernelToHost.m_maxBrightness1000x / 1000.0f;
+	float targetMultiplier = m_graphicsSettings.m_Brightness;
+	if (maxBrightness * targetMultiplier > 1.0f)
+		targetMultiplier = 1.0f / maxBrightness;
+
+	// move towards it a step at a time so the exposure doesn't jump around
+	const float delta = CGame::GameData().m_Gfx.m_HDRBrightnessDelta;
+	if (camera.m_brightnessMultiplier < targetMultiplier - delta)
+		camera.m_brightnessMultiplier += delta;
+	else if (camera.m_brightnessMultiplier > targetMultiplier + delta)
+		camera.m_brightnessMultiplier -= delta;
+	else
+		camera.m_brightnessMultiplier = targetMultiplier;
+}
+
 //-----------------------------------------------------------------------------
 // Name: MsgProc()
 // Desc: The window's message handler
@@ -1123,6 +1335,8 @@ static LRESULT WINAPI MsgProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
 						case 'Z': if (!pressed) CDirectX::Get().ToggleRecording(); break;
 						case 'X': if (!pressed) CDirectX::Get().RequestScreenshot(); break;
+						case 'V': if (!pressed) CDirectX::Get().RequestCPUScreenshot(); break;
+						case 'G': if (!pressed) CDirectX::Get().ReloadGraphicsSettings(); break;
 					}
 				}
 			}
@@ -1147,6 +1361,7 @@ static LRESULT WINAPI MsgProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 // Forward declarations
 //-----------------------------------------------------------------------------
 void UpdateFPS(float elapsed);
+void RunFrame(float elapsed);
 
 //-----------------------------------------------------------------------------
 // Program main
@@ -1157,6 +1372,15 @@ int main(int argc, char** argv)
 	CDirectX::Get().LoadGraphicsSettings();
 	const SData_GfxSettings& settings = CDirectX::Settings();
 
+	// -bake <world file> [baked file] loads a world from xml, writes it out as a baked world and exits
+	if (argc > 2 && !stricmp(argv[1], "-bake"))
+	{
+		CDirectX::Get().SetWorld(argv[2]);
+		CDirectX::Get().InitHeadless();
+		const std::string bakedFileName = argc > 3 ? argv[3] : CWorld::BakedFileName(argv[2]);
+		return CDirectX::GetWorld().Bake(bakedFileName.c_str()) ? 0 : 1;
+	}
+
 	if (argc > 1)
 		CDirectX::Get().SetWorld(argv[1]);
 	else
@@ -1190,10 +1414,7 @@ int main(int argc, char** argv)
 	//
 	while(true) 
 	{
-		UpdateFPS(0.0f);
-		CDirectX::Get().DrawScene(0.0f);
-		CGame::Update(0.0f);
-		CInput::Update();
+		RunFrame(0.0f);
 
 		MSG msg;
 		ZeroMemory( &msg, sizeof(msg) );
@@ -1220,14 +1441,35 @@ int main(int argc, char** argv)
 				delta = wantedDelta;
 			}
 
-		    UpdateFPS(delta);
-			CDirectX::Get().DrawScene(delta);
-			CGame::Update(delta);
-			CInput::Update();
+			RunFrame(delta);
 		}
     };
 }
 
+//-----------------------------------------------------------------------------
+void RunFrame(float elapsed)
+{
+	UpdateFPS(elapsed);
+
+	if (!CDirectX::Settings().m_PipelineGameUpdate)
+	{
+		CDirectX::Get().DrawScene(elapsed);
+		CGame::Update(elapsed);
+		CInput::Update();
+		return;
+	}
+
+	// BeginScene() takes its copies of the camera and any changed world data when it enqueues their
+	// uploads, so the game logic for the next frame can run on the worker thread while the gpu renders
+	// this one.  Windows messages (and so input) are only handled between frames, never during the update.
+	static CWorkerThread s_gameThread;
+	CDirectX::Get().BeginScene(elapsed);
+	s_gameThread.Run([elapsed] () { CGame::Update(elapsed); });
+	CDirectX::Get().EndScene();
+	s_gameThread.Wait();
+	CInput::Update();
+}
+
 //-----------------------------------------------------------------------------
 void UpdateFPS(float elapsed)
 {
@@ -1243,6 +1485,14 @@ void UpdateFPS(float elapsed)
 		time = 0;
 		char buffer[256];
 		sprintf(buffer, "FPS - %0.2f (%0.2f ms)", fps, fps > 0.0f ? 1000.0f / fps : 0.0f);
+
+		// show what the quality governor is doing
+		const CQualityGovernor &governor = CDirectX::Get().QualityGovernor();
+		if (CDirectX::Settings().m_DynamicQuality)
+		{
+			sprintf(buffer + strlen(buffer), " - gpu %0.2f ms, %i%% resolution, %u bounces",
+				governor.FrameTime(), (int)(governor.ResolutionScale() * 100.0f + 0.5f), governor.RayBounces());
+		}
 		SetWindowText(CDirectX::Get().GetHWND(), buffer);
 	}
 }
\ No newline at end of file
@@ -35,6 +35,11 @@ DirectX and OpenCL code lives here
 #include "Game/CWorld.h"
 #include "STexture2D.h"
 #include "CTextureManager.h"
+#include "CWavefront.h"
+#include "CVariableRate.h"
+#include "CKernelVariants.h"
+#include "CQualityGovernor.h"
+#include "CTemporalHistory.h"
 #include "DataSchemas/DataSchemasXML.h"
 
 class CDirectX
@@ -44,8 +49,16 @@ public:
 
 	bool Init ();
 
+	// loads the world without creating a window, directx or opencl.  Textures are not loaded.
+	void InitHeadless ();
+
 	void DrawScene (float elapsed);
 
+	// DrawScene() in two halves.  BeginScene() uploads the camera and world and starts the kernels,
+	// after which they are free to change.  EndScene() presents the frame once the kernels are done.
+	void BeginScene (float elapsed);
+	void EndScene ();
+
 	static CDirectX& Get () { return s_singleton; } 
 
 	HRESULT InitTextures ();
@@ -55,6 +68,14 @@ public:
 
 	void LoadGraphicsSettings ();
 
+	// changes the graphics settings while the game runs.  The kernel for them is built in the background
+	// and swapped in when it's ready, until then the old settings stay in effect for the kernel.  The
+	// resolution, full screen, texture size and default map only take effect on startup.
+	void SetGraphicsSettings (const SData_GfxSettings &settings);
+
+	// loads the graphics settings file again and switches to what's in it
+	void ReloadGraphicsSettings ();
+
 	void SetWorld (const char *world) {m_worldFileName = world;}
 
 	void TakeScreenshot (const char *fileName);
@@ -62,6 +83,10 @@ public:
 
 	void RequestScreenshot ();
 
+	// renders the current view on the cpu and saves it next to the screenshots, for comparing against the kernel
+	void TakeCPUScreenshot ();
+	void RequestCPUScreenshot ();
+
 	void ToggleRecording ();
 
 	bool IsRecording () const { return m_recording; }
@@ -74,25 +99,23 @@ public:
 
 	static const SData_GfxSettings& Settings () { return Get().m_graphicsSettings; }
 
-private:
-	friend class CTextureManager;
+	const CQualityGovernor &QualityGovernor () const { return m_qualityGovernor; }
 
+private:
 	CDirectX ();
 	HRESULT InitD3D10 ();
 
 	void RunCL (float elapsed);
 	void RunKernels (float elapsed);
 
+	// sets the camera's brightness multiplier, from the brightness the kernel sampled if auto exposure is on
+	void UpdateExposure ();
+
 	void AcquireTexturesForOpenCL ();
 	void ReleaseTexturesFromOpenCL ();
 
-	HRESULT CreateKernelProgram (
-		const char *clName,
-		const char *clPtx,
-		const char *kernelEntryPoint,
-		cl_program			&cpProgram,
-		cl_kernel			&ckKernel
-	);
+	// starts rendering with m_kernelVariants' current variant
+	bool UseKernelVariant ();
 
 private:
 	static CDirectX			s_singleton;
@@ -107,6 +130,7 @@ private:
 	ID3D10Effect*           m_pSimpleEffect;
 	ID3D10EffectTechnique*  m_pSimpleTechnique;
 	ID3D10EffectShaderResourceVariable* m_pTexture2D;
+	ID3D10EffectVectorVariable* m_pUVScaleMax;
 
 	STexture2D				m_texture_2d;
 
@@ -118,10 +142,18 @@ private:
 	cl_context			m_cxGPUContext;
 	cl_command_queue	m_cqCommandQueue;
 	//cl_device_id		m_device;
-	cl_program			m_cpProgram_tex2d;
-	cl_kernel			m_ckKernel_tex2d;
+	CKernelVariants		m_kernelVariants;
+	cl_kernel			m_ckKernel_tex2d;		// the current variant's, owned by m_kernelVariants
 	size_t				m_szGlobalWorkSize[2];
 	size_t				m_szLocalWorkSize[2];
+	CWavefront			m_wavefront;
+	CVariableRate		m_variableRate;
+	CQualityGovernor	m_qualityGovernor;
+	CTemporalHistory	m_temporalHistory;
+
+	// the part of m_texture_2d rendered to this frame, which the governor may make smaller than the texture
+	unsigned int		m_renderWidth;
+	unsigned int		m_renderHeight;
 
 	SData_GfxSettings	m_graphicsSettings;
 
@@ -141,4 +173,5 @@ private:
 	bool					m_recording;
 	unsigned int			m_recordingFrameNumber;
 	bool					m_wantsScreenshot;
+	bool					m_wantsCPUScreenshot;
 };
\ No newline at end of file
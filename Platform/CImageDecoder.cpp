@@ -0,0 +1,1336 @@
+/*==================================================================================================
+
+CImageDecoder.cpp
+
+Decodes .png and baseline .jpg files into 8 bit RGBA without needing directx, so textures can be
+decoded on any thread, and on platforms without D3DX.  Other formats, and progressive or CMYK jpgs,
+fail to decode.
+
+==================================================================================================*/
+
+#include "CImageDecoder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// the biggest width or height we'll decode, so a corrupt header can't ask for gigabytes
+static const unsigned int c_maxImageSize = 16384;
+
+//-----------------------------------------------------------------------------
+static unsigned int ReadBigEndian32 (const unsigned char *data)
+{
+	return ((unsigned int)data[0] << 24) | ((unsigned int)data[1] << 16) | ((unsigned int)data[2] << 8) | data[3];
+}
+
+//-----------------------------------------------------------------------------
+static unsigned int ReadBigEndian16 (const unsigned char *data)
+{
+	return ((unsigned int)data[0] << 8) | data[1];
+}
+
+//=================================================================================================
+//                                           Inflate
+//=================================================================================================
+
+// codes this long or shorter are decoded with one table lookup, longer ones a bit at a time
+static const unsigned int c_inflateFastBits = 9;
+
+static const unsigned short c_inflateLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char c_inflateLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short c_inflateDistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char c_inflateDistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// the order the code length code lengths are stored in
+static const unsigned char c_inflateCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+struct SInflateHuffman
+{
+	// how many codes there are of each length, and the symbols in code order
+	unsigned short	m_counts[16];
+	unsigned short	m_symbols[288];
+
+	// indexed by the next c_inflateFastBits bits.  Each entry is symbol << 4 | code length, or 0 if the
+	// code is longer than that.
+	unsigned short	m_fast[1 << c_inflateFastBits];
+};
+
+// deflate packs bits starting from the lowest bit of each byte
+struct SInflateBits
+{
+	SInflateBits (const unsigned char *data, size_t size)
+		: m_data(data)
+		, m_size(size)
+		, m_pos(0)
+		, m_bits(0)
+		, m_numBits(0)
+	{
+	}
+
+	// past the end of the data we read zeros.  Overrun() says whether any of them were used.
+	void Refill ()
+	{
+		while (m_numBits <= 24)
+		{
+			const unsigned int byte = m_pos < m_size ? m_data[m_pos] : 0;
+			m_pos++;
+			m_bits |= byte << m_numBits;
+			m_numBits += 8;
+		}
+	}
+
+	unsigned int Peek (unsigned int count)
+	{
+		Refill();
+		return m_bits & ((1 << count) - 1);
+	}
+
+	void Consume (unsigned int count)
+	{
+		m_bits >>= count;
+		m_numBits -= count;
+	}
+
+	unsigned int Read (unsigned int count)
+	{
+		if (count == 0)
+			return 0;
+		const unsigned int value = Peek(count);
+		Consume(count);
+		return value;
+	}
+
+	void AlignToByte ()
+	{
+		Consume(m_numBits & 7);
+	}
+
+	bool Overrun () const
+	{
+		return m_pos > m_size + m_numBits / 8;
+	}
+
+	const unsigned char	*m_data;
+	size_t				m_size;
+	size_t				m_pos;
+	unsigned int		m_bits;
+	unsigned int		m_numBits;
+};
+
+//-----------------------------------------------------------------------------
+static bool BuildInflateHuffman (const unsigned char *lengths, unsigned int numSymbols, SInflateHuffman &huffman)
+{
+	memset(huffman.m_counts, 0, sizeof(huffman.m_counts));
+	memset(huffman.m_fast, 0, sizeof(huffman.m_fast));
+	for (unsigned int symbol = 0; symbol < numSymbols; ++symbol)
+		huffman.m_counts[lengths[symbol]]++;
+	huffman.m_counts[0] = 0;
+
+	// make sure the lengths don't describe more codes than there's room for
+	int left = 1;
+	for (unsigned int length = 1; length < 16; ++length)
+	{
+		left = (left << 1) - huffman.m_counts[length];
+		if (left < 0)
+			return false;
+	}
+
+	// where each length's symbols start in m_symbols, and the first code of each length
+	unsigned short offsets[16];
+	unsigned int firstCodes[16];
+	offsets[1] = 0;
+	firstCodes[1] = 0;
+	for (unsigned int length = 1; length < 15; ++length)
+	{
+		offsets[length + 1] = offsets[length] + huffman.m_counts[length];
+		firstCodes[length + 1] = (firstCodes[length] + huffman.m_counts[length]) << 1;
+	}
+
+	for (unsigned int symbol = 0; symbol < numSymbols; ++symbol)
+	{
+		const unsigned int length = lengths[symbol];
+		if (length == 0)
+			continue;
+
+		const unsigned int code = firstCodes[length]++;
+		huffman.m_symbols[offsets[length]++] = (unsigned short)symbol;
+		if (length > c_inflateFastBits)
+			continue;
+
+		// codes are stored first bit first, so the table is indexed by the code backwards
+		unsigned int reversed = 0;
+		for (unsigned int bit = 0; bit < length; ++bit)
+			reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+
+		for (unsigned int index = reversed; index < (1u << c_inflateFastBits); index += 1 << length)
+			huffman.m_fast[index] = (unsigned short)(symbol << 4 | length);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+static int DecodeInflateSymbol (SInflateBits &bits, const SInflateHuffman &huffman)
+{
+	const unsigned int fast = huffman.m_fast[bits.Peek(c_inflateFastBits)];
+	if (fast)
+	{
+		bits.Consume(fast & 15);
+		return fast >> 4;
+	}
+
+	// a longer code, so walk it a bit at a time from the start
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for (unsigned int length = 1; length < 16; ++length)
+	{
+		code |= bits.Read(1);
+		const int count = huffman.m_counts[length];
+		if (code - count < first)
+			return huffman.m_symbols[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// decodes a zlib stream into out, which has to come out exactly out.size() bytes long
+static bool Inflate (const unsigned char *data, size_t size, std::vector<unsigned char> &out)
+{
+	if (size < 2 || (data[0] & 15) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 32))
+		return false;
+
+	SInflateBits bits(data + 2, size - 2);
+	unsigned char *dest = out.empty() ? NULL : &out[0];
+	const size_t destSize = out.size();
+	size_t destPos = 0;
+
+	SInflateHuffman lengthCodes;
+	SInflateHuffman distanceCodes;
+
+	bool lastBlock = false;
+	while (!lastBlock)
+	{
+		lastBlock = bits.Read(1) != 0;
+		const unsigned int blockType = bits.Read(2);
+
+		if (blockType == 0)
+		{
+			// stored
+			bits.AlignToByte();
+			const unsigned int length = bits.Read(16);
+			const unsigned int lengthComplement = bits.Read(16);
+			if ((length ^ 0xFFFF) != lengthComplement || destPos + length > destSize)
+				return false;
+			for (unsigned int index = 0; index < length; ++index)
+				dest[destPos++] = (unsigned char)bits.Read(8);
+			if (bits.Overrun())
+				return false;
+			continue;
+		}
+
+		if (blockType == 1)
+		{
+			// fixed codes
+			unsigned char lengths[288 + 30];
+			memset(&lengths[0], 8, 144);
+			memset(&lengths[144], 9, 112);
+			memset(&lengths[256], 7, 24);
+			memset(&lengths[280], 8, 8);
+			memset(&lengths[288], 5, 30);
+			BuildInflateHuffman(&lengths[0], 288, lengthCodes);
+			BuildInflateHuffman(&lengths[288], 30, distanceCodes);
+		}
+		else if (blockType == 2)
+		{
+			// dynamic codes, themselves huffman coded
+			const unsigned int numLengthCodes = bits.Read(5) + 257;
+			const unsigned int numDistanceCodes = bits.Read(5) + 1;
+			const unsigned int numCodeLengthCodes = bits.Read(4) + 4;
+			if (numLengthCodes > 286 || numDistanceCodes > 30)
+				return false;
+
+			unsigned char codeLengthLengths[19] = { 0 };
+			for (unsigned int index = 0; index < numCodeLengthCodes; ++index)
+				codeLengthLengths[c_inflateCodeLengthOrder[index]] = (unsigned char)bits.Read(3);
+
+			SInflateHuffman codeLengthCodes;
+			if (!BuildInflateHuffman(codeLengthLengths, 19, codeLengthCodes))
+				return false;
+
+			unsigned char lengths[288 + 30];
+			const unsigned int numLengths = numLengthCodes + numDistanceCodes;
+			for (unsigned int index = 0; index < numLengths; )
+			{
+				const int symbol = DecodeInflateSymbol(bits, codeLengthCodes);
+				if (symbol < 0)
+					return false;
+
+				if (symbol < 16)
+				{
+					lengths[index++] = (unsigned char)symbol;
+					continue;
+				}
+
+				unsigned char repeatLength = 0;
+				unsigned int repeatCount;
+				if (symbol == 16)
+				{
+					if (index == 0)
+						return false;
+					repeatLength = lengths[index - 1];
+					repeatCount = 3 + bits.Read(2);
+				}
+				else if (symbol == 17)
+					repeatCount = 3 + bits.Read(3);
+				else
+					repeatCount = 11 + bits.Read(7);
+
+				if (index + repeatCount > numLengths)
+					return false;
+				while (repeatCount--)
+					lengths[index++] = repeatLength;
+			}
+
+			if (!BuildInflateHuffman(&lengths[0], numLengthCodes, lengthCodes) ||
+				!BuildInflateHuffman(&lengths[numLengthCodes], numDistanceCodes, distanceCodes))
+				return false;
+		}
+		else
+			return false;
+
+		// the compressed data, until the end of block symbol
+		while (true)
+		{
+			const int symbol = DecodeInflateSymbol(bits, lengthCodes);
+			if (symbol < 0 || bits.Overrun())
+				return false;
+
+			if (symbol < 256)
+			{
+				if (destPos >= destSize)
+					return false;
+				dest[destPos++] = (unsigned char)symbol;
+				continue;
+			}
+
+			if (symbol == 256)
+				break;
+
+			const unsigned int lengthIndex = symbol - 257;
+			if (lengthIndex >= 29)
+				return false;
+			const unsigned int length = c_inflateLengthBase[lengthIndex] + bits.Read(c_inflateLengthExtra[lengthIndex]);
+
+			const int distanceIndex = DecodeInflateSymbol(bits, distanceCodes);
+			if (distanceIndex < 0 || distanceIndex >= 30)
+				return false;
+			const unsigned int distance = c_inflateDistanceBase[distanceIndex] + bits.Read(c_inflateDistanceExtra[distanceIndex]);
+
+			if (distance > destPos || destPos + length > destSize)
+				return false;
+
+			// the copy can overlap itself, so it goes a byte at a time
+			const unsigned char *source = &dest[destPos - distance];
+			for (unsigned int index = 0; index < length; ++index)
+				dest[destPos + index] = source[index];
+			destPos += length;
+		}
+	}
+
+	return destPos == destSize;
+}
+
+//=================================================================================================
+//                                             PNG
+//=================================================================================================
+
+static const unsigned char c_pngSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+// where each of the 7 interlace passes starts, and how far apart its pixels are
+static const unsigned int c_adam7StartX[7] = { 0, 4, 0, 2, 0, 1, 0 };
+static const unsigned int c_adam7StartY[7] = { 0, 0, 4, 0, 2, 0, 1 };
+static const unsigned int c_adam7StepX[7] = { 8, 8, 4, 4, 2, 2, 1 };
+static const unsigned int c_adam7StepY[7] = { 8, 8, 8, 4, 4, 2, 2 };
+
+enum EPNGColorType
+{
+	e_pngColorTypeGray = 0,
+	e_pngColorTypeRGB = 2,
+	e_pngColorTypePalette = 3,
+	e_pngColorTypeGrayAlpha = 4,
+	e_pngColorTypeRGBA = 6,
+};
+
+struct SPNGInfo
+{
+	unsigned int	m_width;
+	unsigned int	m_height;
+	unsigned int	m_bitDepth;
+	unsigned int	m_colorType;
+	unsigned int	m_channels;
+	bool			m_interlaced;
+
+	unsigned char	m_palette[256][4];
+
+	// from the tRNS chunk, the gray or RGB value that is see through, at the image's bit depth
+	bool			m_hasTransparentColor;
+	unsigned int	m_transparentColor[3];
+};
+
+//-----------------------------------------------------------------------------
+static bool ReadPNGHeader (const unsigned char *data, size_t size, SPNGInfo &info)
+{
+	// the IHDR chunk has to come first
+	if (size < 33 || memcmp(data, c_pngSignature, 8) || ReadBigEndian32(&data[8]) != 13 || memcmp(&data[12], "IHDR", 4))
+		return false;
+
+	info.m_width = ReadBigEndian32(&data[16]);
+	info.m_height = ReadBigEndian32(&data[20]);
+	info.m_bitDepth = data[24];
+	info.m_colorType = data[25];
+	info.m_interlaced = data[28] == 1;
+
+	if (info.m_width == 0 || info.m_height == 0 || info.m_width > c_maxImageSize || info.m_height > c_maxImageSize)
+		return false;
+
+	// compression and filter method have to be 0, and interlace 0 or 1
+	if (data[26] != 0 || data[27] != 0 || data[28] > 1)
+		return false;
+
+	const unsigned int bitDepth = info.m_bitDepth;
+	switch (info.m_colorType)
+	{
+		case e_pngColorTypeGray:
+			info.m_channels = 1;
+			return bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8 || bitDepth == 16;
+		case e_pngColorTypePalette:
+			info.m_channels = 1;
+			return bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8;
+		case e_pngColorTypeRGB:
+			info.m_channels = 3;
+			return bitDepth == 8 || bitDepth == 16;
+		case e_pngColorTypeGrayAlpha:
+			info.m_channels = 2;
+			return bitDepth == 8 || bitDepth == 16;
+		case e_pngColorTypeRGBA:
+			info.m_channels = 4;
+			return bitDepth == 8 || bitDepth == 16;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+static unsigned int PNGRowBytes (const SPNGInfo &info, unsigned int width)
+{
+	return (width * info.m_channels * info.m_bitDepth + 7) / 8;
+}
+
+//-----------------------------------------------------------------------------
+// undoes the per row filters of width x height pixels in place.  Each row starts with it's filter type,
+// which is left where it is.
+static bool UnfilterPNG (unsigned char *rows, const SPNGInfo &info, unsigned int width, unsigned int height)
+{
+	const unsigned int rowBytes = PNGRowBytes(info, width);
+	const unsigned int pixelBytes = (info.m_channels * info.m_bitDepth + 7) / 8;
+
+	const unsigned char *prior = NULL;
+	for (unsigned int indexY = 0; indexY < height; ++indexY)
+	{
+		unsigned char *row = &rows[indexY * (rowBytes + 1)];
+		const unsigned int filter = row[0];
+		row++;
+
+		for (unsigned int index = 0; index < rowBytes; ++index)
+		{
+			// left, up and up left
+			const int a = index >= pixelBytes ? row[index - pixelBytes] : 0;
+			const int b = prior ? prior[index] : 0;
+			const int c = prior && index >= pixelBytes ? prior[index - pixelBytes] : 0;
+
+			int predicted;
+			switch (filter)
+			{
+				case 0: predicted = 0; break;
+				case 1: predicted = a; break;
+				case 2: predicted = b; break;
+				case 3: predicted = (a + b) / 2; break;
+				case 4:
+				{
+					const int p = a + b - c;
+					const int pa = p > a ? p - a : a - p;
+					const int pb = p > b ? p - b : b - p;
+					const int pc = p > c ? p - c : c - p;
+					predicted = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+					break;
+				}
+				default: return false;
+			}
+
+			row[index] = (unsigned char)(row[index] + predicted);
+		}
+
+		prior = row;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// converts an unfiltered row of numPixels pixels to RGBA, writing every destStep'th pixel of dest
+static void ExpandPNGRow (const unsigned char *row, unsigned int numPixels, const SPNGInfo &info, unsigned char *dest, unsigned int destStep)
+{
+	const unsigned int bitDepth = info.m_bitDepth;
+	const unsigned int maxValue = (1 << (bitDepth < 8 ? bitDepth : 8)) - 1;
+
+	for (unsigned int index = 0; index < numPixels; ++index, dest += destStep * 4)
+	{
+		// the channels at the image's bit depth, for comparing against the transparent color, and at 8 bits
+		unsigned int raw[4];
+		unsigned int value[4];
+		for (unsigned int channel = 0; channel < info.m_channels; ++channel)
+		{
+			const unsigned int sample = index * info.m_channels + channel;
+			if (bitDepth == 16)
+			{
+				raw[channel] = ReadBigEndian16(&row[sample * 2]);
+				value[channel] = raw[channel] >> 8;
+			}
+			else if (bitDepth == 8)
+			{
+				raw[channel] = row[sample];
+				value[channel] = raw[channel];
+			}
+			else
+			{
+				const unsigned int bit = sample * bitDepth;
+				raw[channel] = (row[bit / 8] >> (8 - bitDepth - bit % 8)) & maxValue;
+				value[channel] = info.m_colorType == e_pngColorTypePalette ? raw[channel] : raw[channel] * 255 / maxValue;
+			}
+		}
+
+		switch (info.m_colorType)
+		{
+			case e_pngColorTypeGray:
+				dest[0] = dest[1] = dest[2] = (unsigned char)value[0];
+				dest[3] = info.m_hasTransparentColor && raw[0] == info.m_transparentColor[0] ? 0 : 255;
+				break;
+			case e_pngColorTypeRGB:
+				dest[0] = (unsigned char)value[0];
+				dest[1] = (unsigned char)value[1];
+				dest[2] = (unsigned char)value[2];
+				dest[3] = info.m_hasTransparentColor &&
+					raw[0] == info.m_transparentColor[0] &&
+					raw[1] == info.m_transparentColor[1] &&
+					raw[2] == info.m_transparentColor[2] ? 0 : 255;
+				break;
+			case e_pngColorTypePalette:
+				memcpy(dest, info.m_palette[value[0]], 4);
+				break;
+			case e_pngColorTypeGrayAlpha:
+				dest[0] = dest[1] = dest[2] = (unsigned char)value[0];
+				dest[3] = (unsigned char)value[1];
+				break;
+			case e_pngColorTypeRGBA:
+				dest[0] = (unsigned char)value[0];
+				dest[1] = (unsigned char)value[1];
+				dest[2] = (unsigned char)value[2];
+				dest[3] = (unsigned char)value[3];
+				break;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool CImageDecoder::DecodePNG (const unsigned char *data, size_t size, std::vector<unsigned char> &pixels, unsigned int &width, unsigned int &height)
+{
+	SPNGInfo info;
+	if (!ReadPNGHeader(data, size, info))
+		return false;
+
+	// missing palette entries are black, and fully opaque unless tRNS says otherwise
+	memset(info.m_palette, 0, sizeof(info.m_palette));
+	for (unsigned int index = 0; index < 256; ++index)
+		info.m_palette[index][3] = 255;
+	info.m_hasTransparentColor = false;
+
+	// gather the palette, transparency and the compressed data, which may be split over many IDAT chunks
+	std::vector<unsigned char> compressed;
+	size_t pos = 8;
+	while (pos + 12 <= size)
+	{
+		const unsigned int length = ReadBigEndian32(&data[pos]);
+		const unsigned char *type = &data[pos + 4];
+		const unsigned char *chunk = &data[pos + 8];
+		if (length > size - pos - 12)
+			return false;
+
+		if (!memcmp(type, "IDAT", 4))
+			compressed.insert(compressed.end(), chunk, chunk + length);
+		else if (!memcmp(type, "PLTE", 4))
+		{
+			for (unsigned int index = 0; index < length / 3 && index < 256; ++index)
+				memcpy(info.m_palette[index], &chunk[index * 3], 3);
+		}
+		else if (!memcmp(type, "tRNS", 4))
+		{
+			if (info.m_colorType == e_pngColorTypePalette)
+			{
+				for (unsigned int index = 0; index < length && index < 256; ++index)
+					info.m_palette[index][3] = chunk[index];
+			}
+			else if (info.m_colorType == e_pngColorTypeGray && length >= 2)
+			{
+				info.m_hasTransparentColor = true;
+				info.m_transparentColor[0] = ReadBigEndian16(chunk);
+			}
+			else if (info.m_colorType == e_pngColorTypeRGB && length >= 6)
+			{
+				info.m_hasTransparentColor = true;
+				for (unsigned int channel = 0; channel < 3; ++channel)
+					info.m_transparentColor[channel] = ReadBigEndian16(&chunk[channel * 2]);
+			}
+		}
+		else if (!memcmp(type, "IEND", 4))
+			break;
+
+		pos += length + 12;
+	}
+
+	// the size of each interlace pass, or of the whole image when it's not interlaced
+	const unsigned int numPasses = info.m_interlaced ? 7 : 1;
+	unsigned int passWidths[7];
+	unsigned int passHeights[7];
+	size_t filteredSize = 0;
+	for (unsigned int pass = 0; pass < numPasses; ++pass)
+	{
+		if (info.m_interlaced)
+		{
+			passWidths[pass] = info.m_width > c_adam7StartX[pass] ? (info.m_width - c_adam7StartX[pass] + c_adam7StepX[pass] - 1) / c_adam7StepX[pass] : 0;
+			passHeights[pass] = info.m_height > c_adam7StartY[pass] ? (info.m_height - c_adam7StartY[pass] + c_adam7StepY[pass] - 1) / c_adam7StepY[pass] : 0;
+		}
+		else
+		{
+			passWidths[pass] = info.m_width;
+			passHeights[pass] = info.m_height;
+		}
+
+		if (passWidths[pass] > 0 && passHeights[pass] > 0)
+			filteredSize += (size_t)(PNGRowBytes(info, passWidths[pass]) + 1) * passHeights[pass];
+	}
+
+	std::vector<unsigned char> filtered(filteredSize);
+	if (compressed.empty() || !Inflate(&compressed[0], compressed.size(), filtered))
+		return false;
+
+	width = info.m_width;
+	height = info.m_height;
+	pixels.resize(width * height * 4);
+
+	unsigned char *passData = &filtered[0];
+	for (unsigned int pass = 0; pass < numPasses; ++pass)
+	{
+		const unsigned int passWidth = passWidths[pass];
+		const unsigned int passHeight = passHeights[pass];
+		if (passWidth == 0 || passHeight == 0)
+			continue;
+
+		if (!UnfilterPNG(passData, info, passWidth, passHeight))
+			return false;
+
+		const unsigned int startX = info.m_interlaced ? c_adam7StartX[pass] : 0;
+		const unsigned int startY = info.m_interlaced ? c_adam7StartY[pass] : 0;
+		const unsigned int stepX = info.m_interlaced ? c_adam7StepX[pass] : 1;
+		const unsigned int stepY = info.m_interlaced ? c_adam7StepY[pass] : 1;
+
+		const unsigned int rowBytes = PNGRowBytes(info, passWidth);
+		for (unsigned int indexY = 0; indexY < passHeight; ++indexY)
+		{
+			unsigned char *dest = &pixels[((startY + indexY * stepY) * width + startX) * 4];
+			ExpandPNGRow(&passData[indexY * (rowBytes + 1) + 1], passWidth, info, dest, stepX);
+		}
+
+		passData += (rowBytes + 1) * passHeight;
+	}
+
+	return true;
+}
+
+//=================================================================================================
+//                                             JPEG
+//=================================================================================================
+
+// the natural order index of each coefficient, in the zig zag order they're stored in
+static const unsigned char c_jpegZigZag[64] =
+{
+	0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+enum EJPEGMarker
+{
+	e_jpegMarkerSOF0 = 0xC0,	// baseline
+	e_jpegMarkerSOF1 = 0xC1,	// extended sequential, huffman coded
+	e_jpegMarkerSOF2 = 0xC2,	// progressive, which we don't decode
+	e_jpegMarkerDHT = 0xC4,
+	e_jpegMarkerRST0 = 0xD0,
+	e_jpegMarkerRST7 = 0xD7,
+	e_jpegMarkerSOI = 0xD8,
+	e_jpegMarkerEOI = 0xD9,
+	e_jpegMarkerSOS = 0xDA,
+	e_jpegMarkerDQT = 0xDB,
+	e_jpegMarkerDRI = 0xDD,
+};
+
+struct SJPEGHuffman
+{
+	SJPEGHuffman ()
+		: m_defined(false)
+	{
+	}
+
+	// canonical decoding: the last code of each length (or -1 if there are none), and the amount to add
+	// to a code of each length to get the index of it's value
+	int				m_maxCode[17];
+	int				m_valueOffset[17];
+	unsigned char	m_values[256];
+	bool			m_defined;
+};
+
+struct SJPEGComponent
+{
+	unsigned int				m_id;
+	unsigned int				m_h;			// sampling factors
+	unsigned int				m_v;
+	unsigned int				m_quantTable;
+	unsigned int				m_dcTable;
+	unsigned int				m_acTable;
+	int							m_dcPrediction;
+
+	// the decoded plane, padded out to whole MCUs
+	unsigned int				m_planeWidth;
+	unsigned int				m_planeHeight;
+	std::vector<unsigned char>	m_plane;
+};
+
+struct SJPEGDecoder
+{
+	SJPEGDecoder (const unsigned char *data, size_t size)
+		: m_data(data)
+		, m_size(size)
+		, m_pos(0)
+		, m_width(0)
+		, m_height(0)
+		, m_numComponents(0)
+		, m_restartInterval(0)
+		, m_bits(0)
+		, m_numBits(0)
+		, m_hitMarker(false)
+	{
+		// the 1d inverse dct basis, with the scale factors folded in
+		for (unsigned int x = 0; x < 8; ++x)
+		{
+			for (unsigned int u = 0; u < 8; ++u)
+				m_idctBasis[x][u] = (u == 0 ? sqrtf(0.5f) : 1.0f) * 0.5f * cosf((float)((2 * x + 1) * u) * 3.14159265f / 16.0f);
+		}
+	}
+
+	bool ReadFrame (const unsigned char *segment, unsigned int length);
+	bool ReadHuffmanTables (const unsigned char *segment, unsigned int length);
+	bool ReadQuantTables (const unsigned char *segment, unsigned int length);
+	bool DecodeScan (const unsigned char *segment, unsigned int length);
+	void ConvertToRGBA (std::vector<unsigned char> &pixels) const;
+
+	// entropy coded data.  The bits are kept at the top of m_bits.
+	void ResetBits ();
+	unsigned int ReadBits (unsigned int count);
+	int DecodeHuffman (const SJPEGHuffman &huffman);
+	bool DecodeBlock (SJPEGComponent &component, unsigned int blockX, unsigned int blockY);
+	bool ReadRestartMarker ();
+
+	const unsigned char	*m_data;
+	size_t				m_size;
+	size_t				m_pos;
+
+	unsigned int		m_width;
+	unsigned int		m_height;
+	unsigned int		m_maxH;
+	unsigned int		m_maxV;
+	unsigned int		m_mcusWide;
+	unsigned int		m_mcusHigh;
+
+	SJPEGComponent		m_components[3];
+	unsigned int		m_numComponents;
+
+	unsigned short		m_quantTables[4][64];	// in zig zag order
+	SJPEGHuffman		m_huffmanTables[2][4];	// dc then ac
+	unsigned int		m_restartInterval;
+
+	unsigned int		m_bits;
+	unsigned int		m_numBits;
+	bool				m_hitMarker;
+
+	float				m_idctBasis[8][8];
+};
+
+//-----------------------------------------------------------------------------
+bool SJPEGDecoder::ReadFrame (const unsigned char *segment, unsigned int length)
+{
+	if (length < 6 || segment[0] != 8)
+		return false;
+
+	m_height = ReadBigEndian16(&segment[1]);
+	m_width = ReadBigEndian16(&segment[3]);
+	m_numComponents = segment[5];
+
+	// a height of 0 means it comes later in a DNL marker, which hardly anything writes
+	if (m_width == 0 || m_height == 0 || m_width > c_maxImageSize || m_height > c_maxImageSize)
+		return false;
+	if ((m_numComponents != 1 && m_numComponents != 3) || length < 6 + m_numComponents * 3)
+		return false;
+
+	m_maxH = 1;
+	m_maxV = 1;
+	for (unsigned int index = 0; index < m_numComponents; ++index)
+	{
+		SJPEGComponent &component = m_components[index];
+		component.m_id = segment[6 + index * 3];
+		component.m_h = segment[7 + index * 3] >> 4;
+		component.m_v = segment[7 + index * 3] & 15;
+		component.m_quantTable = segment[8 + index * 3];
+		if (component.m_h < 1 || component.m_h > 4 || component.m_v < 1 || component.m_v > 4 || component.m_quantTable > 3)
+			return false;
+
+		m_maxH = component.m_h > m_maxH ? component.m_h : m_maxH;
+		m_maxV = component.m_v > m_maxV ? component.m_v : m_maxV;
+	}
+
+	m_mcusWide = (m_width + m_maxH * 8 - 1) / (m_maxH * 8);
+	m_mcusHigh = (m_height + m_maxV * 8 - 1) / (m_maxV * 8);
+	for (unsigned int index = 0; index < m_numComponents; ++index)
+	{
+		SJPEGComponent &component = m_components[index];
+		component.m_planeWidth = m_mcusWide * component.m_h * 8;
+		component.m_planeHeight = m_mcusHigh * component.m_v * 8;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool SJPEGDecoder::ReadHuffmanTables (const unsigned char *segment, unsigned int length)
+{
+	unsigned int pos = 0;
+	while (pos + 17 <= length)
+	{
+		const unsigned int tableClass = segment[pos] >> 4;
+		const unsigned int tableIndex = segment[pos] & 15;
+		if (tableClass > 1 || tableIndex > 3)
+			return false;
+
+		const unsigned char *counts = &segment[pos + 1];
+		unsigned int numValues = 0;
+		for (unsigned int index = 0; index < 16; ++index)
+			numValues += counts[index];
+		if (numValues > 256 || pos + 17 + numValues > length)
+			return false;
+
+		SJPEGHuffman &huffman = m_huffmanTables[tableClass][tableIndex];
+		memcpy(huffman.m_values, &segment[pos + 17], numValues);
+
+		int code = 0;
+		int valueIndex = 0;
+		for (unsigned int codeLength = 1; codeLength <= 16; ++codeLength)
+		{
+			const int count = counts[codeLength - 1];
+			huffman.m_valueOffset[codeLength] = valueIndex - code;
+			code += count;
+			valueIndex += count;
+			huffman.m_maxCode[codeLength] = count ? code - 1 : -1;
+			code <<= 1;
+		}
+		huffman.m_defined = true;
+
+		pos += 17 + numValues;
+	}
+
+	return pos == length;
+}
+
+//-----------------------------------------------------------------------------
+bool SJPEGDecoder::ReadQuantTables (const unsigned char *segment, unsigned int length)
+{
+	unsigned int pos = 0;
+	while (pos < length)
+	{
+		const unsigned int precision = segment[pos] >> 4;
+		const unsigned int tableIndex = segment[pos] & 15;
+		const unsigned int tableBytes = precision ? 128 : 64;
+		if (precision > 1 || tableIndex > 3 || pos + 1 + tableBytes > length)
+			return false;
+
+		for (unsigned int index = 0; index < 64; ++index)
+			m_quantTables[tableIndex][index] = (unsigned short)(precision ? ReadBigEndian16(&segment[pos + 1 + index * 2]) : segment[pos + 1 + index]);
+
+		pos += 1 + tableBytes;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void SJPEGDecoder::ResetBits ()
+{
+	m_bits = 0;
+	m_numBits = 0;
+	m_hitMarker = false;
+}
+
+//-----------------------------------------------------------------------------
+unsigned int SJPEGDecoder::ReadBits (unsigned int count)
+{
+	if (count == 0)
+		return 0;
+
+	while (m_numBits <= 24)
+	{
+		// an FF is followed by a 00 when it's data.  Anything else is a marker, which ends the data, and
+		// past it we read zeros.
+		unsigned int byte = 0;
+		if (!m_hitMarker && m_pos < m_size)
+		{
+			byte = m_data[m_pos];
+			if (byte != 0xFF)
+				m_pos++;
+			else if (m_pos + 1 < m_size && m_data[m_pos + 1] == 0)
+				m_pos += 2;
+			else
+			{
+				m_hitMarker = true;
+				byte = 0;
+			}
+		}
+		else
+			m_hitMarker = true;
+
+		m_bits |= byte << (24 - m_numBits);
+		m_numBits += 8;
+	}
+
+	const unsigned int value = m_bits >> (32 - count);
+	m_bits <<= count;
+	m_numBits -= count;
+	return value;
+}
+
+//-----------------------------------------------------------------------------
+int SJPEGDecoder::DecodeHuffman (const SJPEGHuffman &huffman)
+{
+	int code = 0;
+	for (unsigned int codeLength = 1; codeLength <= 16; ++codeLength)
+	{
+		code = (code << 1) | ReadBits(1);
+		if (code <= huffman.m_maxCode[codeLength])
+			return huffman.m_values[huffman.m_valueOffset[codeLength] + code];
+	}
+
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// turns the bits of a coefficient into it's signed value
+static int ExtendJPEGValue (unsigned int bits, unsigned int numBits)
+{
+	if (numBits == 0)
+		return 0;
+	return bits < (1u << (numBits - 1)) ? (int)bits - (1 << numBits) + 1 : (int)bits;
+}
+
+//-----------------------------------------------------------------------------
+bool SJPEGDecoder::DecodeBlock (SJPEGComponent &component, unsigned int blockX, unsigned int blockY)
+{
+	const unsigned short *quant = m_quantTables[component.m_quantTable];
+
+	float coefficients[64] = { 0 };
+
+	const int dcBits = DecodeHuffman(m_huffmanTables[0][component.m_dcTable]);
+	if (dcBits < 0 || dcBits > 16)
+		return false;
+	component.m_dcPrediction += ExtendJPEGValue(ReadBits(dcBits), dcBits);
+	coefficients[0] = (float)(component.m_dcPrediction * quant[0]);
+
+	for (unsigned int index = 1; index < 64; )
+	{
+		const int runSize = DecodeHuffman(m_huffmanTables[1][component.m_acTable]);
+		if (runSize < 0)
+			return false;
+
+		const unsigned int run = runSize >> 4;
+		const unsigned int bits = runSize & 15;
+		if (bits == 0)
+		{
+			// 16 zeros, or the rest of the block is zeros
+			if (run != 15)
+				break;
+			index += 16;
+			continue;
+		}
+
+		index += run;
+		if (index > 63)
+			return false;
+		coefficients[c_jpegZigZag[index]] = (float)(ExtendJPEGValue(ReadBits(bits), bits) * quant[index]);
+		index++;
+	}
+
+	// inverse dct the rows, then the columns
+	float rows[64];
+	for (unsigned int y = 0; y < 8; ++y)
+	{
+		const float *coefficientRow = &coefficients[y * 8];
+		for (unsigned int x = 0; x < 8; ++x)
+		{
+			float sum = 0.0f;
+			for (unsigned int u = 0; u < 8; ++u)
+				sum += m_idctBasis[x][u] * coefficientRow[u];
+			rows[y * 8 + x] = sum;
+		}
+	}
+
+	unsigned char *dest = &component.m_plane[(blockY * 8) * component.m_planeWidth + blockX * 8];
+	for (unsigned int y = 0; y < 8; ++y, dest += component.m_planeWidth)
+	{
+		for (unsigned int x = 0; x < 8; ++x)
+		{
+			float sum = 128.5f;
+			for (unsigned int v = 0; v < 8; ++v)
+				sum += m_idctBasis[y][v] * rows[v * 8 + x];
+			dest[x] = (unsigned char)(sum < 0.0f ? 0 : (sum > 255.0f ? 255 : (int)sum));
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool SJPEGDecoder::ReadRestartMarker ()
+{
+	// whatever bits are left in the byte before the marker are padding
+	ResetBits();
+	while (m_pos + 1 < m_size && !(m_data[m_pos] == 0xFF && m_data[m_pos + 1] >= e_jpegMarkerRST0 && m_data[m_pos + 1] <= e_jpegMarkerRST7))
+		m_pos++;
+	if (m_pos + 1 >= m_size)
+		return false;
+
+	m_pos += 2;
+	for (unsigned int index = 0; index < m_numComponents; ++index)
+		m_components[index].m_dcPrediction = 0;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool SJPEGDecoder::DecodeScan (const unsigned char *segment, unsigned int length)
+{
+	if (m_numComponents == 0 || length < 1)
+		return false;
+
+	const unsigned int numScanComponents = segment[0];
+	if (numScanComponents < 1 || numScanComponents > m_numComponents || length < 4 + numScanComponents * 2)
+		return false;
+
+	SJPEGComponent *scanComponents[3];
+	for (unsigned int index = 0; index < numScanComponents; ++index)
+	{
+		const unsigned int id = segment[1 + index * 2];
+		scanComponents[index] = NULL;
+		for (unsigned int componentIndex = 0; componentIndex < m_numComponents; ++componentIndex)
+		{
+			if (m_components[componentIndex].m_id == id)
+				scanComponents[index] = &m_components[componentIndex];
+		}
+
+		SJPEGComponent *component = scanComponents[index];
+		if (!component)
+			return false;
+
+		component->m_dcTable = segment[2 + index * 2] >> 4;
+		component->m_acTable = segment[2 + index * 2] & 15;
+		component->m_dcPrediction = 0;
+		if (component->m_plane.empty())
+			component->m_plane.assign(component->m_planeWidth * component->m_planeHeight, 0);
+		if (component->m_dcTable > 3 || component->m_acTable > 3 ||
+			!m_huffmanTables[0][component->m_dcTable].m_defined || !m_huffmanTables[1][component->m_acTable].m_defined)
+			return false;
+	}
+
+	ResetBits();
+
+	// a scan of one component goes through it's blocks in order, covering just the image rather than
+	// whole MCUs.  A scan of several goes an MCU at a time.
+	unsigned int unitsWide = m_mcusWide;
+	unsigned int unitsHigh = m_mcusHigh;
+	if (numScanComponents == 1)
+	{
+		const SJPEGComponent &component = *scanComponents[0];
+		unitsWide = ((m_width * component.m_h + m_maxH - 1) / m_maxH + 7) / 8;
+		unitsHigh = ((m_height * component.m_v + m_maxV - 1) / m_maxV + 7) / 8;
+	}
+
+	const unsigned int numUnits = unitsWide * unitsHigh;
+	for (unsigned int unit = 0; unit < numUnits; ++unit)
+	{
+		if (m_restartInterval && unit > 0 && unit % m_restartInterval == 0 && !ReadRestartMarker())
+			return false;
+
+		const unsigned int unitX = unit % unitsWide;
+		const unsigned int unitY = unit / unitsWide;
+		if (numScanComponents == 1)
+		{
+			if (!DecodeBlock(*scanComponents[0], unitX, unitY))
+				return false;
+			continue;
+		}
+
+		for (unsigned int index = 0; index < numScanComponents; ++index)
+		{
+			SJPEGComponent &component = *scanComponents[index];
+			for (unsigned int v = 0; v < component.m_v; ++v)
+			{
+				for (unsigned int h = 0; h < component.m_h; ++h)
+				{
+					if (!DecodeBlock(component, unitX * component.m_h + h, unitY * component.m_v + v))
+						return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// samples a component's plane at an image pixel, filtering bilinearly when it's subsampled
+static unsigned int SampleJPEGComponent (const SJPEGComponent &component, unsigned int maxH, unsigned int maxV, unsigned int x, unsigned int y)
+{
+	if (component.m_h == maxH && component.m_v == maxV)
+		return component.m_plane[y * component.m_planeWidth + x];
+
+	float planeX = ((float)x + 0.5f) * (float)component.m_h / (float)maxH - 0.5f;
+	float planeY = ((float)y + 0.5f) * (float)component.m_v / (float)maxV - 0.5f;
+	planeX = planeX < 0.0f ? 0.0f : planeX;
+	planeY = planeY < 0.0f ? 0.0f : planeY;
+
+	const unsigned int x0 = (unsigned int)planeX;
+	const unsigned int y0 = (unsigned int)planeY;
+	const unsigned int x1 = x0 + 1 < component.m_planeWidth ? x0 + 1 : x0;
+	const unsigned int y1 = y0 + 1 < component.m_planeHeight ? y0 + 1 : y0;
+	const float fractionX = planeX - (float)x0;
+	const float fractionY = planeY - (float)y0;
+
+	const unsigned char *plane = &component.m_plane[0];
+	const float top = plane[y0 * component.m_planeWidth + x0] * (1.0f - fractionX) + plane[y0 * component.m_planeWidth + x1] * fractionX;
+	const float bottom = plane[y1 * component.m_planeWidth + x0] * (1.0f - fractionX) + plane[y1 * component.m_planeWidth + x1] * fractionX;
+	return (unsigned int)(top + (bottom - top) * fractionY + 0.5f);
+}
+
+//-----------------------------------------------------------------------------
+void SJPEGDecoder::ConvertToRGBA (std::vector<unsigned char> &pixels) const
+{
+	pixels.resize(m_width * m_height * 4);
+	unsigned char *dest = &pixels[0];
+	for (unsigned int y = 0; y < m_height; ++y)
+	{
+		for (unsigned int x = 0; x < m_width; ++x, dest += 4)
+		{
+			const int luma = SampleJPEGComponent(m_components[0], m_maxH, m_maxV, x, y);
+			if (m_numComponents == 1)
+			{
+				dest[0] = dest[1] = dest[2] = (unsigned char)luma;
+				dest[3] = 255;
+				continue;
+			}
+
+			// YCbCr to RGB, in 16.16 fixed point
+			const int blueDifference = (int)SampleJPEGComponent(m_components[1], m_maxH, m_maxV, x, y) - 128;
+			const int redDifference = (int)SampleJPEGComponent(m_components[2], m_maxH, m_maxV, x, y) - 128;
+			const int red = luma + ((91881 * redDifference + 32768) >> 16);
+			const int green = luma - ((22554 * blueDifference + 46802 * redDifference - 32768) >> 16);
+			const int blue = luma + ((116130 * blueDifference + 32768) >> 16);
+
+			dest[0] = (unsigned char)(red < 0 ? 0 : (red > 255 ? 255 : red));
+			dest[1] = (unsigned char)(green < 0 ? 0 : (green > 255 ? 255 : green));
+			dest[2] = (unsigned char)(blue < 0 ? 0 : (blue > 255 ? 255 : blue));
+			dest[3] = 255;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// calls segmentCallback(marker, segment, length) for each marker segment until it returns false or
+// the image ends.  Returns false if the data is broken.
+template <typename T>
+static bool WalkJPEGSegments (const unsigned char *data, size_t size, T segmentCallback)
+{
+	if (size < 4 || data[0] != 0xFF || data[1] != e_jpegMarkerSOI)
+		return false;
+
+	size_t pos = 2;
+	while (pos + 2 <= size)
+	{
+		if (data[pos] != 0xFF)
+			return false;
+
+		const unsigned int marker = data[pos + 1];
+		pos += 2;
+
+		// FF can pad out the space before a marker, and some markers have no segment
+		if (marker == 0xFF)
+		{
+			pos--;
+			continue;
+		}
+		if (marker == e_jpegMarkerEOI)
+			return true;
+		if (marker == e_jpegMarkerSOI || (marker >= e_jpegMarkerRST0 && marker <= e_jpegMarkerRST7) || marker == 0x01)
+			continue;
+
+		if (pos + 2 > size)
+			return false;
+		const unsigned int length = ReadBigEndian16(&data[pos]);
+		if (length < 2 || pos + length > size)
+			return false;
+
+		size_t next = pos + length;
+		if (!segmentCallback(marker, &data[pos + 2], length - 2, next))
+			return true;
+		pos = next;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CImageDecoder::DecodeJPEG (const unsigned char *data, size_t size, std::vector<unsigned char> &pixels, unsigned int &width, unsigned int &height)
+{
+	SJPEGDecoder decoder(data, size);
+	bool ok = true;
+	bool decodedScan = false;
+	const bool walked = WalkJPEGSegments(data, size, [&] (unsigned int marker, const unsigned char *segment, unsigned int length, size_t &next) -> bool {
+		switch (marker)
+		{
+			case e_jpegMarkerSOF0:
+			case e_jpegMarkerSOF1:
+				ok = decoder.ReadFrame(segment, length);
+				break;
+			case e_jpegMarkerDHT:
+				ok = decoder.ReadHuffmanTables(segment, length);
+				break;
+			case e_jpegMarkerDQT:
+				ok = decoder.ReadQuantTables(segment, length);
+				break;
+			case e_jpegMarkerDRI:
+				ok = length >= 2;
+				decoder.m_restartInterval = ok ? ReadBigEndian16(segment) : 0;
+				break;
+			case e_jpegMarkerSOS:
+			{
+				// the entropy coded data follows the segment, up to the next marker that isn't a restart
+				decoder.m_pos = next;
+				ok = decoder.DecodeScan(segment, length);
+				decodedScan = true;
+				size_t pos = decoder.m_pos;
+				while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] != 0 && (data[pos + 1] < e_jpegMarkerRST0 || data[pos + 1] > e_jpegMarkerRST7)))
+					pos++;
+				next = pos;
+				break;
+			}
+			default:
+				// any other frame type is progressive, lossless or arithmetic coded
+				if (marker >= 0xC2 && marker <= 0xCF && marker != e_jpegMarkerDHT && marker != 0xC8 && marker != 0xCC)
+					ok = false;
+				break;
+		}
+		return ok;
+	});
+
+	if (!walked || !ok || !decodedScan)
+		return false;
+
+	width = decoder.m_width;
+	height = decoder.m_height;
+	decoder.ConvertToRGBA(pixels);
+	return true;
+}
+
+//=================================================================================================
+//                                        CImageDecoder
+//=================================================================================================
+
+//-----------------------------------------------------------------------------
+bool CImageDecoder::LoadFile (const char *fileName, std::vector<unsigned char> &data)
+{
+	FILE *file = fopen(fileName, "rb");
+	if (!file)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	const long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	bool ok = size > 0;
+	if (ok)
+	{
+		data.resize(size);
+		ok = fread(&data[0], 1, size, file) == (size_t)size;
+	}
+
+	fclose(file);
+	return ok;
+}
+
+//-----------------------------------------------------------------------------
+bool CImageDecoder::GetSize (const unsigned char *data, size_t size, unsigned int &width, unsigned int &height)
+{
+	SPNGInfo info;
+	if (ReadPNGHeader(data, size, info))
+	{
+		width = info.m_width;
+		height = info.m_height;
+		return true;
+	}
+
+	// the size is in the frame header, which comes before the first scan
+	bool found = false;
+	const bool walked = WalkJPEGSegments(data, size, [&] (unsigned int marker, const unsigned char *segment, unsigned int length, size_t &) -> bool {
+		if (marker == e_jpegMarkerSOF0 || marker == e_jpegMarkerSOF1)
+		{
+			SJPEGDecoder decoder(data, size);
+			found = decoder.ReadFrame(segment, length);
+			width = decoder.m_width;
+			height = decoder.m_height;
+			return false;
+		}
+		return marker != e_jpegMarkerSOS && !(marker >= 0xC2 && marker <= 0xCF && marker != e_jpegMarkerDHT && marker != 0xC8 && marker != 0xCC);
+	});
+
+	return walked && found;
+}
+
+//-----------------------------------------------------------------------------
+bool CImageDecoder::Decode (const unsigned char *data, size_t size, std::vector<unsigned char> &pixels, unsigned int &width, unsigned int &height)
+{
+	if (size >= 8 && !memcmp(data, c_pngSignature, 8))
+		return DecodePNG(data, size, pixels, width, height);
+
+	if (size >= 2 && data[0] == 0xFF && data[1] == e_jpegMarkerSOI)
+		return DecodeJPEG(data, size, pixels, width, height);
+
+	return false;
+}
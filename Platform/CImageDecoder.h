@@ -0,0 +1,33 @@
+/*==================================================================================================
+
+CImageDecoder.h
+
+Decodes .png and baseline .jpg files into 8 bit RGBA without needing directx, so textures can be
+decoded on any thread, and on platforms without D3DX.  Other formats, and progressive or CMYK jpgs,
+fail to decode.
+
+==================================================================================================*/
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+class CImageDecoder
+{
+public:
+	// reads a whole file into data.  Returns false if it couldn't be read or is empty.
+	static bool LoadFile (const char *fileName, std::vector<unsigned char> &data);
+
+	// reads the size from the image's header without decoding it.  Returns false if it isn't an image
+	// that Decode() can handle.
+	static bool GetSize (const unsigned char *data, size_t size, unsigned int &width, unsigned int &height);
+
+	// decodes the image into width * height RGBA pixels, top row first.  Returns false if it couldn't.
+	// Safe to call from any number of threads at once.
+	static bool Decode (const unsigned char *data, size_t size, std::vector<unsigned char> &pixels, unsigned int &width, unsigned int &height);
+
+private:
+	static bool DecodePNG (const unsigned char *data, size_t size, std::vector<unsigned char> &pixels, unsigned int &width, unsigned int &height);
+	static bool DecodeJPEG (const unsigned char *data, size_t size, std::vector<unsigned char> &pixels, unsigned int &width, unsigned int &height);
+};
@@ -0,0 +1,155 @@
+/*==================================================================================================
+
+CJobSystem.cpp
+
+A pool of worker threads that run batches of jobs.  Each thread has it's own queue of jobs, and
+threads that run out of work steal jobs from the back of the other queues, so uneven jobs (like
+tiles of a frame where some tiles see more geometry) still keep every core busy.
+
+==================================================================================================*/
+
+#include "CJobSystem.h"
+
+//-----------------------------------------------------------------------------
+CJobSystem::CJobSystem (unsigned int numThreads)
+	: m_job(NULL)
+	, m_jobsRemaining(0)
+	, m_batch(0)
+	, m_quit(false)
+{
+	if (numThreads == 0)
+		numThreads = std::thread::hardware_concurrency();
+	if (numThreads == 0)
+		numThreads = 1;
+
+	// queue 0 belongs to the thread calling ParallelFor()
+	for (unsigned int index = 0; index < numThreads; ++index)
+		m_queues.push_back(new SJobQueue);
+
+	for (unsigned int index = 1; index < numThreads; ++index)
+		m_threads.push_back(std::thread(&CJobSystem::WorkerThread, this, index));
+}
+
+//-----------------------------------------------------------------------------
+CJobSystem::~CJobSystem ()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_workAvailable.notify_all();
+
+	for (unsigned int index = 0, count = m_threads.size(); index < count; ++index)
+		m_threads[index].join();
+
+	for (unsigned int index = 0, count = m_queues.size(); index < count; ++index)
+		delete m_queues[index];
+}
+
+//-----------------------------------------------------------------------------
+void CJobSystem::ParallelFor (unsigned int count, const std::function<void(unsigned int)> &job)
+{
+	if (count == 0)
+		return;
+
+	// set up the batch before any jobs are queued, since a worker still finishing up the last batch may
+	// grab one of the new jobs as soon as it's queued
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = &job;
+		m_jobsRemaining = count;
+		++m_batch;
+	}
+
+	// deal the jobs out in contiguous runs, so neighboring jobs (neighboring tiles) tend to run on the
+	// same thread.  Stealing evens things out from there.
+	const unsigned int numQueues = m_queues.size();
+	for (unsigned int queueIndex = 0; queueIndex < numQueues; ++queueIndex)
+	{
+		SJobQueue &queue = *m_queues[queueIndex];
+		std::lock_guard<std::mutex> lock(queue.m_mutex);
+		const unsigned int start = (unsigned int)(((unsigned long long)count * queueIndex) / numQueues);
+		const unsigned int stop = (unsigned int)(((unsigned long long)count * (queueIndex + 1)) / numQueues);
+		for (unsigned int index = start; index < stop; ++index)
+			queue.m_jobs.push_back(index);
+	}
+
+	// wake up the workers
+	m_workAvailable.notify_all();
+
+	// help out, then wait for any jobs still running on other threads
+	RunJobs(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_jobsRemaining > 0)
+		m_batchFinished.wait(lock);
+	m_job = NULL;
+}
+
+//-----------------------------------------------------------------------------
+void CJobSystem::WorkerThread (unsigned int queueIndex)
+{
+	unsigned int lastBatch = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (!m_quit && m_batch == lastBatch)
+				m_workAvailable.wait(lock);
+			if (m_quit)
+				return;
+			lastBatch = m_batch;
+		}
+
+		RunJobs(queueIndex);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void CJobSystem::RunJobs (unsigned int queueIndex)
+{
+	unsigned int job;
+	while (PopJob(queueIndex, job) || StealJob(queueIndex, job))
+	{
+		(*m_job)(job);
+
+		// the last job to finish lets ParallelFor() return
+		if (--m_jobsRemaining == 0)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_batchFinished.notify_all();
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool CJobSystem::PopJob (unsigned int queueIndex, unsigned int &job)
+{
+	SJobQueue &queue = *m_queues[queueIndex];
+	std::lock_guard<std::mutex> lock(queue.m_mutex);
+	if (queue.m_jobs.empty())
+		return false;
+
+	job = queue.m_jobs.front();
+	queue.m_jobs.pop_front();
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool CJobSystem::StealJob (unsigned int queueIndex, unsigned int &job)
+{
+	// take from the back of the other queues, which is the work their owners would get to last
+	const unsigned int numQueues = m_queues.size();
+	for (unsigned int offset = 1; offset < numQueues; ++offset)
+	{
+		SJobQueue &queue = *m_queues[(queueIndex + offset) % numQueues];
+		std::lock_guard<std::mutex> lock(queue.m_mutex);
+		if (queue.m_jobs.empty())
+			continue;
+
+		job = queue.m_jobs.back();
+		queue.m_jobs.pop_back();
+		return true;
+	}
+	return false;
+}
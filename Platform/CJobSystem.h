@@ -0,0 +1,63 @@
+/*==================================================================================================
+
+CJobSystem.h
+
+A pool of worker threads that run batches of jobs.  Each thread has it's own queue of jobs, and
+threads that run out of work steal jobs from the back of the other queues, so uneven jobs (like
+tiles of a frame where some tiles see more geometry) still keep every core busy.
+
+==================================================================================================*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+class CJobSystem
+{
+public:
+	// numThreads of 0 means one thread per hardware thread.  The thread calling ParallelFor() counts
+	// as one of them, so numThreads - 1 worker threads are created.
+	CJobSystem (unsigned int numThreads = 0);
+	~CJobSystem ();
+
+	// calls job(index) for every index in [0, count), spread across all the threads, and returns
+	// once they have all finished.  Jobs may not call ParallelFor() themselves.
+	void ParallelFor (unsigned int count, const std::function<void(unsigned int)> &job);
+
+	unsigned int NumThreads () const { return m_queues.size(); }
+
+private:
+	struct SJobQueue
+	{
+		std::mutex					m_mutex;
+		std::deque<unsigned int>	m_jobs;
+	};
+
+	void WorkerThread (unsigned int queueIndex);
+
+	// runs jobs from our own queue, then from everyone else's, until there are none left anywhere
+	void RunJobs (unsigned int queueIndex);
+
+	bool PopJob (unsigned int queueIndex, unsigned int &job);
+	bool StealJob (unsigned int queueIndex, unsigned int &job);
+
+	std::vector<SJobQueue*>			m_queues;
+	std::vector<std::thread>		m_threads;
+
+	// the current batch of jobs.  m_batch changes every time ParallelFor() is called, which is how
+	// sleeping workers know there is new work.
+	const std::function<void(unsigned int)> *m_job;
+	std::atomic<unsigned int>		m_jobsRemaining;
+	unsigned int					m_batch;
+	bool							m_quit;
+
+	std::mutex						m_mutex;
+	std::condition_variable			m_workAvailable;
+	std::condition_variable			m_batchFinished;
+};
@@ -0,0 +1,303 @@
+/*==================================================================================================
+
+CKernelVariants.cpp
+
+The graphics settings that change what the kernel does (Shadows, NormalMapping, RayBounces, ...) are
+compiled into clrt.cl as defines, so each combination of them is a different program.  This keeps
+a program per combination that has been asked for, and builds new ones on a worker thread so the
+settings can change while the game runs.  The current variant keeps rendering until the one asked
+for is built, and only then is swapped in, between frames.
+
+==================================================================================================*/
+
+#include "CKernelVariants.h"
+#include "CProgramBinaryCache.h"
+
+#include <stdio.h>
+
+//-----------------------------------------------------------------------------
+CKernelVariants::CKernelVariants ()
+	: m_context(NULL)
+	, m_device(NULL)
+	, m_current(NULL)
+	, m_requested(NULL)
+	, m_building(NULL)
+{
+}
+
+//-----------------------------------------------------------------------------
+void CKernelVariants::Init (cl_context context, cl_device_id device, const char *sourceFileName, const char *ptxFileName, const char *kernelEntryPoint)
+{
+	Release();
+
+	m_context = context;
+	m_device = device;
+	m_sourceFileName = sourceFileName;
+	m_ptxFileName = ptxFileName;
+	m_kernelEntryPoint = kernelEntryPoint;
+}
+
+//-----------------------------------------------------------------------------
+void CKernelVariants::Release ()
+{
+	m_buildThread.Wait();
+	m_building = NULL;
+
+	for (unsigned int index = 0, count = m_variants.size(); index < count; ++index)
+	{
+		SKernelVariant *variant = m_variants[index];
+		if (variant->m_kernel)
+			clReleaseKernel(variant->m_kernel);
+		if (variant->m_program)
+			clReleaseProgram(variant->m_program);
+		delete variant;
+	}
+	m_variants.clear();
+
+	m_current = NULL;
+	m_requested = NULL;
+}
+
+//-----------------------------------------------------------------------------
+bool CKernelVariants::BuildNow (const SData_GfxSettings &settings)
+{
+	// finish whatever is building in the background, so the variant can't be being built already
+	m_buildThread.Wait();
+	FinishBuild();
+
+	SKernelVariant *variant = FindOrAdd(settings);
+	if (variant->m_state == SKernelVariant::e_stateNotBuilt)
+	{
+		Build(*variant);
+		variant->m_state = variant->m_kernel ? SKernelVariant::e_stateBuilt : SKernelVariant::e_stateFailed;
+	}
+
+	if (variant->m_state != SKernelVariant::e_stateBuilt)
+		return false;
+
+	m_current = variant;
+	m_requested = NULL;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+void CKernelVariants::Request (const SData_GfxSettings &settings)
+{
+	SKernelVariant *variant = FindOrAdd(settings);
+	m_requested = variant != m_current ? variant : NULL;
+}
+
+//-----------------------------------------------------------------------------
+void CKernelVariants::Prepare (const SData_GfxSettings &settings)
+{
+	// Update() builds any variant that hasn't been, so adding it is enough
+	FindOrAdd(settings);
+}
+
+//-----------------------------------------------------------------------------
+bool CKernelVariants::IsReady (const SData_GfxSettings &settings)
+{
+	return FindOrAdd(settings)->m_state == SKernelVariant::e_stateBuilt;
+}
+
+//-----------------------------------------------------------------------------
+bool CKernelVariants::Update ()
+{
+	const bool busy = m_buildThread.IsBusy();
+	if (!busy)
+		FinishBuild();
+
+	bool changed = false;
+	if (m_requested && m_requested->m_state == SKernelVariant::e_stateBuilt)
+	{
+		m_current = m_requested;
+		m_requested = NULL;
+		changed = true;
+	}
+	else if (m_requested && m_requested->m_state == SKernelVariant::e_stateFailed)
+	{
+		printf("Couldn't build the kernel for the new graphics settings, keeping the old ones\n");
+		m_requested = NULL;
+	}
+
+	if (busy)
+		return changed;
+
+	// build the requested variant first, then any that were prepared
+	SKernelVariant *next = m_requested && m_requested->m_state == SKernelVariant::e_stateNotBuilt ? m_requested : NULL;
+	for (unsigned int index = 0, count = m_variants.size(); !next && index < count; ++index)
+	{
+		if (m_variants[index]->m_state == SKernelVariant::e_stateNotBuilt)
+			next = m_variants[index];
+	}
+
+	if (next)
+	{
+		next->m_state = SKernelVariant::e_stateBuilding;
+		m_building = next;
+		m_buildThread.Run([this, next] () { Build(*next); });
+	}
+
+	return changed;
+}
+
+//-----------------------------------------------------------------------------
+void CKernelVariants::FinishBuild ()
+{
+	// only called once the build thread is idle, so it's done with m_building
+	if (!m_building)
+		return;
+
+	m_building->m_state = m_building->m_kernel ? SKernelVariant::e_stateBuilt : SKernelVariant::e_stateFailed;
+	m_building = NULL;
+}
+
+//-----------------------------------------------------------------------------
+SKernelVariant *CKernelVariants::FindOrAdd (const SData_GfxSettings &settings)
+{
+	const std::string buildOptions = BuildOptions(settings);
+	for (unsigned int index = 0, count = m_variants.size(); index < count; ++index)
+	{
+		if (m_variants[index]->m_buildOptions == buildOptions)
+			return m_variants[index];
+	}
+
+	SKernelVariant *variant = new SKernelVariant;
+	variant->m_settings = settings;
+	variant->m_buildOptions = buildOptions;
+	m_variants.push_back(variant);
+	return variant;
+}
+
+//-----------------------------------------------------------------------------
+void CKernelVariants::Build (SKernelVariant &variant) const
+{
+	// runs on the build thread, so only touches the variant's program and kernel
+	cl_int ciErrNum;
+
+	// use the binary from the last time the kernel was built this way, if there is one
+	CProgramBinaryCache binaryCache(m_sourceFileName.c_str(), "./KernelCode/", variant.m_buildOptions, m_device);
+	cl_program program = binaryCache.Load(m_context);
+
+	if (!program)
+	{
+		// Program Setup
+		size_t program_length;
+		char *source = oclLoadProgSource(m_sourceFileName.c_str(), "", &program_length);
+		if (!source)
+		{
+			printf("Could not load %s\n", m_sourceFileName.c_str());
+			return;
+		}
+
+		// create the program
+		program = clCreateProgramWithSource(m_context, 1, (const char **) &source, &program_length, &ciErrNum);
+		free(source);
+		if (ciErrNum != CL_SUCCESS)
+		{
+			printf(" error in clCreateProgramWithSource: %i\n", ciErrNum);
+			return;
+		}
+
+		// build the program
+		ciErrNum = clBuildProgram(program, 1, &m_device, variant.m_buildOptions.c_str(), NULL, NULL);
+		if (ciErrNum != CL_SUCCESS)
+		{
+			// write out standard error, Build Log and PTX, then cleanup
+			printf(" error in clBuildProgram: %i\n", ciErrNum);
+			oclLogBuildInfo(program, m_device);
+			oclLogPtx(program, m_device, m_ptxFileName.c_str());
+			clReleaseProgram(program);
+			return;
+		}
+
+		binaryCache.Save(program);
+	}
+
+	// create the kernel
+	cl_kernel kernel = clCreateKernel(program, m_kernelEntryPoint.c_str(), &ciErrNum);
+	if (!kernel || ciErrNum != CL_SUCCESS)
+	{
+		printf(" error in clCreateKernel: %i\n", ciErrNum);
+		clReleaseProgram(program);
+		return;
+	}
+
+	variant.m_program = program;
+	variant.m_kernel = kernel;
+}
+
+//-----------------------------------------------------------------------------
+std::string CKernelVariants::BuildOptions (const SData_GfxSettings &settings)
+{
+	// make our build options
+	std::string buildOptions;
+	char buffer[32];
+	buildOptions = "-I ./KernelCode/ -D OPENCL=1 -Werror";
+	buildOptions.append(" -D SETTINGS_TEXTUREFILTER=");
+	buildOptions.append(settings.m_TextureFilter ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_INTERLACED=");
+	buildOptions.append(settings.m_InterlaceMode ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_NORMALMAP=");
+	buildOptions.append(settings.m_NormalMapping ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_SHADOWS=");
+	buildOptions.append(settings.m_Shadows ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_HIQLIGHTS=");
+	buildOptions.append(settings.m_HighQualityLights ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_REDBLUE3D=");
+	buildOptions.append(settings.m_RedBlue3D ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_REDBLUEWIDTH=");
+	sprintf(buffer, "%f", settings.m_RedBlueWidth);
+	buildOptions.append(buffer);
+	buildOptions.append(" -D SETTINGS_RAYBOUNCES=");
+	sprintf(buffer, "%i", settings.m_RayBounces);
+	buildOptions.append(buffer);
+	buildOptions.append(" -D SETTINGS_COLORABSORB=");
+	buildOptions.append(settings.m_ColorAbsorption ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_WAVEFRONT=");
+	buildOptions.append(settings.m_WavefrontPath ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_AUTOEXPOSURE=");
+	buildOptions.append(settings.m_AutoExposure ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_TEMPORAL=");
+	buildOptions.append(settings.m_TemporalReprojection ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_TEMPORALREFRESH=");
+	sprintf(buffer, "%u", settings.m_TemporalRefreshFrames > 0 ? settings.m_TemporalRefreshFrames : 1);
+	buildOptions.append(buffer);
+	buildOptions.append(" -D SETTINGS_VARIABLERATE=");
+	buildOptions.append(settings.m_VariableRate ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_VARIABLERATETILE=");
+	sprintf(buffer, "%u", settings.m_VariableRateTileSize > 1 ? settings.m_VariableRateTileSize : 2);
+	buildOptions.append(buffer);
+	buildOptions.append(" -D SETTINGS_VARIABLERATETHRESHOLD=");
+	sprintf(buffer, "%ff", settings.m_VariableRateThreshold);
+	buildOptions.append(buffer);
+	buildOptions.append(" -D SETTINGS_LIGHTSAMPLING=");
+	buildOptions.append(settings.m_LightSampling ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_BAKEDSHADOWS=");
+	buildOptions.append(settings.m_BakedShadows ? "1" : "0");
+	buildOptions.append(" -D SETTINGS_LIGHTSAMPLES=");
+	sprintf(buffer, "%u", settings.m_LightSamples > 0 ? settings.m_LightSamples : 1);
+	buildOptions.append(buffer);
+
+	// debug options
+	buildOptions.append(" -D DEBUG_MODEL_BOUNDING_SPHERE=");
+	buildOptions.append(settings.m_DebugModelBoundingSphere ? "1" : "0");
+	buildOptions.append(" -D DEBUG_TEXTURE_UV=");
+	buildOptions.append(settings.m_DebugTextureUV ? "1" : "0");
+	buildOptions.append(" -D DEBUG_RAY_BOUNCECOUNT=");
+	buildOptions.append(settings.m_DebugRayBounceCount ? "1" : "0");
+	buildOptions.append(" -D DEBUG_TRIANGLES=");
+	buildOptions.append(settings.m_DebugTriangles ? "1" : "0");
+	buildOptions.append(" -D DEBUG_VARIABLE_RATE=");
+	buildOptions.append(settings.m_DebugVariableRate ? "1" : "0");
+
+	// if this setting is on, turn on the optimizations that prefer speed over accuracy and safety
+	if (settings.m_FastestMath) {
+		buildOptions.append(" -cl-single-precision-constant");
+		buildOptions.append(" -cl-denorms-are-zero");
+		buildOptions.append(" -cl-strict-aliasing");
+		buildOptions.append(" -cl-fast-relaxed-math");
+	}
+
+	return buildOptions;
+}
@@ -0,0 +1,108 @@
+/*==================================================================================================
+
+CKernelVariants.h
+
+The graphics settings that change what the kernel does (Shadows, NormalMapping, RayBounces, ...) are
+compiled into clrt.cl as defines, so each combination of them is a different program.  This keeps
+a program per combination that has been asked for, and builds new ones on a worker thread so the
+settings can change while the game runs.  The current variant keeps rendering until the one asked
+for is built, and only then is swapped in, between frames.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "oclUtils.h"
+#include "CWorkerThread.h"
+#include "DataSchemas/DataSchemasStructs.h"
+
+#include <string>
+#include <vector>
+
+struct SKernelVariant
+{
+	enum EState
+	{
+		e_stateNotBuilt,
+		e_stateBuilding,
+		e_stateBuilt,
+		e_stateFailed,
+	};
+
+	SKernelVariant ()
+		: m_program(NULL)
+		, m_kernel(NULL)
+		, m_state(e_stateNotBuilt)
+	{
+	}
+
+	// the settings the variant was built for.  Only the ones that go in the build options are known to
+	// match what the kernel does, so read those from here rather than from the current settings.
+	SData_GfxSettings	m_settings;
+	std::string			m_buildOptions;
+
+	cl_program			m_program;
+	cl_kernel			m_kernel;		// the clrt megakernel.  The wavefront kernels are in m_program too.
+	EState				m_state;
+};
+
+class CKernelVariants
+{
+public:
+	CKernelVariants ();
+
+	~CKernelVariants ()
+	{
+		Release();
+	}
+
+	void Init (cl_context context, cl_device_id device, const char *sourceFileName, const char *ptxFileName, const char *kernelEntryPoint);
+
+	// waits for any build in progress, then releases every variant
+	void Release ();
+
+	// builds the variant for settings on this thread and makes it current.  For startup, when there
+	// isn't a kernel to keep rendering with yet.
+	bool BuildNow (const SData_GfxSettings &settings);
+
+	// makes the variant for settings current once it's built, building it in the background if it
+	// hasn't been.  Asking for another variant before then replaces the request.
+	void Request (const SData_GfxSettings &settings);
+
+	// builds the variant for settings in the background if it hasn't been, without making it current,
+	// so it's ready to swap in straight away if it's asked for later
+	void Prepare (const SData_GfxSettings &settings);
+
+	// call between frames.  Swaps in the requested variant if it has finished building and starts the
+	// next build if the worker is free.  Returns true if the current variant changed.
+	bool Update ();
+
+	bool HasCurrent () const { return m_current != NULL; }
+	const SKernelVariant &Current () const { return *m_current; }
+
+	// whether the variant for settings is built and ready to swap in
+	bool IsReady (const SData_GfxSettings &settings);
+
+	static std::string BuildOptions (const SData_GfxSettings &settings);
+
+private:
+	SKernelVariant *FindOrAdd (const SData_GfxSettings &settings);
+	void Build (SKernelVariant &variant) const;
+	void FinishBuild ();
+
+	cl_context						m_context;
+	cl_device_id					m_device;
+	std::string						m_sourceFileName;
+	std::string						m_ptxFileName;
+	std::string						m_kernelEntryPoint;
+
+	// the variants never move once added, since the build thread holds on to the one it's building
+	std::vector<SKernelVariant *>	m_variants;
+	SKernelVariant					*m_current;
+	SKernelVariant					*m_requested;
+
+	// the build thread only writes the program and kernel of m_building.  Everything else, including
+	// the variants' states, is only touched by the thread calling the methods above.
+	SKernelVariant					*m_building;
+	CWorkerThread					m_buildThread;
+};
@@ -0,0 +1,2149 @@
+/*==================================================================================================
+
+CPUTrace.cpp
+
+A C++ port of the ray tracing routines in clrt.cl, working on the same structs the kernel does.
+Used by the cpu renderer, and as a reference to check kernel changes against.
+
+Changes made to TraceRay, ShadeSurface, SampleTexture, ApplyPointLight, PointCanSeePoint or the
+intersection routines in clrt.cl need to be made here as well.  Textures are read from a copy of
+the texture atlas in memory (see CTextureManager::GetHostAtlas()), the same way the kernel reads them.
+
+==================================================================================================*/
+
+#include "CPUTrace.h"
+#include "DataSchemas/DataSchemasStructs.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h>
+
+namespace CPUTrace
+{
+
+static const float c_maxRayLength = 1000.0f;
+
+// how grazing a hit can get before it stops making the texture footprint bigger
+static const float c_textureLodMinCosine = 0.25f;
+
+// what the cl_uint indices of the shared structs hold when they don't point at anything
+static const cl_uint c_invalidIndex = (cl_uint)-1;
+
+struct SCollisionInfo
+{
+	TObjectId			m_objectHit;
+	bool 				m_fromInside;
+	float3				m_intersectionPoint;
+	float				m_intersectionTime;
+	float3				m_surfaceNormal;
+	float3				m_surfaceU;
+	float3				m_surfaceV;
+	cl_float2			m_textureCoordinates;
+	float3				m_debugAdditiveColor; // for debugging!
+	unsigned int		m_materialIndex;
+	unsigned int		m_portalIndex;
+	float				m_textureDensity;	// texture coordinate units per world unit at the hit, to pick the mip level
+};
+
+// maps the color coming from the levels after it to color * m_filterColor + m_addColor, with the fog
+// of the level, and of any portals crossed on the way to it, folded in.  Same as in clrt.cl.
+struct SColorStackItem
+{
+	float3		m_filterColor;
+	float3		m_addColor;
+};
+
+//-----------------------------------------------------------------------------
+static inline float3 MakeFloat3 (float x, float y, float z)
+{
+	float3 ret;
+	ret[0] = x;
+	ret[1] = y;
+	ret[2] = z;
+	return ret;
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 XYZ (const cl_float4 &v)
+{
+	return MakeFloat3(v.s[0], v.s[1], v.s[2]);
+}
+
+//-----------------------------------------------------------------------------
+static inline float Saturate (float x)
+{
+	return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 Reflect (const float3 &V, const float3 &N)
+{
+	return V - N * (2.0f * dot(V, N));
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 Refract (const float3 &V, const float3 &N, float refrIndex)
+{
+	float cosI = -dot(N, V);
+	float cosT2 = 1.0f - refrIndex * refrIndex * (1.0f - cosI * cosI);
+	return (V * refrIndex) + N * (refrIndex * cosI - sqrt(cosT2));
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 SafeReciprocal (const float3 &v)
+{
+	return MakeFloat3(
+		v[0] != 0.0f ? 1.0f / v[0] : FLT_MAX,
+		v[1] != 0.0f ? 1.0f / v[1] : FLT_MAX,
+		v[2] != 0.0f ? 1.0f / v[2] : FLT_MAX);
+}
+
+//-----------------------------------------------------------------------------
+static inline float ColorToGray (const float3 &color)
+{
+	return color[0] * 0.3f + color[1] * 0.59f + color[2] * 0.11f;
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 sRGBToLinearColor (const float3 &f)
+{
+	return MakeFloat3(sqrt(f[0]), sqrt(f[1]), sqrt(f[2]));
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 LinearColorTosRGB (const float3 &f)
+{
+	return f * f;
+}
+
+//-----------------------------------------------------------------------------
+static inline float MaxAbs (const cl_float2 &v)
+{
+	return fabs(v.s[0]) > fabs(v.s[1]) ? fabs(v.s[0]) : fabs(v.s[1]);
+}
+
+//-----------------------------------------------------------------------------
+static inline void TransformPoint (float3 &outPoint, const float3 &inPoint, const cl_float4 &xAxis, const cl_float4 &yAxis, const cl_float4 &zAxis, const cl_float4 &wAxis)
+{
+	outPoint = XYZ(xAxis) * inPoint[0] + XYZ(yAxis) * inPoint[1] + XYZ(zAxis) * inPoint[2] + XYZ(wAxis);
+}
+
+//-----------------------------------------------------------------------------
+static inline void TransformVector (float3 &outVector, const float3 &inVector, const cl_float4 &xAxis, const cl_float4 &yAxis, const cl_float4 &zAxis)
+{
+	outVector = XYZ(xAxis) * inVector[0] + XYZ(yAxis) * inVector[1] + XYZ(zAxis) * inVector[2];
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 GetSectorPlaneNormal (unsigned int planeIndex)
+{
+	static const float c_normals[SSECTOR_NUMPLANES][3] =
+	{
+		{-1.0f, 0.0f, 0.0f},	// positive x
+		{ 1.0f, 0.0f, 0.0f},	// negative x
+		{ 0.0f,-1.0f, 0.0f},	// positive y
+		{ 0.0f, 1.0f, 0.0f},	// negative y
+		{ 0.0f, 0.0f,-1.0f},	// positive z
+		{ 0.0f, 0.0f, 1.0f},	// negative z
+	};
+	return MakeFloat3(c_normals[planeIndex][0], c_normals[planeIndex][1], c_normals[planeIndex][2]);
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 GetSectorPlaneU (unsigned int planeIndex)
+{
+	static const float c_us[SSECTOR_NUMPLANES][3] =
+	{
+		{ 0.0f, 0.0f,-1.0f},	// positive x
+		{ 0.0f, 0.0f, 1.0f},	// negative x
+		{ 1.0f, 0.0f, 0.0f},	// positive y
+		{-1.0f, 0.0f, 0.0f},	// negative y
+		{ 1.0f, 0.0f, 0.0f},	// positive z
+		{-1.0f, 0.0f, 0.0f},	// negative z
+	};
+	return MakeFloat3(c_us[planeIndex][0], c_us[planeIndex][1], c_us[planeIndex][2]);
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 GetSectorPlaneV (unsigned int planeIndex)
+{
+	static const float c_vs[SSECTOR_NUMPLANES][3] =
+	{
+		{ 0.0f, 1.0f, 0.0f},	// positive x
+		{ 0.0f, 1.0f, 0.0f},	// negative x
+		{ 0.0f, 0.0f,-1.0f},	// positive y
+		{ 0.0f, 0.0f, 1.0f},	// negative y
+		{ 0.0f, 1.0f, 0.0f},	// positive z
+		{ 0.0f, 1.0f, 0.0f},	// negative z
+	};
+	return MakeFloat3(c_vs[planeIndex][0], c_vs[planeIndex][1], c_vs[planeIndex][2]);
+}
+
+//-----------------------------------------------------------------------------
+static inline void InitCollisionInfo (SCollisionInfo &info, float maxTime, const float3 &debugAdditiveColor)
+{
+	const float3 zero = MakeFloat3(0.0f, 0.0f, 0.0f);
+	info.m_objectHit = c_invalidObjectId;
+	info.m_fromInside = false;
+	info.m_intersectionPoint = zero;
+	info.m_intersectionTime = maxTime;
+	info.m_surfaceNormal = zero;
+	info.m_surfaceU = zero;
+	info.m_surfaceV = zero;
+	info.m_textureCoordinates.s[0] = 0.0f;
+	info.m_textureCoordinates.s[1] = 0.0f;
+	info.m_debugAdditiveColor = debugAdditiveColor;
+	info.m_materialIndex = 0;
+	info.m_portalIndex = 0;
+	info.m_textureDensity = 0.0f;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool IsReflective (const SMaterial &material)
+{
+	return material.m_rayInteraction == e_rayInteractionReflect;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool IsRefractive (const SMaterial &material)
+{
+	return material.m_rayInteraction == e_rayInteractionRefract;
+}
+
+//-----------------------------------------------------------------------------
+// returns whether the ray is inside the sphere anywhere before maxTime
+static inline bool RayHitsSphere (const cl_float4 &sphere, const float3 &rayPos, const float3 &rayDir, const float maxTime)
+{
+	float3 m = rayPos - XYZ(sphere);
+	float b = dot(m, rayDir);
+	float c = dot(m, m) - sphere.s[3] * sphere.s[3];
+
+	//exit if r's origin outside s (c > 0) and r pointing away from s (b > 0)
+	if (c > 0.0f && b > 0.0f)
+		return false;
+
+	//a negative discriminant corresponds to ray missing sphere
+	float discr = b * b - c;
+	if (discr < 0.0f)
+		return false;
+
+	//it's a hit unless the ray enters the sphere after maxTime
+	return -b - sqrt(discr) <= maxTime;
+}
+
+//-----------------------------------------------------------------------------
+static bool RayIntersectSphere (const SSphere &sphere, SCollisionInfo &info, const float3 &rayPos, const float3 &rayDir, const TObjectId ignorePrimitiveId)
+{
+	if (ignorePrimitiveId == sphere.m_objectId)
+		return false;
+
+	const float3 center = XYZ(sphere.m_positionAndRadius);
+	const float radius = sphere.m_positionAndRadius.s[3];
+
+	// get the vector from the center of this circle to where the ray begins.
+	float3 m = rayPos - center;
+
+	// get the dot product of the above vector and the ray's vector
+	float b = dot(m, rayDir);
+
+	float c = dot(m, m) - radius * radius;
+
+	//exit if r's origin outside s (c > 0) and r pointing away from s (b > 0)
+	if (c > 0.0f && b > 0.0f)
+		return false;
+
+	//calculate discriminant
+	float discr = b * b - c;
+
+	//a negative discriminant corresponds to ray missing sphere
+	if (discr < 0.0f)
+		return false;
+
+	//not inside til proven otherwise
+	bool fromInside = false;
+
+	//ray now found to intersect sphere, compute smallest t value of intersection
+	float collisionTime = -b - sqrt(discr);
+
+	//if t is negative, ray started inside sphere so clamp t to zero and remember that we hit from the inside
+	if (collisionTime < 0.0f)
+	{
+		collisionTime = -b + sqrt(discr);
+		fromInside = true;
+	}
+
+	//enforce max distance
+	if (collisionTime > info.m_intersectionTime)
+		return false;
+
+	// set all the info params since we are garaunteed a hit at this point
+	info.m_fromInside = fromInside;
+	info.m_materialIndex = sphere.m_materialIndex;
+	info.m_portalIndex = sphere.m_portalIndex;
+
+	//compute the point of intersection
+	info.m_intersectionPoint = rayPos + rayDir * collisionTime;
+	info.m_intersectionTime = collisionTime;
+
+	// calculate the normal
+	info.m_surfaceNormal = normalize(info.m_intersectionPoint - center);
+
+	// calculate U and V
+	info.m_surfaceU = normalize(cross(MakeFloat3(0.0f, 1.0f, 0.0f), info.m_surfaceNormal));
+	info.m_surfaceV = normalize(cross(info.m_surfaceU, info.m_surfaceNormal));
+
+	// texture coordinates are just the angular part of spherical coordiantes of normal
+	info.m_textureCoordinates.s[0] = atan2(info.m_surfaceNormal[1], info.m_surfaceNormal[0]) * sphere.m_textureScale.s[0] + sphere.m_textureOffset.s[0];
+	info.m_textureCoordinates.s[1] = acos(info.m_surfaceNormal[2]) * sphere.m_textureScale.s[1] + sphere.m_textureOffset.s[1];
+	info.m_textureDensity = MaxAbs(sphere.m_textureScale) / sphere.m_positionAndRadius.s[3];
+
+	// we found a hit!
+	info.m_objectHit = sphere.m_objectId;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// shadow rays only need to know whether something is in the way, so the RayOccludedBy*() tests return at
+// the first hit closer than maxTime, and don't work out anything else about it
+static bool RayOccludedBySphere (const SSphere &sphere, const float3 &rayPos, const float3 &rayDir, const float maxTime, const TObjectId ignorePrimitiveId)
+{
+	if (ignorePrimitiveId == sphere.m_objectId)
+		return false;
+
+	float3 m = rayPos - XYZ(sphere.m_positionAndRadius);
+	float b = dot(m, rayDir);
+	float c = dot(m, m) - sphere.m_positionAndRadius.s[3] * sphere.m_positionAndRadius.s[3];
+	if (c > 0.0f && b > 0.0f)
+		return false;
+
+	float discr = b * b - c;
+	if (discr < 0.0f)
+		return false;
+
+	// from inside the sphere, it's the far side that gets hit
+	float collisionTime = -b - sqrt(discr);
+	if (collisionTime < 0.0f)
+		collisionTime = -b + sqrt(discr);
+
+	return collisionTime <= maxTime;
+}
+
+//-----------------------------------------------------------------------------
+// leaves the texture coordinates and tangents for ResolveModelTriangleShading(), with the barycentric
+// coordinates of the hit in the texture coordinates meanwhile
+static inline bool RayIntersectTriangle (const SScene &scene, cl_uint triangleIndex, SCollisionInfo &info, const float3 &rayPos, const float3 &rayDir, const TObjectId ignorePrimitiveId, bool backFaceCulling, cl_uint materialIndex, cl_uint portalIndex)
+{
+	const TObjectId objectId = c_firstModelTriangleObjectId + triangleIndex;
+	if (ignorePrimitiveId == objectId)
+		return false;
+
+	const SModelTriangle &triangle = scene.m_triangles[triangleIndex];
+
+	const float3 planeNormal = XYZ(triangle.m_plane);
+
+	// do back face culling if we are allowed
+	if (backFaceCulling && dot(rayDir, planeNormal) > 0.0f)
+		return false;
+
+	// distance of p (start point) and q (some other point) to triangle plane
+	float distp = dot(rayPos, planeNormal) - triangle.m_plane.s[3];
+	float distq = dot(rayPos + rayDir, planeNormal) - triangle.m_plane.s[3];
+
+	// calculate t value of impact
+	float denom = distp - distq;
+	float t = distp / denom;
+
+	// enforce min and max distance
+	if (t < 0 || t > info.m_intersectionTime)
+		return false;
+
+	// calculate point of impact s
+	float3 s = rayPos + rayDir * t;
+
+	// calculate barycentric coordinate u, exit if outside of 0-1
+	float u = dot(s, XYZ(triangle.m_planeBC)) - triangle.m_planeBC.s[3];
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	// calculate barycentric coordinate v, exit if negative
+	float v = dot(s, XYZ(triangle.m_planeCA)) - triangle.m_planeCA.s[3];
+	if (v < 0.0f)
+		return false;
+
+	// calculate w, exit if negative
+	float w = 1.0f - u - v;
+	if (w < 0.0f)
+		return false;
+
+	// set all the info params since we are garaunteed a hit at this point
+	info.m_materialIndex = materialIndex;
+	info.m_portalIndex = portalIndex;
+
+	//compute the point of intersection
+	info.m_intersectionPoint = s;
+	info.m_intersectionTime = t;
+
+	// calculate the normal
+	info.m_surfaceNormal = planeNormal;
+	info.m_fromInside = dot(rayDir, info.m_surfaceNormal) > 0;
+
+	// remember where on the triangle we hit, for ResolveModelTriangleShading()
+	info.m_textureCoordinates.s[0] = u;
+	info.m_textureCoordinates.s[1] = v;
+
+	if (scene.m_settings && scene.m_settings->m_DebugTriangles)
+	{
+		if (u < 0.025f)
+			info.m_debugAdditiveColor += MakeFloat3(0.3f, 0.0f, 0.0f);
+		if (v < 0.025f)
+			info.m_debugAdditiveColor += MakeFloat3(0.0f, 0.3f, 0.0f);
+		if (w < 0.025f)
+			info.m_debugAdditiveColor += MakeFloat3(0.0f, 0.0f, 0.3f);
+	}
+
+	// we found a hit!
+	info.m_objectHit = objectId;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+static inline bool RayOccludedByTriangle (const SScene &scene, cl_uint triangleIndex, const float3 &rayPos, const float3 &rayDir, const float maxTime, const TObjectId ignorePrimitiveId, bool backFaceCulling)
+{
+	if (ignorePrimitiveId == c_firstModelTriangleObjectId + triangleIndex)
+		return false;
+
+	const SModelTriangle &triangle = scene.m_triangles[triangleIndex];
+	const float3 planeNormal = XYZ(triangle.m_plane);
+	if (backFaceCulling && dot(rayDir, planeNormal) > 0.0f)
+		return false;
+
+	float distp = dot(rayPos, planeNormal) - triangle.m_plane.s[3];
+	float distq = dot(rayPos + rayDir, planeNormal) - triangle.m_plane.s[3];
+	float t = distp / (distp - distq);
+	if (t < 0 || t > maxTime)
+		return false;
+
+	float3 s = rayPos + rayDir * t;
+	float u = dot(s, XYZ(triangle.m_planeBC)) - triangle.m_planeBC.s[3];
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	float v = dot(s, XYZ(triangle.m_planeCA)) - triangle.m_planeCA.s[3];
+	return v >= 0.0f && 1.0f - u - v >= 0.0f;
+}
+
+//-----------------------------------------------------------------------------
+// see SModelTriangleShadingQuantized::m_textureDensity
+static inline float DequantizeTextureDensity (cl_ushort density)
+{
+	return exp2((float)density / c_textureDensityQuantizeScale - c_textureDensityQuantizeBias);
+}
+
+//-----------------------------------------------------------------------------
+static void ResolveModelTriangleShading (const SScene &scene, const SModelObject &object, SCollisionInfo &info)
+{
+	const cl_uint shadingIndex = info.m_objectHit - c_firstModelTriangleObjectId - object.m_startTriangleIndex;
+	const float weights[3] = { info.m_textureCoordinates.s[0], info.m_textureCoordinates.s[1], 1.0f - info.m_textureCoordinates.s[0] - info.m_textureCoordinates.s[1] };
+
+	if (object.m_quantizedShading)
+	{
+		const SModelTriangleShadingQuantized &shading = ((const SModelTriangleShadingQuantized *)&scene.m_triangleShading[object.m_shadingStartIndex])[shadingIndex];
+		for (int index = 0; index < 2; ++index)
+		{
+			const float texture = shading.m_textureA[index] * weights[0] + shading.m_textureB[index] * weights[1] + shading.m_textureC[index] * weights[2];
+			info.m_textureCoordinates.s[index] = object.m_textureBounds.s[index] + texture * object.m_textureBounds.s[index + 2] / 65535.0f;
+		}
+		for (int index = 0; index < 3; ++index)
+		{
+			info.m_surfaceU[index] = shading.m_tangent[index] / 32767.0f;
+			info.m_surfaceV[index] = shading.m_bitangent[index] / 32767.0f;
+		}
+		info.m_textureDensity = DequantizeTextureDensity(shading.m_textureDensity);
+	}
+	else
+	{
+		const SModelTriangleShading &shading = scene.m_triangleShading[object.m_shadingStartIndex + shadingIndex];
+		for (int index = 0; index < 2; ++index)
+			info.m_textureCoordinates.s[index] = shading.m_textureA.s[index] * weights[0] + shading.m_textureB.s[index] * weights[1] + shading.m_textureC.s[index] * weights[2];
+		info.m_surfaceU = shading.m_tangent;
+		info.m_surfaceV = shading.m_bitangent;
+		info.m_textureDensity = shading.m_textureDensity;
+	}
+}
+
+//-----------------------------------------------------------------------------
+static inline bool RayHitsBVHNode (const SBVHNode &node, const float3 &rayPos, const float3 &rayDirInverse, const float maxTime)
+{
+	// slab test against the node's bounding box
+	float enterTime = 0.0f;
+	float exitTime = maxTime;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float time1 = (node.m_min[axis] - rayPos[axis]) * rayDirInverse[axis];
+		float time2 = (node.m_max[axis] - rayPos[axis]) * rayDirInverse[axis];
+		if (time1 > time2)
+		{
+			float temp = time1;
+			time1 = time2;
+			time2 = temp;
+		}
+		if (time1 > enterTime)
+			enterTime = time1;
+		if (time2 < exitTime)
+			exitTime = time2;
+	}
+	return enterTime <= exitTime;
+}
+
+//-----------------------------------------------------------------------------
+// walks a BVH, calling visitLeaf(firstPrimitive, primitiveCount) for the leaves the ray reaches before maxTime,
+// nearest child first.  visitLeaf returns true to stop the walk.  Same traversal as the loops in clrt.cl.
+template <typename TVisitLeaf>
+static inline void WalkBVH (const SBVHNode *nodes, cl_uint rootIndex, const float3 &rayPos, const float3 &rayDir, const float3 &rayDirInverse, const float &maxTime, const TVisitLeaf &visitLeaf)
+{
+	unsigned int nodeStack[BVH_MAXDEPTH];
+	unsigned int nodeStackDepth = 0;
+	unsigned int nodeIndex = rootIndex;
+
+	while (true)
+	{
+		const SBVHNode &node = nodes[nodeIndex];
+
+		// the max time shrinks as we find closer hits, so nodes behind the closest hit so far get skipped
+		if (RayHitsBVHNode(node, rayPos, rayDirInverse, maxTime))
+		{
+			if (node.m_primitiveCount == 0)
+			{
+				if (rayDir[node.m_splitAxis] < 0.0f)
+				{
+					nodeStack[nodeStackDepth++] = nodeIndex + 1;
+					nodeIndex = node.m_rightChildOrFirstPrimitive;
+				}
+				else
+				{
+					nodeStack[nodeStackDepth++] = node.m_rightChildOrFirstPrimitive;
+					nodeIndex = nodeIndex + 1;
+				}
+				continue;
+			}
+
+			if (visitLeaf(node.m_rightChildOrFirstPrimitive, node.m_primitiveCount))
+				return;
+		}
+
+		if (nodeStackDepth == 0)
+			return;
+		nodeIndex = nodeStack[--nodeStackDepth];
+	}
+}
+
+//-----------------------------------------------------------------------------
+static bool RayIntersectModelObject (
+	const SScene &scene,
+	const SModelObject &object,
+	SCollisionInfo &info,
+	const float3 &rayPos,
+	const float3 &rayDir,
+	const float3 &rayDirInverse,
+	const TObjectId ignorePrimitiveId,
+	bool backFaceCulling,
+	cl_uint materialIndex,
+	cl_uint portalIndex
+)
+{
+	if (object.m_bvhRootIndex == c_invalidIndex)
+		return false;
+
+	// the max time shrinks as we find closer hits, so nodes behind the closest hit so far get skipped
+	bool hit = false;
+	WalkBVH(scene.m_bvhNodes, object.m_bvhRootIndex, rayPos, rayDir, rayDirInverse, info.m_intersectionTime,
+		[&] (cl_uint firstTriangle, cl_uint triangleCount) -> bool
+		{
+			for (cl_uint triangleIndex = firstTriangle; triangleIndex < firstTriangle + triangleCount; ++triangleIndex)
+			{
+				if (RayIntersectTriangle(scene, triangleIndex, info, rayPos, rayDir, ignorePrimitiveId, backFaceCulling, materialIndex, portalIndex))
+					hit = true;
+			}
+			return false;
+		}
+	);
+	return hit;
+}
+
+//-----------------------------------------------------------------------------
+static bool RayOccludedByModelObject (
+	const SScene &scene,
+	const SModelObject &object,
+	const float3 &rayPos,
+	const float3 &rayDir,
+	const float3 &rayDirInverse,
+	const float maxTime,
+	const TObjectId ignorePrimitiveId,
+	bool backFaceCulling
+)
+{
+	if (object.m_bvhRootIndex == c_invalidIndex)
+		return false;
+
+	bool hit = false;
+	WalkBVH(scene.m_bvhNodes, object.m_bvhRootIndex, rayPos, rayDir, rayDirInverse, maxTime,
+		[&] (cl_uint firstTriangle, cl_uint triangleCount) -> bool
+		{
+			for (cl_uint triangleIndex = firstTriangle; triangleIndex < firstTriangle + triangleCount; ++triangleIndex)
+			{
+				if (RayOccludedByTriangle(scene, triangleIndex, rayPos, rayDir, maxTime, ignorePrimitiveId, backFaceCulling))
+				{
+					hit = true;
+					return true;
+				}
+			}
+			return false;
+		}
+	);
+	return hit;
+}
+
+//-----------------------------------------------------------------------------
+static inline void RayToModelSpace (const SModelInstance &model, const float3 &rayPos, const float3 &rayDir, float3 &rayPosLocal, float3 &rayDirLocal)
+{
+	// make sure the ray direction is normalized to account for scaling or rounding errors
+	TransformPoint(rayPosLocal, rayPos, model.m_worldToModelX, model.m_worldToModelY, model.m_worldToModelZ, model.m_worldToModelW);
+	TransformVector(rayDirLocal, rayDir, model.m_worldToModelX, model.m_worldToModelY, model.m_worldToModelZ);
+	rayDirLocal = normalize(rayDirLocal);
+}
+
+//-----------------------------------------------------------------------------
+static inline void ModelHitToWorldSpace (const SModelInstance &model, const SCollisionInfo &collisionInfoLocal, SCollisionInfo &info)
+{
+	info = collisionInfoLocal;
+
+	float3 temp;
+	TransformPoint(temp, info.m_intersectionPoint, model.m_modelToWorldX, model.m_modelToWorldY, model.m_modelToWorldZ, model.m_modelToWorldW);
+	info.m_intersectionPoint = temp;
+	TransformVector(temp, info.m_surfaceNormal, model.m_modelToWorldX, model.m_modelToWorldY, model.m_modelToWorldZ);
+	info.m_surfaceNormal = normalize(temp);
+	TransformVector(temp, info.m_surfaceU, model.m_modelToWorldX, model.m_modelToWorldY, model.m_modelToWorldZ);
+	info.m_surfaceU = normalize(temp);
+	TransformVector(temp, info.m_surfaceV, model.m_modelToWorldX, model.m_modelToWorldY, model.m_modelToWorldZ);
+	info.m_surfaceV = normalize(temp);
+	info.m_intersectionTime *= model.m_scale;
+	info.m_textureDensity /= model.m_scale;
+}
+
+//-----------------------------------------------------------------------------
+static bool RayIntersectModelInstance (
+	const SScene &scene,
+	const SModelInstance &model,
+	SCollisionInfo &info,
+	const float3 &rayPos,
+	const float3 &rayDir,
+	const TObjectId ignorePrimitiveId
+)
+{
+	if (!RayHitsSphere(model.m_boundingSphere, rayPos, rayDir, info.m_intersectionTime))
+		return false;
+
+	SCollisionInfo collisionInfoLocal;
+	InitCollisionInfo(collisionInfoLocal, info.m_intersectionTime / model.m_scale, info.m_debugAdditiveColor);
+
+	// convert the ray from world space to model space
+	float3 rayPosLocal;
+	float3 rayDirLocal;
+	RayToModelSpace(model, rayPos, rayDir, rayPosLocal, rayDirLocal);
+	const float3 rayDirLocalInverse = SafeReciprocal(rayDirLocal);
+
+	bool hit = false;
+	const SModelObject *hitObject = NULL;
+	for (cl_uint objectIndex = model.m_startObjectIndex; objectIndex < model.m_stopObjectIndex; ++objectIndex)
+	{
+		const SModelObject &object = scene.m_objects[objectIndex];
+
+		// allow back face culling if the triangle isn't refractive (transparent)
+		unsigned int materialIndex = model.m_materialOverride == c_invalidIndex ? object.m_materialIndex : model.m_materialOverride;
+		bool backFaceCulling = !IsRefractive(scene.m_materials[materialIndex]);
+
+		if (RayIntersectModelObject(scene, object, collisionInfoLocal, rayPosLocal, rayDirLocal, rayDirLocalInverse, ignorePrimitiveId, backFaceCulling, materialIndex, model.m_portalIndex))
+		{
+			hit = true;
+			hitObject = &object;
+		}
+	}
+
+	// if we hit something in local space, we need to convert the local space hit information back into world space
+	if (hit)
+	{
+		ResolveModelTriangleShading(scene, *hitObject, collisionInfoLocal);
+		ModelHitToWorldSpace(model, collisionInfoLocal, info);
+	}
+
+	if (scene.m_settings && scene.m_settings->m_DebugModelBoundingSphere)
+		info.m_debugAdditiveColor += MakeFloat3(0.0f, 0.2f, 0.0f);
+
+	return hit;
+}
+
+//-----------------------------------------------------------------------------
+// only shadow casting objects are tested, and nothing about the hit goes back to world space
+static bool RayOccludedByModelInstance (
+	const SScene &scene,
+	const SModelInstance &model,
+	const float3 &rayPos,
+	const float3 &rayDir,
+	const float maxTime,
+	const TObjectId ignorePrimitiveId
+)
+{
+	if (!RayHitsSphere(model.m_boundingSphere, rayPos, rayDir, maxTime))
+		return false;
+
+	float3 rayPosLocal;
+	float3 rayDirLocal;
+	RayToModelSpace(model, rayPos, rayDir, rayPosLocal, rayDirLocal);
+	const float3 rayDirLocalInverse = SafeReciprocal(rayDirLocal);
+	const float maxTimeLocal = maxTime / model.m_scale;
+
+	for (cl_uint objectIndex = model.m_startObjectIndex; objectIndex < model.m_stopObjectIndex; ++objectIndex)
+	{
+		const SModelObject &object = scene.m_objects[objectIndex];
+		if (!object.m_castsShadows)
+			continue;
+
+		unsigned int materialIndex = model.m_materialOverride == c_invalidIndex ? object.m_materialIndex : model.m_materialOverride;
+		bool backFaceCulling = !IsRefractive(scene.m_materials[materialIndex]);
+
+		if (RayOccludedByModelObject(scene, object, rayPosLocal, rayDirLocal, rayDirLocalInverse, maxTimeLocal, ignorePrimitiveId, backFaceCulling))
+			return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+static bool RayIntersectSectorModels (
+	const SScene &scene,
+	const SSector &sector,
+	SCollisionInfo &info,
+	const float3 &rayPos,
+	const float3 &rayDir,
+	const TObjectId ignorePrimitiveId
+)
+{
+	if (sector.m_staticModelBVHRootIndex == c_invalidIndex)
+		return false;
+
+	bool hit = false;
+	WalkBVH(scene.m_instanceBVHNodes, sector.m_staticModelBVHRootIndex, rayPos, rayDir, SafeReciprocal(rayDir), info.m_intersectionTime,
+		[&] (cl_uint firstModel, cl_uint modelCount) -> bool
+		{
+			for (cl_uint modelIndex = firstModel; modelIndex < firstModel + modelCount; ++modelIndex)
+			{
+				if (RayIntersectModelInstance(scene, scene.m_models[modelIndex], info, rayPos, rayDir, ignorePrimitiveId))
+					hit = true;
+			}
+			return false;
+		}
+	);
+	return hit;
+}
+
+//-----------------------------------------------------------------------------
+static bool RayOccludedBySectorModels (
+	const SScene &scene,
+	const SSector &sector,
+	const float3 &rayPos,
+	const float3 &rayDir,
+	const float maxTime,
+	const TObjectId ignorePrimitiveId
+)
+{
+	if (sector.m_staticModelBVHRootIndex == c_invalidIndex)
+		return false;
+
+	bool hit = false;
+	WalkBVH(scene.m_instanceBVHNodes, sector.m_staticModelBVHRootIndex, rayPos, rayDir, SafeReciprocal(rayDir), maxTime,
+		[&] (cl_uint firstModel, cl_uint modelCount) -> bool
+		{
+			for (cl_uint modelIndex = firstModel; modelIndex < firstModel + modelCount; ++modelIndex)
+			{
+				if (RayOccludedByModelInstance(scene, scene.m_models[modelIndex], rayPos, rayDir, maxTime, ignorePrimitiveId))
+				{
+					hit = true;
+					return true;
+				}
+			}
+			return false;
+		}
+	);
+	return hit;
+}
+
+//-----------------------------------------------------------------------------
+static bool RayIntersectSector (const SSector &sector, SCollisionInfo &info, const float3 &rayPos, const float3 &rayDir)
+{
+	float closestHitTime = info.m_intersectionTime;
+	int closestHitPlaneIndex = SSECTOR_NUMPLANES;
+
+	// test each axis' slab if the ray isn't parallel with it.  The positive side plane of axis N is plane N*2.
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (rayDir[axis] == 0.0f)
+			continue;
+
+		float denom = 1.0f / rayDir[axis];
+		float time1 = (-rayPos[axis] + sector.m_halfDims[axis]) * denom;
+		float time2 = (-rayPos[axis] - sector.m_halfDims[axis]) * denom;
+
+		if (time1 >= time2)
+		{
+			if (time1 > 0.0f && time1 < closestHitTime)
+			{
+				closestHitPlaneIndex = axis * 2;
+				closestHitTime = time1;
+			}
+		}
+		else if (time2 > 0.0f && time2 < closestHitTime)
+		{
+			closestHitPlaneIndex = axis * 2 + 1;
+			closestHitTime = time2;
+		}
+	}
+
+	// if no planes hit, bail out
+	if (closestHitPlaneIndex == SSECTOR_NUMPLANES)
+		return false;
+
+	const SSectorPlane &plane = sector.m_planes[closestHitPlaneIndex];
+
+	// else we hit a sector wall, so set and calculate our collision info data
+	info.m_intersectionTime = closestHitTime;
+	info.m_intersectionPoint = rayPos + rayDir * closestHitTime;
+	info.m_surfaceNormal = GetSectorPlaneNormal(closestHitPlaneIndex);
+
+	// calculate U and V
+	info.m_surfaceU = plane.m_UAxis;
+	info.m_surfaceV = normalize(cross(info.m_surfaceU, info.m_surfaceNormal));
+
+	// unscaled texture coordinates
+	float textureU = dot(info.m_intersectionPoint, info.m_surfaceU);
+	float textureV = dot(info.m_intersectionPoint, info.m_surfaceV);
+
+	// for sector planes, only set the portal index if the ray is in the portal window
+	float portalU = dot(info.m_intersectionPoint, GetSectorPlaneU(closestHitPlaneIndex));
+	float portalV = dot(info.m_intersectionPoint, GetSectorPlaneV(closestHitPlaneIndex));
+	if (plane.m_portalIndex != c_invalidIndex
+	 && portalU >= plane.m_portalWindow.s[0]
+	 && portalV >= plane.m_portalWindow.s[1]
+	 && portalU <= plane.m_portalWindow.s[2]
+	 && portalV <= plane.m_portalWindow.s[3])
+	{
+		info.m_portalIndex = plane.m_portalIndex;
+	}
+	else
+	{
+		info.m_portalIndex = c_invalidIndex;
+	}
+
+	// scale the texture coordinates
+	info.m_textureCoordinates.s[0] = textureU * plane.m_textureScale.s[0] + plane.m_textureOffset.s[0];
+	info.m_textureCoordinates.s[1] = textureV * plane.m_textureScale.s[1] + plane.m_textureOffset.s[1];
+	info.m_textureDensity = MaxAbs(plane.m_textureScale);
+
+	info.m_fromInside = false;
+	info.m_materialIndex = plane.m_materialIndex;
+
+	// we found a hit!
+	info.m_objectHit = plane.m_objectId;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+bool PointOccluded (const SScene &scene, const SSector &sector, const float3 &startPos, const float3 &targetPos, const TObjectId ignorePrimitiveId)
+{
+	float3 rayDir = targetPos - startPos;
+	const float maxTime = length(rayDir);
+	rayDir = normalize(rayDir);
+
+	for (cl_uint index = sector.m_staticSphereStartIndex; index < sector.m_staticSphereStopIndex; ++index)
+	{
+		if (scene.m_spheres[index].m_castsShadows
+		 && RayOccludedBySphere(scene.m_spheres[index], startPos, rayDir, maxTime, ignorePrimitiveId))
+			return true;
+	}
+
+	return RayOccludedBySectorModels(scene, sector, startPos, rayDir, maxTime, ignorePrimitiveId);
+}
+
+//-----------------------------------------------------------------------------
+static bool PointCanSeePoint (const SScene &scene, const SSector &sector, const float3 &startPos, const float3 &targetPos, const TObjectId ignorePrimitiveId, SRayStats *stats)
+{
+	if (!scene.m_settings->m_Shadows)
+		return true;
+
+	if (stats)
+		stats->m_shadowRays++;
+
+	return !PointOccluded(scene, sector, startPos, targetPos, ignorePrimitiveId);
+}
+
+//-----------------------------------------------------------------------------
+// how much of the light gets to a hit on one of the sector's walls, from the baked shadow texels, or -1 if
+// nothing is baked for the hit.  Same as BakedLightVisibility() in clrt.cl.
+static float BakedLightVisibility (const SScene &scene, const SSector &sector, const SCollisionInfo &collisionInfo, cl_uint sectorLightIndex)
+{
+	const cl_uint planeIndex = collisionInfo.m_objectHit - sector.m_planes[0].m_objectId;
+	if (planeIndex >= SSECTOR_NUMPLANES || sectorLightIndex >= SSECTOR_MAXBAKEDSHADOWLIGHTS)
+		return -1.0f;
+
+	const SSectorPlane &plane = sector.m_planes[planeIndex];
+	if (plane.m_shadowTexelStart == c_invalidIndex)
+		return -1.0f;
+
+	const cl_uint axis = planeIndex / 2;
+	const cl_uint axisU = axis == 0 ? 1 : 0;
+	const cl_uint axisV = axis == 2 ? 1 : 2;
+	const int countU = sector.m_shadowTexelCounts[axisU];
+	const int countV = sector.m_shadowTexelCounts[axisV];
+	const float halfDimU = sector.m_halfDims[axisU];
+	const float halfDimV = sector.m_halfDims[axisV];
+
+	float texelU = (collisionInfo.m_intersectionPoint[axisU] + halfDimU) / (2.0f * halfDimU) * (float)countU - 0.5f;
+	float texelV = (collisionInfo.m_intersectionPoint[axisV] + halfDimV) / (2.0f * halfDimV) * (float)countV - 0.5f;
+	texelU = texelU < 0.0f ? 0.0f : (texelU > (float)(countU - 1) ? (float)(countU - 1) : texelU);
+	texelV = texelV < 0.0f ? 0.0f : (texelV > (float)(countV - 1) ? (float)(countV - 1) : texelV);
+	const int u0 = (int)texelU;
+	const int v0 = (int)texelV;
+	const int u1 = u0 + 1 < countU ? u0 + 1 : countU - 1;
+	const int v1 = v0 + 1 < countV ? v0 + 1 : countV - 1;
+
+	const cl_uint *texels = &scene.m_shadowTexels[plane.m_shadowTexelStart];
+	const cl_uint lightBit = 1u << sectorLightIndex;
+	const float visible00 = (texels[v0 * countU + u0] & lightBit) ? 1.0f : 0.0f;
+	const float visible10 = (texels[v0 * countU + u1] & lightBit) ? 1.0f : 0.0f;
+	const float visible01 = (texels[v1 * countU + u0] & lightBit) ? 1.0f : 0.0f;
+	const float visible11 = (texels[v1 * countU + u1] & lightBit) ? 1.0f : 0.0f;
+	const float fractionU = texelU - (float)u0;
+	const float fractionV = texelV - (float)v0;
+	const float visible0 = visible00 + (visible10 - visible00) * fractionU;
+	const float visible1 = visible01 + (visible11 - visible01) * fractionU;
+	return visible0 + (visible1 - visible0) * fractionV;
+}
+
+//-----------------------------------------------------------------------------
+static void ApplyPointLight (
+	const SScene &scene,
+	float3 &pixelColor,
+	const SCollisionInfo &collisionInfo,
+	const SSector &sector,
+	const SMaterial &material,
+	const SPointLight &light,
+	cl_uint sectorLightIndex,
+	const float3 &rayDir,
+	const float3 &diffuseColor,
+	SRayStats *stats
+)
+{
+	// high quality lights attenuate to nothing outside their influence sphere, so they can be skipped before the shadow ray
+	if (scene.m_settings->m_HighQualityLights)
+	{
+		const float3 influenceToHit = collisionInfo.m_intersectionPoint - XYZ(light.m_influenceSphere);
+		if (dot(influenceToHit, influenceToHit) > light.m_influenceSphere.s[3] * light.m_influenceSphere.s[3])
+			return;
+	}
+
+	float3 hitToLight = normalize(light.m_position - collisionInfo.m_intersectionPoint);
+
+	float coneAngle = dot(light.m_spotLightReverseDir, hitToLight);
+	if (coneAngle <= light.m_spotLightcosPhiOver2)
+		return;
+
+	// the walls have their shadows baked, everything else casts a shadow ray
+	float visibility = -1.0f;
+	if (scene.m_settings->m_Shadows && scene.m_settings->m_BakedShadows)
+		visibility = BakedLightVisibility(scene, sector, collisionInfo, sectorLightIndex);
+	if (visibility < 0.0f)
+		visibility = PointCanSeePoint(scene, sector, collisionInfo.m_intersectionPoint, light.m_position, collisionInfo.m_objectHit, stats) ? 1.0f : 0.0f;
+	if (visibility <= 0.0f)
+		return;
+
+	// light attenuation for high quality lights, on top of how much of the light the shadows let through
+	float attenuation = visibility;
+	if (scene.m_settings->m_HighQualityLights)
+	{
+		// spot light attenuation
+		if (light.m_spotLightFalloffFactor != 0 && coneAngle < light.m_spotLightcosThetaOver2)
+			attenuation *= pow((coneAngle - light.m_spotLightcosPhiOver2) / (light.m_spotLightcosThetaOver2 - light.m_spotLightcosPhiOver2), light.m_spotLightFalloffFactor);
+
+		// distance attenuation
+		const float3 &constDistDistsq = light.m_attenuationConstDistDistsq;
+		if (constDistDistsq[0] != 1.0f || constDistDistsq[1] != 0.0f || constDistDistsq[2] != 0.0f)
+		{
+			float distanceToLight = length(light.m_position - collisionInfo.m_intersectionPoint);
+			attenuation /= (
+				constDistDistsq[0] +
+				distanceToLight * constDistDistsq[1] +
+				distanceToLight * distanceToLight * constDistDistsq[2]);
+		}
+	}
+
+	// diffuse
+	float dp = dot(collisionInfo.m_surfaceNormal, hitToLight);
+	if (dp > 0.0f)
+		pixelColor += diffuseColor * light.m_color * (dp * attenuation);
+
+	// specular
+	float3 reflection = Reflect(hitToLight, collisionInfo.m_surfaceNormal);
+	dp = dot(rayDir, reflection);
+	if (dp > 0.0f)
+		pixelColor += XYZ(material.m_specularColorAndPower) * light.m_color * (pow(dp, material.m_specularColorAndPower.s[3]) * attenuation);
+}
+
+//-----------------------------------------------------------------------------
+// the same hash of the hit point and frame as the kernel's
+static inline cl_uint HashLightSample (const float3 &point, cl_uint frameCount)
+{
+	cl_uint bits[3];
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float value = point[axis];
+		memcpy(&bits[axis], &value, sizeof(cl_uint));
+	}
+
+	cl_uint hash = (bits[0] * 0x8da6b343u) ^ (bits[1] * 0xd8163841u) ^ (bits[2] * 0xcb1ab31fu) ^ (frameCount * 0x9e3779b9u);
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+//-----------------------------------------------------------------------------
+// applies every light of the sector, or with LightSampling, LightSamples of them picked from SPointLight::m_samplingCdf
+// and weighted by the chance of picking them.  Same as ApplySectorPointLights() in clrt.cl.
+static void ApplySectorPointLights (
+	const SScene &scene,
+	float3 &pixelColor,
+	const SCollisionInfo &collisionInfo,
+	const SSector &sector,
+	const SMaterial &material,
+	const float3 &rayDir,
+	const float3 &diffuseColor,
+	SRayStats *stats
+)
+{
+	const cl_uint lightSamples = scene.m_settings->m_LightSamples > 0 ? scene.m_settings->m_LightSamples : 1;
+	if (scene.m_settings->m_LightSampling && sector.m_staticLightStopIndex - sector.m_staticLightStartIndex > lightSamples)
+	{
+		const float offset = (float)(HashLightSample(collisionInfo.m_intersectionPoint, scene.m_frameCount) >> 8) / 16777216.0f;
+		for (cl_uint sample = 0; sample < lightSamples; ++sample)
+		{
+			// find the first light whose cumulative probability is above the pick
+			const float pick = ((float)sample + offset) / (float)lightSamples;
+			cl_uint low = sector.m_staticLightStartIndex;
+			cl_uint high = sector.m_staticLightStopIndex - 1;
+			while (low < high)
+			{
+				const cl_uint middle = (low + high) / 2;
+				if (scene.m_lights[middle].m_samplingCdf <= pick)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+
+			const float probability = scene.m_lights[low].m_samplingCdf - (low > sector.m_staticLightStartIndex ? scene.m_lights[low - 1].m_samplingCdf : 0.0f);
+			if (probability <= 0.0f)
+				continue;
+
+			float3 lightColor = MakeFloat3(0.0f, 0.0f, 0.0f);
+			ApplyPointLight(scene, lightColor, collisionInfo, sector, material, scene.m_lights[low], low - sector.m_staticLightStartIndex, rayDir, diffuseColor, stats);
+			pixelColor += lightColor / (probability * (float)lightSamples);
+		}
+		return;
+	}
+
+	for (cl_uint index = sector.m_staticLightStartIndex; index < sector.m_staticLightStopIndex; ++index)
+		ApplyPointLight(scene, pixelColor, collisionInfo, sector, material, scene.m_lights[index], index - sector.m_staticLightStartIndex, rayDir, diffuseColor, stats);
+}
+
+//-----------------------------------------------------------------------------
+// the portals crossed since the last color stack item are kept as color * portalFilter + portalAdd,
+// and folded into the next item.  Same as AddPortalCrossing() in clrt.cl.
+static inline void AddPortalCrossing (float &portalFilter, float3 &portalAdd, const float3 &addColor, const cl_float4 &fogColorAndAmount)
+{
+	const float fogAmount = fogColorAndAmount.s[3];
+	portalAdd += (addColor * (1.0f - fogAmount) + XYZ(fogColorAndAmount) * fogAmount) * portalFilter;
+	portalFilter *= 1.0f - fogAmount;
+}
+
+//-----------------------------------------------------------------------------
+static inline void AddColorStackItem (SColorStackItem *colorStack, unsigned int &colorStackDepth, float &portalFilter, float3 &portalAdd, const float3 &filterColor, const float3 &addColor, const cl_float4 &fogColorAndAmount)
+{
+	SColorStackItem &item = colorStack[colorStackDepth++];
+	const float fogAmount = fogColorAndAmount.s[3];
+	item.m_filterColor = filterColor * ((1.0f - fogAmount) * portalFilter);
+	item.m_addColor = (addColor * (1.0f - fogAmount) + XYZ(fogColorAndAmount) * fogAmount) * portalFilter + portalAdd;
+
+	portalFilter = 1.0f;
+	portalAdd = MakeFloat3(0.0f, 0.0f, 0.0f);
+}
+
+//-----------------------------------------------------------------------------
+static inline float DotPointPlane (const float3 &point, const cl_float4 &plane)
+{
+	return point[0] * plane.s[0] + point[1] * plane.s[1] + point[2] * plane.s[2] + plane.s[3];
+}
+
+//-----------------------------------------------------------------------------
+// taken from https://www.terathon.com/lengyel/Lengyel-UnifiedFog.pdf
+static float LineSegmentFogAmount (const float3 &c, const float3 &p, const cl_float4 &plane, const float fogDensityFactor, const float fogFactorMax, const cl_uint fogMode)
+{
+	if (fogMode == e_fogNone)
+		return 0.0f;
+
+	const float k = DotPointPlane(c, plane) <= 0.0f ? 1.0f : 0.0f;
+	const float3 v = p - c;
+	const float f_dot_v = dot(v, XYZ(plane));
+	const float f_dot_p = DotPointPlane(p, plane);
+
+	// constant density
+	if (fogMode == e_fogConstantDensity)
+	{
+		float d = Saturate(k - (f_dot_p / fabs(f_dot_v)));
+		d *= length(v);
+
+		float amount = d * fogDensityFactor;
+		return Saturate(amount < fogFactorMax ? amount : fogFactorMax);
+	}
+	// linear density
+	else
+	{
+		const float f_dot_c = DotPointPlane(c, plane);
+
+		const float a = fogDensityFactor;
+
+		const float3 aV = v * (a / 2.0f);
+		const float c1 = k * (f_dot_p + f_dot_c);
+		float c2 = (1 - 2.0f * k) * f_dot_p;
+		if (c2 > 0.0f)
+			c2 = 0.0f;
+
+		// add an epsilon of 0.001f to keep from 0/0 situations which make visual problems
+		float amount = -length(aV) * (c1 - c2 * c2 / fabs(f_dot_v + 0.001f));
+		return Saturate(amount < fogFactorMax ? amount : fogFactorMax);
+	}
+}
+
+//-----------------------------------------------------------------------------
+float PixelSpreadAngle (const SCamera &camera, unsigned int width)
+{
+	if (camera.m_viewWidthHeightDistance[2] == 0.0f || width == 0)
+		return 0.0f;
+	return camera.m_viewWidthHeightDistance[0] / (camera.m_viewWidthHeightDistance[2] * (float)width);
+}
+
+//-----------------------------------------------------------------------------
+float3 CameraRayDir (const SCamera &camera, unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+	const float percentX = ((float)x / (float)width) - 0.5f;
+	const float percentY = ((float)y / (float)height) - 0.5f;
+	return normalize((camera.m_fwd * camera.m_viewWidthHeightDistance[2])
+		- (camera.m_left * (percentX * camera.m_viewWidthHeightDistance[0]))
+		- (camera.m_up * (percentY * camera.m_viewWidthHeightDistance[1])));
+}
+
+//-----------------------------------------------------------------------------
+// moves a ray that hit a portal at intersectionPoint into the space of the sector on the other side.
+// Same as TransformRayThroughPortal() in clrt.cl.
+static void TransformRayThroughPortal (const SPortal &portal, const float3 &intersectionPoint, float3 &rayPos, float3 &rayDir)
+{
+	// set our point if we are supposed to, else transform the collision point into sector space
+	float3 transformedPoint;
+	if (portal.m_setPosition)
+		transformedPoint = portal.m_position;
+	else
+		TransformPoint(transformedPoint, intersectionPoint, portal.m_xaxis, portal.m_yaxis, portal.m_zaxis, portal.m_waxis);
+
+	// transform the ray direction into sector space
+	float3 transformedDir;
+	TransformVector(transformedDir, rayDir, portal.m_xaxis, portal.m_yaxis, portal.m_zaxis);
+
+	rayPos = transformedPoint;
+	rayDir = normalize(transformedDir);
+}
+
+//-----------------------------------------------------------------------------
+// how much of the texture coordinate space the ray's footprint on the surface covers, following ray
+// cones: coneWidth is how wide the cone around the ray is where it hit.  Same as TextureFootprint() in clrt.cl.
+static inline float TextureFootprint (const SCollisionInfo &collisionInfo, const float3 &rayDir, float coneWidth)
+{
+	const float cosine = fabs(dot(rayDir, collisionInfo.m_surfaceNormal));
+	return coneWidth * collisionInfo.m_textureDensity / (cosine > c_textureLodMinCosine ? cosine : c_textureLodMinCosine);
+}
+
+//-----------------------------------------------------------------------------
+// the mip level of a texture whose texels are about the size of the footprint.  Same as TextureLod() in clrt.cl.
+static inline float TextureLod (const SAtlasTexture &texture, float footprint)
+{
+	const float texels = footprint * sqrt((float)(texture.m_width * texture.m_height));
+	return log2(texels > 1.0f ? texels : 1.0f);
+}
+
+//-----------------------------------------------------------------------------
+// adds weight times the atlas texel at x,y, as 0 to 1, to color.  Coordinates off the atlas are clamped
+// to it's edges, the same as g_atlasSampler in clrt.cl.
+static inline void AddAtlasTexel (const SScene &scene, int x, int y, float weight, float color[4])
+{
+	const int maxX = (int)scene.m_textureAtlasWidth - 1;
+	const int maxY = (int)scene.m_textureAtlasHeight - 1;
+	x = x < 0 ? 0 : (x > maxX ? maxX : x);
+	y = y < 0 ? 0 : (y > maxY ? maxY : y);
+
+	const unsigned char *texel = &scene.m_textureAtlas[((size_t)y * scene.m_textureAtlasWidth + x) * 4];
+	for (int channel = 0; channel < 4; ++channel)
+		color[channel] += weight * ((float)texel[channel] / 255.0f);
+}
+
+//-----------------------------------------------------------------------------
+// reads a texture from the atlas at texture coordinates uv, which repeat, from the mip level nearest lod.
+// Same as SampleTexture() in clrt.cl.
+static void SampleTexture (const SScene &scene, const SAtlasTexture &texture, const cl_float2 &uv, float lod, float color[4])
+{
+	// find the mip level in the atlas.  See STextureAtlas.h for the layout.
+	int maxLevel = 0;
+	for (int size = texture.m_width > texture.m_height ? texture.m_width : texture.m_height; size > 1; size >>= 1)
+		++maxLevel;
+	lod = lod < (float)maxLevel ? lod : (float)maxLevel;
+	const int level = lod > 0.0f ? (int)(lod + 0.5f) : 0;
+
+	const int width = (texture.m_width >> level) > 0 ? texture.m_width >> level : 1;
+	const int height = (texture.m_height >> level) > 0 ? texture.m_height >> level : 1;
+	int originX = texture.m_x;
+	int originY = texture.m_y;
+	if (level > 0)
+	{
+		originX += texture.m_width;
+		for (int index = 1; index < level; ++index)
+			originY += (texture.m_height >> index) > 0 ? texture.m_height >> index : 1;
+	}
+
+	const float texelX = (uv.s[0] - floor(uv.s[0])) * (float)width;
+	const float texelY = (uv.s[1] - floor(uv.s[1])) * (float)height;
+
+	for (int channel = 0; channel < 4; ++channel)
+		color[channel] = 0.0f;
+
+	if (scene.m_settings->m_TextureFilter)
+	{
+		// bilinear, wrapping around the edges of the texture like CLK_ADDRESS_REPEAT would
+		const float floorX = floor(texelX - 0.5f);
+		const float floorY = floor(texelY - 0.5f);
+		const float fractionX = texelX - 0.5f - floorX;
+		const float fractionY = texelY - 0.5f - floorY;
+		const int x0 = ((int)floorX + width) % width;
+		const int y0 = ((int)floorY + height) % height;
+		const int x1 = (x0 + 1) % width;
+		const int y1 = (y0 + 1) % height;
+		AddAtlasTexel(scene, originX + x0, originY + y0, (1.0f - fractionX) * (1.0f - fractionY), color);
+		AddAtlasTexel(scene, originX + x1, originY + y0, fractionX * (1.0f - fractionY), color);
+		AddAtlasTexel(scene, originX + x0, originY + y1, (1.0f - fractionX) * fractionY, color);
+		AddAtlasTexel(scene, originX + x1, originY + y1, fractionX * fractionY, color);
+	}
+	else
+	{
+		const int x = (int)texelX < width - 1 ? (int)texelX : width - 1;
+		const int y = (int)texelY < height - 1 ? (int)texelY : height - 1;
+		AddAtlasTexel(scene, originX + x, originY + y, 1.0f, color);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// applies the normal map to the surface normal, and returns the color of the surface lit by the ambient
+// light and it's emissive color.  diffuseColorBase gets the unlit diffuse color, for the point lights.
+// rayDir and coneWidth are for picking the mip level of the textures.  Same as ShadeSurface() in clrt.cl.
+static float3 ShadeSurface (
+	const SScene &scene,
+	const SMaterial &material,
+	SCollisionInfo &collisionInfo,
+	const float3 &ambientLight,
+	float3 &diffuseColorBase,
+	const float3 &rayDir,
+	float coneWidth
+)
+{
+	const SData_GfxSettings &settings = *scene.m_settings;
+	const SAtlasTexture *atlasTextures = scene.m_textureAtlas ? scene.m_atlasTextures : NULL;
+
+	// before the normal map changes the normal
+	const cl_float2 textureCoords = collisionInfo.m_textureCoordinates;
+	const float footprint = TextureFootprint(collisionInfo, rayDir, coneWidth);
+
+	// handle normal mapping if there is any
+	if (settings.m_NormalMapping && atlasTextures && material.m_normalTextureIndex >= 0)
+	{
+		const SAtlasTexture &texture = atlasTextures[material.m_normalTextureIndex];
+		// do not convert to sRGB since this is a normal map!
+		float texel[4];
+		SampleTexture(scene, texture, textureCoords, TextureLod(texture, footprint), texel);
+		const float3 textureNormal = normalize(MakeFloat3(texel[0], texel[1], texel[2]) * 2.0f - MakeFloat3(1.0f, 1.0f, 1.0f));
+
+		const float3 adjustedNormal = collisionInfo.m_surfaceU * textureNormal[0] + collisionInfo.m_surfaceV * textureNormal[1] + collisionInfo.m_surfaceNormal * textureNormal[2];
+		collisionInfo.m_surfaceNormal = normalize(adjustedNormal);
+	}
+
+	// get the diffuse color of the object we hit
+	diffuseColorBase = material.m_diffuseColor;
+	if (atlasTextures && material.m_diffuseTextureIndex >= 0)
+	{
+		const SAtlasTexture &texture = atlasTextures[material.m_diffuseTextureIndex];
+		float texel[4];
+		SampleTexture(scene, texture, textureCoords, TextureLod(texture, footprint), texel);
+
+		// if this is a distance field texture
+		if (material.m_diffuseTextureIsDistanceField)
+		{
+			// do not convert to sRGB since this is a distance texture
+			const float smoothing = 1.0f / 64.0f;
+			const float t = Saturate((texel[3] - (0.5f - smoothing)) / (2.0f * smoothing));
+			const float alpha = Saturate(t * t * (3.0f - 2.0f * t));
+			diffuseColorBase *= 1.0f - alpha;
+		}
+		// else it's a regular texture map
+		else
+		{
+			// convert to sRGB since this is a color
+			diffuseColorBase *= LinearColorTosRGB(MakeFloat3(texel[0], texel[1], texel[2]));
+		}
+	}
+
+	// get the emissive color of the object we hit
+	float3 emissiveColor = material.m_emissiveColor;
+	if (atlasTextures && material.m_emissiveTextureIndex >= 0)
+	{
+		const SAtlasTexture &texture = atlasTextures[material.m_emissiveTextureIndex];
+		// convert to sRGB since this is a color
+		float texel[4];
+		SampleTexture(scene, texture, textureCoords, TextureLod(texture, footprint), texel);
+		emissiveColor *= LinearColorTosRGB(MakeFloat3(texel[0], texel[1], texel[2]));
+	}
+
+	if (settings.m_DebugTextureUV)
+		diffuseColorBase = MakeFloat3(collisionInfo.m_textureCoordinates.s[0], collisionInfo.m_textureCoordinates.s[1], 0.0f);
+
+	// apply ambient lighting, emissive color and the debug additive color
+	return diffuseColorBase * ambientLight + emissiveColor + collisionInfo.m_debugAdditiveColor;
+}
+
+//-----------------------------------------------------------------------------
+// firstHit, if given, is what the ray hits in it's starting sector, already found by the packet tracer
+static float3 TraceRay (const SScene &scene, cl_uint currentSector, float3 rayPos, float3 rayDir, SRayStats *stats, const SCollisionInfo *firstHit)
+{
+	const SData_GfxSettings &settings = *scene.m_settings;
+	const unsigned int maxRayBounces = settings.m_RayBounces < c_maxRayBounces ? settings.m_RayBounces : c_maxRayBounces;
+
+	SColorStackItem colorStack[c_maxRayBounces];
+	unsigned int colorStackDepth = 0;
+
+	// the portals crossed since the last color stack item, see AddPortalCrossing()
+	float portalFilter = 1.0f;
+	float3 portalAdd = MakeFloat3(0.0f, 0.0f, 0.0f);
+
+	TObjectId lastHitPrimitiveId = c_invalidObjectId;
+
+	float3 absorbance = MakeFloat3(0.0f, 0.0f, 0.0f);
+
+	const float3 white = MakeFloat3(1.0f, 1.0f, 1.0f);
+	const float bounceCountColor = settings.m_DebugRayBounceCount ? 1.0f / ((float)maxRayBounces) : 0.0f;
+
+	// how far the ray has gone, through portals and bounces, for how wide it's footprint is
+	float rayLength = 0.0f;
+
+	// portal crossings don't count as bounces, they have a limit of their own
+	unsigned int bounce = 0;
+	unsigned int portalCrossings = 0;
+	while (bounce < maxRayBounces && portalCrossings < SPORTAL_MAXCROSSINGS && currentSector != c_invalidIndex)
+	{
+		// the stats count the rays by how many bounces and portals came before them
+		const unsigned int segment = bounce + portalCrossings;
+		if (stats)
+			stats->m_raysPerBounce[segment < c_maxRayBounces ? segment : c_maxRayBounces - 1]++;
+
+		SCollisionInfo collisionInfo;
+		InitCollisionInfo(collisionInfo, c_maxRayLength, MakeFloat3(bounceCountColor, bounceCountColor, bounceCountColor));
+
+		const SSector &sector = scene.m_sectors[currentSector];
+
+		const float3 ambientLight = sector.m_ambientLight;
+
+		if (segment == 0 && firstHit)
+		{
+			collisionInfo = *firstHit;
+		}
+		else
+		{
+			for (cl_uint index = sector.m_staticSphereStartIndex; index < sector.m_staticSphereStopIndex; ++index)
+				RayIntersectSphere(scene.m_spheres[index], collisionInfo, rayPos, rayDir, lastHitPrimitiveId);
+
+			RayIntersectSectorModels(scene, sector, collisionInfo, rayPos, rayDir, lastHitPrimitiveId);
+
+			RayIntersectSector(sector, collisionInfo, rayPos, rayDir);
+		}
+
+		// if no hit, set pixel to ambient light and bail out
+		if (collisionInfo.m_objectHit == c_invalidObjectId)
+		{
+			cl_float4 noFog = { 0.0f, 0.0f, 0.0f, 0.0f };
+			AddColorStackItem(colorStack, colorStackDepth, portalFilter, portalAdd, white, ambientLight + collisionInfo.m_debugAdditiveColor, noFog);
+			break;
+		}
+
+		// set the fog color and calculate how long the ray spent in the fog half space
+		cl_float4 fogColorAndAmount = sector.m_fogColorAndFactor;
+		fogColorAndAmount.s[3] = LineSegmentFogAmount(rayPos, collisionInfo.m_intersectionPoint, sector.m_fogPlane, sector.m_fogColorAndFactor.s[3], sector.m_fogFactorMax, sector.m_fogMode);
+
+		// if we hit a portal, change our sector, transform the ray and bail out of this loop.
+		if (collisionInfo.m_portalIndex != c_invalidIndex)
+		{
+			rayLength += collisionInfo.m_intersectionTime;
+
+			const SPortal &portal = scene.m_portals[collisionInfo.m_portalIndex];
+			TransformRayThroughPortal(portal, collisionInfo.m_intersectionPoint, rayPos, rayDir);
+			currentSector = portal.m_sector;
+			lastHitPrimitiveId = collisionInfo.m_objectHit;
+
+			// the fog on the way to the portal goes in with the next color stack item
+			AddPortalCrossing(portalFilter, portalAdd, collisionInfo.m_debugAdditiveColor, fogColorAndAmount);
+			++portalCrossings;
+			continue;
+		}
+
+		const SMaterial &material = scene.m_materials[collisionInfo.m_materialIndex];
+
+		// if we hit an object from the inside, flip it's normal, and also make sure no fog is used
+		if (collisionInfo.m_fromInside)
+		{
+			collisionInfo.m_surfaceNormal *= -1.0f;
+			fogColorAndAmount.s[0] = fogColorAndAmount.s[1] = fogColorAndAmount.s[2] = fogColorAndAmount.s[3] = 0.0f;
+		}
+
+		float3 currentAbsorbance = white;
+		if (settings.m_ColorAbsorption)
+		{
+			for (int index = 0; index < 3; ++index)
+				currentAbsorbance[index] = pow(10.0f, absorbance[index] * -collisionInfo.m_intersectionTime);
+		}
+
+		// get the colors of the surface we hit, with ambient lighting, emissive color and the debug additive color applied
+		float3 diffuseColorBase;
+		rayLength += collisionInfo.m_intersectionTime;
+		float3 diffuseColor = ShadeSurface(scene, material, collisionInfo, ambientLight, diffuseColorBase, rayDir, rayLength * scene.m_pixelSpreadAngle);
+
+		// apply diffuse / specular from the point lights
+		ApplySectorPointLights(scene, diffuseColor, collisionInfo, sector, material, rayDir, diffuseColorBase, stats);
+
+		// if reflective, set up the reflected ray
+		if (IsReflective(material))
+		{
+			rayPos = collisionInfo.m_intersectionPoint;
+			rayDir = Reflect(rayDir, collisionInfo.m_surfaceNormal);
+
+			// remember that we hit this object so we don't look for another collision with it
+			lastHitPrimitiveId = collisionInfo.m_objectHit;
+
+			// add this calculated color to the stack, tinting all future colors by the reflection color
+			AddColorStackItem(colorStack, colorStackDepth, portalFilter, portalAdd, material.m_reflectionColor * currentAbsorbance, diffuseColor, fogColorAndAmount);
+		}
+		// if refractive, set up the refracted ray
+		else if (IsRefractive(material))
+		{
+			// refract the ray, pushing a little bit past the point of intersection since we can't ignore the
+			// object we hit - we may need to go out the back side of it.
+			rayPos = collisionInfo.m_intersectionPoint + rayDir * 0.001f;
+			rayDir = Refract(rayDir, collisionInfo.m_surfaceNormal, material.m_refractionIndex);
+			lastHitPrimitiveId = 0;
+
+			if (collisionInfo.m_fromInside)
+				absorbance -= material.m_absorbance;
+			else
+				absorbance += material.m_absorbance;
+
+			// add this calculated color to the stack, tinting all future colors by the refraction color
+			AddColorStackItem(colorStack, colorStackDepth, portalFilter, portalAdd, material.m_refractionColor * currentAbsorbance, diffuseColor, fogColorAndAmount);
+		}
+		// else we are done
+		else
+		{
+			AddColorStackItem(colorStack, colorStackDepth, portalFilter, portalAdd, currentAbsorbance, diffuseColor, fogColorAndAmount);
+			break;
+		}
+
+		++bounce;
+	}
+
+	// a ray that ran out of portal crossings still gets the fog of the portals it went through
+	float3 pixelColor = portalAdd;
+	for (int index = colorStackDepth - 1; index >= 0; --index)
+	{
+		pixelColor *= colorStack[index].m_filterColor;
+		pixelColor += colorStack[index].m_addColor;
+	}
+	return pixelColor;
+}
+
+//-----------------------------------------------------------------------------
+float3 TraceRay (const SScene &scene, cl_uint currentSector, float3 rayPos, float3 rayDir, SRayStats *stats)
+{
+	return TraceRay(scene, currentSector, rayPos, rayDir, stats, NULL);
+}
+
+//-----------------------------------------------------------------------------
+bool RayCast (const SScene &scene, cl_uint currentSector, float3 rayPos, float3 rayDir, float maxDistance, SRayHit &hit)
+{
+	TObjectId lastHitPrimitiveId = c_invalidObjectId;
+	float distance = 0.0f;
+	rayDir = normalize(rayDir);
+
+	for (unsigned int portalCrossings = 0; portalCrossings < SPORTAL_MAXCROSSINGS && currentSector != c_invalidIndex; ++portalCrossings)
+	{
+		const SSector &sector = scene.m_sectors[currentSector];
+
+		SCollisionInfo collisionInfo;
+		InitCollisionInfo(collisionInfo, maxDistance - distance, MakeFloat3(0.0f, 0.0f, 0.0f));
+
+		for (cl_uint index = sector.m_staticSphereStartIndex; index < sector.m_staticSphereStopIndex; ++index)
+			RayIntersectSphere(scene.m_spheres[index], collisionInfo, rayPos, rayDir, lastHitPrimitiveId);
+
+		RayIntersectSectorModels(scene, sector, collisionInfo, rayPos, rayDir, lastHitPrimitiveId);
+
+		RayIntersectSector(sector, collisionInfo, rayPos, rayDir);
+
+		if (collisionInfo.m_objectHit == c_invalidObjectId)
+			return false;
+
+		distance += collisionInfo.m_intersectionTime;
+
+		// go on through portals, as if they weren't there
+		if (collisionInfo.m_portalIndex != c_invalidIndex)
+		{
+			const SPortal &portal = scene.m_portals[collisionInfo.m_portalIndex];
+			TransformRayThroughPortal(portal, collisionInfo.m_intersectionPoint, rayPos, rayDir);
+			currentSector = portal.m_sector;
+			lastHitPrimitiveId = collisionInfo.m_objectHit;
+			continue;
+		}
+
+		hit.m_position = collisionInfo.m_intersectionPoint;
+		hit.m_normal = collisionInfo.m_fromInside ? collisionInfo.m_surfaceNormal * -1.0f : collisionInfo.m_surfaceNormal;
+		hit.m_distance = distance;
+		hit.m_sector = currentSector;
+		hit.m_objectId = collisionInfo.m_objectHit;
+		hit.m_materialIndex = collisionInfo.m_materialIndex;
+		return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+bool LocatePoint (const SScene &scene, cl_uint currentSector, float3 startPos, float3 targetPos, cl_uint &sector, float3 &position)
+{
+	for (unsigned int portalCrossings = 0; portalCrossings <= SPORTAL_MAXCROSSINGS && currentSector != c_invalidIndex; ++portalCrossings)
+	{
+		const SSector &sectorData = scene.m_sectors[currentSector];
+
+		// the walls are the only thing that bounds a sector, so only they can stop the way to the point
+		float3 rayDir = targetPos - startPos;
+		const float remaining = length(rayDir);
+		if (remaining <= 0.0f)
+			break;
+		rayDir = rayDir * (1.0f / remaining);
+
+		SCollisionInfo collisionInfo;
+		InitCollisionInfo(collisionInfo, remaining, MakeFloat3(0.0f, 0.0f, 0.0f));
+		if (!RayIntersectSector(sectorData, collisionInfo, startPos, rayDir))
+			break;
+
+		// a wall without a portal in the way means the point isn't anywhere you can get to from here
+		if (collisionInfo.m_portalIndex == c_invalidIndex || portalCrossings == SPORTAL_MAXCROSSINGS)
+			return false;
+
+		// carry the rest of the way to the point through the portal
+		const SPortal &portal = scene.m_portals[collisionInfo.m_portalIndex];
+		TransformRayThroughPortal(portal, collisionInfo.m_intersectionPoint, startPos, rayDir);
+		targetPos = startPos + rayDir * (remaining - collisionInfo.m_intersectionTime);
+		currentSector = portal.m_sector;
+	}
+
+	if (currentSector == c_invalidIndex)
+		return false;
+
+	sector = currentSector;
+	position = targetPos;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// applies the brightness and the red/blue 3d mode to the colors TraceRay() returned for a pixel
+static cl_float4 ResolvePixelColor (const SData_GfxSettings &settings, const SCamera &camera, const float3 &leftEyeColor, const float3 &rightEyeColor)
+{
+	float3 color = leftEyeColor * camera.m_brightnessMultiplier;
+
+	if (settings.m_RedBlue3D)
+		color = MakeFloat3(ColorToGray(color), 0.0f, ColorToGray(rightEyeColor * camera.m_brightnessMultiplier));
+
+	// convert color from sRGB back to linear space
+	color = sRGBToLinearColor(color);
+	cl_float4 ret = { color[0], color[1], color[2], 1.0f };
+	return ret;
+}
+
+//-----------------------------------------------------------------------------
+cl_float4 TracePixel (const SScene &scene, const SCamera &camera, unsigned int x, unsigned int y, unsigned int width, unsigned int height, SRayStats *stats)
+{
+	const SData_GfxSettings &settings = *scene.m_settings;
+	const float3 rayDir = CameraRayDir(camera, x, y, width, height);
+
+	float3 color = TraceRay(scene, camera.m_sector, camera.m_pos, rayDir, stats);
+
+	// trace the ray for the other eye
+	float3 rightColor = color;
+	if (settings.m_RedBlue3D)
+		rightColor = TraceRay(scene, camera.m_sector, camera.m_pos + camera.m_left * settings.m_RedBlueWidth, rayDir, stats);
+
+	return ResolvePixelColor(settings, camera, color, rightColor);
+}
+
+//-----------------------------------------------------------------------------
+// Packet tracing.  Camera rays for neighboring pixels start at the same point and head in nearly the
+// same direction, so they see the same sector walls, spheres, models and BVH nodes.  A packet holds
+// c_packetSize of them in SoA form and finds their closest hits in the camera's sector together, using
+// SSE to test c_simdWidth rays at a time.  The tests are the same math as the single ray versions,
+// done in the same order, so the packet finds exactly the same hits.
+//
+// Only the first hit is found as a packet.  After that the rays go their own way through portals,
+// reflections and refractions, so each ray finishes in TraceRay() on it's own, with the hit found
+// here standing in for it's first intersection test.
+//-----------------------------------------------------------------------------
+
+static const unsigned int c_simdWidth = 4;
+
+enum EPacketHit
+{
+	e_packetHitNone,
+	e_packetHitSphere,
+	e_packetHitTriangle,
+	e_packetHitSector,
+};
+
+struct SRayPacket
+{
+	float3			m_pos;						// every ray in the packet starts here
+	float			m_dirX[c_packetSize];
+	float			m_dirY[c_packetSize];
+	float			m_dirZ[c_packetSize];
+	float			m_dirInverseX[c_packetSize];
+	float			m_dirInverseY[c_packetSize];
+	float			m_dirInverseZ[c_packetSize];
+	cl_uint			m_active[c_packetSize];		// all bits set for active rays.  Rays for pixels off the edge of the screen are inactive.
+};
+
+// the closest hit of each ray so far.  Only enough is stored to find the primitive again afterwards.
+struct SPacketHits
+{
+	float			m_time[c_packetSize];
+	cl_uint			m_type[c_packetSize];			// EPacketHit
+	cl_uint			m_primitiveIndex[c_packetSize];	// sphere or triangle index
+	cl_uint			m_modelIndex[c_packetSize];
+	cl_uint			m_objectIndex[c_packetSize];
+	cl_uint			m_materialIndex[c_packetSize];
+};
+
+//-----------------------------------------------------------------------------
+static inline __m128 LoadMask (const cl_uint *mask)
+{
+	return _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)mask));
+}
+
+//-----------------------------------------------------------------------------
+static inline __m128 Select (__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+//-----------------------------------------------------------------------------
+// sets the lanes of dest that are set in mask to value
+static inline void StoreMasked (cl_uint *dest, __m128 mask, cl_uint value)
+{
+	const __m128i maskInt = _mm_castps_si128(mask);
+	const __m128i old = _mm_loadu_si128((const __m128i *)dest);
+	_mm_storeu_si128((__m128i *)dest, _mm_or_si128(_mm_and_si128(maskInt, _mm_set1_epi32(value)), _mm_andnot_si128(maskInt, old)));
+}
+
+//-----------------------------------------------------------------------------
+static inline void StoreMasked (float *dest, __m128 mask, __m128 value)
+{
+	_mm_storeu_ps(dest, Select(mask, value, _mm_loadu_ps(dest)));
+}
+
+//-----------------------------------------------------------------------------
+static inline float3 PacketRayDir (const SRayPacket &packet, unsigned int lane)
+{
+	return MakeFloat3(packet.m_dirX[lane], packet.m_dirY[lane], packet.m_dirZ[lane]);
+}
+
+//-----------------------------------------------------------------------------
+static inline void SetPacketRayDir (SRayPacket &packet, unsigned int lane, const float3 &rayDir)
+{
+	packet.m_dirX[lane] = rayDir[0];
+	packet.m_dirY[lane] = rayDir[1];
+	packet.m_dirZ[lane] = rayDir[2];
+
+	const float3 rayDirInverse = SafeReciprocal(rayDir);
+	packet.m_dirInverseX[lane] = rayDirInverse[0];
+	packet.m_dirInverseY[lane] = rayDirInverse[1];
+	packet.m_dirInverseZ[lane] = rayDirInverse[2];
+}
+
+//-----------------------------------------------------------------------------
+static inline bool PacketAnyActive (const cl_uint *active)
+{
+	cl_uint any = 0;
+	for (unsigned int lane = 0; lane < c_packetSize; ++lane)
+		any |= active[lane];
+	return any != 0;
+}
+
+//-----------------------------------------------------------------------------
+// the slab test of RayHitsBVHNode() for every ray in the packet.  True if any active ray hits the node.
+static inline bool PacketHitsBVHNode (const SBVHNode &node, const SRayPacket &packet, const float *maxTime, const cl_uint *active)
+{
+	const __m128 minOffsetX = _mm_set1_ps(node.m_min[0] - packet.m_pos[0]);
+	const __m128 minOffsetY = _mm_set1_ps(node.m_min[1] - packet.m_pos[1]);
+	const __m128 minOffsetZ = _mm_set1_ps(node.m_min[2] - packet.m_pos[2]);
+	const __m128 maxOffsetX = _mm_set1_ps(node.m_max[0] - packet.m_pos[0]);
+	const __m128 maxOffsetY = _mm_set1_ps(node.m_max[1] - packet.m_pos[1]);
+	const __m128 maxOffsetZ = _mm_set1_ps(node.m_max[2] - packet.m_pos[2]);
+
+	for (unsigned int lane = 0; lane < c_packetSize; lane += c_simdWidth)
+	{
+		__m128 enterTime = _mm_setzero_ps();
+		__m128 exitTime = _mm_loadu_ps(&maxTime[lane]);
+
+		__m128 dirInverse = _mm_loadu_ps(&packet.m_dirInverseX[lane]);
+		__m128 time1 = _mm_mul_ps(minOffsetX, dirInverse);
+		__m128 time2 = _mm_mul_ps(maxOffsetX, dirInverse);
+		enterTime = _mm_max_ps(_mm_min_ps(time2, time1), enterTime);
+		exitTime = _mm_min_ps(_mm_max_ps(time1, time2), exitTime);
+
+		dirInverse = _mm_loadu_ps(&packet.m_dirInverseY[lane]);
+		time1 = _mm_mul_ps(minOffsetY, dirInverse);
+		time2 = _mm_mul_ps(maxOffsetY, dirInverse);
+		enterTime = _mm_max_ps(_mm_min_ps(time2, time1), enterTime);
+		exitTime = _mm_min_ps(_mm_max_ps(time1, time2), exitTime);
+
+		dirInverse = _mm_loadu_ps(&packet.m_dirInverseZ[lane]);
+		time1 = _mm_mul_ps(minOffsetZ, dirInverse);
+		time2 = _mm_mul_ps(maxOffsetZ, dirInverse);
+		enterTime = _mm_max_ps(_mm_min_ps(time2, time1), enterTime);
+		exitTime = _mm_min_ps(_mm_max_ps(time1, time2), exitTime);
+
+		if (_mm_movemask_ps(_mm_and_ps(LoadMask(&active[lane]), _mm_cmple_ps(enterTime, exitTime))))
+			return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// WalkBVH() for a packet.  A node is visited if any ray in the packet hits it, and children are visited
+// in the order the first active ray would visit them.
+template <typename TVisitLeaf>
+static inline void WalkBVHPacket (const SBVHNode *nodes, cl_uint rootIndex, const SRayPacket &packet, const float *maxTime, const cl_uint *active, const TVisitLeaf &visitLeaf)
+{
+	unsigned int firstActive = 0;
+	while (!active[firstActive])
+		++firstActive;
+	const float3 orderDir = PacketRayDir(packet, firstActive);
+
+	unsigned int nodeStack[BVH_MAXDEPTH];
+	unsigned int nodeStackDepth = 0;
+	unsigned int nodeIndex = rootIndex;
+
+	while (true)
+	{
+		const SBVHNode &node = nodes[nodeIndex];
+
+		if (PacketHitsBVHNode(node, packet, maxTime, active))
+		{
+			if (node.m_primitiveCount == 0)
+			{
+				if (orderDir[node.m_splitAxis] < 0.0f)
+				{
+					nodeStack[nodeStackDepth++] = nodeIndex + 1;
+					nodeIndex = node.m_rightChildOrFirstPrimitive;
+				}
+				else
+				{
+					nodeStack[nodeStackDepth++] = node.m_rightChildOrFirstPrimitive;
+					nodeIndex = nodeIndex + 1;
+				}
+				continue;
+			}
+
+			visitLeaf(node.m_rightChildOrFirstPrimitive, node.m_primitiveCount);
+		}
+
+		if (nodeStackDepth == 0)
+			return;
+		nodeIndex = nodeStack[--nodeStackDepth];
+	}
+}
+
+//-----------------------------------------------------------------------------
+// RayIntersectSphere() for every ray in the packet.  Camera rays have no primitive to ignore.
+static void PacketIntersectSphere (const SSphere &sphere, cl_uint sphereIndex, const SRayPacket &packet, SPacketHits &hits)
+{
+	// the rays share a start point, so only b differs per ray
+	const float3 m = packet.m_pos - XYZ(sphere.m_positionAndRadius);
+	const float radius = sphere.m_positionAndRadius.s[3];
+	const float c = dot(m, m) - radius * radius;
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 mX = _mm_set1_ps(m[0]);
+	const __m128 mY = _mm_set1_ps(m[1]);
+	const __m128 mZ = _mm_set1_ps(m[2]);
+	const __m128 cSplat = _mm_set1_ps(c);
+	const __m128 cPositive = _mm_cmpgt_ps(cSplat, zero);
+
+	for (unsigned int lane = 0; lane < c_packetSize; lane += c_simdWidth)
+	{
+		const __m128 b = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(mX, _mm_loadu_ps(&packet.m_dirX[lane])),
+			_mm_mul_ps(mY, _mm_loadu_ps(&packet.m_dirY[lane]))),
+			_mm_mul_ps(mZ, _mm_loadu_ps(&packet.m_dirZ[lane])));
+		const __m128 discr = _mm_sub_ps(_mm_mul_ps(b, b), cSplat);
+		const __m128 root = _mm_sqrt_ps(_mm_max_ps(discr, zero));
+		const __m128 negB = _mm_sub_ps(zero, b);
+
+		// use the far side of the sphere if the ray starts inside it
+		__m128 collisionTime = _mm_sub_ps(negB, root);
+		collisionTime = Select(_mm_cmplt_ps(collisionTime, zero), _mm_add_ps(negB, root), collisionTime);
+
+		const __m128 time = _mm_loadu_ps(&hits.m_time[lane]);
+		__m128 hit = LoadMask(&packet.m_active[lane]);
+		hit = _mm_andnot_ps(_mm_and_ps(cPositive, _mm_cmpgt_ps(b, zero)), hit);
+		hit = _mm_andnot_ps(_mm_cmplt_ps(discr, zero), hit);
+		hit = _mm_andnot_ps(_mm_cmpgt_ps(collisionTime, time), hit);
+		if (!_mm_movemask_ps(hit))
+			continue;
+
+		StoreMasked(&hits.m_time[lane], hit, collisionTime);
+		StoreMasked(&hits.m_type[lane], hit, e_packetHitSphere);
+		StoreMasked(&hits.m_primitiveIndex[lane], hit, sphereIndex);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// RayIntersectTriangle() for every ray in the packet, in the model's space.  localTime is the packet's
+// closest hit times in model space.
+static void PacketIntersectTriangle (
+	const SModelTriangle &triangle,
+	cl_uint triangleIndex,
+	const SRayPacket &packet,
+	const cl_uint *active,
+	float *localTime,
+	bool backFaceCulling,
+	cl_uint modelIndex,
+	float modelScale,
+	cl_uint objectIndex,
+	cl_uint materialIndex,
+	SPacketHits &hits
+)
+{
+	const float3 planeNormal = XYZ(triangle.m_plane);
+	const float distp = dot(packet.m_pos, planeNormal) - triangle.m_plane.s[3];
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 posX = _mm_set1_ps(packet.m_pos[0]);
+	const __m128 posY = _mm_set1_ps(packet.m_pos[1]);
+	const __m128 posZ = _mm_set1_ps(packet.m_pos[2]);
+	const __m128 normalX = _mm_set1_ps(planeNormal[0]);
+	const __m128 normalY = _mm_set1_ps(planeNormal[1]);
+	const __m128 normalZ = _mm_set1_ps(planeNormal[2]);
+	const __m128 planeD = _mm_set1_ps(triangle.m_plane.s[3]);
+	const __m128 distpSplat = _mm_set1_ps(distp);
+	const __m128 cullMask = backFaceCulling ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+
+	for (unsigned int lane = 0; lane < c_packetSize; lane += c_simdWidth)
+	{
+		const __m128 dirX = _mm_loadu_ps(&packet.m_dirX[lane]);
+		const __m128 dirY = _mm_loadu_ps(&packet.m_dirY[lane]);
+		const __m128 dirZ = _mm_loadu_ps(&packet.m_dirZ[lane]);
+
+		const __m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, normalX), _mm_mul_ps(dirY, normalY)), _mm_mul_ps(dirZ, normalZ));
+
+		// distance of some other point along the ray to the triangle plane, and the t value of impact
+		const __m128 distq = _mm_sub_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_add_ps(posX, dirX), normalX),
+			_mm_mul_ps(_mm_add_ps(posY, dirY), normalY)),
+			_mm_mul_ps(_mm_add_ps(posZ, dirZ), normalZ)),
+			planeD);
+		const __m128 t = _mm_div_ps(distpSplat, _mm_sub_ps(distpSplat, distq));
+
+		// point of impact and it's barycentric coordinates
+		const __m128 sX = _mm_add_ps(posX, _mm_mul_ps(dirX, t));
+		const __m128 sY = _mm_add_ps(posY, _mm_mul_ps(dirY, t));
+		const __m128 sZ = _mm_add_ps(posZ, _mm_mul_ps(dirZ, t));
+		const __m128 u = _mm_sub_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(sX, _mm_set1_ps(triangle.m_planeBC.s[0])),
+			_mm_mul_ps(sY, _mm_set1_ps(triangle.m_planeBC.s[1]))),
+			_mm_mul_ps(sZ, _mm_set1_ps(triangle.m_planeBC.s[2]))),
+			_mm_set1_ps(triangle.m_planeBC.s[3]));
+		const __m128 v = _mm_sub_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(sX, _mm_set1_ps(triangle.m_planeCA.s[0])),
+			_mm_mul_ps(sY, _mm_set1_ps(triangle.m_planeCA.s[1]))),
+			_mm_mul_ps(sZ, _mm_set1_ps(triangle.m_planeCA.s[2]))),
+			_mm_set1_ps(triangle.m_planeCA.s[3]));
+		const __m128 w = _mm_sub_ps(_mm_sub_ps(one, u), v);
+
+		const __m128 time = _mm_loadu_ps(&localTime[lane]);
+		__m128 hit = LoadMask(&active[lane]);
+		hit = _mm_andnot_ps(_mm_and_ps(cullMask, _mm_cmpgt_ps(facing, zero)), hit);
+		hit = _mm_andnot_ps(_mm_or_ps(_mm_cmplt_ps(t, zero), _mm_cmpgt_ps(t, time)), hit);
+		hit = _mm_andnot_ps(_mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)), hit);
+		hit = _mm_andnot_ps(_mm_cmplt_ps(v, zero), hit);
+		hit = _mm_andnot_ps(_mm_cmplt_ps(w, zero), hit);
+		if (!_mm_movemask_ps(hit))
+			continue;
+
+		StoreMasked(&localTime[lane], hit, t);
+		StoreMasked(&hits.m_time[lane], hit, _mm_mul_ps(t, _mm_set1_ps(modelScale)));
+		StoreMasked(&hits.m_type[lane], hit, e_packetHitTriangle);
+		StoreMasked(&hits.m_primitiveIndex[lane], hit, triangleIndex);
+		StoreMasked(&hits.m_modelIndex[lane], hit, modelIndex);
+		StoreMasked(&hits.m_objectIndex[lane], hit, objectIndex);
+		StoreMasked(&hits.m_materialIndex[lane], hit, materialIndex);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// RayIntersectModelInstance() for every ray in the packet
+static void PacketIntersectModelInstance (const SScene &scene, cl_uint modelIndex, const SRayPacket &packet, SPacketHits &hits)
+{
+	const SModelInstance &model = scene.m_models[modelIndex];
+
+	// only the rays that hit the bounding sphere go on to the triangles
+	SRayPacket packetLocal;
+	for (unsigned int lane = 0; lane < c_packetSize; ++lane)
+		packetLocal.m_active[lane] = packet.m_active[lane] && RayHitsSphere(model.m_boundingSphere, packet.m_pos, PacketRayDir(packet, lane), hits.m_time[lane]) ? ~0u : 0u;
+	if (!PacketAnyActive(packetLocal.m_active))
+		return;
+
+	// convert the packet into model space
+	float localTime[c_packetSize];
+	for (unsigned int lane = 0; lane < c_packetSize; ++lane)
+	{
+		float3 rayDirLocal;
+		RayToModelSpace(model, packet.m_pos, PacketRayDir(packet, lane), packetLocal.m_pos, rayDirLocal);
+		SetPacketRayDir(packetLocal, lane, rayDirLocal);
+		localTime[lane] = hits.m_time[lane] / model.m_scale;
+	}
+
+	for (cl_uint objectIndex = model.m_startObjectIndex; objectIndex < model.m_stopObjectIndex; ++objectIndex)
+	{
+		const SModelObject &object = scene.m_objects[objectIndex];
+		if (object.m_bvhRootIndex == c_invalidIndex)
+			continue;
+
+		// allow back face culling if the triangle isn't refractive (transparent)
+		const cl_uint materialIndex = model.m_materialOverride == c_invalidIndex ? object.m_materialIndex : model.m_materialOverride;
+		const bool backFaceCulling = !IsRefractive(scene.m_materials[materialIndex]);
+
+		WalkBVHPacket(scene.m_bvhNodes, object.m_bvhRootIndex, packetLocal, localTime, packetLocal.m_active,
+			[&] (cl_uint firstTriangle, cl_uint triangleCount)
+			{
+				for (cl_uint triangleIndex = firstTriangle; triangleIndex < firstTriangle + triangleCount; ++triangleIndex)
+					PacketIntersectTriangle(scene.m_triangles[triangleIndex], triangleIndex, packetLocal, packetLocal.m_active, localTime, backFaceCulling, modelIndex, model.m_scale, objectIndex, materialIndex, hits);
+			}
+		);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// RayIntersectSector() for every ray in the packet
+static void PacketIntersectSector (const SSector &sector, const SRayPacket &packet, SPacketHits &hits)
+{
+	const float *dir[3] = { packet.m_dirX, packet.m_dirY, packet.m_dirZ };
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (unsigned int lane = 0; lane < c_packetSize; lane += c_simdWidth)
+	{
+		__m128 closestHitTime = _mm_loadu_ps(&hits.m_time[lane]);
+		__m128 hit = zero;
+
+		// the slabs of each axis the ray isn't parallel with
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const __m128 rayDir = _mm_loadu_ps(&dir[axis][lane]);
+			const __m128 denom = _mm_div_ps(one, rayDir);
+			const __m128 time1 = _mm_mul_ps(_mm_set1_ps(-packet.m_pos[axis] + sector.m_halfDims[axis]), denom);
+			const __m128 time2 = _mm_mul_ps(_mm_set1_ps(-packet.m_pos[axis] - sector.m_halfDims[axis]), denom);
+			const __m128 time = Select(_mm_cmpge_ps(time1, time2), time1, time2);
+			const __m128 closer = _mm_and_ps(_mm_and_ps(_mm_cmpneq_ps(rayDir, zero), _mm_cmpgt_ps(time, zero)), _mm_cmplt_ps(time, closestHitTime));
+			closestHitTime = Select(closer, time, closestHitTime);
+			hit = _mm_or_ps(hit, closer);
+		}
+
+		hit = _mm_and_ps(hit, LoadMask(&packet.m_active[lane]));
+		StoreMasked(&hits.m_time[lane], hit, closestHitTime);
+		StoreMasked(&hits.m_type[lane], hit, e_packetHitSector);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// fills out the full collision info for a ray of the packet, by testing the ray against the primitive
+// the packet found it hits
+static void GetPacketCollisionInfo (
+	const SScene &scene,
+	const SSector &sector,
+	const SRayPacket &packet,
+	const SPacketHits &hits,
+	unsigned int lane,
+	SCollisionInfo &info
+)
+{
+	const float3 rayDir = PacketRayDir(packet, lane);
+
+	switch (hits.m_type[lane])
+	{
+		case e_packetHitSphere:
+		{
+			RayIntersectSphere(scene.m_spheres[hits.m_primitiveIndex[lane]], info, packet.m_pos, rayDir, c_invalidObjectId);
+			break;
+		}
+		case e_packetHitTriangle:
+		{
+			const SModelInstance &model = scene.m_models[hits.m_modelIndex[lane]];
+			const cl_uint materialIndex = hits.m_materialIndex[lane];
+
+			float3 rayPosLocal;
+			float3 rayDirLocal;
+			RayToModelSpace(model, packet.m_pos, rayDir, rayPosLocal, rayDirLocal);
+
+			SCollisionInfo collisionInfoLocal;
+			InitCollisionInfo(collisionInfoLocal, info.m_intersectionTime / model.m_scale, info.m_debugAdditiveColor);
+			if (RayIntersectTriangle(scene, hits.m_primitiveIndex[lane], collisionInfoLocal, rayPosLocal, rayDirLocal, c_invalidObjectId, !IsRefractive(scene.m_materials[materialIndex]), materialIndex, model.m_portalIndex))
+			{
+				ResolveModelTriangleShading(scene, scene.m_objects[hits.m_objectIndex[lane]], collisionInfoLocal);
+				ModelHitToWorldSpace(model, collisionInfoLocal, info);
+			}
+			break;
+		}
+		case e_packetHitSector:
+		{
+			RayIntersectSector(sector, info, packet.m_pos, rayDir);
+			break;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// traces every active ray of the packet, starting in the given sector
+static void TracePacket (const SScene &scene, cl_uint sectorIndex, const SRayPacket &packet, float3 *colors, SRayStats *stats)
+{
+	const SSector &sector = scene.m_sectors[sectorIndex];
+
+	SPacketHits hits;
+	for (unsigned int lane = 0; lane < c_packetSize; ++lane)
+	{
+		hits.m_time[lane] = c_maxRayLength;
+		hits.m_type[lane] = e_packetHitNone;
+		hits.m_primitiveIndex[lane] = 0;
+		hits.m_modelIndex[lane] = 0;
+		hits.m_objectIndex[lane] = 0;
+		hits.m_materialIndex[lane] = 0;
+	}
+
+	// same order as TraceRay(): spheres, then models, then the sector walls
+	for (cl_uint index = sector.m_staticSphereStartIndex; index < sector.m_staticSphereStopIndex; ++index)
+		PacketIntersectSphere(scene.m_spheres[index], index, packet, hits);
+
+	if (sector.m_staticModelBVHRootIndex != c_invalidIndex)
+	{
+		WalkBVHPacket(scene.m_instanceBVHNodes, sector.m_staticModelBVHRootIndex, packet, hits.m_time, packet.m_active,
+			[&] (cl_uint firstModel, cl_uint modelCount)
+			{
+				for (cl_uint modelIndex = firstModel; modelIndex < firstModel + modelCount; ++modelIndex)
+					PacketIntersectModelInstance(scene, modelIndex, packet, hits);
+			}
+		);
+	}
+
+	PacketIntersectSector(sector, packet, hits);
+
+	// each ray finishes on it's own from here
+	const SData_GfxSettings &settings = *scene.m_settings;
+	const unsigned int maxRayBounces = settings.m_RayBounces < c_maxRayBounces ? settings.m_RayBounces : c_maxRayBounces;
+	const float bounceCountColor = settings.m_DebugRayBounceCount ? 1.0f / ((float)maxRayBounces) : 0.0f;
+	for (unsigned int lane = 0; lane < c_packetSize; ++lane)
+	{
+		if (!packet.m_active[lane])
+			continue;
+
+		SCollisionInfo collisionInfo;
+		InitCollisionInfo(collisionInfo, c_maxRayLength, MakeFloat3(bounceCountColor, bounceCountColor, bounceCountColor));
+		GetPacketCollisionInfo(scene, sector, packet, hits, lane, collisionInfo);
+
+		colors[lane] = TraceRay(scene, sectorIndex, packet.m_pos, PacketRayDir(packet, lane), stats, &collisionInfo);
+	}
+}
+
+//-----------------------------------------------------------------------------
+void TracePixelPacket (const SScene &scene, const SCamera &camera, unsigned int x, unsigned int y, unsigned int width, unsigned int height, cl_float4 *colors, SRayStats *stats)
+{
+	const SData_GfxSettings &settings = *scene.m_settings;
+
+	// the model debug visualizations need every bounding sphere and triangle test a ray makes, so they
+	// only work with single rays.  So does a camera outside of any sector.
+	if (settings.m_DebugModelBoundingSphere || settings.m_DebugTriangles || camera.m_sector == c_invalidIndex)
+	{
+		for (unsigned int lane = 0; lane < c_packetSize; ++lane)
+		{
+			const unsigned int pixelX = x + lane % c_packetWidth;
+			const unsigned int pixelY = y + lane / c_packetWidth;
+			if (pixelX < width && pixelY < height)
+				colors[lane] = TracePixel(scene, camera, pixelX, pixelY, width, height, stats);
+		}
+		return;
+	}
+
+	SRayPacket packet;
+	packet.m_pos = camera.m_pos;
+	for (unsigned int lane = 0; lane < c_packetSize; ++lane)
+	{
+		const unsigned int pixelX = x + lane % c_packetWidth;
+		const unsigned int pixelY = y + lane / c_packetWidth;
+		packet.m_active[lane] = pixelX < width && pixelY < height ? ~0u : 0u;
+		SetPacketRayDir(packet, lane, CameraRayDir(camera, pixelX, pixelY, width, height));
+	}
+
+	float3 leftEyeColors[c_packetSize];
+	float3 rightEyeColors[c_packetSize];
+	TracePacket(scene, camera.m_sector, packet, leftEyeColors, stats);
+
+	// trace the rays for the other eye
+	if (settings.m_RedBlue3D)
+	{
+		packet.m_pos = camera.m_pos + camera.m_left * settings.m_RedBlueWidth;
+		TracePacket(scene, camera.m_sector, packet, rightEyeColors, stats);
+	}
+
+	for (unsigned int lane = 0; lane < c_packetSize; ++lane)
+	{
+		if (packet.m_active[lane])
+			colors[lane] = ResolvePixelColor(settings, camera, leftEyeColors[lane], settings.m_RedBlue3D ? rightEyeColors[lane] : leftEyeColors[lane]);
+	}
+}
+
+};
@@ -0,0 +1,142 @@
+/*==================================================================================================
+
+CPUTrace.h
+
+A C++ port of the ray tracing routines in clrt.cl, working on the same structs the kernel does.
+Used by the cpu renderer, by the world's cpu side queries (see Game/CWorldQuery.cpp), and as a
+reference to check kernel changes against.
+
+Changes made to TraceRay, ShadeSurface, SampleTexture, ApplyPointLight, PointCanSeePoint or the
+intersection routines in clrt.cl need to be made here as well.  Textures are read from a copy of
+the texture atlas in memory (see CTextureManager::GetHostAtlas()), the same way the kernel reads them.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "KernelCode/Shared/SharedGeometry.h"
+#include "KernelCode/Shared/SCamera.h"
+#include "KernelCode/Shared/STextureAtlas.h"
+
+struct SData_GfxSettings;
+
+namespace CPUTrace
+{
+	// the most bounces a ray can make on the cpu, regardless of the RayBounces setting
+	static const unsigned int c_maxRayBounces = 64;
+
+	// the block of pixels traced together by TracePixelPacket()
+	static const unsigned int c_packetWidth = 4;
+	static const unsigned int c_packetHeight = 2;
+	static const unsigned int c_packetSize = c_packetWidth * c_packetHeight;
+
+	// counts of the rays traced, for benchmarking
+	struct SRayStats
+	{
+		SRayStats () { Clear(); }
+
+		void Clear ()
+		{
+			for (unsigned int index = 0; index < c_maxRayBounces; ++index)
+				m_raysPerBounce[index] = 0;
+			m_shadowRays = 0;
+		}
+
+		void Add (const SRayStats &other)
+		{
+			for (unsigned int index = 0; index < c_maxRayBounces; ++index)
+				m_raysPerBounce[index] += other.m_raysPerBounce[index];
+			m_shadowRays += other.m_shadowRays;
+		}
+
+		unsigned long long TotalRays () const
+		{
+			unsigned long long total = m_shadowRays;
+			for (unsigned int index = 0; index < c_maxRayBounces; ++index)
+				total += m_raysPerBounce[index];
+			return total;
+		}
+
+		unsigned long long	m_raysPerBounce[c_maxRayBounces];	// entry 0 is camera rays, entry 1 is the rays from their first bounce (or portal), etc
+		unsigned long long	m_shadowRays;
+	};
+
+	// the world data the routines trace against, in the same layout the kernel gets it
+	struct SScene
+	{
+		const SPointLight		*m_lights;
+		const SSphere			*m_spheres;
+		const SModelTriangle	*m_triangles;
+		const SModelTriangleShading	*m_triangleShading;
+		const SModelObject		*m_objects;
+		const SBVHNode			*m_bvhNodes;
+		const SBVHNode			*m_instanceBVHNodes;
+		const SModelInstance	*m_models;
+		const SSector			*m_sectors;
+		const SMaterial			*m_materials;
+		const SPortal			*m_portals;
+		const cl_uint			*m_shadowTexels;
+
+		// the texture atlas, RGBA with 8 bits a channel, and where each texture is in it.  If m_textureAtlas
+		// is NULL textured materials use their untextured colors, and normal maps are ignored.
+		const unsigned char		*m_textureAtlas;
+		unsigned int			m_textureAtlasWidth;
+		unsigned int			m_textureAtlasHeight;
+		const SAtlasTexture		*m_atlasTextures;
+
+		// stands in for the SETTINGS_* and DEBUG_* defines the kernel is built with
+		const SData_GfxSettings	*m_settings;
+
+		// the camera's frame count, which light sampling mixes into it's picks
+		cl_uint					m_frameCount;
+
+		// the angle between the camera rays of neighboring pixels, which is how fast the footprint of a ray
+		// grows with the distance it travels.  Picks the mip level of the textures.  See PixelSpreadAngle().
+		float					m_pixelSpreadAngle;
+	};
+
+	// whether anything that casts shadows is between the two points, which are both in the sector.  Doesn't
+	// look at the settings, so scene.m_settings may be NULL.  Same as !PointCanSeePoint() in clrt.cl with shadows on.
+	bool PointOccluded (const SScene &scene, const SSector &sector, const float3 &startPos, const float3 &targetPos, const TObjectId ignorePrimitiveId);
+
+	// what RayCast() hit
+	struct SRayHit
+	{
+		float3		m_position;			// in the space of m_sector
+		float3		m_normal;			// facing back toward the ray
+		float		m_distance;			// how far along the ray, through any portals
+		cl_uint		m_sector;
+		TObjectId	m_objectId;
+		cl_uint		m_materialIndex;
+	};
+
+	// finds the closest sphere, model triangle or sector wall the ray hits within maxDistance, going through
+	// any portals on the way, using the same intersection tests and BVHs as TraceRay().  Doesn't look at the
+	// settings, so scene.m_settings may be NULL.
+	bool RayCast (const SScene &scene, cl_uint sector, float3 rayPos, float3 rayDir, float maxDistance, SRayHit &hit);
+
+	// finds which sector targetPos, in the space of the given sector, is in, by following the line from
+	// startPos to it through the portals of the sector walls it crosses.  Sets sector and position to where it
+	// ends up, in that sector's space.  Returns false if the line goes through a wall without a portal.
+	bool LocatePoint (const SScene &scene, cl_uint startSector, float3 startPos, float3 targetPos, cl_uint &sector, float3 &position);
+
+	// the angle between the camera rays of neighboring pixels of a width wide image.  Same as
+	// PixelSpreadAngle() in clrt.cl, with width being the camera's m_renderWidth.
+	float PixelSpreadAngle (const SCamera &camera, unsigned int width);
+
+	// the ray direction the kernel uses for pixel x,y of a width x height image
+	float3 CameraRayDir (const SCamera &camera, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+
+	// traces a ray through the scene starting in the given sector, returning it's color before the
+	// brightness multiplier is applied.  Same as TraceRay() in clrt.cl.  The rays traced are added to
+	// stats, if given.
+	float3 TraceRay (const SScene &scene, cl_uint sector, float3 rayPos, float3 rayDir, SRayStats *stats = NULL);
+
+	// the final color the kernel would write for pixel x,y of a width x height image
+	cl_float4 TracePixel (const SScene &scene, const SCamera &camera, unsigned int x, unsigned int y, unsigned int width, unsigned int height, SRayStats *stats = NULL);
+
+	// the same colors as TracePixel() for the c_packetWidth x c_packetHeight block of pixels starting at
+	// x,y, with the camera rays traced as one packet.  colors[lane] is pixel (x + lane % c_packetWidth,
+	// y + lane / c_packetWidth).  Pixels off the edge of the image are left alone.
+	void TracePixelPacket (const SScene &scene, const SCamera &camera, unsigned int x, unsigned int y, unsigned int width, unsigned int height, cl_float4 *colors, SRayStats *stats = NULL);
+};
@@ -0,0 +1,224 @@
+/*==================================================================================================
+
+CProgramBinaryCache.cpp
+
+Keeps the binaries of built OpenCL programs on disk, so the kernel only gets compiled from source
+when it, the headers it includes, the build options or the device driver have changed.
+
+==================================================================================================*/
+
+#include "CProgramBinaryCache.h"
+#include "OS.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <set>
+
+static const char c_programBinaryMagic[8] = { 'C', 'L', 'R', 'T', 'P', 'B', 'I', 'N' };
+static const cl_uint c_programBinaryVersion = 1;
+
+struct SProgramBinaryHeader
+{
+	char	m_magic[8];
+	cl_uint	m_version;
+	cl_uint	m_keySize;		// the key follows the header
+	cl_uint	m_binarySize;	// and the binary follows the key
+	cl_uint	m_pad;
+};
+
+//-----------------------------------------------------------------------------
+static unsigned long long HashBytes (unsigned long long hash, const void *data, size_t size)
+{
+	// 64 bit FNV-1a
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t index = 0; index < size; ++index)
+		hash = (hash ^ bytes[index]) * 1099511628211ull;
+	return hash;
+}
+
+//-----------------------------------------------------------------------------
+static bool ReadTextFile (const std::string &fileName, std::string &contents)
+{
+	FILE *file = fopen(fileName.c_str(), "rb");
+	if (!file)
+		return false;
+
+	char buffer[4096];
+	size_t read;
+	contents.clear();
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		contents.append(buffer, read);
+	fclose(file);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// hashes the file and everything it #includes.  Includes are looked for next to the including file, then
+// in includeDir, then in the current directory, which is how the kernel build finds them.  Includes that
+// can't be found are skipped, since they're either inside an #ifdef that's off for the kernel or the build
+// will fail anyway.
+static unsigned long long HashSourceFile (
+	const std::string &fileName,
+	const std::string &includeDir,
+	std::set<std::string> &hashedFiles,
+	unsigned long long hash
+) {
+	std::string contents;
+	if (hashedFiles.count(fileName) > 0 || !ReadTextFile(fileName, contents))
+		return hash;
+	hashedFiles.insert(fileName);
+
+	hash = HashBytes(hash, fileName.c_str(), fileName.length());
+	hash = HashBytes(hash, contents.c_str(), contents.length());
+
+	const size_t slash = fileName.find_last_of("/\\");
+	const std::string fileDir = slash == std::string::npos ? std::string() : fileName.substr(0, slash + 1);
+
+	for (size_t lineStart = 0; lineStart < contents.length(); )
+	{
+		size_t lineEnd = contents.find('\n', lineStart);
+		if (lineEnd == std::string::npos)
+			lineEnd = contents.length();
+
+		size_t position = contents.find_first_not_of(" \t", lineStart);
+		if (position < lineEnd && contents.compare(position, 8, "#include") == 0)
+		{
+			const size_t nameStart = contents.find('"', position);
+			const size_t nameEnd = nameStart < lineEnd ? contents.find('"', nameStart + 1) : std::string::npos;
+			if (nameEnd < lineEnd)
+			{
+				const std::string name = contents.substr(nameStart + 1, nameEnd - nameStart - 1);
+				const std::string candidates[3] = { fileDir + name, includeDir + name, name };
+				for (int index = 0; index < 3; ++index)
+				{
+					FILE *file = fopen(candidates[index].c_str(), "rb");
+					if (file)
+					{
+						fclose(file);
+						hash = HashSourceFile(candidates[index], includeDir, hashedFiles, hash);
+						break;
+					}
+				}
+			}
+		}
+
+		lineStart = lineEnd + 1;
+	}
+
+	return hash;
+}
+
+//-----------------------------------------------------------------------------
+static std::string GetDeviceString (cl_device_id device, cl_device_info param)
+{
+	char buffer[1024];
+	size_t size = 0;
+	if (clGetDeviceInfo(device, param, sizeof(buffer), buffer, &size) != CL_SUCCESS || size == 0)
+		return std::string();
+	return std::string(buffer, strnlen(buffer, size));
+}
+
+//-----------------------------------------------------------------------------
+CProgramBinaryCache::CProgramBinaryCache (const char *sourceFileName, const char *includeDir, const std::string &buildOptions, cl_device_id device)
+	: m_device(device)
+	, m_buildOptions(buildOptions)
+{
+	std::set<std::string> hashedFiles;
+	const unsigned long long sourceHash = HashSourceFile(sourceFileName, includeDir, hashedFiles, 14695981039346656037ull);
+
+	char buffer[32];
+	sprintf(buffer, "%016llx", sourceHash);
+	m_key = "source ";
+	m_key.append(buffer);
+	m_key.append("\noptions ");
+	m_key.append(buildOptions);
+	m_key.append("\ndevice ");
+	m_key.append(GetDeviceString(device, CL_DEVICE_NAME));
+	m_key.append("\nvendor ");
+	m_key.append(GetDeviceString(device, CL_DEVICE_VENDOR));
+	m_key.append("\nversion ");
+	m_key.append(GetDeviceString(device, CL_DEVICE_VERSION));
+	m_key.append("\ndriver ");
+	m_key.append(GetDeviceString(device, CL_DRIVER_VERSION));
+
+	sprintf(buffer, ".%016llx.clbin", HashBytes(14695981039346656037ull, m_key.c_str(), m_key.length()));
+	m_fileName = std::string(sourceFileName) + buffer;
+}
+
+//-----------------------------------------------------------------------------
+cl_program CProgramBinaryCache::Load (cl_context context) const
+{
+	OS::CMappedFile file;
+	if (!file.Open(m_fileName.c_str()) || file.Size() < sizeof(SProgramBinaryHeader))
+		return NULL;
+
+	const SProgramBinaryHeader &header = *(const SProgramBinaryHeader *)file.Data();
+	const char *key = (const char *)file.Data() + sizeof(header);
+	if (memcmp(header.m_magic, c_programBinaryMagic, sizeof(header.m_magic)) ||
+		header.m_version != c_programBinaryVersion ||
+		(unsigned long long)sizeof(header) + header.m_keySize + header.m_binarySize != file.Size() ||
+		header.m_keySize != m_key.length() ||
+		memcmp(key, m_key.c_str(), m_key.length()))
+	{
+		printf("Program binary cache %s is stale, building from source\n", m_fileName.c_str());
+		return NULL;
+	}
+
+	const unsigned char *binary = file.Data() + sizeof(header) + header.m_keySize;
+	size_t binarySize = header.m_binarySize;
+	cl_int binaryStatus = CL_INVALID_BINARY;
+	cl_int ciErrNum;
+	cl_program program = clCreateProgramWithBinary(context, 1, &m_device, &binarySize, &binary, &binaryStatus, &ciErrNum);
+	if (ciErrNum == CL_SUCCESS && binaryStatus == CL_SUCCESS)
+		ciErrNum = clBuildProgram(program, 1, &m_device, m_buildOptions.c_str(), NULL, NULL);
+
+	if (ciErrNum != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+	{
+		printf("The driver didn't accept program binary %s (%i), building from source\n", m_fileName.c_str(), ciErrNum != CL_SUCCESS ? ciErrNum : binaryStatus);
+		if (program)
+			clReleaseProgram(program);
+		return NULL;
+	}
+
+	printf("Loaded program binary %s\n", m_fileName.c_str());
+	return program;
+}
+
+//-----------------------------------------------------------------------------
+void CProgramBinaryCache::Save (cl_program program) const
+{
+	char *binary = NULL;
+	size_t binarySize = 0;
+	oclGetProgBinary(program, m_device, &binary, &binarySize);
+	if (!binary || binarySize == 0)
+	{
+		free(binary);
+		return;
+	}
+
+	SProgramBinaryHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, c_programBinaryMagic, sizeof(header.m_magic));
+	header.m_version = c_programBinaryVersion;
+	header.m_keySize = (cl_uint)m_key.length();
+	header.m_binarySize = (cl_uint)binarySize;
+
+	bool success = false;
+	FILE *file = fopen(m_fileName.c_str(), "wb");
+	if (file)
+	{
+		success = fwrite(&header, sizeof(header), 1, file) == 1;
+		success = success && fwrite(m_key.c_str(), m_key.length(), 1, file) == 1;
+		success = success && fwrite(binary, binarySize, 1, file) == 1;
+		success = fclose(file) == 0 && success;
+
+		// don't leave a partial file behind for the next run to trip over
+		if (!success)
+			remove(m_fileName.c_str());
+	}
+
+	if (!success)
+		printf("Could not write program binary %s\n", m_fileName.c_str());
+
+	free(binary);
+}
@@ -0,0 +1,40 @@
+/*==================================================================================================
+
+CProgramBinaryCache.h
+
+Keeps the binaries of built OpenCL programs on disk, so the kernel only gets compiled from source
+when it, the headers it includes, the build options or the device driver have changed.
+
+The cache file for a build is the source file name plus a hash of everything the build depends on,
+so each combination of graphics settings gets it's own file.  The file also holds the full key, which
+is checked when loading in case two keys hash the same.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "oclUtils.h"
+#include <string>
+
+class CProgramBinaryCache
+{
+public:
+	// works out the key and cache file for building sourceFileName with buildOptions for device.
+	// includeDir is where #includes that aren't next to the including file are looked for.
+	CProgramBinaryCache (const char *sourceFileName, const char *includeDir, const std::string &buildOptions, cl_device_id device);
+
+	// creates and builds the program from the cached binary.  Returns NULL if there isn't a cached binary
+	// for this key, or if the driver won't take it, in which case the program should be built from source.
+	cl_program Load (cl_context context) const;
+
+	// writes the binary of the program, which must have been built from source with the same options, to the cache
+	void Save (cl_program program) const;
+
+	const std::string &FileName () const { return m_fileName; }
+
+private:
+	cl_device_id	m_device;
+	std::string		m_buildOptions;
+	std::string		m_key;
+	std::string		m_fileName;
+};
@@ -0,0 +1,186 @@
+/*==================================================================================================
+
+CQualityGovernor.cpp
+
+Holds the gpu time per frame near the TargetFrameTime graphics setting when DynamicQuality is on.
+The time comes from OpenCL profiling events around each frame's kernels, read back a frame or more
+later so it never waits on the gpu.  When frames are over budget the resolution is scaled down
+first, then the ray bounces are cut.  When there's time to spare they come back in the reverse order.
+
+==================================================================================================*/
+
+#include "CQualityGovernor.h"
+
+#include <math.h>
+
+// frames measured at the current quality before it's changed again
+static const unsigned int c_framesPerChange = 4;
+
+// how much of each new frame's time goes into the average
+static const float c_frameTimeSmoothing = 0.25f;
+
+// the quality is only raised when frames take less than this fraction of the target, so it doesn't
+// go back and forth between two levels
+static const float c_raiseThreshold = 0.85f;
+
+// the most the resolution scale changes by in one step
+static const float c_minScaleStep = 0.8f;
+static const float c_maxScaleStep = 1.1f;
+
+// frames are dropped unmeasured if the gpu gets this far behind
+static const unsigned int c_maxPendingFrames = 8;
+
+//-----------------------------------------------------------------------------
+CQualityGovernor::CQualityGovernor ()
+	: m_resolutionScale(1.0f)
+	, m_rayBounces(0)
+	, m_frameTime(0.0f)
+	, m_framesMeasured(0)
+	, m_qualityChanges(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+void CQualityGovernor::Release ()
+{
+	for (unsigned int index = 0, count = m_pendingFrames.size(); index < count; ++index)
+		ReleaseFrame(m_pendingFrames[index]);
+	m_pendingFrames.clear();
+}
+
+//-----------------------------------------------------------------------------
+void CQualityGovernor::ReleaseFrame (const SPendingFrame &frame)
+{
+	if (frame.m_firstEvent != frame.m_lastEvent)
+		clReleaseEvent(frame.m_firstEvent);
+	clReleaseEvent(frame.m_lastEvent);
+}
+
+//-----------------------------------------------------------------------------
+void CQualityGovernor::AddFrame (cl_event firstEvent, cl_event lastEvent)
+{
+	if (m_pendingFrames.size() >= c_maxPendingFrames)
+	{
+		ReleaseFrame(m_pendingFrames.front());
+		m_pendingFrames.pop_front();
+	}
+
+	SPendingFrame frame;
+	frame.m_firstEvent = firstEvent;
+	frame.m_lastEvent = lastEvent;
+	frame.m_qualityChange = m_qualityChanges;
+	m_pendingFrames.push_back(frame);
+}
+
+//-----------------------------------------------------------------------------
+void CQualityGovernor::Update (const SData_GfxSettings &settings, unsigned int maxRayBounces)
+{
+	// measure the frames the gpu has finished, oldest first since the queue runs in order
+	while (!m_pendingFrames.empty())
+	{
+		const SPendingFrame &frame = m_pendingFrames.front();
+
+		cl_int status = CL_QUEUED;
+		clGetEventInfo(frame.m_lastEvent, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+		if (status > CL_COMPLETE)
+			break;
+
+		// frames rendered before the last change in quality would throw off the average
+		cl_ulong start = 0;
+		cl_ulong end = 0;
+		if (status == CL_COMPLETE &&
+			frame.m_qualityChange == m_qualityChanges &&
+			clGetEventProfilingInfo(frame.m_firstEvent, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) == CL_SUCCESS &&
+			clGetEventProfilingInfo(frame.m_lastEvent, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) == CL_SUCCESS &&
+			end > start)
+		{
+			const float frameTime = (float)(end - start) / 1000000.0f;
+			m_frameTime = m_framesMeasured == 0 ? frameTime : m_frameTime + (frameTime - m_frameTime) * c_frameTimeSmoothing;
+			m_framesMeasured++;
+		}
+
+		ReleaseFrame(frame);
+		m_pendingFrames.pop_front();
+	}
+
+	if (!settings.m_DynamicQuality)
+	{
+		m_resolutionScale = 1.0f;
+		m_rayBounces = maxRayBounces;
+		return;
+	}
+
+	// the settings, or the kernel, may have changed since the last update
+	const unsigned int minRayBounces = settings.m_MinRayBounces < maxRayBounces ? settings.m_MinRayBounces : maxRayBounces;
+	if (m_rayBounces > maxRayBounces || m_rayBounces == 0)
+		m_rayBounces = maxRayBounces;
+	if (m_rayBounces < minRayBounces)
+		m_rayBounces = minRayBounces;
+	if (m_resolutionScale < settings.m_MinResolutionScale)
+		m_resolutionScale = settings.m_MinResolutionScale;
+
+	if (m_framesMeasured < c_framesPerChange)
+		return;
+
+	bool changed = false;
+	if (m_frameTime > settings.m_TargetFrameTime)
+		changed = Lower(settings);
+	else if (m_frameTime < settings.m_TargetFrameTime * c_raiseThreshold)
+		changed = Raise(settings, maxRayBounces);
+
+	if (changed)
+	{
+		m_qualityChanges++;
+		m_framesMeasured = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+bool CQualityGovernor::Lower (const SData_GfxSettings &settings)
+{
+	if (m_resolutionScale > settings.m_MinResolutionScale)
+	{
+		// the time goes with the number of pixels, so scale each direction by the square root
+		float step = sqrtf(settings.m_TargetFrameTime / m_frameTime);
+		if (step < c_minScaleStep)
+			step = c_minScaleStep;
+
+		m_resolutionScale *= step;
+		if (m_resolutionScale < settings.m_MinResolutionScale)
+			m_resolutionScale = settings.m_MinResolutionScale;
+		return true;
+	}
+
+	if (m_rayBounces > settings.m_MinRayBounces)
+	{
+		m_rayBounces--;
+		return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+bool CQualityGovernor::Raise (const SData_GfxSettings &settings, unsigned int maxRayBounces)
+{
+	if (m_rayBounces < maxRayBounces)
+	{
+		m_rayBounces++;
+		return true;
+	}
+
+	if (m_resolutionScale < 1.0f)
+	{
+		// aim for the raise threshold rather than the target, so the next frames don't go over it
+		float step = sqrtf(settings.m_TargetFrameTime * c_raiseThreshold / m_frameTime);
+		if (step > c_maxScaleStep)
+			step = c_maxScaleStep;
+
+		m_resolutionScale *= step;
+		if (m_resolutionScale > 1.0f)
+			m_resolutionScale = 1.0f;
+		return true;
+	}
+
+	return false;
+}
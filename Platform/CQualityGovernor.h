@@ -0,0 +1,71 @@
+/*==================================================================================================
+
+CQualityGovernor.h
+
+Holds the gpu time per frame near the TargetFrameTime graphics setting when DynamicQuality is on.
+The time comes from OpenCL profiling events around each frame's kernels, read back a frame or more
+later so it never waits on the gpu.  When frames are over budget the resolution is scaled down
+first, then the ray bounces are cut.  When there's time to spare they come back in the reverse order.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "oclUtils.h"
+#include "DataSchemas/DataSchemasStructs.h"
+
+#include <deque>
+
+class CQualityGovernor
+{
+public:
+	CQualityGovernor ();
+
+	~CQualityGovernor ()
+	{
+		Release();
+	}
+
+	// releases the events of the frames that haven't been measured yet
+	void Release ();
+
+	// hands over the events of the first and last kernels of a frame, which need to have come from a
+	// queue with profiling enabled.  They may be the same event.  The governor releases them.
+	void AddFrame (cl_event firstEvent, cl_event lastEvent);
+
+	// measures the frames that the gpu has finished and changes the quality if they need it.
+	// maxRayBounces is the most bounces the kernel was built for.
+	void Update (const SData_GfxSettings &settings, unsigned int maxRayBounces);
+
+	// the fraction of the full resolution to render at, in both directions
+	float ResolutionScale () const { return m_resolutionScale; }
+
+	unsigned int RayBounces () const { return m_rayBounces; }
+
+	// the average gpu time of the last few frames, in milliseconds
+	float FrameTime () const { return m_frameTime; }
+
+private:
+	struct SPendingFrame
+	{
+		cl_event		m_firstEvent;
+		cl_event		m_lastEvent;
+		unsigned int	m_qualityChange;	// m_qualityChanges when the frame was rendered
+	};
+
+	static void ReleaseFrame (const SPendingFrame &frame);
+
+	// turns the quality down or up a step.  Returns false if it's already as low or high as it goes.
+	bool Lower (const SData_GfxSettings &settings);
+	bool Raise (const SData_GfxSettings &settings, unsigned int maxRayBounces);
+
+	std::deque<SPendingFrame>	m_pendingFrames;
+
+	float						m_resolutionScale;
+	unsigned int				m_rayBounces;
+
+	// the frame time only averages frames rendered since the last change in quality
+	float						m_frameTime;
+	unsigned int				m_framesMeasured;
+	unsigned int				m_qualityChanges;
+};
@@ -0,0 +1,79 @@
+/*==================================================================================================
+
+CTemporalHistory.cpp
+
+The buffers temporal reprojection reads last frame's pixels from and writes this frame's to.  Each
+pixel is a float4 of the color and the distance to the first surface the camera ray hit, or a negative
+distance if it can't be reused.  There are two buffers, swapped each frame.
+
+==================================================================================================*/
+
+#include "CTemporalHistory.h"
+
+//-----------------------------------------------------------------------------
+CTemporalHistory::CTemporalHistory ()
+	: m_current(0)
+	, m_width(0)
+	, m_height(0)
+	, m_valid(false)
+	, m_written(false)
+{
+	m_buffers[0] = NULL;
+	m_buffers[1] = NULL;
+}
+
+//-----------------------------------------------------------------------------
+void CTemporalHistory::Release ()
+{
+	for (int index = 0; index < 2; ++index)
+	{
+		if (m_buffers[index])
+			clReleaseMemObject(m_buffers[index]);
+		m_buffers[index] = NULL;
+	}
+
+	m_width = 0;
+	m_height = 0;
+	m_valid = false;
+	m_written = false;
+}
+
+//-----------------------------------------------------------------------------
+void CTemporalHistory::BeginFrame (cl_context context, unsigned int width, unsigned int height, bool enabled)
+{
+	if (!enabled)
+	{
+		// free the memory rather than keep it around for a setting that's usually off
+		Release();
+		return;
+	}
+
+	if (!m_buffers[0] || width != m_width || height != m_height)
+	{
+		Release();
+
+		cl_int ciErrNum;
+		const size_t size = (size_t)width * height * sizeof(cl_float4);
+		for (int index = 0; index < 2; ++index)
+		{
+			m_buffers[index] = clCreateBuffer(context, CL_MEM_READ_WRITE, size, NULL, &ciErrNum);
+			oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+		}
+
+		m_width = width;
+		m_height = height;
+	}
+
+	m_written = true;
+}
+
+//-----------------------------------------------------------------------------
+void CTemporalHistory::EndFrame ()
+{
+	if (!m_written)
+		return;
+
+	m_current ^= 1;
+	m_valid = true;
+	m_written = false;
+}
@@ -0,0 +1,51 @@
+/*==================================================================================================
+
+CTemporalHistory.h
+
+The buffers temporal reprojection reads last frame's pixels from and writes this frame's to.  Each
+pixel is a float4 of the color and the distance to the first surface the camera ray hit, or a negative
+distance if it can't be reused.  There are two buffers, swapped each frame.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "oclUtils.h"
+
+class CTemporalHistory
+{
+public:
+	CTemporalHistory ();
+
+	~CTemporalHistory ()
+	{
+		Release();
+	}
+
+	void Release ();
+
+	// makes sure the buffers are there and width x height.  If they had to be made, or enabled is false,
+	// there's no history to read this frame.
+	void BeginFrame (cl_context context, unsigned int width, unsigned int height, bool enabled);
+
+	// swaps the buffers, so what was written this frame is read next frame
+	void EndFrame ();
+
+	// drops the history, for when last frame's pixels don't line up with this frame's any more
+	void Invalidate () { m_valid = false; }
+
+	// whether the buffer HistoryIn() returns holds last frame
+	bool IsValid () const { return m_valid; }
+
+	// NULL while temporal reprojection is off
+	cl_mem HistoryIn () const { return m_buffers[m_current ^ 1]; }
+	cl_mem HistoryOut () const { return m_buffers[m_current]; }
+
+private:
+	cl_mem			m_buffers[2];
+	unsigned int	m_current;		// the one written this frame
+	unsigned int	m_width;
+	unsigned int	m_height;
+	bool			m_valid;
+	bool			m_written;		// whether the kernel wrote HistoryOut() this frame
+};
@@ -4,171 +4,478 @@ CTextureManager.cpp
 
 Holds loaded textures and allows for passing them to the kernel code
 
+The textures are packed into one 8 bit RGBA atlas, each at it's own size (up to the TextureSize graphics
+setting) and with a mip chain.  Materials refer to textures by their index in the atlas, see
+KernelCode/Shared/STextureAtlas.h.
+
+Files are only read when a texture is asked for.  Decoding them, making the mips and sending them to
+opencl all happens in FinalizeTextures(), spread across every core, with each texture's upload
+starting as soon as it's ready while the rest are still decoding.  Headless, the atlas is put together
+in memory instead, for the cpu renderer to sample.
+
 ==================================================================================================*/
 
-#include "CDirectx.h"
 #include "CTextureManager.h"
+#include "CImageDecoder.h"
+#include "CJobSystem.h"
+#include "OS.h"
+#include "DataSchemas/DataSchemasStructs.h"
+
+#include <algorithm>
+
+// SSE2 is always there on x64, and the compiler targets it on x86
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTURE_MANAGER_SSE2 1
+#else
+#define TEXTURE_MANAGER_SSE2 0
+#endif
+
+// the largest atlas when headless, where there's no opencl device to ask
+static const unsigned int c_hostAtlasMaxSize = 16384;
+
+//-----------------------------------------------------------------------------
+static unsigned int MipCount (unsigned int width, unsigned int height)
+{
+	// down to 1x1, the same as SampleTexture() in clrt.cl
+	unsigned int count = 1;
+	for (unsigned int size = width > height ? width : height; size > 1; size >>= 1)
+		count++;
+	return count;
+}
+
+//-----------------------------------------------------------------------------
+static unsigned int MipWidth (unsigned int width, unsigned int level)
+{
+	return (width >> level) > 0 ? width >> level : 1;
+}
+
+//-----------------------------------------------------------------------------
+// the size of the texture's space in the atlas, with the mips in a column to the right of mip 0
+static void AtlasBlockSize (unsigned int width, unsigned int height, unsigned int &blockWidth, unsigned int &blockHeight)
+{
+	const unsigned int mipCount = MipCount(width, height);
+
+	unsigned int columnHeight = 0;
+	for (unsigned int level = 1; level < mipCount; ++level)
+		columnHeight += MipWidth(height, level);
+
+	blockWidth = width + (mipCount > 1 ? MipWidth(width, 1) : 0);
+	blockHeight = height > columnHeight ? height : columnHeight;
+}
+
+//-----------------------------------------------------------------------------
+// averages each 2x2 block of an RGBA image with even width and height
+static void HalveImageEven (const unsigned char *source, unsigned int width, unsigned int height, unsigned char *dest)
+{
+	const unsigned int destWidth = width / 2;
+	const unsigned int destHeight = height / 2;
+	for (unsigned int destY = 0; destY < destHeight; ++destY)
+	{
+		const unsigned char *top = &source[destY * 2 * width * 4];
+		const unsigned char *bottom = top + width * 4;
+		unsigned char *destRow = &dest[destY * destWidth * 4];
+
+		unsigned int destX = 0;
+#if TEXTURE_MANAGER_SSE2
+		// four texels from each row make two texels, with each channel summed in 16 bits
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rounding = _mm_set1_epi16(2);
+		for (; destX + 2 <= destWidth; destX += 2)
+		{
+			const __m128i topTexels = _mm_loadu_si128((const __m128i *)&top[destX * 8]);
+			const __m128i bottomTexels = _mm_loadu_si128((const __m128i *)&bottom[destX * 8]);
+			const __m128i columns01 = _mm_add_epi16(_mm_unpacklo_epi8(topTexels, zero), _mm_unpacklo_epi8(bottomTexels, zero));
+			const __m128i columns23 = _mm_add_epi16(_mm_unpackhi_epi8(topTexels, zero), _mm_unpackhi_epi8(bottomTexels, zero));
+			__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(columns01, columns23), _mm_unpackhi_epi64(columns01, columns23));
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+			_mm_storel_epi64((__m128i *)&destRow[destX * 4], _mm_packus_epi16(sum, zero));
+		}
+#endif
+		for (; destX < destWidth; ++destX)
+		{
+			const unsigned char *topTexel = &top[destX * 8];
+			const unsigned char *bottomTexel = &bottom[destX * 8];
+			for (unsigned int channel = 0; channel < 4; ++channel)
+				destRow[destX * 4 + channel] = (unsigned char)((topTexel[channel] + topTexel[channel + 4] + bottomTexel[channel] + bottomTexel[channel + 4] + 2) / 4);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// box filters an RGBA image down to half it's size.  Odd rows and columns out are folded into the last texel.
+static void HalveImage (const unsigned char *source, unsigned int width, unsigned int height, unsigned char *dest)
+{
+	if ((width & 1) == 0 && (height & 1) == 0)
+	{
+		HalveImageEven(source, width, height, dest);
+		return;
+	}
+
+	const unsigned int destWidth = MipWidth(width, 1);
+	const unsigned int destHeight = MipWidth(height, 1);
+	for (unsigned int destY = 0; destY < destHeight; ++destY)
+	{
+		const unsigned int y0 = destY * height / destHeight;
+		const unsigned int y1 = (destY + 1) * height / destHeight;
+		for (unsigned int destX = 0; destX < destWidth; ++destX)
+		{
+			const unsigned int x0 = destX * width / destWidth;
+			const unsigned int x1 = (destX + 1) * width / destWidth;
+
+			unsigned int sum[4] = { 0, 0, 0, 0 };
+			for (unsigned int y = y0; y < y1; ++y)
+			{
+				for (unsigned int x = x0; x < x1; ++x)
+				{
+					const unsigned char *texel = &source[(y * width + x) * 4];
+					for (unsigned int channel = 0; channel < 4; ++channel)
+						sum[channel] += texel[channel];
+				}
+			}
+
+			const unsigned int count = (y1 - y0) * (x1 - x0);
+			unsigned char *destTexel = &dest[(destY * destWidth + destX) * 4];
+			for (unsigned int channel = 0; channel < 4; ++channel)
+				destTexel[channel] = (unsigned char)((sum[channel] + count / 2) / count);
+		}
+	}
+}
 
 //-----------------------------------------------------------------------------
-void CTextureManager::Init ()
+void CTextureManager::Init (const SData_GfxSettings &settings, cl_context context, cl_command_queue commandQueue)
 {
-	m_textureSize = CDirectX::Settings().m_TextureSize;
+	m_context = context;
+	m_commandQueue = commandQueue;
+
+	m_maxTextureSize = settings.m_TextureSize;
+	if (m_maxTextureSize < 1)
+		m_maxTextureSize = 1;
 }
 
 //-----------------------------------------------------------------------------
-unsigned int CTextureManager::GetOrLoad (const char *fileName)
+void CTextureManager::Release ()
 {
-	for (unsigned int index = 0; index < m_numTextures; ++index)
+	m_textures.clear();
+	m_hostAtlas.clear();
+	m_atlasTextures.clear();
+	m_atlasWidth = 0;
+	m_atlasHeight = 0;
+
+	if (m_clAtlas)
 	{
-		if (!stricmp(fileName, m_textures[index].m_fileName.c_str()))
-			return index + 1;
+		clReleaseMemObject(m_clAtlas);
+		m_clAtlas = NULL;
 	}
 
-	Assert_(m_numTextures < c_maxTextures);
+	if (m_clAtlasTextures)
+	{
+		clReleaseMemObject(m_clAtlasTextures);
+		m_clAtlasTextures = NULL;
+	}
+}
+
+//-----------------------------------------------------------------------------
+int CTextureManager::GetOrLoad (const char *fileName)
+{
+	for (unsigned int index = 0, count = m_textures.size(); index < count; ++index)
+	{
+		if (!OS::StringCompareNoCase(fileName, m_textures[index].m_fileName.c_str()))
+			return index;
+	}
 
-	if (LoadTexture(fileName, &m_textures[m_numTextures].pTexture, m_textures[m_numTextures].clTexture))
+	m_textures.push_back(STexture());
+	if (!ReadTexture(fileName, m_textures.back()))
 	{
-		m_textures[m_numTextures].m_fileName = fileName;
-		m_numTextures++;
-		return m_numTextures;
+		printf("Could not load texture %s\n", fileName);
+		m_textures.pop_back();
+		return -1;
 	}
 
-	return 0;
+	m_textures.back().m_fileName = fileName;
+	return m_textures.size() - 1;
 }
 
 //-----------------------------------------------------------------------------
 void CTextureManager::FinalizeTextures ()
 {
-	// create the 3d texture
-	cl_image_format imageFormat;
-	imageFormat.image_channel_order = CL_RGBA;
-	imageFormat.image_channel_data_type = CL_FLOAT;
+	size_t maxWidth = c_hostAtlasMaxSize;
+	size_t maxHeight = c_hostAtlasMaxSize;
+	if (!m_headless)
+	{
+		cl_device_id device;
+		clGetContextInfo(m_context, CL_CONTEXT_DEVICES, sizeof(device), &device, NULL);
+		clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_WIDTH, sizeof(maxWidth), &maxWidth, NULL);
+		clGetDeviceInfo(device, CL_DEVICE_IMAGE2D_MAX_HEIGHT, sizeof(maxHeight), &maxHeight, NULL);
+	}
 
+	unsigned int atlasWidth = 1;
+	unsigned int atlasHeight = 1;
+	if (!PackAtlas((unsigned int)maxWidth, (unsigned int)maxHeight, atlasWidth, atlasHeight))
+	{
+		printf("The textures don't fit in a %ux%u texture atlas.  Make TextureSize in gfxsettings.xml smaller.\n", (unsigned int)maxWidth, (unsigned int)maxHeight);
+		Assert_(false);
+		return;
+	}
+	m_atlasWidth = atlasWidth;
+	m_atlasHeight = atlasHeight;
+
+	// create the atlas
 	int ciErrNum = 0;
-	m_clTexture3d = clCreateImage3D(
-		CDirectX::Get().m_cxGPUContext,
-		CL_MEM_READ_ONLY,
-		&imageFormat,
-		m_textureSize,
-		m_textureSize,
-		m_numTextures > 1 ? m_numTextures : 2, // depth - need at least 2 textures
-		0, // row pitch
-		0, // slice pitch
-		NULL,
-		&ciErrNum);
-	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	if (m_headless)
+	{
+		m_hostAtlas.assign((size_t)atlasWidth * atlasHeight * 4, 0);
+	}
+	else
+	{
+		cl_image_format imageFormat;
+		imageFormat.image_channel_order = CL_RGBA;
+		imageFormat.image_channel_data_type = CL_UNORM_INT8;
 
-	for (unsigned int index = 0; index < m_numTextures; ++index)
-		MoveTextureToCL(index);
+		m_clAtlas = clCreateImage2D(
+			m_context,
+			CL_MEM_READ_ONLY,
+			&imageFormat,
+			atlasWidth,
+			atlasHeight,
+			0, // row pitch
+			NULL,
+			&ciErrNum);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	}
+
+	// decode every texture and start it's upload as soon as it's done, on every core.  The writes don't
+	// wait, so the gpu is copying textures while the later ones are still decoding.
+	{
+		CJobSystem jobSystem;
+		jobSystem.ParallelFor(m_textures.size(), [this] (unsigned int index) {
+			DecodeTexture(m_textures[index]);
+			if (m_headless)
+				CopyTextureToHostAtlas(m_textures[index]);
+			else
+				UploadTexture(m_textures[index]);
+		});
+	}
+
+	// the pixels have to stay around until the writes are done
+	if (!m_headless)
+	{
+		ciErrNum = clFinish(m_commandQueue);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	}
+
+	m_atlasTextures.clear();
+	for (unsigned int index = 0, count = m_textures.size(); index < count; ++index)
+	{
+		STexture &texture = m_textures[index];
+		m_atlasTextures.push_back(texture.m_atlas);
+
+		// the atlas has it now
+		std::vector<unsigned char>().swap(texture.m_pixels);
+	}
+
+	// the kernel needs a buffer even when there are no textures
+	if (m_atlasTextures.empty())
+	{
+		SAtlasTexture empty = { 0, 0, 1, 1 };
+		m_atlasTextures.push_back(empty);
+	}
 
+	if (!m_headless)
+	{
+		m_clAtlasTextures = clCreateBuffer(
+			m_context,
+			CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			m_atlasTextures.size() * sizeof(SAtlasTexture),
+			&m_atlasTextures[0],
+			&ciErrNum);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	}
+
+	printf("Texture atlas is %ux%u for %u textures\n", atlasWidth, atlasHeight, (unsigned int)m_textures.size());
+}
+
+//-----------------------------------------------------------------------------
+void CTextureManager::ReadBackAtlas ()
+{
+	if (m_headless || !m_clAtlas)
+		return;
+
+	m_hostAtlas.resize((size_t)m_atlasWidth * m_atlasHeight * 4);
+	const size_t origin[3] = { 0, 0, 0 };
+	const size_t region[3] = { m_atlasWidth, m_atlasHeight, 1 };
+	int ciErrNum = clEnqueueReadImage(m_commandQueue, m_clAtlas, CL_TRUE, origin, region, 0, 0, &m_hostAtlas[0], 0, NULL, NULL);
+	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
 }
 
 //-----------------------------------------------------------------------------
-void CTextureManager::MoveTextureToCL (int index)
+bool CTextureManager::PackAtlas (unsigned int maxWidth, unsigned int maxHeight, unsigned int &atlasWidth, unsigned int &atlasHeight)
 {
-	// map the texture
-	STexture2D &texture = m_textures[index];
-	D3D10_TEXTURE2D_DESC desc;
-	texture.pTexture->GetDesc(&desc);
-	Assert_(desc.Width == desc.Height); // textures must be square
-	D3D10_MAPPED_TEXTURE2D mapped2dTexture;
-	HRESULT hr = texture.pTexture->Map(0, D3D10_MAP_READ, 0, &mapped2dTexture);
-	Assert_(!FAILED(hr));
-	
-	// make the image data so we can pass it to opencl
-	float *imageData = new float[m_textureSize * m_textureSize * 4];
-	float *destPixel = imageData;
-	for (unsigned int indexY = 0; indexY < m_textureSize; ++indexY)
-	{
-		float percentY = (float)indexY / (float)m_textureSize;
-		for (unsigned int indexX = 0; indexX < m_textureSize; ++indexX)
+	// place the tallest textures first, left to right in rows as tall as the first texture in them
+	std::vector<unsigned int> order;
+	unsigned int widestBlock = 1;
+	unsigned long long totalArea = 0;
+	for (unsigned int index = 0, count = m_textures.size(); index < count; ++index)
+	{
+		unsigned int blockWidth, blockHeight;
+		AtlasBlockSize(m_textures[index].m_width, m_textures[index].m_height, blockWidth, blockHeight);
+		widestBlock = blockWidth > widestBlock ? blockWidth : widestBlock;
+		totalArea += (unsigned long long)blockWidth * blockHeight;
+		order.push_back(index);
+	}
+
+	std::sort(order.begin(), order.end(), [this] (unsigned int a, unsigned int b) {
+		return m_textures[a].m_height > m_textures[b].m_height;
+	});
+
+	// start about square, and go wider if it comes out too tall
+	atlasWidth = 1;
+	while (atlasWidth < widestBlock || (unsigned long long)atlasWidth * atlasWidth < totalArea)
+		atlasWidth *= 2;
+
+	for (; atlasWidth <= maxWidth || atlasWidth == 1; atlasWidth *= 2)
+	{
+		unsigned int x = 0;
+		unsigned int y = 0;
+		unsigned int rowHeight = 0;
+		for (unsigned int index = 0, count = order.size(); index < count; ++index)
 		{
-			float percentX = (float)indexX / (float)m_textureSize;
-			SampleMappedPixelBilinear(mapped2dTexture, destPixel, percentX, percentY, desc.Width, desc.Height);
-			destPixel += 4;
+			STexture &texture = m_textures[order[index]];
+			unsigned int blockWidth, blockHeight;
+			AtlasBlockSize(texture.m_width, texture.m_height, blockWidth, blockHeight);
+
+			if (x + blockWidth > atlasWidth)
+			{
+				x = 0;
+				y += rowHeight;
+				rowHeight = 0;
+			}
+
+			texture.m_atlas.m_x = x;
+			texture.m_atlas.m_y = y;
+			texture.m_atlas.m_width = texture.m_width;
+			texture.m_atlas.m_height = texture.m_height;
+
+			x += blockWidth;
+			rowHeight = blockHeight > rowHeight ? blockHeight : rowHeight;
 		}
+
+		atlasHeight = y + rowHeight > 1 ? y + rowHeight : 1;
+		if (atlasHeight <= maxHeight && atlasWidth <= maxWidth)
+			return true;
 	}
 
-	// unmap and release the texture
-	texture.pTexture->Unmap(0);
-	texture.Release();
-
-	// send the image data to opencl
-	const size_t origin[3] = {0, 0, index};
-	const size_t region[3] = {m_textureSize, m_textureSize, 1};
-
-	int ciErrNum = clEnqueueWriteImage(
-		CDirectX::Get().m_cqCommandQueue,
-		m_clTexture3d,
-		true,
-		origin,
-		region,
-		0,
-		0,
-		imageData,
-		0,
-		0,
-		0);
-	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	return false;
+}
 
-	// free the image data
-	delete[] imageData;
+//-----------------------------------------------------------------------------
+bool CTextureManager::ReadTexture (const char *fileName, STexture &texture)
+{
+	unsigned int width, height;
+	if (!CImageDecoder::LoadFile(fileName, texture.m_fileData) ||
+		!CImageDecoder::GetSize(&texture.m_fileData[0], texture.m_fileData.size(), width, height))
+		return false;
+
+	// the size it'll be once it's halved enough to fit in TextureSize, which the atlas is packed for
+	// before it's decoded
+	while (width > m_maxTextureSize || height > m_maxTextureSize)
+	{
+		width = MipWidth(width, 1);
+		height = MipWidth(height, 1);
+	}
+
+	texture.m_width = width;
+	texture.m_height = height;
+	return true;
 }
 
 //-----------------------------------------------------------------------------
-void CTextureManager::SampleMappedPixelBilinear(
-	D3D10_MAPPED_TEXTURE2D& mapped2dTexture,
-	float *destPixel,
-	float percentX,
-	float percentY,
-	unsigned int width,
-	unsigned int height)
+void CTextureManager::DecodeTexture (STexture &texture)
 {
-	// calculate our texel coordinates
-	float srcCoordX = percentX * (float)width;
-	float srcCoordY = percentY * (float)height;
-
-	// get pointers to the 4 texels we are sampling
-	unsigned char *pUL = ((unsigned char *)mapped2dTexture.pData + (int)srcCoordY * mapped2dTexture.RowPitch) + (int)srcCoordX * 4;
-	unsigned char *pUR = pUL + 4;
-	unsigned char *pBL = pUL + mapped2dTexture.RowPitch;
-	unsigned char *pBR = pBL + 4;
-
-	// calculate the weights for each texel
-	float fracx = srcCoordX - floorf(srcCoordX);
-	float fracy = srcCoordY - floorf(srcCoordY);
-	float wUL = (1.0f - fracx) * (1.0f - fracy);
-	float wUR = fracx * (1.0f - fracy);
-	float wBL = (1.0f - fracx) * fracy;
-	float wBR = fracx *  fracy;
-
-	//color = pUL * wUL + pUR * wUR + pBL * wBL + pBR * wBR
-	for (unsigned int index = 0; index < 4; ++index)
-	{
-		destPixel[index] =
-			((float)pUL[index]) / 256.0f * wUL +
-			((float)pUR[index]) / 256.0f * wUR +
-			((float)pBL[index]) / 256.0f * wBL +
-			((float)pBR[index]) / 256.0f * wBR;
+	std::vector<unsigned char> pixels;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	const bool decoded = CImageDecoder::Decode(&texture.m_fileData[0], texture.m_fileData.size(), pixels, width, height);
+	std::vector<unsigned char>().swap(texture.m_fileData);
+
+	// halve it until it fits in TextureSize
+	while (decoded && (width > texture.m_width || height > texture.m_height))
+	{
+		std::vector<unsigned char> halved(MipWidth(width, 1) * MipWidth(height, 1) * 4);
+		HalveImage(&pixels[0], width, height, &halved[0]);
+		pixels.swap(halved);
+		width = MipWidth(width, 1);
+		height = MipWidth(height, 1);
+	}
+
+	// the header was fine but the rest wasn't.  It already has it's place in the atlas, so fill it with white.
+	if (!decoded || width != texture.m_width || height != texture.m_height)
+	{
+		printf("Could not decode texture %s\n", texture.m_fileName.c_str());
+		pixels.assign(texture.m_width * texture.m_height * 4, 255);
+	}
+
+	// then add each mip level after it, made from the one before
+	size_t mipsSize = 0;
+	const unsigned int mipCount = MipCount(texture.m_width, texture.m_height);
+	for (unsigned int level = 0; level < mipCount; ++level)
+		mipsSize += MipWidth(texture.m_width, level) * MipWidth(texture.m_height, level) * 4;
+
+	texture.m_pixels.resize(mipsSize);
+	memcpy(&texture.m_pixels[0], &pixels[0], pixels.size());
+	size_t levelStart = 0;
+	for (unsigned int level = 1; level < mipCount; ++level)
+	{
+		const unsigned int levelWidth = MipWidth(texture.m_width, level - 1);
+		const unsigned int levelHeight = MipWidth(texture.m_height, level - 1);
+		const size_t nextStart = levelStart + levelWidth * levelHeight * 4;
+		HalveImage(&texture.m_pixels[levelStart], levelWidth, levelHeight, &texture.m_pixels[nextStart]);
+		levelStart = nextStart;
 	}
 }
 
 //-----------------------------------------------------------------------------
-bool CTextureManager::LoadTexture(const char *fileName, ID3D10Texture2D **d3dTexture, cl_mem & clTexture)
+void CTextureManager::UploadTexture (const STexture &texture)
 {
-	D3DX10_IMAGE_LOAD_INFO loadInfo;
-	loadInfo.Width = D3DX10_DEFAULT;  
-	loadInfo.Height = D3DX10_DEFAULT;
-	loadInfo.Depth = D3DX10_DEFAULT;
-	loadInfo.FirstMipLevel = D3DX10_DEFAULT;
-	loadInfo.MipLevels = D3DX10_DEFAULT;
-	loadInfo.Usage = D3D10_USAGE_STAGING;
-	loadInfo.BindFlags = 0;
-	loadInfo.CpuAccessFlags = D3D10_CPU_ACCESS_READ;
-	loadInfo.MiscFlags = D3DX10_DEFAULT;
-	loadInfo.Filter = D3DX10_FILTER_NONE;
-	loadInfo.MipFilter = D3DX10_FILTER_NONE;
-	loadInfo.pSrcInfo = NULL;
-	return !FAILED(D3DX10CreateTextureFromFile( CDirectX::Get().m_pd3dDevice, fileName, &loadInfo, NULL, (ID3D10Resource**)d3dTexture, NULL ));
+	// opencl calls other than clSetKernelArg() are safe from any thread, so the jobs can share the queue
+	const unsigned char *pixels = &texture.m_pixels[0];
+	size_t origin[3] = { (size_t)texture.m_atlas.m_x, (size_t)texture.m_atlas.m_y, 0 };
+	for (unsigned int level = 0, mipCount = MipCount(texture.m_width, texture.m_height); level < mipCount; ++level)
+	{
+		const size_t region[3] = { MipWidth(texture.m_width, level), MipWidth(texture.m_height, level), 1 };
+		int ciErrNum = clEnqueueWriteImage(m_commandQueue, m_clAtlas, false, origin, region, 0, 0, pixels, 0, NULL, NULL);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+		pixels += region[0] * region[1] * 4;
+
+		// mip 1 goes to the right of mip 0, and the rest below each other
+		if (level == 0)
+			origin[0] += region[0];
+		else
+			origin[1] += region[1];
+	}
 }
 
+//-----------------------------------------------------------------------------
+void CTextureManager::CopyTextureToHostAtlas (const STexture &texture)
+{
+	// each texture has it's own part of the atlas, so the jobs can all write to it at once
+	const unsigned char *pixels = &texture.m_pixels[0];
+	unsigned int originX = texture.m_atlas.m_x;
+	unsigned int originY = texture.m_atlas.m_y;
+	for (unsigned int level = 0, mipCount = MipCount(texture.m_width, texture.m_height); level < mipCount; ++level)
+	{
+		const unsigned int width = MipWidth(texture.m_width, level);
+		const unsigned int height = MipWidth(texture.m_height, level);
+		for (unsigned int y = 0; y < height; ++y)
+			memcpy(&m_hostAtlas[((size_t)(originY + y) * m_atlasWidth + originX) * 4], &pixels[(size_t)y * width * 4], width * 4);
+
+		pixels += width * height * 4;
+
+		// mip 1 goes to the right of mip 0, and the rest below each other
+		if (level == 0)
+			originX += width;
+		else
+			originY += height;
+	}
+}
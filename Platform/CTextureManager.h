@@ -4,26 +4,39 @@ CTextureManager.h
 
 Holds loaded textures and allows for passing them to the kernel code
 
-Note that texture indexes start at 1 and texture 0 is reserved for "no texture"
+The textures are packed into one 8 bit RGBA atlas, each at it's own size (up to the TextureSize graphics
+setting) and with a mip chain.  Materials refer to textures by their index in the atlas, see
+KernelCode/Shared/STextureAtlas.h.
+
+Files are only read when a texture is asked for.  Decoding them, making the mips and sending them to
+opencl all happens in FinalizeTextures(), spread across every core, with each texture's upload
+starting as soon as it's ready while the rest are still decoding.  Headless, the atlas is put together
+in memory instead, for the cpu renderer to sample.
 
 ==================================================================================================*/
 
 #pragma once
 
-#include "STexture2D.h"
+#include "oclUtils.h"
 #include "Platform/Assert.h"
+#include "KernelCode/Shared/STextureAtlas.h"
+
+#include <string>
+#include <vector>
 
 class CTextureManager
 {
 public:
-	static const unsigned int c_maxTextures = 16;
-
 	CTextureManager()
 	{
-		m_textureSize = 512;
-		m_numTextures = 0;
-		m_texture3d = NULL;
-		m_clTexture3d = NULL;
+		m_maxTextureSize = 512;
+		m_context = NULL;
+		m_commandQueue = NULL;
+		m_clAtlas = NULL;
+		m_clAtlasTextures = NULL;
+		m_atlasWidth = 0;
+		m_atlasHeight = 0;
+		m_headless = false;
 	}
 
 	~CTextureManager()
@@ -31,58 +44,81 @@ public:
 		Release();
 	}
 
-	void Init ();
+	// takes the texture size from the graphics settings.  The textures go to opencl through context and
+	// commandQueue, which can be NULL when headless.
+	void Init (const struct SData_GfxSettings &settings, cl_context context, cl_command_queue commandQueue);
 
-	void Release ()
-	{
-		for (unsigned int index = 0; index < c_maxTextures; ++index)
-			m_textures[index].Release();
-
-		m_numTextures = 0;
-
-		if(m_clTexture3d)
-		{
-			clReleaseMemObject(m_clTexture3d);
-			m_clTexture3d = NULL;
-		}
-
-		if (m_texture3d)
-		{
-			m_texture3d->Release();
-			m_texture3d = NULL;
-		}
-	}
+	// when headless, nothing is given to opencl, and the atlas is kept in memory instead.  Used when there
+	// is no opencl device, like when benchmarking on the cpu.
+	void SetHeadless (bool headless) { m_headless = headless; }
 
-	cl_mem GetCLTexture3d ()
-	{
-		return m_clTexture3d;
-	}
+	void Release ();
+
+	// the atlas image, and the buffer of SAtlasTexture saying where each texture is in it
+	cl_mem GetCLAtlas () { return m_clAtlas; }
+	cl_mem GetCLAtlasTextures () { return m_clAtlasTextures; }
+
+	unsigned int NumTextures () { return m_textures.size(); }
 
-	unsigned int NumTextures () { return m_numTextures; }
+	// the atlas in memory, RGBA with 8 bits a channel, and where each texture is in it.  NULL if it isn't
+	// in memory: it always is when headless, and otherwise only after ReadBackAtlas().
+	const unsigned char *GetHostAtlas () const { return m_hostAtlas.empty() ? NULL : &m_hostAtlas[0]; }
+	const SAtlasTexture *GetHostAtlasTextures () const { return m_hostAtlas.empty() ? NULL : &m_atlasTextures[0]; }
+	unsigned int AtlasWidth () const { return m_atlasWidth; }
+	unsigned int AtlasHeight () const { return m_atlasHeight; }
 
-	unsigned int GetOrLoad (const char *fileName);
+	// copies the atlas back from opencl into memory, so the cpu renderer can sample it too.  Waits for it.
+	void ReadBackAtlas ();
 
-	// this finalizes the textures for use in openck and frees the directx resources
+	// returns the index of the texture in the atlas, reading the file if it hasn't been, or -1 if it
+	// couldn't be read or isn't an image we can decode
+	int GetOrLoad (const char *fileName);
+
+	// decodes the textures, packs them into the atlas, gives it to opencl and frees the copies in memory.
+	// Headless, the atlas stays in memory.
 	void FinalizeTextures ();
 
 private:
-	void MoveTextureToCL (int index);
+	struct STexture
+	{
+		std::string					m_fileName;
+		std::vector<unsigned char>	m_fileData;		// the file, until it's decoded
+		unsigned int				m_width;		// the size it's stored at, which may be smaller than the file's
+		unsigned int				m_height;
+		std::vector<unsigned char>	m_pixels;		// each mip level in turn, RGBA
+		SAtlasTexture				m_atlas;
+	};
+
+	// reads the file and the image's size, but doesn't decode it
+	bool ReadTexture (const char *fileName, STexture &texture);
+
+	// decodes the file and makes the mips in m_pixels.  Safe to call for different textures at once.
+	void DecodeTexture (STexture &texture);
+
+	// starts copying the mips into the atlas without waiting for it to finish
+	void UploadTexture (const STexture &texture);
+
+	// copies the mips into the atlas in memory, the same way UploadTexture() does into opencl's
+	void CopyTextureToHostAtlas (const STexture &texture);
+
+	// lays the textures out in an atlas no bigger than maxWidth x maxHeight, setting their m_atlas.
+	// Returns false if they don't fit.
+	bool PackAtlas (unsigned int maxWidth, unsigned int maxHeight, unsigned int &atlasWidth, unsigned int &atlasHeight);
+
+	std::vector<STexture>	m_textures;
 
-	void SampleMappedPixelBilinear(
-		D3D10_MAPPED_TEXTURE2D& mapped2dTexture,
-		float *destPixel,
-		float percentX,
-		float percentY,
-		unsigned int width,
-		unsigned int height);
+	cl_context				m_context;
+	cl_command_queue		m_commandQueue;
 
-	bool LoadTexture(const char *fileName, ID3D10Texture2D **d3dTexture, cl_mem & clTexture);
+	cl_mem					m_clAtlas;
+	cl_mem					m_clAtlasTextures;
 
-	STexture2D		m_textures[c_maxTextures];
-	unsigned int	m_numTextures;
+	std::vector<unsigned char>	m_hostAtlas;
+	std::vector<SAtlasTexture>	m_atlasTextures;
+	unsigned int			m_atlasWidth;
+	unsigned int			m_atlasHeight;
 
-	ID3D10Texture3D *m_texture3d;
-	cl_mem			m_clTexture3d;
+	unsigned int			m_maxTextureSize;
 
-	unsigned int	m_textureSize;
-};
\ No newline at end of file
+	bool					m_headless;
+};
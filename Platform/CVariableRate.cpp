@@ -0,0 +1,122 @@
+/*==================================================================================================
+
+CVariableRate.cpp
+
+Runs the clrt_coarse kernel in clrt.cl when the VariableRate graphics setting is on.  It traces a ray
+through the corners of each tile of the screen, before the clrt kernel, which then only traces every
+pixel of the tiles whose corners saw different things and fills in the rest from the corners.
+
+==================================================================================================*/
+
+#include "CVariableRate.h"
+#include "KernelCode/Shared/SVariableRate.h"
+
+static const size_t c_sampleGroupSize = 8;
+
+//-----------------------------------------------------------------------------
+static void SetKernelArg (cl_kernel kernel, cl_uint &argNumber, size_t size, const void *value)
+{
+	cl_int ciErrNum = clSetKernelArg(kernel, argNumber++, size, value);
+	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+}
+
+//-----------------------------------------------------------------------------
+CVariableRate::CVariableRate ()
+	: m_coarseKernel(NULL)
+	, m_samples(NULL)
+	, m_numSamples(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+bool CVariableRate::Init (cl_program program)
+{
+	Release();
+
+	cl_int ciErrNum;
+	m_coarseKernel = clCreateKernel(program, "clrt_coarse", &ciErrNum);
+	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	return m_coarseKernel != NULL;
+}
+
+//-----------------------------------------------------------------------------
+void CVariableRate::Release ()
+{
+	if (m_coarseKernel)
+		clReleaseKernel(m_coarseKernel);
+	m_coarseKernel = NULL;
+
+	if (m_samples)
+		clReleaseMemObject(m_samples);
+	m_samples = NULL;
+	m_numSamples = 0;
+}
+
+//-----------------------------------------------------------------------------
+void CVariableRate::EnsureBuffer (cl_context context, unsigned int numSamples)
+{
+	// the buffer only grows, so the quality governor changing the resolution doesn't reallocate it
+	if (numSamples <= m_numSamples)
+		return;
+
+	if (m_samples)
+		clReleaseMemObject(m_samples);
+
+	cl_int ciErrNum;
+	m_samples = clCreateBuffer(context, CL_MEM_READ_WRITE, numSamples * sizeof(SVariableRateSample), NULL, &ciErrNum);
+	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	m_numSamples = numSamples;
+}
+
+//-----------------------------------------------------------------------------
+cl_mem CVariableRate::Render (
+	cl_context context,
+	cl_command_queue commandQueue,
+	cl_mem textureAtlas,
+	cl_mem atlasTextures,
+	cl_mem dataRoot,
+	const SWavefrontScene &scene,
+	unsigned int width,
+	unsigned int height,
+	unsigned int tileSize,
+	cl_event *event
+)
+{
+	// the same as the build options make SETTINGS_VARIABLERATETILE
+	if (tileSize < 2)
+		tileSize = 2;
+
+	// a corner at the top left of every tile, plus a row and column past the right and bottom edges.
+	// Has to match CoarseSampleDims() in clrt.cl.
+	const unsigned int samplesWide = (width + tileSize - 1) / tileSize + 1;
+	const unsigned int samplesHigh = (height + tileSize - 1) / tileSize + 1;
+	EnsureBuffer(context, samplesWide * samplesHigh);
+
+	cl_uint argNumber = 0;
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &textureAtlas);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &atlasTextures);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &dataRoot);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_pointLights);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_spheres);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_modelTriangles);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_modelTriangleShading);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_modelObjects);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_modelBVHNodes);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_modelInstanceBVHNodes);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_modelInstances);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_sectors);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_materials);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_portals);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &scene.m_shadowTexels);
+	SetKernelArg(m_coarseKernel, argNumber, sizeof(cl_mem), &m_samples);
+
+	size_t localWorkSize[2] = { c_sampleGroupSize, c_sampleGroupSize };
+	size_t globalWorkSize[2] = {
+		((samplesWide + c_sampleGroupSize - 1) / c_sampleGroupSize) * c_sampleGroupSize,
+		((samplesHigh + c_sampleGroupSize - 1) / c_sampleGroupSize) * c_sampleGroupSize
+	};
+	cl_int ciErrNum = clEnqueueNDRangeKernel(commandQueue, m_coarseKernel, 2, NULL, globalWorkSize, localWorkSize, 0, NULL, event);
+	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+	return m_samples;
+}
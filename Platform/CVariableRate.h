@@ -0,0 +1,55 @@
+/*==================================================================================================
+
+CVariableRate.h
+
+Runs the clrt_coarse kernel in clrt.cl when the VariableRate graphics setting is on.  It traces a ray
+through the corners of each tile of the screen, before the clrt kernel, which then only traces every
+pixel of the tiles whose corners saw different things and fills in the rest from the corners.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "oclUtils.h"
+#include "CWavefront.h"
+
+class CVariableRate
+{
+public:
+	CVariableRate ();
+
+	~CVariableRate ()
+	{
+		Release();
+	}
+
+	// creates the kernel.  program must be clrt.cl built with SETTINGS_VARIABLERATE=1
+	bool Init (cl_program program);
+
+	void Release ();
+
+	bool IsInitialized () const { return m_coarseKernel != NULL; }
+
+	// traces the tile corners for a frame of width x height pixels and returns the buffer they're in,
+	// to pass to the clrt kernel.  scene is the world buffers clrt takes, in the same order the wavefront
+	// kernels take them.  If event isn't NULL it gets the kernel's event, which the caller has to release.
+	cl_mem Render (
+		cl_context context,
+		cl_command_queue commandQueue,
+		cl_mem textureAtlas,
+	cl_mem atlasTextures,
+		cl_mem dataRoot,
+		const SWavefrontScene &scene,
+		unsigned int width,
+		unsigned int height,
+		unsigned int tileSize,
+		cl_event *event = NULL
+	);
+
+private:
+	void EnsureBuffer (cl_context context, unsigned int numSamples);
+
+	cl_kernel		m_coarseKernel;
+	cl_mem			m_samples;
+	unsigned int	m_numSamples;
+};
@@ -0,0 +1,328 @@
+/*==================================================================================================
+
+CWavefront.cpp
+
+Runs the wavefront path kernels in clrt.cl, an alternative to the clrt megakernel that splits
+rendering into a kernel per stage (generate, extend, shade, connect, resolve) with the rays kept in
+queues in global memory between them.  Used when the WavefrontPath graphics setting is on.
+
+==================================================================================================*/
+
+#include "CWavefront.h"
+
+#include <string.h>
+
+// work group sizes of the per pixel kernels and of the per ray kernels
+static const size_t c_pixelGroupSize = 16;
+static const size_t c_rayGroupSize = 64;
+
+// how many more passes than the rays needed last time to run, in case the view has changed since
+static const unsigned int c_extraPasses = 2;
+
+//-----------------------------------------------------------------------------
+static size_t RoundUp (size_t groupSize, size_t globalSize)
+{
+	return ((globalSize + groupSize - 1) / groupSize) * groupSize;
+}
+
+//-----------------------------------------------------------------------------
+static cl_kernel CreateKernel (cl_program program, const char *kernelEntryPoint)
+{
+	cl_int ciErrNum;
+	cl_kernel kernel = clCreateKernel(program, kernelEntryPoint, &ciErrNum);
+	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	return kernel;
+}
+
+//-----------------------------------------------------------------------------
+static void ReleaseKernel (cl_kernel &kernel)
+{
+	if (kernel)
+		clReleaseKernel(kernel);
+	kernel = NULL;
+}
+
+//-----------------------------------------------------------------------------
+static void ReleaseMem (cl_mem &mem)
+{
+	if (mem)
+		clReleaseMemObject(mem);
+	mem = NULL;
+}
+
+//-----------------------------------------------------------------------------
+static cl_mem CreateBuffer (cl_context context, size_t size)
+{
+	cl_int ciErrNum;
+	cl_mem mem = clCreateBuffer(context, CL_MEM_READ_WRITE, size, NULL, &ciErrNum);
+	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	return mem;
+}
+
+//-----------------------------------------------------------------------------
+static void SetKernelArg (cl_kernel kernel, cl_uint &argNumber, size_t size, const void *value)
+{
+	cl_int ciErrNum = clSetKernelArg(kernel, argNumber++, size, value);
+	oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+}
+
+//-----------------------------------------------------------------------------
+static void SetSceneKernelArgs (cl_kernel kernel, cl_uint &argNumber, const SWavefrontScene &scene)
+{
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_pointLights);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_spheres);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_modelTriangles);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_modelTriangleShading);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_modelObjects);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_modelBVHNodes);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_modelInstanceBVHNodes);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_modelInstances);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_sectors);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_materials);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_portals);
+	SetKernelArg(kernel, argNumber, sizeof(cl_mem), &scene.m_shadowTexels);
+}
+
+//-----------------------------------------------------------------------------
+CWavefront::CWavefront ()
+{
+	m_resetKernel = NULL;
+	m_generateKernel = NULL;
+	m_extendKernel = NULL;
+	m_shadeKernel = NULL;
+	m_connectKernel = NULL;
+	m_resolveKernel = NULL;
+
+	m_paths = NULL;
+	m_hits = NULL;
+	m_queues[0] = NULL;
+	m_queues[1] = NULL;
+	m_shadowRays = NULL;
+	m_queueCounts = NULL;
+	m_numPaths = 0;
+	m_passCount = -1;
+}
+
+//-----------------------------------------------------------------------------
+bool CWavefront::Init (cl_program program)
+{
+	Release();
+
+	m_resetKernel = CreateKernel(program, "wavefront_reset");
+	m_generateKernel = CreateKernel(program, "wavefront_generate");
+	m_extendKernel = CreateKernel(program, "wavefront_extend");
+	m_shadeKernel = CreateKernel(program, "wavefront_shade");
+	m_connectKernel = CreateKernel(program, "wavefront_connect");
+	m_resolveKernel = CreateKernel(program, "wavefront_resolve");
+
+	memset(&m_passStats.GetObject(), 0, sizeof(SWavefrontPassStats));
+
+	return m_resetKernel && m_generateKernel && m_extendKernel && m_shadeKernel && m_connectKernel && m_resolveKernel;
+}
+
+//-----------------------------------------------------------------------------
+void CWavefront::Release ()
+{
+	ReleaseKernel(m_resetKernel);
+	ReleaseKernel(m_generateKernel);
+	ReleaseKernel(m_extendKernel);
+	ReleaseKernel(m_shadeKernel);
+	ReleaseKernel(m_connectKernel);
+	ReleaseKernel(m_resolveKernel);
+
+	ReleaseBuffers();
+
+	m_passStats.Release();
+	m_passCount = -1;
+}
+
+//-----------------------------------------------------------------------------
+void CWavefront::ReleaseBuffers ()
+{
+	ReleaseMem(m_paths);
+	ReleaseMem(m_hits);
+	ReleaseMem(m_queues[0]);
+	ReleaseMem(m_queues[1]);
+	ReleaseMem(m_shadowRays);
+	ReleaseMem(m_queueCounts);
+	m_numPaths = 0;
+}
+
+//-----------------------------------------------------------------------------
+void CWavefront::EnsureBuffers (cl_context context, unsigned int numPaths)
+{
+	if (numPaths == m_numPaths)
+		return;
+
+	ReleaseBuffers();
+
+	// every path can be in a queue and make a shadow ray each bounce, but no more than that
+	m_paths = CreateBuffer(context, sizeof(SWavefrontPath) * numPaths);
+	m_hits = CreateBuffer(context, sizeof(SWavefrontHit) * numPaths);
+	m_queues[0] = CreateBuffer(context, sizeof(cl_uint) * numPaths);
+	m_queues[1] = CreateBuffer(context, sizeof(cl_uint) * numPaths);
+	m_shadowRays = CreateBuffer(context, sizeof(SWavefrontShadowRay) * numPaths);
+	m_queueCounts = CreateBuffer(context, sizeof(cl_uint) * e_wavefrontQueueCountCount);
+	m_numPaths = numPaths;
+}
+
+//-----------------------------------------------------------------------------
+void CWavefront::Render (
+	cl_context context,
+	cl_command_queue commandQueue,
+	cl_mem texOut,
+	cl_mem textureAtlas,
+	cl_mem atlasTextures,
+	cl_mem dataRoot,
+	cl_mem dataRootOut,
+	const SWavefrontScene &scene,
+	unsigned int width,
+	unsigned int height,
+	unsigned int eyes,
+	unsigned int maxRayBounces,
+	cl_event *firstEvent,
+	cl_event *lastEvent
+)
+{
+	const unsigned int numPaths = width * height * eyes;
+	EnsureBuffers(context, numPaths);
+
+	size_t pixelLocalWorkSize[2] = { c_pixelGroupSize, c_pixelGroupSize };
+	size_t pixelGlobalWorkSize[2] = { RoundUp(c_pixelGroupSize, width), RoundUp(c_pixelGroupSize, height) };
+
+	// every path can be in the queue, so each pass launches a work item per path
+	size_t rayLocalWorkSize = c_rayGroupSize;
+	size_t rayGlobalWorkSize = RoundUp(c_rayGroupSize, numPaths);
+	size_t resetWorkSize = 1;
+
+	// run as many passes as the rays needed in the latest frame the stats are back for, plus a few in case
+	// the view has changed since.  If rays were left over then, all the passes bounces and portal crossings
+	// allow are run again, until the stats say fewer will do.
+	const unsigned int maxPassCount = maxRayBounces + SPORTAL_MAXCROSSINGS;
+	SWavefrontPassStats passStats;
+	if (m_passStats.GetLatestRead(passStats))
+		m_passCount = passStats.m_passesWithRays > passStats.m_passesRun ? -1 : passStats.m_passesWithRays + c_extraPasses;
+	const unsigned int passCount = m_passCount < maxPassCount ? m_passCount : maxPassCount;
+
+	// clear the count of the first queue, which the camera rays go in, of the shadow rays and the pass stats
+	cl_int ciErrNum;
+	cl_uint queueCountIndex = e_wavefrontQueueCountExtend0;
+	cl_mem passStatsMem = m_passStats.GetAndWriteCLMem(context, commandQueue);
+	{
+		const cl_uint passArg = WAVEFRONT_RESET_FRAME;
+
+		cl_uint argNumber = 0;
+		SetKernelArg(m_resetKernel, argNumber, sizeof(cl_mem), &m_queueCounts);
+		SetKernelArg(m_resetKernel, argNumber, sizeof(cl_mem), &passStatsMem);
+		SetKernelArg(m_resetKernel, argNumber, sizeof(cl_uint), &queueCountIndex);
+		SetKernelArg(m_resetKernel, argNumber, sizeof(cl_uint), &passArg);
+
+		ciErrNum = clEnqueueNDRangeKernel(commandQueue, m_resetKernel, 1, NULL, &resetWorkSize, &resetWorkSize, 0, NULL, firstEvent);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	}
+
+	// make the camera rays
+	{
+		const cl_int widthArg = (cl_int)width;
+		const cl_int heightArg = (cl_int)height;
+
+		cl_uint argNumber = 0;
+		SetKernelArg(m_generateKernel, argNumber, sizeof(cl_mem), &dataRoot);
+		SetKernelArg(m_generateKernel, argNumber, sizeof(cl_mem), &m_paths);
+		SetKernelArg(m_generateKernel, argNumber, sizeof(cl_mem), &m_queues[0]);
+		SetKernelArg(m_generateKernel, argNumber, sizeof(cl_mem), &m_queueCounts);
+		SetKernelArg(m_generateKernel, argNumber, sizeof(cl_int), &widthArg);
+		SetKernelArg(m_generateKernel, argNumber, sizeof(cl_int), &heightArg);
+
+		ciErrNum = clEnqueueNDRangeKernel(commandQueue, m_generateKernel, 2, NULL, pixelGlobalWorkSize, pixelLocalWorkSize, 0, NULL, NULL);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	}
+
+	// the arguments that don't change between bounces
+	{
+		cl_uint argNumber = 0;
+		SetKernelArg(m_extendKernel, argNumber, sizeof(cl_mem), &m_paths);
+		SetKernelArg(m_extendKernel, argNumber, sizeof(cl_mem), &m_hits);
+		argNumber++; // queue
+		SetKernelArg(m_extendKernel, argNumber, sizeof(cl_mem), &m_queueCounts);
+		argNumber++; // queueCountIndex
+		SetSceneKernelArgs(m_extendKernel, argNumber, scene);
+
+		argNumber = 0;
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_mem), &textureAtlas);
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_mem), &atlasTextures);
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_mem), &dataRoot);
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_mem), &m_paths);
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_mem), &m_hits);
+		argNumber += 2; // queue, nextQueue
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_mem), &m_shadowRays);
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_mem), &m_queueCounts);
+		argNumber++; // queueCountIndex
+		SetSceneKernelArgs(m_shadeKernel, argNumber, scene);
+
+		argNumber = 0;
+		SetKernelArg(m_connectKernel, argNumber, sizeof(cl_mem), &dataRoot);
+		SetKernelArg(m_connectKernel, argNumber, sizeof(cl_mem), &m_paths);
+		SetKernelArg(m_connectKernel, argNumber, sizeof(cl_mem), &m_shadowRays);
+		SetKernelArg(m_connectKernel, argNumber, sizeof(cl_mem), &m_queueCounts);
+		SetSceneKernelArgs(m_connectKernel, argNumber, scene);
+	}
+
+	// extend, shade and connect the rays still going, for passCount passes.  Going through a portal takes
+	// a pass too, but doesn't count as a bounce, so there can be more passes than bounces.  Once the rays
+	// are all done the passes find empty queues and return right away.
+	for (unsigned int pass = 0; pass <= passCount; ++pass)
+	{
+		// clear the counts of the queues this pass writes to, and note whether it has rays.  After the last
+		// pass this only notes whether any rays were left over.
+		const cl_uint nextQueueCountIndex = 1 - queueCountIndex;
+		cl_uint argNumber = 2;
+		SetKernelArg(m_resetKernel, argNumber, sizeof(cl_uint), &nextQueueCountIndex);
+		SetKernelArg(m_resetKernel, argNumber, sizeof(cl_uint), &pass);
+		ciErrNum = clEnqueueNDRangeKernel(commandQueue, m_resetKernel, 1, NULL, &resetWorkSize, &resetWorkSize, 0, NULL, NULL);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+		if (pass == passCount)
+			break;
+
+		argNumber = 2;
+		SetKernelArg(m_extendKernel, argNumber, sizeof(cl_mem), &m_queues[queueCountIndex]);
+		argNumber = 4;
+		SetKernelArg(m_extendKernel, argNumber, sizeof(cl_uint), &queueCountIndex);
+		ciErrNum = clEnqueueNDRangeKernel(commandQueue, m_extendKernel, 1, NULL, &rayGlobalWorkSize, &rayLocalWorkSize, 0, NULL, NULL);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+		argNumber = 3;
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_mem), &m_queues[queueCountIndex]);
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_mem), &m_queues[nextQueueCountIndex]);
+		argNumber = 7;
+		SetKernelArg(m_shadeKernel, argNumber, sizeof(cl_uint), &queueCountIndex);
+		ciErrNum = clEnqueueNDRangeKernel(commandQueue, m_shadeKernel, 1, NULL, &rayGlobalWorkSize, &rayLocalWorkSize, 0, NULL, NULL);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+		// there is at most one shadow ray per ray shaded, so at most one per path
+		ciErrNum = clEnqueueNDRangeKernel(commandQueue, m_connectKernel, 1, NULL, &rayGlobalWorkSize, &rayLocalWorkSize, 0, NULL, NULL);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+
+		queueCountIndex = nextQueueCountIndex;
+	}
+
+	m_passStats.ReadFromCLMemAsync(context, commandQueue);
+
+	// write out the pixels
+	{
+		const cl_int widthArg = (cl_int)width;
+		const cl_int heightArg = (cl_int)height;
+
+		cl_uint argNumber = 0;
+		SetKernelArg(m_resolveKernel, argNumber, sizeof(cl_mem), &texOut);
+		SetKernelArg(m_resolveKernel, argNumber, sizeof(cl_mem), &dataRoot);
+		SetKernelArg(m_resolveKernel, argNumber, sizeof(cl_mem), &dataRootOut);
+		SetKernelArg(m_resolveKernel, argNumber, sizeof(cl_mem), &m_paths);
+		SetKernelArg(m_resolveKernel, argNumber, sizeof(cl_int), &widthArg);
+		SetKernelArg(m_resolveKernel, argNumber, sizeof(cl_int), &heightArg);
+
+		ciErrNum = clEnqueueNDRangeKernel(commandQueue, m_resolveKernel, 2, NULL, pixelGlobalWorkSize, pixelLocalWorkSize, 0, NULL, lastEvent);
+		oclCheckErrorEX(ciErrNum, CL_SUCCESS, NULL);
+	}
+}
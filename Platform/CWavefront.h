@@ -0,0 +1,97 @@
+/*==================================================================================================
+
+CWavefront.h
+
+Runs the wavefront path kernels in clrt.cl, an alternative to the clrt megakernel that splits
+rendering into a kernel per stage (generate, extend, shade, connect, resolve) with the rays kept in
+queues in global memory between them.  Used when the WavefrontPath graphics setting is on.
+
+==================================================================================================*/
+
+#pragma once
+
+#include "oclUtils.h"
+#include "SharedObject.h"
+#include "KernelCode/Shared/SWavefront.h"
+
+// the world buffers the extend, shade and connect kernels take, in the order they take them.  clrt and
+// clrt_coarse take them in the same order.
+struct SWavefrontScene
+{
+	cl_mem	m_pointLights;
+	cl_mem	m_spheres;
+	cl_mem	m_modelTriangles;
+	cl_mem	m_modelTriangleShading;
+	cl_mem	m_modelObjects;
+	cl_mem	m_modelBVHNodes;
+	cl_mem	m_modelInstanceBVHNodes;
+	cl_mem	m_modelInstances;
+	cl_mem	m_sectors;
+	cl_mem	m_materials;
+	cl_mem	m_portals;
+	cl_mem	m_shadowTexels;
+};
+
+class CWavefront
+{
+public:
+	CWavefront ();
+
+	~CWavefront ()
+	{
+		Release();
+	}
+
+	// creates the kernels.  program must be clrt.cl built with SETTINGS_WAVEFRONT=1
+	bool Init (cl_program program);
+
+	void Release ();
+
+	// renders a frame into the top left width x height of texOut.  eyes is 2 for red/blue 3d, else 1.
+	// Everything is queued without waiting on the device: the queue counts stay on the device, and every
+	// pass is launched at one work item per path, with the items past the end of the queue returning.
+	// Rather than every pass bounces and portal crossings allow, it only runs as many as the rays needed
+	// in the latest frame whose pass stats have been read back, plus a couple more.
+	// If firstEvent and lastEvent aren't NULL they get events for the first and last kernels launched,
+	// which the caller has to release.
+	void Render (
+		cl_context context,
+		cl_command_queue commandQueue,
+		cl_mem texOut,
+		cl_mem textureAtlas,
+		cl_mem atlasTextures,
+		cl_mem dataRoot,
+		cl_mem dataRootOut,
+		const SWavefrontScene &scene,
+		unsigned int width,
+		unsigned int height,
+		unsigned int eyes,
+		unsigned int maxRayBounces,
+		cl_event *firstEvent = NULL,
+		cl_event *lastEvent = NULL
+	);
+
+private:
+	void ReleaseBuffers ();
+	void EnsureBuffers (cl_context context, unsigned int numPaths);
+
+	cl_kernel		m_resetKernel;
+	cl_kernel		m_generateKernel;
+	cl_kernel		m_extendKernel;
+	cl_kernel		m_shadeKernel;
+	cl_kernel		m_connectKernel;
+	cl_kernel		m_resolveKernel;
+
+	cl_mem			m_paths;
+	cl_mem			m_hits;
+	cl_mem			m_queues[2];
+	cl_mem			m_shadowRays;
+	cl_mem			m_queueCounts;
+	unsigned int	m_numPaths;
+
+	// read back each frame, without waiting, to find m_passCount
+	CPinnedSharedObject<SWavefrontPassStats>	m_passStats;
+
+	// how many passes to run, or -1 for all of them until the first stats come back
+	unsigned int	m_passCount;
+};
@@ -0,0 +1,82 @@
+/*==================================================================================================
+
+CWorkerThread.cpp
+
+A single thread that runs one job at a time in the background.  The main loop uses it to run the
+game logic for the next frame while the gpu renders the current one, and CKernelVariants uses one to
+build kernels.
+
+==================================================================================================*/
+
+#include "CWorkerThread.h"
+
+//-----------------------------------------------------------------------------
+CWorkerThread::CWorkerThread ()
+	: m_busy(false)
+	, m_quit(false)
+	, m_thread(&CWorkerThread::ThreadProc, this)
+{
+}
+
+//-----------------------------------------------------------------------------
+CWorkerThread::~CWorkerThread ()
+{
+	Wait();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_jobAvailable.notify_one();
+	m_thread.join();
+}
+
+//-----------------------------------------------------------------------------
+void CWorkerThread::Run (const std::function<void()> &job)
+{
+	Wait();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = job;
+		m_busy = true;
+	}
+	m_jobAvailable.notify_one();
+}
+
+//-----------------------------------------------------------------------------
+void CWorkerThread::Wait ()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_busy)
+		m_jobFinished.wait(lock);
+}
+
+//-----------------------------------------------------------------------------
+bool CWorkerThread::IsBusy ()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_busy;
+}
+
+//-----------------------------------------------------------------------------
+void CWorkerThread::ThreadProc ()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		while (!m_busy && !m_quit)
+			m_jobAvailable.wait(lock);
+
+		if (m_quit)
+			return;
+
+		// run the job without holding the lock, so Wait() can be called meanwhile
+		std::function<void()> job;
+		job.swap(m_job);
+		lock.unlock();
+		job();
+		lock.lock();
+
+		m_busy = false;
+		m_jobFinished.notify_all();
+	}
+}
@@ -0,0 +1,46 @@
+/*==================================================================================================
+
+CWorkerThread.h
+
+A single thread that runs one job at a time in the background.  The main loop uses it to run the
+game logic for the next frame while the gpu renders the current one, and CKernelVariants uses one to
+build kernels.
+
+==================================================================================================*/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class CWorkerThread
+{
+public:
+	CWorkerThread ();
+	~CWorkerThread ();
+
+	// starts running job on the worker thread.  Waits for the previous job to finish first.
+	void Run (const std::function<void()> &job);
+
+	// returns once the job last given to Run() has finished
+	void Wait ();
+
+	// whether the job last given to Run() is still running.  Lets a caller avoid blocking in Run().
+	bool IsBusy ();
+
+private:
+	void ThreadProc ();
+
+	std::function<void()>		m_job;
+	bool						m_busy;
+	bool						m_quit;
+
+	std::mutex					m_mutex;
+	std::condition_variable		m_jobAvailable;
+	std::condition_variable		m_jobFinished;
+
+	// declared last so everything above is constructed before the thread starts using it
+	std::thread					m_thread;
+};
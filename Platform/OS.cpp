@@ -8,10 +8,22 @@ OS Specific functionality here
 
 #include "OS.h"
 
+#ifdef _WIN32
+#include <windows.h>
 #include "Shlwapi.h"
+#else
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 namespace OS
 {
+#ifdef _WIN32
 	bool GetAbsolutePath (const char *file, std::string &result)
 	{
 		// get the absolute path if we can
@@ -32,4 +44,205 @@ namespace OS
 		// return success
 		return true;
 	}
+
+	void GetRelativePath (const char *file, std::string &result)
+	{
+		result = file;
+
+		char currentDirectory[MAX_PATH];
+		char fullPath[MAX_PATH];
+		if (GetCurrentDirectory(MAX_PATH, currentDirectory) == 0 || GetFullPathName(file, MAX_PATH, fullPath, NULL) == 0)
+			return;
+
+		// if the file is in the current directory, or under it, chop the current directory off the front
+		const size_t length = strlen(currentDirectory);
+		if (!strnicmp(fullPath, currentDirectory, length) && (fullPath[length] == '\\' || fullPath[length] == '/'))
+		{
+			result = "./";
+			result += &fullPath[length + 1];
+		}
+	}
+
+	bool GetFileSizeAndTime (const char *file, unsigned long long &size, unsigned long long &writeTime)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesEx(file, GetFileExInfoStandard, &attributes))
+			return false;
+
+		size = ((unsigned long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+		writeTime = ((unsigned long long)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+		return true;
+	}
+
+	int StringCompareNoCase (const char *a, const char *b)
+	{
+		return stricmp(a, b);
+	}
+
+	CMappedFile::CMappedFile ()
+		: m_file(INVALID_HANDLE_VALUE)
+		, m_mapping(NULL)
+		, m_data(NULL)
+		, m_size(0)
+	{
+	}
+
+	bool CMappedFile::Open (const char *fileName)
+	{
+		Close();
+
+		m_file = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0 || (unsigned long long)size.QuadPart > (size_t)-1)
+		{
+			Close();
+			return false;
+		}
+		m_size = (size_t)size.QuadPart;
+
+		m_mapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_mapping)
+			m_data = (const unsigned char *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+
+		if (!m_data)
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void CMappedFile::Close ()
+	{
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = NULL;
+		m_data = NULL;
+		m_size = 0;
+	}
+
+#else
+	// the absolute path of file, which doesn't have to exist
+	static bool GetFullPath (const char *file, std::string &result)
+	{
+		if (file[0] == '/')
+		{
+			result = file;
+			return true;
+		}
+
+		char currentDirectory[PATH_MAX];
+		if (!getcwd(currentDirectory, PATH_MAX))
+			return false;
+
+		result = currentDirectory;
+		result += "/";
+		result += file;
+		return true;
+	}
+
+	bool GetAbsolutePath (const char *file, std::string &result)
+	{
+		if (!GetFullPath(file, result))
+			return false;
+
+		// remove the filename portion
+		size_t pos = result.find_last_of("/");
+		if (std::string::npos != pos)
+			result = result.substr(0, pos + 1);
+
+		// return success
+		return true;
+	}
+
+	void GetRelativePath (const char *file, std::string &result)
+	{
+		result = file;
+
+		char currentDirectory[PATH_MAX];
+		std::string fullPath;
+		if (!getcwd(currentDirectory, PATH_MAX) || !GetFullPath(file, fullPath))
+			return;
+
+		// if the file is in the current directory, or under it, chop the current directory off the front
+		const size_t length = strlen(currentDirectory);
+		if (!strncmp(fullPath.c_str(), currentDirectory, length) && fullPath[length] == '/')
+		{
+			result = "./";
+			result += &fullPath[length + 1];
+		}
+	}
+
+	bool GetFileSizeAndTime (const char *file, unsigned long long &size, unsigned long long &writeTime)
+	{
+		struct stat attributes;
+		if (stat(file, &attributes) != 0)
+			return false;
+
+		size = (unsigned long long)attributes.st_size;
+		writeTime = (unsigned long long)attributes.st_mtime;
+		return true;
+	}
+
+	int StringCompareNoCase (const char *a, const char *b)
+	{
+		return strcasecmp(a, b);
+	}
+
+	CMappedFile::CMappedFile ()
+		: m_file(-1)
+		, m_data(NULL)
+		, m_size(0)
+	{
+	}
+
+	bool CMappedFile::Open (const char *fileName)
+	{
+		Close();
+
+		m_file = open(fileName, O_RDONLY);
+		if (m_file < 0)
+			return false;
+
+		struct stat attributes;
+		if (fstat(m_file, &attributes) != 0 || attributes.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+		m_size = (size_t)attributes.st_size;
+
+		void *data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_file, 0);
+		if (data == MAP_FAILED)
+		{
+			Close();
+			return false;
+		}
+
+		m_data = (const unsigned char *)data;
+		return true;
+	}
+
+	void CMappedFile::Close ()
+	{
+		if (m_data)
+			munmap((void *)m_data, m_size);
+		if (m_file >= 0)
+			close(m_file);
+
+		m_file = -1;
+		m_data = NULL;
+		m_size = 0;
+	}
+#endif
 };
\ No newline at end of file
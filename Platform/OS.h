@@ -12,4 +12,37 @@ OS Specific functionality here
 namespace OS
 {
 	bool GetAbsolutePath (const char *file, std::string &result);
+
+	// makes file relative to the current directory, if it's inside of it.  Otherwise result is file.
+	void GetRelativePath (const char *file, std::string &result);
+
+	// gets the size of a file and the time it was last written to.  Returns false if the file doesn't exist.
+	bool GetFileSizeAndTime (const char *file, unsigned long long &size, unsigned long long &writeTime);
+
+	// compares two strings ignoring case, like stricmp() on windows and strcasecmp() elsewhere
+	int StringCompareNoCase (const char *a, const char *b);
+
+	// a whole file mapped into memory, read only
+	class CMappedFile
+	{
+	public:
+		CMappedFile ();
+		~CMappedFile () { Close(); }
+
+		bool Open (const char *fileName);
+		void Close ();
+
+		const unsigned char *Data () const { return m_data; }
+		size_t Size () const { return m_size; }
+
+	private:
+		#ifdef _WIN32
+		void				*m_file;
+		void				*m_mapping;
+		#else
+		int					m_file;
+		#endif
+		const unsigned char	*m_data;
+		size_t				m_size;
+	};
 };
\ No newline at end of file
@@ -4,14 +4,22 @@ SharedArray.h
 
 An array class that can be passed to kernel code
 
+Only the parts of the array that changed are uploaded to the kernel: changes are tracked as ranges
+of elements and each range gets it's own write.  The allocation grows geometrically, and the cl_mem
+is sized to the allocation rather than the count, so adding elements one at a time doesn't reallocate
+and re-upload everything each time.
+
+The changed elements are copied into one of two staging buffers and uploaded from there, so the
+array can be changed (or reallocated) as soon as GetAndUpdateMem() returns, even though the upload
+hasn't happened yet.  A staging buffer is only reused once the upload from it two frames ago is done.
+
 ==================================================================================================*/
 
 #pragma once
 
 #include "oclUtils.h"
-#include <CL/cl_d3d10.h>
-#include <CL/cl_d3d10_ext.h>
-#include <CL/cl_ext.h>
+#include "Platform/Assert.h"
+#include <vector>
 
 template<typename T>
 class CSharedArray
@@ -24,7 +32,15 @@ public:
 		m_data = NULL;
 		m_dataSize = 0;
 		m_allocatedSize = 0;
+		m_clAllocatedSize = 0;
 		m_clDataStale = true;
+		for (unsigned int index = 0; index < c_stagingCount; ++index)
+		{
+			m_staging[index] = NULL;
+			m_stagingSize[index] = 0;
+			m_stagingEvents[index] = NULL;
+		}
+		m_stagingIndex = 0;
 	}
 
 	~CSharedArray()
@@ -34,14 +50,24 @@ public:
 
 	void Release()
 	{
+		for (unsigned int index = 0; index < c_stagingCount; ++index)
+		{
+			WaitForStaging(index);
+			delete[] m_staging[index];
+			m_staging[index] = NULL;
+			m_stagingSize[index] = 0;
+		}
+
 		if (m_clData)
 			clReleaseMemObject(m_clData);
 		m_clData = NULL;
-		delete m_data;
+		delete[] m_data;
 		m_data = NULL;
 		m_dataSize = 0;
 		m_allocatedSize = 0;
+		m_clAllocatedSize = 0;
 		m_clDataStale = true;
+		m_dirtyRanges.clear();
 	}
 
 	unsigned int SizeInBytes () const { return sizeof(T) * m_dataSize; }
@@ -49,29 +75,42 @@ public:
 
 	cl_mem& GetAndUpdateMem (cl_context& context, cl_command_queue& commandQueue)
 	{
-		if (m_clDataStale)
+		// (re)allocate the cl_mem object if it's missing or too small.  It all needs uploading then, which
+		// creating it from the array does, without going through the staging buffers.
+		if (m_clAllocatedSize < m_allocatedSize)
 		{
-			// allocate a new cl_mem object if needed
-			if (!m_clData && m_allocatedSize > 0)
+			if (m_clData)
+				clReleaseMemObject(m_clData);
+
+			cl_int errorcode;
+			m_clData = clCreateBuffer(
+				context,
+				CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				sizeof(T) * m_allocatedSize,
+				m_data, 
+				&errorcode
+			);
+			oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
+			m_clAllocatedSize = m_allocatedSize;
+			m_clDataStale = false;
+			m_dirtyRanges.clear();
+		}
+
+		if (m_clData && m_dataSize > 0)
+		{
+			if (m_clDataStale)
 			{
-				cl_int errorcode;
-				m_clData = clCreateBuffer(
-					context,
-					CL_MEM_READ_ONLY,
-					SizeInBytes(),
-					NULL, 
-					&errorcode
-				);
-				oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
+				m_dirtyRanges.resize(1);
+				m_dirtyRanges[0].m_begin = 0;
+				m_dirtyRanges[0].m_end = m_dataSize;
 			}
 
-			if (m_clData) {
-				cl_int errorcode;
-				errorcode = clEnqueueWriteBuffer(commandQueue, m_clData, CL_FALSE, 0, SizeInBytes(), m_data, 0, NULL, NULL);
-				oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
-			}
-			m_clDataStale = false;
+			if (!m_dirtyRanges.empty())
+				WriteRanges(commandQueue);
 		}
+
+		m_clDataStale = false;
+		m_dirtyRanges.clear();
 		return m_clData;
 	}
 
@@ -81,6 +120,12 @@ public:
 		return m_data[index];
 	}
 
+	const T& operator[] (unsigned int index) const
+	{
+		Assert_(index < m_dataSize);
+		return m_data[index];
+	}
+
 	T& AddOne ()
 	{
 		unsigned int newIndex = Count();
@@ -88,10 +133,62 @@ public:
 		return (*this)[newIndex];
 	}
 
-	void Clear ()
+	// call this after modifying elements in place, so the kernel gets the new data
+	void MarkStale ()
+	{
+		m_clDataStale = true;
+	}
+
+	// call this after modifying count elements in place starting at index, so the kernel gets the new data.
+	// Only the marked elements are uploaded.
+	void MarkStale (unsigned int index, unsigned int count = 1)
+	{
+		Assert_(index + count <= m_dataSize);
+		if (m_clDataStale || count == 0)
+			return;
+
+		// merge the range with the ones it overlaps or touches.  The ranges are kept sorted.
+		SRange range = { index, index + count };
+		unsigned int insertIndex = 0;
+		while (insertIndex < m_dirtyRanges.size() && m_dirtyRanges[insertIndex].m_end < range.m_begin)
+			++insertIndex;
+
+		unsigned int mergeEnd = insertIndex;
+		while (mergeEnd < m_dirtyRanges.size() && m_dirtyRanges[mergeEnd].m_begin <= range.m_end)
+		{
+			if (m_dirtyRanges[mergeEnd].m_begin < range.m_begin)
+				range.m_begin = m_dirtyRanges[mergeEnd].m_begin;
+			if (m_dirtyRanges[mergeEnd].m_end > range.m_end)
+				range.m_end = m_dirtyRanges[mergeEnd].m_end;
+			++mergeEnd;
+		}
+
+		m_dirtyRanges.erase(m_dirtyRanges.begin() + insertIndex, m_dirtyRanges.begin() + mergeEnd);
+		m_dirtyRanges.insert(m_dirtyRanges.begin() + insertIndex, range);
+
+		// past a point, one write of everything from the first change to the last beats lots of small writes
+		if (m_dirtyRanges.size() > c_maxDirtyRanges)
+		{
+			m_dirtyRanges.front().m_end = m_dirtyRanges.back().m_end;
+			m_dirtyRanges.resize(1);
+		}
+	}
+
+	// replaces the contents of the array with count elements copied from data
+	void Assign (const T *data, unsigned int count)
 	{
+		Clear();
+		Presize(count);
+		if (count > 0)
+			memcpy(m_data, data, sizeof(T) * count);
+		m_dataSize = count;
 		m_clDataStale = true;
+	}
+
+	void Clear ()
+	{
 		m_dataSize = 0;
+		m_dirtyRanges.clear();
 	}
 
 	// ensures there is enough space allocated for at least this many elements but doesn't
@@ -118,44 +215,88 @@ public:
 	// sets the array size to the specified size
 	void Resize (unsigned int newSize)
 	{
-		// our data is stale when we resize
-		m_clDataStale = true;
-
-		// if we can just change the size without reallocating and copying
-		// go for it
-		if (newSize <= m_allocatedSize)
+		// grow the allocation geometrically so that adding one element at a time stays cheap
+		if (newSize > m_allocatedSize)
 		{
-			m_dataSize = newSize;
-			return;
+			unsigned int allocateSize = m_allocatedSize * 2;
+			if (allocateSize < c_minAllocatedSize)
+				allocateSize = c_minAllocatedSize;
+			Presize(newSize > allocateSize ? newSize : allocateSize);
 		}
 
-		// allocate a new buffer and copy the existing data over
-		T* newData = new T[newSize];
-		if (m_dataSize > 0 && newSize > 0)
-			memcpy(newData, m_data, min(m_dataSize, newSize) * sizeof(T));
+		// the new elements need uploading
+		const unsigned int oldSize = m_dataSize;
+		m_dataSize = newSize;
+		if (newSize > oldSize)
+			MarkStale(oldSize, newSize - oldSize);
+	}
 
-		// free the old data and set the pointer to the new data
-		delete[] m_data;
-		m_data = newData;
+	const T* DataConst () const { return m_data; }
 
-		// set the data size and allocated data size
-		m_allocatedSize = newSize;
-		m_dataSize = newSize;
+private:
+	struct SRange
+	{
+		unsigned int m_begin;
+		unsigned int m_end;
+	};
 
-		// release the cl_mem object so we know to allocate a new one if asked for it
-		if (m_clData)
+	static const unsigned int c_maxDirtyRanges = 16;
+	static const unsigned int c_minAllocatedSize = 16;
+	static const unsigned int c_stagingCount = 2;
+
+	// copies the dirty ranges into the next staging buffer and enqueues a write for each of them
+	void WriteRanges (cl_command_queue& commandQueue)
+	{
+		const unsigned int stagingIndex = m_stagingIndex;
+		m_stagingIndex = (m_stagingIndex + 1) % c_stagingCount;
+		WaitForStaging(stagingIndex);
+
+		unsigned int stagingNeeded = 0;
+		for (unsigned int index = 0, count = m_dirtyRanges.size(); index < count; ++index)
+			stagingNeeded += m_dirtyRanges[index].m_end - m_dirtyRanges[index].m_begin;
+
+		if (m_stagingSize[stagingIndex] < stagingNeeded)
 		{
-			clReleaseMemObject(m_clData);
-			m_clData = NULL;
+			delete[] m_staging[stagingIndex];
+			m_staging[stagingIndex] = new T[stagingNeeded];
+			m_stagingSize[stagingIndex] = stagingNeeded;
+		}
+
+		// the queue is in order, so once the last write is done they all are
+		T *staging = m_staging[stagingIndex];
+		for (unsigned int index = 0, count = m_dirtyRanges.size(); index < count; ++index)
+		{
+			const SRange &range = m_dirtyRanges[index];
+			const unsigned int rangeCount = range.m_end - range.m_begin;
+			memcpy(staging, &m_data[range.m_begin], sizeof(T) * rangeCount);
+
+			cl_event *event = index + 1 == count ? &m_stagingEvents[stagingIndex] : NULL;
+			cl_int errorcode = clEnqueueWriteBuffer(commandQueue, m_clData, CL_FALSE, sizeof(T) * range.m_begin, sizeof(T) * rangeCount, staging, 0, NULL, event);
+			oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
+			staging += rangeCount;
 		}
 	}
 
-	const T* DataConst () const { return m_data; }
+	// waits for the last upload from a staging buffer to finish, so it can be reused
+	void WaitForStaging (unsigned int stagingIndex)
+	{
+		if (!m_stagingEvents[stagingIndex])
+			return;
+		clWaitForEvents(1, &m_stagingEvents[stagingIndex]);
+		clReleaseEvent(m_stagingEvents[stagingIndex]);
+		m_stagingEvents[stagingIndex] = NULL;
+	}
 
-private:
 	T			*m_data;
 	unsigned int m_dataSize;
 	unsigned int m_allocatedSize;
 	cl_mem		 m_clData;
-	bool		 m_clDataStale;
+	unsigned int m_clAllocatedSize;	// how many elements m_clData has room for
+	bool		 m_clDataStale;		// true if all of m_clData needs uploading, not just m_dirtyRanges
+	std::vector<SRange> m_dirtyRanges;
+
+	T			*m_staging[c_stagingCount];
+	unsigned int m_stagingSize[c_stagingCount];
+	cl_event	 m_stagingEvents[c_stagingCount];	// the last write from each staging buffer
+	unsigned int m_stagingIndex;					// the staging buffer to use next
 };
\ No newline at end of file
@@ -9,9 +9,6 @@ An object that can be passed to kernel code by memory as a cl_mem
 #pragma once
 
 #include "oclUtils.h"
-#include <CL/cl_d3d10.h>
-#include <CL/cl_d3d10_ext.h>
-#include <CL/cl_ext.h>
 
 #include "Platform/Assert.h"
 
@@ -85,4 +82,193 @@ private:
 	T			m_object;
 	cl_mem		m_clData;
 	bool		m_clDataStale;
-};
\ No newline at end of file
+};
+
+// A CSharedObject that moves it's data to and from the kernel through pinned (CL_MEM_ALLOC_HOST_PTR)
+// memory, so the transfers are straight DMA copies, ring buffered c_ringSize frames deep so the host
+// never waits on them.
+//
+// Each write copies the object into the next ring slot and queues the transfer from there.  A slot is
+// only reused once the transfer that last used it has finished, which with one write per frame it
+// long since has.  Reads are queued the same way into their own ring, and GetLatestRead() gives the
+// newest one that has finished, without waiting for the ones that haven't.
+template<typename T>
+class CPinnedSharedObject
+{
+public:
+	static const unsigned int c_ringSize = 3;
+
+	CPinnedSharedObject()
+	{
+		static_assert(sizeof(T) % 16 == 0, "CPinnedSharedObject type sizes must be multiples of 16");
+		m_clData = NULL;
+		m_clPinned = NULL;
+		m_pinned = NULL;
+		m_commandQueue = NULL;
+		m_clDataStale = true;
+		m_writeSlot = 0;
+		m_readSlot = 0;
+		m_readCount = 0;
+		m_lastReadReturned = 0;
+		for (unsigned int index = 0; index < c_ringSize; ++index)
+		{
+			m_writeEvents[index] = NULL;
+			m_readEvents[index] = NULL;
+			m_readNumbers[index] = 0;
+		}
+	}
+
+	~CPinnedSharedObject()
+	{
+		Release();
+	}
+
+	// call before the command queue the object was used with is released
+	void Release()
+	{
+		for (unsigned int index = 0; index < c_ringSize; ++index)
+		{
+			ReleaseEvent(m_writeEvents[index]);
+			ReleaseEvent(m_readEvents[index]);
+			m_readNumbers[index] = 0;
+		}
+
+		if (m_pinned)
+		{
+			clEnqueueUnmapMemObject(m_commandQueue, m_clPinned, m_pinned, 0, NULL, NULL);
+			clFinish(m_commandQueue);
+			m_pinned = NULL;
+		}
+
+		if (m_clPinned)
+			clReleaseMemObject(m_clPinned);
+		m_clPinned = NULL;
+
+		if (m_clData)
+			clReleaseMemObject(m_clData);
+		m_clData = NULL;
+
+		m_commandQueue = NULL;
+		m_clDataStale = true;
+	}
+
+	void EnsureCLMemExists (cl_context& context, cl_command_queue& commandQueue)
+	{
+		if (m_clData)
+			return;
+
+		cl_int errorcode;
+		m_clData = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(T), NULL, &errorcode);
+		oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
+
+		// the write ring, then the read ring.  It stays mapped for the life of the object.
+		m_clPinned = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(T) * c_ringSize * 2, NULL, &errorcode);
+		oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
+
+		m_pinned = (T*)clEnqueueMapBuffer(commandQueue, m_clPinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(T) * c_ringSize * 2, 0, NULL, NULL, &errorcode);
+		oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
+		Assert_(m_pinned != NULL);
+
+		m_commandQueue = commandQueue;
+		m_clDataStale = true;
+	}
+
+	cl_mem& GetAndWriteCLMem (cl_context& context, cl_command_queue& commandQueue)
+	{
+		EnsureCLMemExists(context, commandQueue);
+
+		if (m_clDataStale)
+		{
+			const unsigned int slot = m_writeSlot;
+			m_writeSlot = (m_writeSlot + 1) % c_ringSize;
+
+			WaitForEvent(m_writeEvents[slot]);
+			m_pinned[slot] = m_object;
+
+			cl_int errorcode = clEnqueueWriteBuffer(commandQueue, m_clData, CL_FALSE, 0, sizeof(T), &m_pinned[slot], 0, NULL, &m_writeEvents[slot]);
+			oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
+			m_clDataStale = false;
+		}
+
+		return m_clData;
+	}
+
+	// queues a read of what the kernel wrote.  See GetLatestRead().
+	void ReadFromCLMemAsync (cl_context& context, cl_command_queue& commandQueue)
+	{
+		EnsureCLMemExists(context, commandQueue);
+
+		const unsigned int slot = m_readSlot;
+		m_readSlot = (m_readSlot + 1) % c_ringSize;
+
+		WaitForEvent(m_readEvents[slot]);
+
+		cl_int errorcode = clEnqueueReadBuffer(commandQueue, m_clData, CL_FALSE, 0, sizeof(T), &m_pinned[c_ringSize + slot], 0, NULL, &m_readEvents[slot]);
+		oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
+		m_readNumbers[slot] = ++m_readCount;
+	}
+
+	// copies the newest finished read into object.  Returns false if no read has finished since the last
+	// time this returned true.  Never waits.
+	bool GetLatestRead (T &object)
+	{
+		unsigned int newestSlot = c_ringSize;
+		for (unsigned int slot = 0; slot < c_ringSize; ++slot)
+		{
+			if (!m_readEvents[slot] || m_readNumbers[slot] <= m_lastReadReturned)
+				continue;
+
+			cl_int status;
+			cl_int errorcode = clGetEventInfo(m_readEvents[slot], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+			oclCheckErrorEX(errorcode, CL_SUCCESS, NULL);
+			if (status != CL_COMPLETE)
+				continue;
+
+			if (newestSlot == c_ringSize || m_readNumbers[slot] > m_readNumbers[newestSlot])
+				newestSlot = slot;
+		}
+
+		if (newestSlot == c_ringSize)
+			return false;
+
+		object = m_pinned[c_ringSize + newestSlot];
+		m_lastReadReturned = m_readNumbers[newestSlot];
+		return true;
+	}
+
+	T &GetObject() { m_clDataStale = true; return m_object; }
+	const T &GetObjectConst() { return m_object; }
+
+private:
+	static void WaitForEvent (cl_event &event)
+	{
+		if (!event)
+			return;
+		clWaitForEvents(1, &event);
+		clReleaseEvent(event);
+		event = NULL;
+	}
+
+	static void ReleaseEvent (cl_event &event)
+	{
+		if (event)
+			clReleaseEvent(event);
+		event = NULL;
+	}
+
+	T					m_object;
+	cl_mem				m_clData;
+	cl_mem				m_clPinned;
+	T					*m_pinned;			// m_clPinned, mapped.  c_ringSize write slots then c_ringSize read slots.
+	cl_command_queue	m_commandQueue;		// the queue m_clPinned was mapped with
+	bool				m_clDataStale;
+
+	unsigned int		m_writeSlot;
+	cl_event			m_writeEvents[c_ringSize];
+
+	unsigned int		m_readSlot;
+	cl_event			m_readEvents[c_ringSize];
+	unsigned int		m_readNumbers[c_ringSize];	// which read each slot holds, counting from 1
+	unsigned int		m_readCount;
+	unsigned int		m_lastReadReturned;
+};
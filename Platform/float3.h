@@ -105,6 +105,24 @@ public:
 		return *this;
 	}
 
+	// component wise, like float3 * float3 in OpenCL
+	inline float3 operator* (const float3& other) const
+	{
+		float3 ret;
+		ret[0] = m_data.s[0] * other[0];
+		ret[1] = m_data.s[1] * other[1];
+		ret[2] = m_data.s[2] * other[2];
+		return ret;
+	}
+
+	inline float3 operator*= (const float3& other)
+	{
+		(*this)[0] *= other[0];
+		(*this)[1] *= other[1];
+		(*this)[2] *= other[2];
+		return *this;
+	}
+
 	cl_float3 m_data;
 };
 